@@ -18,10 +18,17 @@ import Wisp.Core.Types
 import Wisp.Core.Error
 import Wisp.Core.Request
 import Wisp.Core.Response
+import Wisp.Core.Retry
 import Wisp.Core.Streaming
 import Wisp.Core.WebSocket
 import Wisp.FFI.Easy
 import Wisp.FFI.Multi
+import Wisp.FFI.Share
+import Wisp.FFI.Template
+import Wisp.HTTP.Share
+import Wisp.HTTP.Cache
 import Wisp.HTTP.Client
+import Wisp.HTTP.Metrics
 import Wisp.HTTP.SSE
 import Wisp.HTTP.WebSocket
+import Wisp.HTTP.WebSocketHub
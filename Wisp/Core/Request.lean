@@ -4,6 +4,8 @@
 -/
 
 import Wisp.Core.Types
+import Wisp.Core.Retry
+import Std.Sync.Channel
 
 namespace Wisp
 
@@ -19,6 +21,13 @@ structure MultipartPart where
   data : ByteArray
   deriving Inhabited
 
+/-- Where a streamed request body comes from -/
+inductive BodySource where
+  /-- Read the body from a file -/
+  | file (path : String)
+  /-- Send chunks from a channel until it is closed -/
+  | channel (chunks : Std.CloseableChannel.Sync ByteArray)
+
 /-- Request body types -/
 inductive Body where
   /-- No request body -/
@@ -33,8 +42,50 @@ inductive Body where
   | form (fields : Array (String × String))
   /-- Multipart form data (for file uploads) -/
   | multipart (parts : Array MultipartPart)
+  /-- Body streamed from a file or channel without buffering it in memory.
+      Files send their size; a channel body without a known `length` is sent
+      with chunked transfer encoding. -/
+  | stream (source : BodySource) (contentType : String) (length : Option Nat)
   deriving Inhabited
 
+/-- Content codings a request body can be compressed with -/
+inductive ContentCoding where
+  | gzip
+  /-- Sent as gzip when Wisp was built without zstd (see the README) -/
+  | zstd
+  deriving Repr, BEq, Inhabited
+
+namespace ContentCoding
+
+/-- Code passed to the native layer -/
+def toCode : ContentCoding → UInt8
+  | .gzip => 1
+  | .zstd => 2
+
+/-- Coding for a code returned by the native layer -/
+def ofCode (code : UInt8) : ContentCoding :=
+  if code == 2 then .zstd else .gzip
+
+/-- Value of the `Content-Encoding` header -/
+def headerValue : ContentCoding → String
+  | .gzip => "gzip"
+  | .zstd => "zstd"
+
+end ContentCoding
+
+/-- Compression of request bodies held in memory (`.raw`, `.text`, `.json`
+    and `.form`). The body is compressed while it is sent and goes out with
+    chunked transfer encoding, since its compressed length is not known
+    up front. -/
+structure BodyCompression where
+  /-- Codec to compress with -/
+  coding : ContentCoding := .gzip
+  /-- Compression level (none = the codec's default) -/
+  level : Option Nat := none
+  /-- Bodies smaller than this many bytes are sent uncompressed -/
+  minBytes : Nat := 1024
+  deriving Repr, Inhabited
+
 /-- Authentication methods -/
 inductive Auth where
   /-- No authentication -/
@@ -71,6 +122,15 @@ structure CookieJar where
   cookies : Option String := none
   deriving Inhabited
 
+/-- Scheduling class of a request. While an origin is at its connection limit,
+    queued requests of a higher class start first, and origins whose next
+    request has a higher class get a larger share of the client. -/
+inductive Priority where
+  | high
+  | normal
+  | low
+  deriving Repr, Inhabited, BEq
+
 /-- HTTP Request with builder pattern -/
 structure Request where
   /-- HTTP method -/
@@ -101,6 +161,14 @@ structure Request where
   cookieJar : CookieJar := {}
   /-- Enable verbose curl output (for debugging) -/
   verbose : Bool := false
+  /-- Scheduling class when requests are queued behind connection limits -/
+  priority : Priority := .normal
+  /-- HTTP version to request (none = the client's choice) -/
+  httpVersion : Option HttpVersion := none
+  /-- Retry policy (none = the client's) -/
+  retry : Option RetryPolicy := none
+  /-- Request body compression (none = the client's) -/
+  compression : Option BodyCompression := none
   deriving Inhabited
 
 namespace Request
@@ -165,6 +233,16 @@ def withForm (r : Request) (fields : Array (String × String)) : Request :=
 def withMultipart (r : Request) (parts : Array MultipartPart) : Request :=
   { r with body := .multipart parts }
 
+/-- Stream the body from a file (its size is sent as Content-Length) -/
+def withBodyFile (r : Request) (path : String) (contentType : String := "application/octet-stream") : Request :=
+  { r with body := .stream (.file path) contentType none }
+
+/-- Stream the body from a channel of chunks; the body ends when the channel is closed.
+    Pass `length` if known, otherwise chunked transfer encoding is used. -/
+def withBodyStream (r : Request) (chunks : Std.CloseableChannel.Sync ByteArray)
+    (contentType : String := "application/octet-stream") (length : Option Nat := none) : Request :=
+  { r with body := .stream (.channel chunks) contentType length }
+
 /-- Set basic authentication -/
 def withBasicAuth (r : Request) (username : String) (password : String) : Request :=
   { r with auth := .basic username password }
@@ -221,6 +299,22 @@ def withCookieEngine (r : Request) : Request :=
 def withCookies (r : Request) (cookies : String) : Request :=
   { r with cookieJar := { r.cookieJar with cookies := some cookies } }
 
+/-- Request a specific HTTP version -/
+def withHttpVersion (r : Request) (v : HttpVersion) : Request :=
+  { r with httpVersion := some v }
+
+/-- Set the scheduling class -/
+def withPriority (r : Request) (p : Priority) : Request :=
+  { r with priority := p }
+
+/-- Retry transient failures according to a policy -/
+def withRetry (r : Request) (p : RetryPolicy := {}) : Request :=
+  { r with retry := some p }
+
+/-- Compress the body with `Content-Encoding` when it is at least `minBytes` -/
+def withCompression (r : Request) (c : BodyCompression := {}) : Request :=
+  { r with compression := some c }
+
 end Request
 
 end Wisp
@@ -13,6 +13,8 @@ structure Response where
   status : UInt32
   /-- Response headers -/
   headers : Headers
+  /-- The same headers indexed for case-insensitive lookup -/
+  headerMap : HeaderMap := HeaderMap.ofHeaders headers
   /-- Response body as raw bytes -/
   body : ByteArray
   /-- Content-Type from headers (cached for convenience) -/
@@ -21,6 +23,10 @@ structure Response where
   totalTime : Float := 0.0
   /-- Effective URL after redirects -/
   effectiveUrl : String := ""
+  /-- Timing breakdown and transfer statistics -/
+  metrics : TransferMetrics := {}
+  /-- Whether the body was served from the client's cache -/
+  fromCache : Bool := false
   deriving Inhabited
 
 namespace Response
@@ -61,7 +67,11 @@ def bodyTextLossy (r : Response) : String :=
 
 /-- Get header value by name (case-insensitive) -/
 def header (r : Response) (name : String) : Option String :=
-  r.headers.get? name
+  r.headerMap.get? name
+
+/-- HTTP version the response was received over -/
+def httpVersion (r : Response) : Option HttpVersion :=
+  r.metrics.httpVersion
 
 /-- Get body size in bytes -/
 def bodySize (r : Response) : Nat :=
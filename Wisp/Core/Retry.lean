@@ -0,0 +1,113 @@
+/-
+  Wisp Retry Policy
+  Which failures are retried, how long to back off, and when to hedge
+-/
+
+import Wisp.Core.Types
+import Wisp.Core.Error
+
+namespace Wisp
+
+/-- Kinds of transfer failure a retry policy can match -/
+inductive RetryErrorClass where
+  /-- The transfer timed out -/
+  | timeout
+  /-- Name resolution or the connect failed -/
+  | connect
+  /-- The connection broke mid-transfer -/
+  | reset
+  /-- TLS handshake or certificate failure -/
+  | tls
+  /-- Anything else -/
+  | other
+  deriving Repr, BEq, Inhabited
+
+namespace RetryErrorClass
+
+/-- Classify a curl result code -/
+def ofCurlCode : CurlCode → RetryErrorClass
+  | .operationTimedout => .timeout
+  | .couldntResolveHost | .couldntResolveProxy | .couldntConnect => .connect
+  | .sendError | .recvError | .gotNothing | .http2Stream => .reset
+  | .sslConnectError | .sslCertProblem | .sslCipher | .peerFailedVerification
+  | .sslInvalidcertstatus => .tls
+  -- CURLE_PARTIAL_FILE: the body ended before Content-Length
+  | .unknown code => if code == 18 then .reset else .other
+  | _ => .other
+
+end RetryErrorClass
+
+/-- Automatic retry and hedging for buffered requests.
+
+    A failed attempt is retried when its error class or status is listed,
+    after an exponential backoff that doubles per attempt (with jitter, and
+    never shorter than a `Retry-After` the server sent). Retries and hedges
+    draw on a budget per worker: every request adds `budgetRatio`, every
+    retry or hedge spends one, and at most `budgetReserve` can be spent
+    ahead, so a failing upstream is not hit with a multiple of its load.
+
+    With hedging, a duplicate is sent if no response has arrived after
+    `hedgeAfterMs`, or after the origin's p95 latency with `hedgeAtP95`;
+    whichever copy answers first is kept and the other is canceled. -/
+structure RetryPolicy where
+  /-- Attempts in total, the first included -/
+  maxAttempts : Nat := 3
+  /-- Response statuses that are retried -/
+  statuses : Array UInt32 := #[408, 429, 500, 502, 503, 504]
+  /-- Transfer failures that are retried -/
+  errors : Array RetryErrorClass := #[.timeout, .connect, .reset]
+  /-- Backoff before the first retry; doubles with each further retry -/
+  baseDelayMs : Nat := 100
+  /-- Upper bound on the backoff -/
+  maxDelayMs : Nat := 10000
+  /-- Randomize the second half of each backoff -/
+  jitter : Bool := true
+  /-- Wait as long as a `Retry-After` header asks -/
+  respectRetryAfter : Bool := true
+  /-- Give up instead of waiting for a longer `Retry-After` -/
+  maxRetryAfterMs : Nat := 60000
+  /-- Also retry and hedge POST and PATCH -/
+  retryNonIdempotent : Bool := false
+  /-- Retries and hedges earned per request -/
+  budgetRatio : Float := 0.2
+  /-- Retries and hedges that may be spent ahead of earning them -/
+  budgetReserve : Nat := 10
+  /-- Send a duplicate when no response arrived after this long -/
+  hedgeAfterMs : Option Nat := none
+  /-- Send a duplicate after the origin's p95 latency, once known -/
+  hedgeAtP95 : Bool := false
+  deriving Repr, Inhabited
+
+namespace RetryPolicy
+
+/-- Backoff before retry `n` (1 = the first retry), without jitter -/
+def backoffMs (p : RetryPolicy) (n : Nat) : Nat :=
+  min p.maxDelayMs (p.baseDelayMs * 2 ^ (min (n - 1) 32))
+
+/-- Apply jitter to a backoff: half is kept, the other half is random -/
+def jittered (p : RetryPolicy) (delayMs : Nat) : IO Nat := do
+  if !p.jitter then return delayMs
+  let half := delayMs / 2
+  return delayMs - half + (← IO.rand 0 half)
+
+/-- Whether requests with this method may be sent more than once -/
+def allowsMethod (p : RetryPolicy) (m : Method) : Bool :=
+  match m with
+  | .POST | .PATCH | .CONNECT => p.retryNonIdempotent
+  | _ => true
+
+/-- Whether the policy sends hedged duplicates -/
+def hedges (p : RetryPolicy) : Bool :=
+  p.hedgeAfterMs.isSome || p.hedgeAtP95
+
+/-- Send a duplicate after `ms` without a response -/
+def withHedging (p : RetryPolicy) (ms : Nat) : RetryPolicy :=
+  { p with hedgeAfterMs := some ms }
+
+/-- Send a duplicate after the origin's p95 latency -/
+def withP95Hedging (p : RetryPolicy) (fallbackMs : Option Nat := none) : RetryPolicy :=
+  { p with hedgeAtP95 := true, hedgeAfterMs := fallbackMs }
+
+end RetryPolicy
+
+end Wisp
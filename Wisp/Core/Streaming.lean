@@ -14,12 +14,17 @@ structure StreamingResponse where
   status : UInt32
   /-- Response headers -/
   headers : Headers
+  /-- The same headers indexed for case-insensitive lookup -/
+  headerMap : HeaderMap := HeaderMap.ofHeaders headers
   /-- Content-Type from headers -/
   contentType : Option String := none
   /-- Channel for receiving body chunks. Closes when stream ends. -/
   bodyChannel : Std.CloseableChannel.Sync ByteArray
   /-- Effective URL after redirects -/
   effectiveUrl : String := ""
+  /-- Timing and transfer statistics as of when the headers arrived; the body
+      is still in flight, so totals cover only what was received by then -/
+  metrics : TransferMetrics := {}
 
 namespace StreamingResponse
 
@@ -45,7 +50,7 @@ def isError (r : StreamingResponse) : Bool :=
 
 /-- Get header value by name (case-insensitive) -/
 def header (r : StreamingResponse) (name : String) : Option String :=
-  r.headers.get? name
+  r.headerMap.get? name
 
 /-- Read all chunks from the body channel, concatenating into a single ByteArray -/
 partial def readAllBody (r : StreamingResponse) : IO ByteArray := do
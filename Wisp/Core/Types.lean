@@ -3,6 +3,8 @@
   HTTP methods, headers, and URL types
 -/
 
+import Std.Data.HashMap
+
 namespace Wisp
 
 /-- HTTP request methods -/
@@ -39,10 +41,82 @@ end Method
 inductive HttpVersion where
   | HTTP1_0
   | HTTP1_1
+  /-- HTTP/2, negotiated with ALPN over TLS or an Upgrade over cleartext -/
   | HTTP2
+  /-- HTTP/2 without negotiation, for servers known to speak it (cleartext h2c) -/
+  | HTTP2_PRIOR_KNOWLEDGE
+  /-- HTTP/3 over QUIC, falling back to HTTP/2 or 1.1 when it is unavailable -/
   | HTTP3
   deriving Repr, BEq, Inhabited
 
+namespace HttpVersion
+
+/-- The CURL_HTTP_VERSION_* value requesting this version -/
+def toCurl : HttpVersion → Int64
+  | .HTTP1_0 => 1
+  | .HTTP1_1 => 2
+  | .HTTP2 => 3
+  | .HTTP2_PRIOR_KNOWLEDGE => 5
+  | .HTTP3 => 30
+
+end HttpVersion
+
+/-- Timing and transfer statistics for a request, as reported by libcurl.
+    Times are seconds from the start of the transfer; each phase includes the
+    ones before it. -/
+structure TransferMetrics where
+  /-- Name resolution completed -/
+  namelookupTime : Float := 0.0
+  /-- TCP (or QUIC) connection established -/
+  connectTime : Float := 0.0
+  /-- TLS handshake completed (0 without TLS) -/
+  appconnectTime : Float := 0.0
+  /-- About to send the request -/
+  pretransferTime : Float := 0.0
+  /-- First response byte received (time to first byte) -/
+  starttransferTime : Float := 0.0
+  /-- Time spent following redirects before the final request -/
+  redirectTime : Float := 0.0
+  /-- Whole transfer -/
+  totalTime : Float := 0.0
+  /-- Request body bytes sent -/
+  bytesUploaded : Nat := 0
+  /-- Response body bytes received -/
+  bytesDownloaded : Nat := 0
+  /-- Average download speed in bytes per second -/
+  downloadSpeed : Float := 0.0
+  /-- An existing connection was reused instead of opening a new one -/
+  connectionReused : Bool := false
+  /-- HTTP version used for the final response -/
+  httpVersion : Option HttpVersion := none
+  deriving Repr, Inhabited
+
+namespace TransferMetrics
+
+/-- Decode the array returned by `FFI.getTransferInfo`. -/
+def fromInfo (info : FloatArray) : TransferMetrics :=
+  let slot (i : Nat) : Float := if h : i < info.size then info[i] else 0.0
+  let httpVersion := match (slot 11).toUInt64.toNat with
+    | 1 => some .HTTP1_0
+    | 2 => some .HTTP1_1
+    | 3 => some .HTTP2
+    | 30 => some .HTTP3
+    | _ => none
+  { namelookupTime := slot 0
+    connectTime := slot 1
+    appconnectTime := slot 2
+    pretransferTime := slot 3
+    starttransferTime := slot 4
+    redirectTime := slot 5
+    totalTime := slot 6
+    bytesUploaded := (slot 7).toUInt64.toNat
+    bytesDownloaded := (slot 8).toUInt64.toNat
+    downloadSpeed := slot 9
+    connectionReused := info.size > 10 && slot 10 == 0.0
+    httpVersion }
+
+end TransferMetrics
+
 /-- A single HTTP header (key-value pair) -/
 abbrev Header := String × String
 
@@ -91,4 +165,49 @@ def contentLength (headers : Headers) : Option Nat := do
 
 end Headers
 
+/-- Headers with a case-insensitive index for constant-time lookup -/
+structure HeaderMap where
+  /-- Headers in the order they were received -/
+  entries : Headers := #[]
+  /-- Positions in `entries` for each lowercased name -/
+  index : Std.HashMap String (Array Nat) := {}
+  deriving Inhabited
+
+namespace HeaderMap
+
+/-- Index `entries` given each entry's lowercased name (`keys[i]` for `entries[i]`) -/
+def ofLowered (entries : Headers) (keys : Array String) : HeaderMap := Id.run do
+  let mut index : Std.HashMap String (Array Nat) := Std.HashMap.emptyWithCapacity keys.size
+  for h : i in [0:keys.size] do
+    index := index.alter keys[i] fun
+      | some positions => some (positions.push i)
+      | none => some #[i]
+  return { entries, index }
+
+/-- Index a header collection -/
+def ofHeaders (headers : Headers) : HeaderMap :=
+  ofLowered headers (headers.map (·.1.toLower))
+
+/-- Get the first value for a header name (case-insensitive) -/
+def get? (m : HeaderMap) (key : String) : Option String := do
+  let positions ← m.index.get? key.toLower
+  let i ← positions[0]?
+  let (_, value) ← m.entries[i]?
+  return value
+
+/-- Get all values for a header name (case-insensitive) -/
+def getAll (m : HeaderMap) (key : String) : Array String :=
+  match m.index.get? key.toLower with
+  | some positions => positions.filterMap fun i => m.entries[i]?.map (·.2)
+  | none => #[]
+
+/-- Check if a header exists (case-insensitive) -/
+def contains (m : HeaderMap) (key : String) : Bool :=
+  m.index.contains key.toLower
+
+/-- Number of headers -/
+def size (m : HeaderMap) : Nat := m.entries.size
+
+end HeaderMap
+
 end Wisp
@@ -130,6 +130,17 @@ def closeReason (f : WebSocketFrame) : Option String :=
 
 end WebSocketFrame
 
+/-- A piece of a WebSocket message, delivered as it arrives rather than
+    after the whole message is assembled -/
+structure WebSocketFragment where
+  /-- The type of frame (`.continuation` for later fragments) -/
+  frameType : WebSocketFrameType
+  /-- The bytes received in this piece -/
+  payload : ByteArray
+  /-- True if this piece completes its message -/
+  final : Bool
+  deriving Inhabited
+
 -- WebSocket close codes (RFC 6455)
 namespace WebSocketCloseCode
 
@@ -72,6 +72,8 @@ namespace CurlOpt
   def HTTPAUTH : UInt32 := 107
   def ACCEPT_ENCODING : UInt32 := 10102
   def MAXREDIRS : UInt32 := 68
+  def HTTP_VERSION : UInt32 := 84
+  def PIPEWAIT : UInt32 := 237
 
   -- SSL/TLS options
   def SSL_VERIFYPEER : UInt32 := 64
@@ -161,6 +163,19 @@ opaque globalCleanup : IO Unit
 @[extern "wisp_version_info"]
 opaque versionInfo : IO String
 
+-- ============================================================================
+-- HTTP Dates
+-- ============================================================================
+
+/-- Parse an HTTP date (IMF-fixdate, RFC 850 or asctime) into seconds since
+    the epoch. Returns -1 if the date cannot be parsed. -/
+@[extern "wisp_parse_http_date"]
+opaque parseHttpDate (date : @& String) : IO Int64
+
+/-- Current wall-clock time in seconds since the epoch -/
+@[extern "wisp_unix_time"]
+opaque unixTime : IO Int64
+
 -- ============================================================================
 -- Easy Handle Operations
 -- ============================================================================
@@ -217,6 +232,11 @@ opaque getinfoLong (easy : @& Easy) (info : UInt32) : IO UInt64
 @[extern "wisp_easy_getinfo_double"]
 opaque getinfoDouble (easy : @& Easy) (info : UInt32) : IO Float
 
+/-- Get timing and transfer statistics in one call, in the slot order read by
+    `Wisp.TransferMetrics.fromInfo`. -/
+@[extern "wisp_easy_get_transfer_info"]
+opaque getTransferInfo (easy : @& Easy) : IO FloatArray
+
 /-- Get a string info value. -/
 @[extern "wisp_easy_getinfo_string"]
 opaque getinfoString (easy : @& Easy) (info : UInt32) : IO String
@@ -233,7 +253,8 @@ opaque setupWriteCallback (easy : @& Easy) : IO Unit
 @[extern "wisp_easy_setup_header_callback"]
 opaque setupHeaderCallback (easy : @& Easy) : IO Unit
 
-/-- Get the response body as a ByteArray. Call after easyPerform. -/
+/-- Get the response body as a ByteArray. Call after easyPerform.
+    The body is written directly into this array, so no copy is made. -/
 @[extern "wisp_easy_get_response_body"]
 opaque getResponseBody (easy : @& Easy) : IO ByteArray
 
@@ -241,6 +262,11 @@ opaque getResponseBody (easy : @& Easy) : IO ByteArray
 @[extern "wisp_easy_get_response_headers"]
 opaque getResponseHeaders (easy : @& Easy) : IO String
 
+/-- Get the final response's headers, parsed as they arrived, together with
+    each name lowercased (same order). Common names are shared, not copied. -/
+@[extern "wisp_easy_get_response_header_fields"]
+opaque getResponseHeaderFields (easy : @& Easy) : IO (Array (String × String) × Array String)
+
 -- ============================================================================
 -- Slist Operations
 -- ============================================================================
@@ -305,6 +331,72 @@ opaque urlEncode (easy : @& Easy) (str : @& String) : IO String
 @[extern "wisp_url_decode"]
 opaque urlDecode (easy : @& Easy) (str : @& String) : IO String
 
+-- ============================================================================
+-- Request Body Upload
+-- ============================================================================
+
+/-- Send a ByteArray as the request body (POST) without copying it. -/
+@[extern "wisp_easy_set_body_bytes"]
+opaque setBodyBytes (easy : @& Easy) (data : @& ByteArray) : IO Unit
+
+/-- Send a ByteArray as the request body (POST), compressed while curl reads
+    it and sent chunked. `coding` is 1 for gzip or 2 for zstd; `level` 0 is the
+    codec's default. Returns the coding used, which is gzip when zstd was asked
+    for but Wisp was built without it. -/
+@[extern "wisp_easy_set_body_compressed"]
+opaque setBodyCompressed (easy : @& Easy) (data : @& ByteArray) (coding : UInt8) (level : UInt32)
+    : IO UInt8
+
+/-- Like `setBodyCompressed`, for a String body. -/
+@[extern "wisp_easy_set_body_compressed_string"]
+opaque setBodyCompressedString (easy : @& Easy) (data : @& String) (coding : UInt8) (level : UInt32)
+    : IO UInt8
+
+/-- Stream a file as the request body (POST). Returns the file size. -/
+@[extern "wisp_easy_set_body_file"]
+opaque setBodyFile (easy : @& Easy) (path : @& String) : IO UInt64
+
+/-- Stream the request body (POST) from chunks supplied with `uploadPush`.
+    A negative length means unknown; the body is then sent chunked. -/
+@[extern "wisp_easy_set_body_stream"]
+opaque setBodyStream (easy : @& Easy) (length : Int64) : IO Unit
+
+/-- Check if a streamed body has sent its current chunk and needs the next one. -/
+@[extern "wisp_easy_upload_wants_data"]
+opaque uploadWantsData (easy : @& Easy) : IO Bool
+
+/-- Supply the next chunk of a streamed body, resuming a paused upload. -/
+@[extern "wisp_easy_upload_push"]
+opaque uploadPush (easy : @& Easy) (chunk : @& ByteArray) : IO Unit
+
+/-- Mark the end of a streamed body. -/
+@[extern "wisp_easy_upload_finish"]
+opaque uploadFinish (easy : @& Easy) : IO Unit
+
+-- ============================================================================
+-- Download to File
+-- ============================================================================
+
+/-- Write the body of a successful (2xx) response straight to the file at
+    `path` from the write callback, instead of into the response body. With
+    `resume`, the bytes already in the file are skipped with a Range request;
+    a 206 reply is appended, a 200 replaces the file. With `preallocate`,
+    disk space for the body is reserved from its Content-Length (Linux).
+    Error responses are buffered as usual. Returns the offset asked for. -/
+@[extern "wisp_easy_set_download_file"]
+opaque setDownloadFile (easy : @& Easy) (path : @& String) (resume : Bool) (preallocate : Bool) : IO UInt64
+
+/-- Write the byte range `start` to `start + length - 1` of the response at
+    that offset in the file at `path`. Anything but a 206 reply (other than
+    an error status, which is buffered) fails the transfer. -/
+@[extern "wisp_easy_set_download_segment"]
+opaque setDownloadSegment (easy : @& Easy) (path : @& String) (start : UInt64) (length : UInt64) : IO Unit
+
+/-- Create or empty the file at `path` and size it to `size` bytes, reserving
+    the disk space where the file system allows. -/
+@[extern "wisp_file_preallocate"]
+opaque preallocateFile (path : @& String) (size : UInt64) : IO Unit
+
 -- ============================================================================
 -- Streaming Support
 -- ============================================================================
@@ -321,7 +413,9 @@ opaque isStreaming (easy : @& Easy) : IO Bool
 @[extern "wisp_easy_headers_complete"]
 opaque headersComplete (easy : @& Easy) : IO Bool
 
-/-- Drain any new body data since last call. Returns empty if no new data. -/
+/-- Drain any new body data since last call. Returns empty if no new data.
+    Frees the space in the streaming buffer and resumes a transfer that was
+    paused because the buffer was full. -/
 @[extern "wisp_easy_drain_body_chunk"]
 opaque drainBodyChunk (easy : @& Easy) : IO ByteArray
 
@@ -329,10 +423,15 @@ opaque drainBodyChunk (easy : @& Easy) : IO ByteArray
 @[extern "wisp_easy_has_pending_data"]
 opaque hasPendingData (easy : @& Easy) : IO Bool
 
-/-- Reset streaming state (read offset, headers_complete flag). -/
+/-- Reset streaming state (buffered body data, headers_complete flag). -/
 @[extern "wisp_easy_reset_streaming"]
 opaque resetStreaming (easy : @& Easy) : IO Unit
 
+/-- Index of the first CR or LF byte at or after `start`, or `data.size` if
+    there is none. Used by the SSE parser to split lines. -/
+@[extern "wisp_sse_find_line_end"]
+opaque findLineEnd (data : @& ByteArray) (start : USize) : USize
+
 -- ============================================================================
 -- WebSocket Support (curl 7.86+)
 -- ============================================================================
@@ -345,11 +444,43 @@ opaque wsCheckSupport : IO Bool
 @[extern "wisp_ws_send"]
 opaque wsSend (easy : @& Easy) (data : @& ByteArray) (frameType : UInt32) : IO Unit
 
-/-- Receive a WebSocket frame. Returns None if no data available (non-blocking).
-    Returns (payload, frameType) on success. -/
+/-- Send as much of a frame's payload, from `offset` on, as the socket takes
+    without blocking. Returns the offset reached and whether the frame is
+    complete; an incomplete frame must be continued from that offset before
+    anything else is sent on the connection. -/
+@[extern "wisp_ws_send_some"]
+opaque wsSendSome (easy : @& Easy) (data : @& ByteArray) (offset : UInt64) (frameType : UInt32)
+    : IO (UInt64 × Bool)
+
+/-- Receive a complete WebSocket message. Fragmented and multi-read frames are
+    reassembled natively; control frames arriving between fragments are returned
+    on their own. Returns None if no complete message is available yet
+    (non-blocking). Returns (payload, frameType) on success. -/
 @[extern "wisp_ws_recv"]
 opaque wsRecv (easy : @& Easy) : IO (Option (ByteArray × UInt32))
 
+/-- Receive the next piece of a message without reassembling it.
+    Returns (payload, flags, bytesleft); the piece ends its message when
+    bytesleft is 0 and flags lack `CurlWs.CONT`. Returns None if no data is
+    available (non-blocking). -/
+@[extern "wisp_ws_recv_fragment"]
+opaque wsRecvFragment (easy : @& Easy) : IO (Option (ByteArray × UInt32 × UInt64))
+
+/-- Set the largest message `wsRecv` will assemble (default 64 MiB).
+    Larger messages are discarded and reported as an error. -/
+@[extern "wisp_ws_set_max_message"]
+opaque wsSetMaxMessage (easy : @& Easy) (maxBytes : UInt64) : IO Unit
+
+/-- Number of messages `wsRecv` has dropped for exceeding the size limit. -/
+@[extern "wisp_ws_dropped_messages"]
+opaque wsDroppedMessages (easy : @& Easy) : IO UInt64
+
+/-- Block until the connection's socket is readable or `timeoutMs` elapses,
+    without spinning. Returns true if it became readable. Call after `wsRecv`
+    returned none. -/
+@[extern "wisp_ws_wait"]
+opaque wsWait (easy : @& Easy) (timeoutMs : UInt32) : IO Bool
+
 /-- Get WebSocket metadata (offset, bytesleft, flags) after a recv call. -/
 @[extern "wisp_ws_meta"]
 opaque wsMeta (easy : @& Easy) : IO (UInt64 × UInt64 × UInt32)
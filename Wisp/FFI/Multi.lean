@@ -16,6 +16,17 @@ opaque MultiPointed : NonemptyType
 def Multi := MultiPointed.type
 instance : Nonempty Multi := MultiPointed.property
 
+-- ============================================================================
+-- Multi Option Constants (CURLMOPT_*)
+-- ============================================================================
+
+namespace CurlMOpt
+  def MAXCONNECTS : UInt32 := 6
+  def MAX_HOST_CONNECTIONS : UInt32 := 7
+  def MAX_TOTAL_CONNECTIONS : UInt32 := 13
+  def MAX_CONCURRENT_STREAMS : UInt32 := 16
+end CurlMOpt
+
 -- ============================================================================
 -- Multi Handle Operations
 -- ============================================================================
@@ -28,6 +39,10 @@ opaque multiInit : IO Multi
 @[extern "wisp_multi_cleanup"]
 opaque multiCleanup (multi : @& Multi) : IO Unit
 
+/-- Set a long-valued multi option (CURLMOPT_*). -/
+@[extern "wisp_multi_setopt_long"]
+opaque multiSetoptLong (multi : @& Multi) (option : UInt32) (value : Int64) : IO Unit
+
 /-- Add an easy handle to the multi stack. -/
 @[extern "wisp_multi_add_handle"]
 opaque multiAddHandle (multi : @& Multi) (easy : @& Easy) : IO Unit
@@ -44,8 +59,41 @@ opaque multiPerform (multi : @& Multi) : IO UInt32
 @[extern "wisp_multi_poll"]
 opaque multiPoll (multi : @& Multi) (timeoutMs : UInt32) : IO UInt32
 
+/-- Timeout for `multiWait` meaning "until there is work to do". -/
+def waitForever : UInt32 := 0xFFFFFFFF
+
+/-- Wait for socket activity or curl's next timeout, then drive the ready
+    transfers via curl_multi_socket_action. Returns early after `multiWakeup`.
+    Returns number still running. -/
+@[extern "wisp_multi_wait"]
+opaque multiWait (multi : @& Multi) (timeoutMs : UInt32) : IO UInt32
+
+/-- Interrupt a blocked `multiWait`. Safe to call from any thread. -/
+@[extern "wisp_multi_wakeup"]
+opaque multiWakeup (multi : @& Multi) : IO Unit
+
+/-- Take the ids of streaming transfers that received headers or body data
+    since the last call. Each transfer appears at most once. -/
+@[extern "wisp_multi_take_ready"]
+opaque multiTakeReady (multi : @& Multi) : IO (Array UInt64)
+
 /-- Read a completed transfer (id, curl code), if any. -/
 @[extern "wisp_multi_info_read"]
 opaque multiInfoRead (multi : @& Multi) : IO (Option (UInt64 × UInt32))
 
+/-- Wait on the socket of a WebSocket connection whose CONNECT_ONLY handshake
+    finished on this multi handle. The connection's id (CURLOPT_PRIVATE) is
+    then listed by `multiTakeReady` whenever it has data to receive. -/
+@[extern "wisp_multi_watch_ws"]
+opaque multiWatchWebSocket (multi : @& Multi) (easy : @& Easy) : IO Unit
+
+/-- Also wait for a watched WebSocket's socket to be writable, listing the
+    connection in `multiTakeReady` once a blocked send can continue. -/
+@[extern "wisp_multi_ws_want_write"]
+opaque multiWebSocketWantWrite (multi : @& Multi) (easy : @& Easy) (want : Bool) : IO Unit
+
+/-- Stop waiting on a WebSocket connection's socket. -/
+@[extern "wisp_multi_unwatch_ws"]
+opaque multiUnwatchWebSocket (multi : @& Multi) (easy : @& Easy) : IO Unit
+
 end Wisp.FFI
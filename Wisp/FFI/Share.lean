@@ -0,0 +1,48 @@
+/-
+  Wisp FFI Share Handle
+  Low-level bindings to curl_share_* functions for caches shared across handles
+-/
+
+import Wisp.FFI.Easy
+
+namespace Wisp.FFI
+
+-- ============================================================================
+-- Opaque Types
+-- ============================================================================
+
+/-- Opaque handle to a curl share handle (DNS, TLS session and connection caches) -/
+opaque SharePointed : NonemptyType
+def Share := SharePointed.type
+instance : Nonempty Share := SharePointed.property
+
+-- ============================================================================
+-- Share Data Constants (CURL_LOCK_DATA_*)
+-- ============================================================================
+
+namespace CurlLockData
+  def COOKIE : UInt32 := 2
+  def DNS : UInt32 := 3
+  def SSL_SESSION : UInt32 := 4
+  def CONNECT : UInt32 := 5
+  def PSL : UInt32 := 6
+  def HSTS : UInt32 := 7
+end CurlLockData
+
+-- ============================================================================
+-- Share Handle Operations
+-- ============================================================================
+
+/-- Create a new share handle. Locking is set up so it can be used from any thread. -/
+@[extern "wisp_share_init"]
+opaque shareInit : IO Share
+
+/-- Share one kind of data (a CurlLockData constant) between attached handles. -/
+@[extern "wisp_share_add"]
+opaque shareAdd (share : @& Share) (data : UInt32) : IO Unit
+
+/-- Attach an easy handle to a share handle (CURLOPT_SHARE). -/
+@[extern "wisp_easy_setopt_share"]
+opaque setoptShare (easy : @& Easy) (share : @& Share) : IO Unit
+
+end Wisp.FFI
@@ -0,0 +1,53 @@
+/-
+  Wisp FFI Request Templates
+  Options, header lines and a share handle compiled once, then applied to
+  easy handles in a single call
+-/
+
+import Wisp.FFI.Easy
+import Wisp.FFI.Share
+
+namespace Wisp.FFI
+
+-- ============================================================================
+-- Opaque Types
+-- ============================================================================
+
+/-- Opaque handle to a compiled request template -/
+opaque TemplatePointed : NonemptyType
+def Template := TemplatePointed.type
+instance : Nonempty Template := TemplatePointed.property
+
+-- ============================================================================
+-- Template Operations
+-- ============================================================================
+
+/-- Create an empty template. Fill it before the first `templateApply`; it
+    is only read afterwards and may then be applied from any thread. -/
+@[extern "wisp_template_new"]
+opaque templateNew : IO Template
+
+/-- Record a long/integer option. Fails now if curl rejects it. -/
+@[extern "wisp_template_set_long"]
+opaque templateSetLong (tmpl : @& Template) (option : UInt32) (value : Int64) : IO Unit
+
+/-- Record a string option. Fails now if curl rejects it. -/
+@[extern "wisp_template_set_string"]
+opaque templateSetString (tmpl : @& Template) (option : UInt32) (value : @& String) : IO Unit
+
+/-- Add a header line sent with every request. -/
+@[extern "wisp_template_add_header"]
+opaque templateAddHeader (tmpl : @& Template) (line : @& String) : IO Unit
+
+/-- Attach handles to a share handle when the template is applied. -/
+@[extern "wisp_template_set_share"]
+opaque templateSetShare (tmpl : @& Template) (share : @& Share) : IO Unit
+
+/-- Configure a clean easy handle from the template: response callbacks, the
+    URL, every recorded option, the share handle, and the template's headers
+    followed by `headers`. A line in `headers` replaces the template's lines
+    of the same name. Takes over the lines of `headers`, like `setoptSlist`. -/
+@[extern "wisp_template_apply"]
+opaque templateApply (easy : @& Easy) (tmpl : @& Template) (url : @& String) (headers : @& Slist) : IO Unit
+
+end Wisp.FFI
@@ -0,0 +1,608 @@
+/-
+  Wisp HTTP Cache
+  RFC 9111 private response cache: an in-memory LRU backed by an on-disk store
+-/
+
+import Wisp.Core.Types
+import Wisp.Core.Error
+import Wisp.Core.Request
+import Wisp.Core.Response
+import Wisp.FFI.Easy
+import Std.Data.HashMap
+import Std.Sync.Mutex
+
+namespace Wisp.HTTP
+
+/-- Cache configuration -/
+structure CacheConfig where
+  /-- Bytes of stored responses kept in memory -/
+  maxMemoryBytes : Nat := 64 * 1024 * 1024
+  /-- Directory of the on-disk store (none = memory only) -/
+  directory : Option String := none
+  /-- Bytes of stored responses kept on disk -/
+  maxDiskBytes : Nat := 512 * 1024 * 1024
+  /-- Responses larger than this are never stored -/
+  maxEntryBytes : Nat := 8 * 1024 * 1024
+  /-- Upper bound in seconds on the freshness guessed from Last-Modified -/
+  maxHeuristicSeconds : Nat := 24 * 60 * 60
+  deriving Repr, Inhabited
+
+/-- Cache counters -/
+structure CacheStats where
+  /-- Requests answered from a fresh stored response -/
+  hits : Nat := 0
+  /-- Requests sent to the network, revalidations included -/
+  misses : Nat := 0
+  /-- Revalidations answered with 304, served from the stored body -/
+  revalidated : Nat := 0
+  /-- Requests that joined an identical request already in flight -/
+  coalesced : Nat := 0
+  /-- Responses written to the cache -/
+  stored : Nat := 0
+  /-- Responses dropped to stay within the size bounds -/
+  evicted : Nat := 0
+  /-- Writes to the on-disk store that failed; the response stays cached in memory -/
+  diskErrors : Nat := 0
+  deriving Repr, Inhabited
+
+/-- A stored response -/
+private structure CacheEntry where
+  url : String
+  status : UInt32
+  headers : Headers
+  body : ByteArray
+  /-- Request headers named by the response's Vary, as they were sent -/
+  vary : Array (String × Option String)
+  /-- Wall-clock seconds when the request was sent -/
+  requestTime : Nat
+  /-- Wall-clock seconds when the response arrived -/
+  responseTime : Nat
+  /-- Response Cache-Control directives, lowercased -/
+  directives : Array (String × Option String)
+  date : Option Nat
+  expires : Option Nat
+  lastModified : Option Nat
+  /-- LRU clock value of the last use -/
+  lastUsed : Nat := 0
+
+private structure CacheState where
+  /-- Stored variants by URL -/
+  entries : Std.HashMap String (Array CacheEntry) := {}
+  bytes : Nat := 0
+  /-- Files of the on-disk store: name → (size, LRU clock of the last use) -/
+  disk : Std.HashMap String (Nat × Nat) := {}
+  diskBytes : Nat := 0
+  clock : Nat := 0
+  stats : CacheStats := {}
+
+/-- An HTTP response cache, shared by every client it is attached to -/
+structure Cache where
+  private mk ::
+  config : CacheConfig
+  private state : Std.Mutex CacheState
+  /-- Requests in flight, by `coalescingKey` -/
+  private inflight : Std.Mutex (Std.HashMap String (Task (WispResult Response)))
+
+instance : Repr Cache where
+  reprPrec c _ := Std.Format.text "Wisp.HTTP.Cache " ++ repr c.config
+
+-- ============================================================================
+-- Header Parsing
+-- ============================================================================
+
+/-- Split comma-separated Cache-Control values into lowercased directives -/
+private def parseDirectives (values : Array String) : Array (String × Option String) :=
+  values.foldl (init := #[]) fun acc value =>
+    (value.splitOn ",").foldl (init := acc) fun acc part =>
+      match part.splitOn "=" with
+      | [] => acc
+      | name :: rest =>
+        let name := name.trim.toLower
+        if name.isEmpty then acc
+        else if rest.isEmpty then acc.push (name, none)
+        else
+          let arg := ("=".intercalate rest).trim
+          let arg := if arg.startsWith "\"" && arg.endsWith "\"" && arg.length ≥ 2
+            then (arg.drop 1).dropRight 1 else arg
+          acc.push (name, some arg)
+
+private def hasDirective (ds : Array (String × Option String)) (name : String) : Bool :=
+  ds.any (·.1 == name)
+
+private def directiveSeconds (ds : Array (String × Option String)) (name : String) : Option Nat :=
+  ds.findSome? fun (n, arg) => if n == name then arg.bind String.toNat? else none
+
+private def requestDirectives (req : Request) : Array (String × Option String) :=
+  parseDirectives (req.headers.getAll "Cache-Control")
+
+/-- Header names listed by Vary, lowercased -/
+private def varyNames (headers : Headers) : Array String :=
+  (headers.getAll "Vary").foldl (init := #[]) fun acc value =>
+    (value.splitOn ",").foldl (init := acc) fun acc name =>
+      let name := name.trim.toLower
+      if name.isEmpty then acc else acc.push name
+
+/-- A request header as it is sent, including those curl adds from request fields -/
+private def requestHeader (req : Request) (name : String) : Option String :=
+  match req.headers.get? name with
+  | some value => some value.trim
+  | none =>
+    if name == "accept-encoding" then req.acceptEncoding
+    else if name == "user-agent" then some req.userAgent
+    else none
+
+private def httpDate? (value : Option String) : IO (Option Nat) := do
+  let some value := value | return none
+  let t ← FFI.parseHttpDate value
+  return if t < 0 then none else some t.toInt.toNat
+
+private def unixNow : IO Nat :=
+  return (← FFI.unixTime).toInt.toNat
+
+-- ============================================================================
+-- Entries
+-- ============================================================================
+
+namespace CacheEntry
+
+private def make (url : String) (status : UInt32) (headers : Headers) (body : ByteArray)
+    (vary : Array (String × Option String)) (requestTime responseTime : Nat) : IO CacheEntry := do
+  let date ← httpDate? (headers.get? "Date")
+  -- An Expires that cannot be parsed means the response is already stale
+  let expires ← match headers.get? "Expires" with
+    | some value => do return some ((← httpDate? (some value)).getD 0)
+    | none => pure none
+  let lastModified ← httpDate? (headers.get? "Last-Modified")
+  return {
+    url, status, headers, body, vary, requestTime, responseTime
+    directives := parseDirectives (headers.getAll "Cache-Control")
+    date, expires, lastModified
+  }
+
+/-- Bytes the entry is charged against the size bounds -/
+private def size (e : CacheEntry) : Nat :=
+  e.headers.foldl (init := e.url.utf8ByteSize + e.body.size) fun acc (k, v) =>
+    acc + k.utf8ByteSize + v.utf8ByteSize + 4
+
+private def matches (e : CacheEntry) (req : Request) : Bool :=
+  e.vary.all fun (name, value) => requestHeader req name == value
+
+/-- Statuses that may be stored without explicit freshness (RFC 9110 §15.1) -/
+private def heuristicallyCacheable (status : UInt32) : Bool :=
+  (#[200, 203, 204, 300, 301, 308, 404, 405, 410, 414, 501] : Array UInt32).contains status
+
+/-- Seconds the response stays fresh after it was generated (RFC 9111 §4.2.1) -/
+private def freshnessLifetime (config : CacheConfig) (e : CacheEntry) : Nat :=
+  match directiveSeconds e.directives "max-age" with
+  | some seconds => seconds
+  | none =>
+    let date := e.date.getD e.responseTime
+    match e.expires, e.lastModified with
+    | some expires, _ => expires - date
+    | none, some lastModified =>
+      if heuristicallyCacheable e.status then
+        min ((date - lastModified) / 10) config.maxHeuristicSeconds
+      else 0
+    | none, none => 0
+
+/-- Seconds since the response was generated by the origin (RFC 9111 §4.2.3) -/
+private def currentAge (e : CacheEntry) (now : Nat) : Nat :=
+  let ageValue := ((e.headers.get? "Age").bind (·.trim.toNat?)).getD 0
+  let apparentAge := e.responseTime - e.date.getD e.responseTime
+  let responseDelay := e.responseTime - e.requestTime
+  let correctedInitialAge := max apparentAge (ageValue + responseDelay)
+  correctedInitialAge + (now - e.responseTime)
+
+/-- Whether the entry may answer the request without contacting the origin -/
+private def isFresh (config : CacheConfig) (e : CacheEntry) (req : Request) (now : Nat) : Bool :=
+  let reqDirectives := requestDirectives req
+  let noCache := hasDirective e.directives "no-cache" || hasDirective reqDirectives "no-cache"
+    || (req.headers.getAll "Pragma").any (·.trim.toLower == "no-cache")
+  let lifetime := e.freshnessLifetime config
+  let age := e.currentAge now
+  let maxAge := (directiveSeconds reqDirectives "max-age").getD age
+  let minFresh := (directiveSeconds reqDirectives "min-fresh").getD 0
+  !noCache && age < lifetime && age ≤ maxAge && age + minFresh ≤ lifetime
+
+private def hasValidators (e : CacheEntry) : Bool :=
+  e.headers.contains "ETag" || e.headers.contains "Last-Modified"
+
+/-- The request with If-None-Match / If-Modified-Since taken from the entry -/
+private def conditional (e : CacheEntry) (req : Request) : Request := Id.run do
+  let mut req := req
+  if let some etag := e.headers.get? "ETag" then
+    req := req.withHeader "If-None-Match" etag
+  if let some lastModified := e.headers.get? "Last-Modified" then
+    req := req.withHeader "If-Modified-Since" lastModified
+  return req
+
+private def toResponse (e : CacheEntry) (now : Nat) (metrics : TransferMetrics := {}) : Response :=
+  let headers := (e.headers.remove "Age").add "Age" (toString (e.currentAge now))
+  {
+    status := e.status
+    headers
+    body := e.body
+    contentType := headers.contentType
+    totalTime := metrics.totalTime
+    effectiveUrl := e.url
+    metrics
+    fromCache := true
+  }
+
+/-- Header fields a 304 must not replace (RFC 9111 §3.2) -/
+private def keptOnUpdate : Array String :=
+  #["content-length", "content-encoding", "transfer-encoding", "content-range"]
+
+/-- Apply the header fields of a 304 to the stored response -/
+private def refresh (e : CacheEntry) (notModified : Headers) (requestTime responseTime : Nat)
+    : IO CacheEntry := do
+  let fresh := notModified.filter fun (k, _) => !keptOnUpdate.contains k.toLower
+  let replaced := fresh.map (·.1.toLower)
+  let headers := e.headers.filter (fun (k, _) => !replaced.contains k.toLower) ++ fresh
+  make e.url e.status headers e.body e.vary requestTime responseTime
+
+-- On-disk format: a UTF-8 header block ending in a blank line, then the body.
+-- Header lines never contain a newline, so the first blank line ends the block.
+
+private def magic : String := "WISPCACHE 1"
+
+private def encode (e : CacheEntry) : ByteArray :=
+  let lines := #[magic, e.url, toString e.status, toString e.requestTime,
+      toString e.responseTime, toString e.headers.size]
+    ++ e.headers.map (fun (k, v) => s!"{k}: {v}")
+    ++ #[toString e.vary.size]
+    ++ e.vary.map (fun (name, value) => match value with
+      | some value => s!"{name}: {value}"
+      | none => name)
+  ("\n".intercalate lines.toList ++ "\n\n").toUTF8 ++ e.body
+
+private def findBlankLine (data : ByteArray) : Option Nat := Id.run do
+  for i in [0:data.size - 1] do
+    if data[i]! == 10 && data[i + 1]! == 10 then
+      return some i
+  return none
+
+private def splitField (line : String) : String × Option String :=
+  match line.splitOn ": " with
+  | [name] => (name, none)
+  | name :: rest => (name, some (": ".intercalate rest))
+  | [] => (line, none)
+
+private def decode (data : ByteArray) : IO (Option CacheEntry) := do
+  let some blank := findBlankLine data | return none
+  let some text := String.fromUTF8? (data.extract 0 blank) | return none
+  let lines := (text.splitOn "\n").toArray
+  if lines[0]? != some magic then return none
+  let some url := lines[1]? | return none
+  let some status := lines[2]?.bind String.toNat? | return none
+  let some requestTime := lines[3]?.bind String.toNat? | return none
+  let some responseTime := lines[4]?.bind String.toNat? | return none
+  let some headerCount := lines[5]?.bind String.toNat? | return none
+  let some varyCount := lines[6 + headerCount]?.bind String.toNat? | return none
+  if lines.size != 7 + headerCount + varyCount then return none
+  let headers := (lines.extract 6 (6 + headerCount)).map fun line =>
+    let (k, v) := splitField line
+    (k, v.getD "")
+  let vary := (lines.extract (7 + headerCount) lines.size).map splitField
+  let body := data.extract (blank + 2) data.size
+  some <$> make url status.toUInt32 headers body vary requestTime responseTime
+
+end CacheEntry
+
+-- ============================================================================
+-- Storage
+-- ============================================================================
+
+/-- Whether a request may be answered from, or stored in, the cache -/
+def Cache.isCacheable (req : Request) : Bool :=
+  req.method == .GET
+    && (match req.body with | .empty => true | _ => false)
+    -- Caller-supplied validators are passed through untouched
+    && !req.headers.contains "If-None-Match"
+    && !req.headers.contains "If-Modified-Since"
+    && !hasDirective (requestDirectives req) "no-store"
+
+/-- Identical requests share one transfer -/
+private def coalescingKey (req : Request) : String :=
+  let fields := req.headers.map fun (k, v) => s!"{k.toLower}: {v}"
+  "\n".intercalate ([req.url, req.acceptEncoding.getD "", req.userAgent] ++ fields.toList)
+
+/-- Name of a URL's file in the on-disk store -/
+private def diskName (url : String) : String :=
+  let h := hash url
+  let hex := (Nat.toDigits 16 h.toNat).asString
+  "".pushn '0' (16 - hex.length) ++ hex ++ ".wc"
+
+namespace CacheState
+
+private def tick (s : CacheState) : Nat × CacheState :=
+  (s.clock, { s with clock := s.clock + 1 })
+
+private def removeVariant (s : CacheState) (url : String) (lastUsed : Nat) : CacheState :=
+  match s.entries.get? url with
+  | none => s
+  | some variants =>
+    let (gone, kept) := variants.partition (·.lastUsed == lastUsed)
+    let freed := gone.foldl (init := 0) fun acc e => acc + e.size
+    let entries := if kept.isEmpty then s.entries.erase url else s.entries.insert url kept
+    { s with entries, bytes := s.bytes - freed,
+             stats := { s.stats with evicted := s.stats.evicted + gone.size } }
+
+/-- Drop least recently used entries until memory use is a tenth under the limit -/
+private def evictMemory (s : CacheState) (limit : Nat) : CacheState := Id.run do
+  if s.bytes ≤ limit then return s
+  let byAge := s.entries.fold (init := #[]) fun acc url variants =>
+    variants.foldl (init := acc) fun acc e => acc.push (e.lastUsed, url)
+  let target := limit - limit / 10
+  let mut s := s
+  for (lastUsed, url) in byAge.qsort (·.1 < ·.1) do
+    if s.bytes ≤ target then break
+    s := s.removeVariant url lastUsed
+  return s
+
+/-- Pick files to delete until disk use is a tenth under the limit -/
+private def evictDisk (s : CacheState) (limit : Nat) : Array String × CacheState := Id.run do
+  if s.diskBytes ≤ limit then return (#[], s)
+  let byAge := s.disk.fold (init := #[]) fun acc name (_, lastUsed) => acc.push (lastUsed, name)
+  let target := limit - limit / 10
+  let mut s := s
+  let mut victims : Array String := #[]
+  for (_, name) in byAge.qsort (·.1 < ·.1) do
+    if s.diskBytes ≤ target then break
+    if let some (size, _) := s.disk.get? name then
+      s := { s with disk := s.disk.erase name, diskBytes := s.diskBytes - size }
+      victims := victims.push name
+  return (victims, s)
+
+/-- Store a variant, replacing the one it supersedes -/
+private def insert (s : CacheState) (e : CacheEntry) (limit : Nat) : CacheState :=
+  let (clock, s) := s.tick
+  let e := { e with lastUsed := clock }
+  let variants := (s.entries.get? e.url).getD #[]
+  let (old, kept) := variants.partition fun v => v.vary == e.vary
+  let freed := old.foldl (init := 0) fun acc v => acc + v.size
+  let s := { s with
+    entries := s.entries.insert e.url (kept.push e)
+    bytes := s.bytes - freed + e.size }
+  s.evictMemory limit
+
+/-- Find a variant matching the request and mark it used -/
+private def lookup (s : CacheState) (req : Request) : Option CacheEntry × CacheState :=
+  match (s.entries.get? req.url).bind (·.find? (·.matches req)) with
+  | none => (none, s)
+  | some e =>
+    let (clock, s) := s.tick
+    let e' := { e with lastUsed := clock }
+    let variants := ((s.entries.get? req.url).getD #[]).map fun v =>
+      if v.lastUsed == e.lastUsed then e' else v
+    (some e', { s with entries := s.entries.insert req.url variants })
+
+end CacheState
+
+namespace Cache
+
+/-- Create a cache. With a directory, responses stored there by earlier runs
+    are picked up, least recently written evicted first. -/
+def new (config : CacheConfig := {}) : IO Cache := do
+  let mut st : CacheState := {}
+  if let some dir := config.directory then
+    let dir := System.FilePath.mk dir
+    IO.FS.createDirAll dir
+    let mut files : Array (Int × String × Nat) := #[]
+    for entry in (← dir.readDir) do
+      if entry.fileName.endsWith ".wc" then
+        let info ← entry.path.metadata
+        files := files.push (info.modified.sec, entry.fileName, info.byteSize.toNat)
+    for (_, name, size) in files.qsort (·.1 < ·.1) do
+      let (clock, st') := st.tick
+      st := { st' with disk := st'.disk.insert name (size, clock), diskBytes := st'.diskBytes + size }
+  return {
+    config
+    state := ← Std.Mutex.new st
+    inflight := ← Std.Mutex.new {}
+  }
+
+/-- Snapshot of the cache counters -/
+def stats (cache : Cache) : IO CacheStats :=
+  cache.state.atomically do return (← get).stats
+
+private def count (cache : Cache) (f : CacheStats → CacheStats) : IO Unit :=
+  cache.state.atomically do modify fun s => { s with stats := f s.stats }
+
+private def diskPath (cache : Cache) (name : String) : Option System.FilePath :=
+  cache.config.directory.map (System.FilePath.mk · / name)
+
+/-- Write then rename, so a reader never sees a partial file. The temporary
+    name is unique per write, so concurrent stores of one URL don't collide. -/
+private def writeAtomically (cache : Cache) (path : System.FilePath) (data : ByteArray)
+    : IO Bool := do
+  let seq ← cache.state.atomically do
+    let (clock, s) := (← get).tick
+    set s
+    return clock
+  let tmp := path.withExtension s!"{seq}-{← IO.rand 0 999999}.tmp"
+  try
+    IO.FS.writeBinFile tmp data
+    IO.FS.rename tmp path
+    return true
+  catch _ =>
+    try IO.FS.removeFile tmp catch _ => pure ()
+    cache.count fun s => { s with diskErrors := s.diskErrors + 1 }
+    return false
+
+/-- Write an entry to the on-disk store and delete what no longer fits. Best
+    effort: a failed write is counted in `diskErrors` and otherwise ignored. -/
+private def persist (cache : Cache) (e : CacheEntry) : IO Unit := do
+  let name := diskName e.url
+  let some path := cache.diskPath name | return
+  let data := e.encode
+  if data.size > cache.config.maxDiskBytes then return
+  unless (← cache.writeAtomically path data) do return
+  let victims ← cache.state.atomically do
+    let s ← get
+    let (clock, s) := s.tick
+    let oldSize := ((s.disk.get? name).map (·.1)).getD 0
+    let s := { s with disk := s.disk.insert name (data.size, clock),
+                      diskBytes := s.diskBytes - oldSize + data.size }
+    let (victims, s) := s.evictDisk cache.config.maxDiskBytes
+    set s
+    return victims
+  for victim in victims do
+    if let some path := cache.diskPath victim then
+      try IO.FS.removeFile path catch _ => pure ()
+
+/-- Find a stored variant for the request, in memory or on disk -/
+private def find (cache : Cache) (req : Request) : IO (Option CacheEntry) := do
+  let (found, onDisk) ← cache.state.atomically do
+    let (found, s) := (← get).lookup req
+    set s
+    return (found, s.disk.contains (diskName req.url))
+  if found.isSome || !onDisk then return found
+  let some path := cache.diskPath (diskName req.url) | return none
+  let loaded ← try CacheEntry.decode (← IO.FS.readBinFile path) catch _ => pure none
+  let some e := loaded | return none
+  -- Different URLs can share a file name; only the latest variant is on disk
+  if e.url != req.url || !e.matches req then return none
+  cache.state.atomically do
+    let s ← get
+    let (clock, s) := s.tick
+    let s := { s with disk := s.disk.modify (diskName req.url) fun (size, _) => (size, clock) }
+    set (s.insert e cache.config.maxMemoryBytes)
+  return some e
+
+/-- Store a response to a request if RFC 9111 §3 allows it -/
+private def store (cache : Cache) (req : Request) (resp : Response)
+    (requestTime responseTime : Nat) : IO Unit := do
+  let headers := resp.headers
+  let directives := parseDirectives (headers.getAll "Cache-Control")
+  let names := varyNames headers
+  let storable :=
+    (resp.effectiveUrl.isEmpty || resp.effectiveUrl == req.url)
+      && CacheEntry.heuristicallyCacheable resp.status
+      && !hasDirective directives "no-store"
+      && !names.contains "*"
+      && ((directiveSeconds directives "max-age").isSome
+          || headers.contains "Expires" || headers.contains "Last-Modified"
+          || headers.contains "ETag")
+  unless storable do return
+  let vary := names.map fun name => (name, requestHeader req name)
+  let e ← CacheEntry.make req.url resp.status headers resp.body vary requestTime responseTime
+  if e.size > cache.config.maxEntryBytes then return
+  cache.state.atomically do
+    let s := (← get).insert e cache.config.maxMemoryBytes
+    set { s with stats := { s.stats with stored := s.stats.stored + 1 } }
+  cache.persist e
+
+/-- Drop every stored variant of a URL -/
+def invalidate (cache : Cache) (url : String) : IO Unit := do
+  let name := diskName url
+  let onDisk ← cache.state.atomically do
+    let s ← get
+    let freed := ((s.entries.get? url).getD #[]).foldl (init := 0) fun acc e => acc + e.size
+    let diskSize := ((s.disk.get? name).map (·.1)).getD 0
+    set { s with entries := s.entries.erase url, bytes := s.bytes - freed,
+                 disk := s.disk.erase name, diskBytes := s.diskBytes - diskSize }
+    return s.disk.contains name
+  if onDisk then
+    if let some path := cache.diskPath name then
+      try IO.FS.removeFile path catch _ => pure ()
+
+/-- Drop every stored response, in memory and on disk -/
+def clear (cache : Cache) : IO Unit := do
+  let names ← cache.state.atomically do
+    let s ← get
+    set { s with entries := {}, bytes := 0, disk := {}, diskBytes := 0 }
+    return s.disk.fold (init := #[]) fun acc name _ => acc.push name
+  for name in names do
+    if let some path := cache.diskPath name then
+      try IO.FS.removeFile path catch _ => pure ()
+
+/-- Turn the network result into the caller's response: a 304 to a
+    revalidation becomes the stored body with refreshed headers. -/
+private def complete (cache : Cache) (req : Request) (stored : Option CacheEntry)
+    (requestTime : Nat) (result : WispResult Response) : IO (WispResult Response) := do
+  let .ok resp := result | return result
+  let responseTime ← unixNow
+  match stored with
+  | some e =>
+    if resp.status == 304 then
+      let e ← e.refresh resp.headers requestTime responseTime
+      cache.state.atomically do
+        let s := (← get).insert e cache.config.maxMemoryBytes
+        set { s with stats := { s.stats with revalidated := s.stats.revalidated + 1 } }
+      cache.persist e
+      return .ok (e.toResponse responseTime resp.metrics)
+  | none => pure ()
+  cache.store req resp requestTime responseTime
+  return .ok resp
+
+/-- Whether a successful response to the method invalidates stored responses (RFC 9111 §4.4) -/
+private def isUnsafe (m : Method) : Bool :=
+  match m with
+  | .GET | .HEAD | .OPTIONS | .TRACE => false
+  | _ => true
+
+/-- Drop the stored responses for a request's URL once it succeeds, if its
+    method is unsafe. For transfers that do not go through `fetch`; `status`
+    reads the status of their result. -/
+def invalidateAfter {α : Type} (cache : Cache) (req : Request) (task : Task (WispResult α))
+    (status : α → UInt32) : IO (Task (WispResult α)) := do
+  unless isUnsafe req.method do return task
+  let mapped ← IO.mapTask (t := task) fun result => do
+    if let .ok resp := result then
+      if status resp < 400 then cache.invalidate req.url
+    return result
+  return mapped.map fun
+    | .ok result => result
+    | .error e => .error (.ioError (toString e))
+
+/-- Answer a request through the cache. Fresh stored responses are returned
+    without a transfer; stale ones are revalidated with `If-None-Match` /
+    `If-Modified-Since`; identical GETs in flight share one transfer. `send`
+    performs the transfer. -/
+def fetch (cache : Cache) (req : Request)
+    (send : Request → IO (Task (WispResult Response))) : IO (Task (WispResult Response)) := do
+  unless isCacheable req do
+    return (← cache.invalidateAfter req (← send req) (·.status))
+
+  let stored ← cache.find req
+  if let some e := stored then
+    let now ← unixNow
+    if e.isFresh cache.config req now then
+      cache.count fun s => { s with hits := s.hits + 1 }
+      return .pure (.ok (e.toResponse now))
+
+  -- Join an identical request already in flight, or become the one others join
+  let key := coalescingKey req
+  let promise ← IO.Promise.new
+  let joined ← cache.inflight.atomically do
+    let m ← get
+    match m.get? key with
+    | some task => return some task
+    | none =>
+      set (m.insert key promise.result!)
+      return none
+  if let some task := joined then
+    cache.count fun s => { s with coalesced := s.coalesced + 1 }
+    return task
+
+  cache.count fun s => { s with misses := s.misses + 1 }
+  let stored := stored.filter (·.hasValidators)
+  let sent := match stored with
+    | some e => e.conditional req
+    | none => req
+  let requestTime ← unixNow
+  let finish (result : WispResult Response) : IO Unit := do
+    let result ← try cache.complete req stored requestTime result catch _ => pure result
+    cache.inflight.atomically (modify (·.erase key))
+    promise.resolve result
+  try
+    let task ← send sent
+    let _ ← IO.mapTask (t := task) finish
+  catch e =>
+    finish (.error (.ioError (toString e)))
+  return promise.result!
+
+end Cache
+
+end Wisp.HTTP
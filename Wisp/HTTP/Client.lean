@@ -10,12 +10,27 @@ import Wisp.Core.Response
 import Wisp.Core.Streaming
 import Wisp.FFI.Easy
 import Wisp.FFI.Multi
+import Wisp.FFI.Template
+import Wisp.HTTP.Share
+import Wisp.HTTP.Cache
+import Wisp.HTTP.Metrics
 import Std.Data.HashMap
 import Std.Sync.Channel
 import Std.Sync.Mutex
 
 namespace Wisp.HTTP
 
+/-- Headers, auth and options of a request compiled into a native template
+    by `Client.prepare` -/
+structure RequestTemplate where
+  private mk ::
+  /-- Request the template was compiled from -/
+  base : Wisp.Request
+  private native : Wisp.FFI.Template
+
+instance : Repr RequestTemplate where
+  reprPrec t _ := Std.Format.text "Wisp.HTTP.RequestTemplate " ++ repr t.base.headers
+
 /-- HTTP Client configuration -/
 structure Client where
   /-- Default user agent string -/
@@ -30,12 +45,106 @@ structure Client where
   maxRedirects : UInt32 := 10
   /-- Verify SSL by default -/
   verifySsl : Bool := true
+  /-- DNS, TLS session and connection caches shared across requests -/
+  share : ShareOptions := {}
+  /-- Most requests in flight to one origin at a time (0 = no limit).
+      Further requests to it wait in the scheduler. -/
+  maxHostConnections : Nat := 0
+  /-- Most requests in flight at a time across all origins (0 = no limit),
+      counted over every worker -/
+  maxTotalConnections : Nat := 0
+  /-- HTTP version to request by default (none = libcurl's default: HTTP/2
+      over TLS when the server offers it, HTTP/1.1 otherwise) -/
+  httpVersion : Option Wisp.HttpVersion := none
+  /-- Let a request wait for a connection that may multiplex it (HTTP/2 or 3)
+      instead of opening a new one (CURLOPT_PIPEWAIT) -/
+  pipeWait : Bool := true
+  /-- Retry policy for requests that set none -/
+  retry : Option Wisp.RetryPolicy := none
+  /-- Response cache consulted by `execute` and `executeBatch` (none = no
+      caching). Other requests bypass it, but unsafe methods still
+      invalidate the URL. -/
+  cache : Option Cache := none
+  /-- Request body compression for requests that set none -/
+  compression : Option Wisp.BodyCompression := none
+  /-- Template every request is configured from, set by `prepare` -/
+  private template : Option RequestTemplate := none
   deriving Repr, Inhabited
 
+/-- Requests sharing one shape, configured from a template compiled once by
+    `Client.prepare`. Each call only sets the URL, method, body and its own
+    headers. -/
+structure PreparedRequest where
+  private mk ::
+  /-- Request the template was compiled from -/
+  base : Wisp.Request
+  /-- The client, with the template attached -/
+  private client : Client
+
 /-- Handle to cancel an in-flight request. -/
 structure CancelHandle where
   cancel : IO Unit
 
+/-- Configuration of the background workers that drive transfers -/
+structure WorkerConfig where
+  /-- Number of workers, each running its own curl multi handle on a dedicated thread -/
+  workers : Nat := 1
+  /-- Spread a busy origin to another worker once each of its workers has this
+      many requests in flight (0 keeps every origin on a single worker).
+      Requests from a client with `maxHostConnections` set always go to the
+      origin's first worker, which enforces that limit. -/
+  stealThreshold : Nat := 32
+  /-- Most HTTP/2 or HTTP/3 streams multiplexed on one connection -/
+  maxConcurrentStreams : Nat := 100
+  deriving Repr, Inhabited
+
+/-- Scheduler statistics for one origin -/
+structure OriginStats where
+  /-- Scheme, host and port -/
+  origin : String
+  /-- Requests waiting for a connection slot -/
+  queued : Nat
+  /-- Requests running on a multi handle -/
+  inflight : Nat
+  /-- Requests started so far -/
+  started : Nat
+  /-- Total time (ms) started requests spent queued -/
+  totalWaitMs : Nat
+  /-- Longest time (ms) a started request spent queued -/
+  maxWaitMs : Nat
+  deriving Repr, Inhabited
+
+/-- Average time (ms) a started request spent queued -/
+def OriginStats.meanWaitMs (s : OriginStats) : Float :=
+  if s.started == 0 then 0 else s.totalWaitMs.toFloat / s.started.toFloat
+
+/-- Outcome of `Client.download` -/
+structure Download where
+  /-- Final response. Its body is empty when it went to the file. -/
+  response : Wisp.Response
+  /-- Size of the file afterwards -/
+  size : Nat
+  /-- Whether the file holds the whole resource: the response was a success,
+      or a resume found nothing left to fetch (416 for the file's size) -/
+  complete : Bool
+  /-- Byte ranges the body was fetched in (1 = a single stream). For a
+      segmented download, `response` is the HEAD reply that probed the object. -/
+  segments : Nat := 1
+
+/-- How `Client.downloadSegmented` splits an object into byte ranges -/
+structure SegmentConfig where
+  /-- Size of each range -/
+  segmentBytes : Nat := 8 * 1024 * 1024
+  /-- Ranges fetched at once to start with -/
+  initialConcurrency : Nat := 4
+  /-- Most ranges fetched at once -/
+  maxConcurrency : Nat := 16
+  /-- Raise or lower the ranges in flight by the throughput they achieve -/
+  adaptive : Bool := true
+  /-- Objects smaller than this are fetched with a single stream -/
+  minObjectBytes : Nat := 32 * 1024 * 1024
+  deriving Repr, Inhabited
+
 namespace Client
 
 /-- Create a new HTTP client with default settings -/
@@ -67,29 +176,33 @@ def withFollowRedirects (c : Client) (follow : Bool) : Client :=
 def withSslVerify (c : Client) (verify : Bool) : Client :=
   { c with verifySsl := verify }
 
-/-- Find index of character in string -/
-private def findCharIdx (s : String) (c : Char) : Option Nat := do
-  let chars := s.toList
-  for i in [:chars.length] do
-    if chars[i]! == c then
-      return i
-  none
-
-/-- Parse raw header string into Headers array -/
-private def parseHeaders (raw : String) : Wisp.Headers := Id.run do
-  let lines := raw.splitOn "\r\n"
-  let mut headers : Wisp.Headers := #[]
-  for line in lines do
-    -- Skip empty lines and status lines
-    if line.isEmpty || line.startsWith "HTTP/" then
-      continue
-    -- Find the colon separator
-    if let some colonIdx := findCharIdx line ':' then
-      let key := (line.take colonIdx).trim
-      let value := (line.drop (colonIdx + 1)).trim
-      if !key.isEmpty then
-        headers := headers.push (key, value)
-  headers
+/-- Choose which caches are shared across requests -/
+def withShare (c : Client) (opts : ShareOptions) : Client :=
+  { c with share := opts }
+
+/-- Request a specific HTTP version by default -/
+def withHttpVersion (c : Client) (v : Wisp.HttpVersion) : Client :=
+  { c with httpVersion := some v }
+
+/-- Enable/disable waiting for a multiplexed connection -/
+def withPipeWait (c : Client) (wait : Bool) : Client :=
+  { c with pipeWait := wait }
+
+/-- Limit requests in flight per origin and in total (0 = no limit) -/
+def withConnectionLimits (c : Client) (perHost : Nat) (total : Nat := 0) : Client :=
+  { c with maxHostConnections := perHost, maxTotalConnections := total }
+
+/-- Retry transient failures of buffered requests -/
+def withRetry (c : Client) (p : Wisp.RetryPolicy := {}) : Client :=
+  { c with retry := some p }
+
+/-- Answer requests made with `execute` through a response cache -/
+def withCache (c : Client) (cache : Cache) : Client :=
+  { c with cache := some cache }
+
+/-- Compress request bodies of at least `minBytes` by default -/
+def withCompression (c : Client) (comp : Wisp.BodyCompression := {}) : Client :=
+  { c with compression := some comp }
 
 /-- URL-encode a form field value -/
 private def urlEncodeField (easy : Wisp.FFI.Easy) (s : String) : IO String := do
@@ -104,27 +217,337 @@ private def buildFormBody (easy : Wisp.FFI.Easy) (fields : Array (String × Stri
     parts := parts.push s!"{encodedKey}={encodedValue}"
   return "&".intercalate parts.toList
 
+-- ============================================================================
+-- Easy Handle Pool
+-- ============================================================================
+
+/-- Maximum number of idle easy handles kept for reuse -/
+private def easyPoolCapacity : Nat := 64
+
+/-- Number of handles created up front when the manager starts -/
+private def easyPoolPrewarm : Nat := 8
+
+initialize easyPool : Std.Mutex (Array Wisp.FFI.Easy) ← Std.Mutex.new #[]
+
+/-- Take an idle handle from the pool, or create one if the pool is empty. -/
+private def acquireEasy : IO Wisp.FFI.Easy := do
+  let pooled ← easyPool.atomically do
+    let pool ← get
+    match pool.back? with
+    | some easy =>
+      set pool.pop
+      return some easy
+    | none => return none
+  match pooled with
+  | some easy => return easy
+  | none => Wisp.FFI.easyInit
+
+/-- Reset a finished handle and return it to the pool.
+    Handles beyond `easyPoolCapacity` are dropped and freed by their finalizer. -/
+private def releaseEasy (easy : Wisp.FFI.Easy) : IO Unit := do
+  try
+    Wisp.FFI.easyReset easy
+    easyPool.atomically do
+      let pool ← get
+      if pool.size < easyPoolCapacity then
+        set (pool.push easy)
+  catch _ =>
+    pure ()
+
+/-- Fill the pool with fresh handles so the first requests skip allocation. -/
+private def prewarmEasyPool : IO Unit := do
+  let missing ← easyPool.atomically do
+    return easyPoolPrewarm - (← get).size
+  let mut fresh : Array Wisp.FFI.Easy := #[]
+  for _ in [0:missing] do
+    fresh := fresh.push (← Wisp.FFI.easyInit)
+  easyPool.atomically do
+    let pool ← get
+    set (pool ++ fresh.extract 0 (easyPoolCapacity - pool.size))
+
+-- ============================================================================
+-- Request Setup
+-- ============================================================================
+
+/-- Where request options are written: straight to an easy handle, or into
+    a template compiled by `prepare` -/
+private structure OptionSink where
+  long : UInt32 → Int64 → IO Unit
+  string : UInt32 → String → IO Unit
+  header : String → IO Unit
+
+/-- Write the options of `req` that do not depend on its URL, method or body:
+    its headers, auth, timeouts (falling back to the client defaults),
+    redirects, HTTP version, TLS, user agent and cookies. -/
+private def applyOptions (client : Client) (req : Wisp.Request) (sink : OptionSink) : IO Unit := do
+  -- Add user headers
+  for (key, value) in req.headers do
+    sink.header s!"{key}: {value}"
+
+  -- Set authentication
+  match req.auth with
+  | .none => pure ()
+  | .basic username password =>
+    sink.string Wisp.FFI.CurlOpt.USERPWD s!"{username}:{password}"
+    sink.long Wisp.FFI.CurlOpt.HTTPAUTH Wisp.FFI.CurlOpt.AUTH_BASIC
+  | .bearer token =>
+    sink.header s!"Authorization: Bearer {token}"
+  | .digest username password =>
+    sink.string Wisp.FFI.CurlOpt.USERPWD s!"{username}:{password}"
+    sink.long Wisp.FFI.CurlOpt.HTTPAUTH Wisp.FFI.CurlOpt.AUTH_DIGEST
+
+  -- Set timeouts
+  let timeout := if req.timeoutMs > 0 then req.timeoutMs else client.defaultTimeout
+  let connectTimeout := if req.connectTimeoutMs > 0 then req.connectTimeoutMs else client.defaultConnectTimeout
+  sink.long Wisp.FFI.CurlOpt.TIMEOUT_MS timeout.toInt64
+  sink.long Wisp.FFI.CurlOpt.CONNECTTIMEOUT_MS connectTimeout.toInt64
+
+  -- Set redirect behavior
+  sink.long Wisp.FFI.CurlOpt.FOLLOWLOCATION (if req.followRedirects then 1 else 0)
+  sink.long Wisp.FFI.CurlOpt.MAXREDIRS req.maxRedirects.toNat.toInt64
+
+  -- Set HTTP version
+  match req.httpVersion <|> client.httpVersion with
+  | none => pure ()
+  | some .HTTP3 =>
+    -- Fall back to HTTP/2 when libcurl was built without HTTP/3
+    try
+      sink.long Wisp.FFI.CurlOpt.HTTP_VERSION Wisp.HttpVersion.HTTP3.toCurl
+    catch _ =>
+      sink.long Wisp.FFI.CurlOpt.HTTP_VERSION Wisp.HttpVersion.HTTP2.toCurl
+  | some v =>
+    sink.long Wisp.FFI.CurlOpt.HTTP_VERSION v.toCurl
+  -- Share a multiplexed connection rather than opening another
+  if client.pipeWait then
+    sink.long Wisp.FFI.CurlOpt.PIPEWAIT 1
+
+  -- Set SSL options
+  sink.long Wisp.FFI.CurlOpt.SSL_VERIFYPEER (if req.ssl.verifyPeer then 1 else 0)
+  sink.long Wisp.FFI.CurlOpt.SSL_VERIFYHOST (if req.ssl.verifyHost then 2 else 0)
+  if let some caPath := req.ssl.caCertPath then
+    sink.string Wisp.FFI.CurlOpt.CAINFO caPath
+  if let some certPath := req.ssl.clientCertPath then
+    sink.string Wisp.FFI.CurlOpt.SSLCERT certPath
+  if let some keyPath := req.ssl.clientKeyPath then
+    sink.string Wisp.FFI.CurlOpt.SSLKEY keyPath
+
+  -- Set user agent
+  sink.string Wisp.FFI.CurlOpt.USERAGENT req.userAgent
+
+  -- Set accept encoding
+  if let some enc := req.acceptEncoding then
+    sink.string Wisp.FFI.CurlOpt.ACCEPT_ENCODING enc
+
+  -- Enable verbose if requested
+  if req.verbose then
+    sink.long Wisp.FFI.CurlOpt.VERBOSE 1
+
+  -- Set cookie jar options
+  if let some cookieFile := req.cookieJar.cookieFile then
+    sink.string Wisp.FFI.CurlOpt.COOKIEFILE cookieFile
+  if let some jarFile := req.cookieJar.cookieJarFile then
+    sink.string Wisp.FFI.CurlOpt.COOKIEJAR jarFile
+  if let some cookies := req.cookieJar.cookies then
+    sink.string Wisp.FFI.CurlOpt.COOKIE cookies
+
+/-- Set the method and body of `req` on `easy`, adding the header lines the
+    body needs to `slist`. Returns the channel feeding a streamed request
+    body, which the manager pumps into the handle while the transfer runs. -/
+private def configureBody (req : Wisp.Request) (easy : Wisp.FFI.Easy) (slist : Wisp.FFI.Slist)
+    (compression : Option Wisp.BodyCompression)
+    : IO (Option (Std.CloseableChannel.Sync ByteArray)) := do
+  -- Set method
+  let customMethod : Option String :=
+    match req.method with
+    | .PUT => some "PUT"
+    | .DELETE => some "DELETE"
+    | .PATCH => some "PATCH"
+    | .OPTIONS => some "OPTIONS"
+    | .TRACE => some "TRACE"
+    | .CONNECT => some "CONNECT"
+    | _ => none
+
+  match req.method with
+  | .GET => Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.HTTPGET 1
+  | .POST => Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.POST 1
+  | .HEAD => Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.NOBODY 1
+  | _ => pure ()
+
+  -- Compression applies to bodies of at least `minBytes`
+  let compressionFor (size : Nat) : Option Wisp.BodyCompression :=
+    compression.filter fun c => size ≥ c.minBytes
+  -- Bodies held as a String: compressed while sent, or handed to curl as is
+  let setStringBody (content : String) : IO Unit := do
+    match compressionFor content.utf8ByteSize with
+    | some c =>
+      let used ← Wisp.FFI.setBodyCompressedString easy content c.coding.toCode (c.level.getD 0).toUInt32
+      Wisp.FFI.slistAppend slist s!"Content-Encoding: {(Wisp.ContentCoding.ofCode used).headerValue}"
+      Wisp.FFI.slistAppend slist "Transfer-Encoding: chunked"
+    | none =>
+      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.POSTFIELDS content
+      Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.POSTFIELDSIZE content.utf8ByteSize.toInt64
+
+  -- Set body based on type
+  let mut upload : Option (Std.CloseableChannel.Sync ByteArray) := none
+  match req.body with
+  | .empty => pure ()
+  | .raw data contentType =>
+    Wisp.FFI.slistAppend slist s!"Content-Type: {contentType}"
+    match compressionFor data.size with
+    | some c =>
+      let used ← Wisp.FFI.setBodyCompressed easy data c.coding.toCode (c.level.getD 0).toUInt32
+      Wisp.FFI.slistAppend slist s!"Content-Encoding: {(Wisp.ContentCoding.ofCode used).headerValue}"
+      Wisp.FFI.slistAppend slist "Transfer-Encoding: chunked"
+    | none => Wisp.FFI.setBodyBytes easy data
+  | .text content =>
+    Wisp.FFI.slistAppend slist "Content-Type: text/plain; charset=utf-8"
+    setStringBody content
+  | .json content =>
+    Wisp.FFI.slistAppend slist "Content-Type: application/json; charset=utf-8"
+    setStringBody content
+  | .form fields =>
+    Wisp.FFI.slistAppend slist "Content-Type: application/x-www-form-urlencoded"
+    setStringBody (← buildFormBody easy fields)
+  | .multipart parts =>
+    let mime ← Wisp.FFI.mimeInit easy
+    for p in parts do
+      let mimepart ← Wisp.FFI.mimeAddpart mime
+      Wisp.FFI.mimepartName mimepart p.name
+      Wisp.FFI.mimepartData mimepart p.data
+      if let some filename := p.filename then
+        Wisp.FFI.mimepartFilename mimepart filename
+      if let some ct := p.contentType then
+        Wisp.FFI.mimepartType mimepart ct
+    Wisp.FFI.setoptMime easy mime
+  | .stream source contentType length =>
+    Wisp.FFI.slistAppend slist s!"Content-Type: {contentType}"
+    match source with
+    | .file path =>
+      -- The file size is sent as the Content-Length
+      let _ ← Wisp.FFI.setBodyFile easy path
+    | .channel chunks =>
+      Wisp.FFI.setBodyStream easy ((length.map (·.toInt64)).getD (-1))
+      if length.isNone then
+        Wisp.FFI.slistAppend slist "Transfer-Encoding: chunked"
+      upload := some chunks
+
+  -- Re-apply custom method after setting body/options that may override it
+  if let some method := customMethod then
+    Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.CUSTOMREQUEST method
+
+  return upload
+
+/-- Apply `req` (and the client defaults it falls back to) to a clean easy handle.
+    Returns the channel feeding a streamed request body. -/
+private def configureEasy (client : Client) (req : Wisp.Request) (easy : Wisp.FFI.Easy)
+    : IO (Option (Std.CloseableChannel.Sync ByteArray)) := do
+  -- Setup response callbacks
+  Wisp.FFI.setupWriteCallback easy
+  Wisp.FFI.setupHeaderCallback easy
+
+  -- Set URL
+  Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.URL req.url
+
+  let slist ← Wisp.FFI.slistNew
+  applyOptions client req {
+    long := Wisp.FFI.setoptLong easy
+    string := fun option value => Wisp.FFI.setoptString easy option value
+    header := Wisp.FFI.slistAppend slist
+  }
+  let upload ← configureBody req easy slist (req.compression <|> client.compression)
+
+  -- Apply headers
+  Wisp.FFI.setoptSlist easy Wisp.FFI.CurlOpt.HTTPHEADER slist
+  return upload
+
+/-- Acquire a pooled handle and configure it for `req`. Also returns the
+    channel feeding a streamed request body, if any. -/
+private def prepareEasy (client : Client) (req : Wisp.Request)
+    : IO (Wisp.FFI.Easy × Option (Std.CloseableChannel.Sync ByteArray)) := do
+  let easy ← acquireEasy
+  match client.template with
+  | some t =>
+    -- Only what differs from the template: headers added to its base
+    -- request, the method and the body
+    let slist ← Wisp.FFI.slistNew
+    for (key, value) in req.headers.extract t.base.headers.size do
+      Wisp.FFI.slistAppend slist s!"{key}: {value}"
+    let upload ← configureBody req easy slist (req.compression <|> client.compression)
+    Wisp.FFI.templateApply easy t.native req.url slist
+    return (easy, upload)
+  | none =>
+    applyShare easy client.share
+    let upload ← configureEasy client req easy
+    return (easy, upload)
+
 -- ============================================================================
 -- Async Manager (curl_multi)
 -- ============================================================================
 
+/-- How the scheduler treats a submitted request -/
+private structure Admission where
+  origin : String
+  priority : Wisp.Priority
+  /-- Limits of the submitting client (0 = no limit) -/
+  hostLimit : Nat
+  totalLimit : Nat
+  submittedMs : Nat
+
+/-- What a request with a retry policy needs for another attempt -/
+private structure RetryState where
+  policy : Wisp.RetryPolicy
+  admission : Admission
+  /-- Acquire a handle configured for the request -/
+  prepare : IO Wisp.FFI.Easy
+  /-- Attempt number, starting at 1 -/
+  attempt : Nat := 1
+  /-- Set on the duplicate sent by hedging -/
+  hedge : Bool := false
+
 private structure BufferedPending where
   easy : Wisp.FFI.Easy
   promise : IO.Promise (Wisp.WispResult Wisp.Response)
+  /-- Channel feeding a streamed request body -/
+  upload : Option (Std.CloseableChannel.Sync ByteArray) := none
+  retry : Option RetryState := none
+
+/-- Maximum number of body chunks queued for a streaming consumer -/
+private def streamChannelCapacity : Nat := 8
+
+/-- How often (ms) the manager retries while a body channel is full or empty -/
+private def streamRetryMs : UInt32 := 5
 
 private structure StreamingPending where
   easy : Wisp.FFI.Easy
   channel : Std.CloseableChannel.Sync ByteArray
   promise : IO.Promise (Wisp.WispResult Wisp.StreamingResponse)
   headersReported : IO.Ref Bool
+  /-- Chunk drained from the native buffer that the full channel has not accepted yet -/
+  stalled : IO.Ref (Option ByteArray)
+  /-- Set once curl has finished the transfer; buffered data may remain -/
+  finished : IO.Ref Bool
+  /-- Channel feeding a streamed request body -/
+  upload : Option (Std.CloseableChannel.Sync ByteArray) := none
 
 private inductive Pending where
   | buffered (p : BufferedPending)
   | streaming (p : StreamingPending)
 
+private def getEasyHandle : Pending → Wisp.FFI.Easy
+  | .buffered p => p.easy
+  | .streaming p => p.easy
+
+private def getUpload : Pending → Option (Std.CloseableChannel.Sync ByteArray)
+  | .buffered p => p.upload
+  | .streaming p => p.upload
+
 private inductive Command where
-  | add (id : UInt64) (pending : Pending)
+  | add (id : UInt64) (pending : Pending) (admission : Admission)
+  /-- Several requests submitted together by `executeBatch` -/
+  | addBatch (items : Array (UInt64 × Pending × Admission))
   | cancel (id : UInt64)
+  | stats (promise : IO.Promise (Array OriginStats))
+  | metrics (promise : IO.Promise ClientMetrics)
 
 private def curlErrorFromCode (code : UInt32) : Wisp.WispError :=
   match Wisp.CurlCode.fromNat code.toNat with
@@ -138,169 +561,875 @@ private def curlErrorFromCode (code : UInt32) : Wisp.WispError :=
 
 private def readResponse (easy : Wisp.FFI.Easy) : IO Wisp.Response := do
   let body ← Wisp.FFI.getResponseBody easy
-  let rawHeaders ← Wisp.FFI.getResponseHeaders easy
+  let (headers, keys) ← Wisp.FFI.getResponseHeaderFields easy
   let status ← Wisp.FFI.getinfoLong easy Wisp.FFI.CurlInfo.RESPONSE_CODE
-  let totalTime ← Wisp.FFI.getinfoDouble easy Wisp.FFI.CurlInfo.TOTAL_TIME
   let effectiveUrl ← Wisp.FFI.getinfoString easy Wisp.FFI.CurlInfo.EFFECTIVE_URL
+  let metrics := Wisp.TransferMetrics.fromInfo (← Wisp.FFI.getTransferInfo easy)
 
-  let headers := parseHeaders rawHeaders
-  let contentType := headers.get? "Content-Type"
+  let headerMap := Wisp.HeaderMap.ofLowered headers keys
+  let contentType := headerMap.get? "content-type"
 
   return {
     status := status.toUInt32
     headers := headers
+    headerMap := headerMap
     body := body
     contentType := contentType
-    totalTime := totalTime
+    totalTime := metrics.totalTime
+    effectiveUrl := effectiveUrl
+    metrics := metrics
+  }
+
+/-- Resolve a streaming request's promise with its status and headers (once). -/
+private def reportHeaders (sp : StreamingPending) : IO Unit := do
+  if (← sp.headersReported.get) then return
+  let (headers, keys) ← Wisp.FFI.getResponseHeaderFields sp.easy
+  let status ← Wisp.FFI.getinfoLong sp.easy Wisp.FFI.CurlInfo.RESPONSE_CODE
+  let effectiveUrl ← Wisp.FFI.getinfoString sp.easy Wisp.FFI.CurlInfo.EFFECTIVE_URL
+  let metrics := Wisp.TransferMetrics.fromInfo (← Wisp.FFI.getTransferInfo sp.easy)
+  let headerMap := Wisp.HeaderMap.ofLowered headers keys
+  let contentType := headerMap.get? "content-type"
+  let resp : Wisp.StreamingResponse := {
+    status := status.toUInt32
+    headers := headers
+    headerMap := headerMap
+    contentType := contentType
+    bodyChannel := sp.channel
     effectiveUrl := effectiveUrl
+    metrics := metrics
   }
+  sp.promise.resolve (.ok resp)
+  sp.headersReported.set true
+
+/-- Parse a `Retry-After` value, in delay-seconds or HTTP-date form, into
+    milliseconds from now -/
+def parseRetryAfter (value : String) : IO (Option Nat) := do
+  let value := value.trim
+  if let some seconds := value.toNat? then
+    return some (seconds * 1000)
+  let date ← Wisp.FFI.parseHttpDate value
+  if date < 0 then return none
+  let now ← Wisp.FFI.unixTime
+  return some ((date - now).toInt.toNat * 1000)
+
+/-- Timed work of the retry machinery -/
+private inductive TimerAction where
+  /-- Start the next attempt of a request -/
+  | retry (id : UInt64) (promise : IO.Promise (Wisp.WispResult Wisp.Response)) (rs : RetryState)
+  /-- Send a duplicate of a request that has not answered yet -/
+  | hedge (id : UInt64)
+
+/-- Set in the id of a hedged duplicate, which is otherwise its primary's -/
+private def hedgeBit : UInt64 := 1 <<< 63
+
+/-- Latencies remembered per origin for hedging at p95 -/
+private def latencySamples : Nat := 128
+
+/-- Latencies needed before the p95 is trusted -/
+private def minLatencySamples : Nat := 20
+
+/-- Per-worker state of retries and hedging. Timers are checked each time the
+    manager wakes, and its wait is cut short for the next one due, so no task
+    sleeps while a request backs off. -/
+private structure Retries where
+  /-- Actions and the monotonic time (ms) they are due -/
+  timers : Array (Nat × TimerAction) := #[]
+  /-- Primary and duplicate of hedged requests that are both running, both ways -/
+  linked : Std.HashMap UInt64 UInt64 := {}
+  /-- Hedged duplicates in the pending map -/
+  copies : Nat := 0
+  /-- Retry budget: earned minus spent, capped at 0. Spending may go as low as
+      minus the policy's reserve. -/
+  credits : Float := 0
+  /-- Recent latencies of successful first attempts, per origin -/
+  latency : Std.HashMap String (Array Nat) := {}
+  /-- Retries and hedges started, for the worker's metrics -/
+  retried : Nat := 0
+  hedged : Nat := 0
+
+/-- Retries waiting for their timer; they still count as in flight -/
+private def Retries.backingOff (rq : Retries) : Nat :=
+  rq.timers.foldl (init := 0) fun n (_, action) =>
+    match action with
+    | .retry .. => n + 1
+    | .hedge _ => n
+
+private def Retries.after (rq : Retries) (due : Nat) (action : TimerAction) : Retries :=
+  { rq with timers := rq.timers.push (due, action) }
+
+private def Retries.takeDue (rq : Retries) (now : Nat) : Array TimerAction × Retries :=
+  let (due, later) := rq.timers.partition (·.1 ≤ now)
+  (due.map (·.2), { rq with timers := later })
+
+/-- Milliseconds until the next timer is due -/
+private def Retries.nextDueIn (rq : Retries) (now : Nat) : Option Nat :=
+  rq.timers.foldl (init := none) fun acc (due, _) =>
+    some (min (acc.getD (due - now)) (due - now))
+
+/-- Withdraw a retry that is backing off -/
+private def Retries.takeRetry (rq : Retries) (id : UInt64)
+    : Option (IO.Promise (Wisp.WispResult Wisp.Response)) × Retries :=
+  let isRetry (entry : Nat × TimerAction) : Bool :=
+    match entry.2 with
+    | .retry i _ _ => i == id
+    | .hedge _ => false
+  match rq.timers.find? isRetry with
+  | some (_, .retry _ promise _) => (some promise, { rq with timers := rq.timers.filter (!isRetry ·) })
+  | _ => (none, rq)
+
+private def Retries.spend (rq : Retries) (p : Wisp.RetryPolicy) : Option Retries :=
+  if rq.credits - 1 + p.budgetReserve.toFloat ≥ 0 then
+    some { rq with credits := rq.credits - 1 }
+  else none
+
+private def Retries.link (rq : Retries) (a b : UInt64) : Retries :=
+  { rq with linked := (rq.linked.insert a b).insert b a }
+
+private def Retries.unlink (rq : Retries) (a b : UInt64) : Retries :=
+  { rq with linked := (rq.linked.erase a).erase b }
+
+/-- Account for an id that left the pending map -/
+private def Retries.forget (rq : Retries) (id : UInt64) : Retries :=
+  let rq := match rq.linked.get? id with
+    | some other => rq.unlink id other
+    | none => rq
+  if id &&& hedgeBit != 0 then { rq with copies := rq.copies - 1 } else rq
+
+private def Retries.record (rq : Retries) (origin : String) (ms : Nat) : Retries :=
+  let samples := (rq.latency.get? origin).getD #[]
+  let samples := if samples.size ≥ latencySamples then samples.extract 1 samples.size else samples
+  { rq with latency := rq.latency.insert origin (samples.push ms) }
+
+private def Retries.p95 (rq : Retries) (origin : String) : Option Nat := do
+  let samples ← rq.latency.get? origin
+  if samples.size < minLatencySamples then none
+  else
+    let sorted := samples.qsort (· < ·)
+    sorted[sorted.size * 95 / 100]?
+
+/-- Earn budget for a new request and arm its hedge timer -/
+private def Retries.admit (rq : Retries) (id : UInt64) (p : Pending) : Retries :=
+  match p with
+  | .buffered bp =>
+    match bp.retry with
+    | some rs =>
+      let rq := { rq with credits := min 0 (rq.credits + rs.policy.budgetRatio) }
+      let delay :=
+        if rs.policy.hedgeAtP95 then
+          (rq.p95 rs.admission.origin).orElse fun _ => rs.policy.hedgeAfterMs
+        else rs.policy.hedgeAfterMs
+      match delay with
+      | some ms => if rs.attempt == 1 then rq.after (rs.admission.submittedMs + ms) (.hedge id) else rq
+      | none => rq
+    | none => rq
+  | .streaming _ => rq
+
+/-- Requests in flight for load accounting: a hedged pair counts once -/
+private def liveCount (pending : Std.HashMap UInt64 Pending) (waiting : Nat) (rq : Retries) : Nat :=
+  pending.size - rq.copies + waiting + rq.backingOff
+
+/-- Result of a finished buffered transfer -/
+private def attemptResult (easy : Wisp.FFI.Easy) (code : UInt32) : IO (Wisp.WispResult Wisp.Response) := do
+  try
+    if code == 0 then
+      return .ok (← readResponse easy)
+    else
+      return .error (curlErrorFromCode code)
+  catch e =>
+    return .error (.ioError (toString e))
 
+/-- Count a finished transfer in the worker's metrics. Buffered transfers
+    pass their response, which already holds the transfer info. -/
+private def recordCompletion (metrics : IO.Ref ClientMetrics) (origin : String)
+    (easy : Wisp.FFI.Easy) (code : UInt32) (resp? : Option Wisp.Response) : IO Unit := do
+  try
+    let (t, outcome) : Wisp.TransferMetrics × Except Wisp.RetryErrorClass UInt32 ←
+      match resp? with
+      | some resp => pure (resp.metrics, .ok resp.status)
+      | none => do
+        let t := Wisp.TransferMetrics.fromInfo (← Wisp.FFI.getTransferInfo easy)
+        if code == 0 then
+          let status ← Wisp.FFI.getinfoLong easy Wisp.FFI.CurlInfo.RESPONSE_CODE
+          pure (t, .ok status.toUInt32)
+        else
+          pure (t, .error (Wisp.RetryErrorClass.ofCurlCode (Wisp.CurlCode.fromNat code.toNat)))
+    metrics.modify (·.recordTransfer origin t outcome)
+  catch _ =>
+    pure ()
+
+/-- Delay before another attempt, or none if the result stands -/
+private def retryDelay (rs : RetryState) (code : UInt32) (result : Wisp.WispResult Wisp.Response)
+    : IO (Option Nat) := do
+  let p := rs.policy
+  if rs.attempt ≥ p.maxAttempts then return none
+  let backoff ← p.jittered (p.backoffMs rs.attempt)
+  match result with
+  | .error _ =>
+    if code == 0 then return none
+    let cls := Wisp.RetryErrorClass.ofCurlCode (Wisp.CurlCode.fromNat code.toNat)
+    return if p.errors.contains cls then some backoff else none
+  | .ok resp =>
+    unless p.statuses.contains resp.status do return none
+    if p.respectRetryAfter then
+      if let some value := resp.header "Retry-After" then
+        match ← parseRetryAfter value with
+        | some ms => return if ms > p.maxRetryAfterMs then none else some (max ms backoff)
+        | none => pure ()
+    return some backoff
+
+/-- Remove a request from curl and the pending map without resolving it -/
+private def dropAttempt (multi : Wisp.FFI.Multi) (pending : Std.HashMap UInt64 Pending)
+    (rq : Retries) (id : UInt64) : IO (Std.HashMap UInt64 Pending × Retries) := do
+  let some p := pending.get? id | return (pending, rq)
+  try Wisp.FFI.multiRemoveHandle multi (getEasyHandle p) catch _ => pure ()
+  releaseEasy (getEasyHandle p)
+  return (pending.erase id, rq.forget id)
+
+/-- Settle a finished attempt of a buffered request: resolve its promise,
+    leave the answer to a hedged copy still running, or back off and retry -/
+private def finishAttempt (multi : Wisp.FFI.Multi) (pending : Std.HashMap UInt64 Pending)
+    (rq : Retries) (id : UInt64) (bp : BufferedPending) (code : UInt32)
+    (result : Wisp.WispResult Wisp.Response) : IO (Std.HashMap UInt64 Pending × Retries) := do
+  let some rs := bp.retry
+    | bp.promise.resolve result
+      return (pending, rq)
+  let delay ← retryDelay rs code result
+  let now ← IO.monoMsNow
+  if let some other := rq.linked.get? id then
+    let rq := rq.unlink id other
+    -- The other copy may still succeed
+    if delay.isSome then return (pending, rq)
+    let (pending, rq) ← dropAttempt multi pending rq other
+    bp.promise.resolve result
+    return (pending, rq)
+  let mut rq := rq
+  if rs.attempt == 1 && !rs.hedge then
+    if let .ok _ := result then
+      rq := rq.record rs.admission.origin (now - rs.admission.submittedMs)
+  match delay with
+  | some ms =>
+    match rq.spend rs.policy with
+    | some rq =>
+      let next := { rs with attempt := rs.attempt + 1, hedge := false }
+      let rq := { rq with retried := rq.retried + 1 }
+      return (pending, rq.after (now + ms) (.retry (id &&& ~~~hedgeBit) bp.promise next))
+    | none =>
+      bp.promise.resolve result
+      return (pending, rq)
+  | none =>
+    bp.promise.resolve result
+    return (pending, rq)
+
+/-- Resolve finished transfers, retrying those their policy allows. Returns the
+    remaining pending map and the ids of finished streams, which still need
+    their buffered data delivered. -/
 private def handleCompletion
     (multi : Wisp.FFI.Multi)
-    (pending : Std.HashMap UInt64 Pending) : IO (Std.HashMap UInt64 Pending) := do
+    (pending : Std.HashMap UInt64 Pending)
+    (rq : Retries)
+    (metrics : IO.Ref ClientMetrics)
+    (admitted : Std.HashMap UInt64 String) : IO (Std.HashMap UInt64 Pending × Retries × Array UInt64) := do
   let mut pending := pending
+  let mut rq := rq
+  let mut finishedStreams : Array UInt64 := #[]
   let mut msg ← Wisp.FFI.multiInfoRead multi
   while msg.isSome do
     match msg with
     | some (id, code) =>
       if let some p := pending.get? id then
+        let origin := (admitted.get? (id &&& ~~~hedgeBit)).getD "unknown"
         match p with
         | .buffered bp =>
-          try
-            if code == 0 then
-              let resp ← readResponse bp.easy
-              bp.promise.resolve (.ok resp)
-            else
-              bp.promise.resolve (.error (curlErrorFromCode code))
-          catch e =>
-            bp.promise.resolve (.error (.ioError (toString e)))
+          let result ← attemptResult bp.easy code
+          recordCompletion metrics origin bp.easy code
+            (match result with | .ok resp => some resp | .error _ => none)
           Wisp.FFI.multiRemoveHandle multi bp.easy
+          releaseEasy bp.easy
+          pending := pending.erase id
+          if id &&& hedgeBit != 0 then
+            rq := { rq with copies := rq.copies - 1 }
+          (pending, rq) ← finishAttempt multi pending rq id bp code result
         | .streaming sp =>
+          recordCompletion metrics origin sp.easy code none
+          Wisp.FFI.multiRemoveHandle multi sp.easy
           try
-            -- Drain any remaining data
-            let chunk ← Wisp.FFI.drainBodyChunk sp.easy
-            if chunk.size > 0 then
-              let _ ← sp.channel.send chunk
-            -- Close the channel to signal EOF
-            let _ ← Std.CloseableChannel.Sync.close sp.channel
-            -- Promise should already be resolved when headers arrived
+            if code == 0 then
+              reportHeaders sp
+            else
+              sp.promise.resolve (.error (curlErrorFromCode code))
           catch e =>
             sp.promise.resolve (.error (.ioError (toString e)))
-          Wisp.FFI.multiRemoveHandle multi sp.easy
-        pending := pending.erase id
+          -- Stays pending until serviceTransfers has delivered the
+          -- remaining data, closed the channel and recycled the handle
+          sp.finished.set true
+          finishedStreams := finishedStreams.push id
     | none => pure ()
     msg ← Wisp.FFI.multiInfoRead multi
-  return pending
+  return (pending, rq, finishedStreams)
 
-private def getEasyHandle : Pending → Wisp.FFI.Easy
-  | .buffered p => p.easy
-  | .streaming p => p.easy
+/-- Fail a request that never reached curl -/
+private def resolveFailed (p : Pending) (err : Wisp.WispError) : IO Unit := do
+  try
+    match p with
+    | .buffered bp => bp.promise.resolve (.error err)
+    | .streaming sp =>
+      let _ ← Std.CloseableChannel.Sync.close sp.channel
+      sp.promise.resolve (.error err)
+  catch _ =>
+    pure ()
+
+/-- Origins remembered before the route and scheduler tables are pruned -/
+private def maxRoutes : Nat := 4096
+
+/-- Index of a priority class in `OriginQueue.queues` -/
+private def priorityRank : Wisp.Priority → Nat
+  | .high => 0
+  | .normal => 1
+  | .low => 2
+
+/-- Virtual time an origin is charged for starting a request of this class.
+    Lower cost means a larger share: high gets 4x and normal 2x the share of low. -/
+private def priorityCost : Wisp.Priority → Nat
+  | .high => 3
+  | .normal => 6
+  | .low => 12
+
+private structure OriginQueue where
+  /-- Waiting request ids, one queue per priority class. Canceled ids are
+      skipped when they reach the front. -/
+  queues : Array (Std.Queue UInt64) := #[.empty, .empty, .empty]
+  queued : Nat := 0
+  inflight : Nat := 0
+  hostLimit : Nat := 0
+  totalLimit : Nat := 0
+  /-- Virtual finish time of the origin's last started request -/
+  finish : Nat := 0
+  started : Nat := 0
+  totalWaitMs : Nat := 0
+  maxWaitMs : Nat := 0
+
+/-- Per-worker admission control. Requests are held here until their origin
+    is under the submitting client's host limit and all workers together are
+    under its total limit; origins then take turns by start-time fair
+    queuing, weighted by priority class. -/
+private structure Scheduler where
+  origins : Std.HashMap String OriginQueue := {}
+  /-- Requests not yet added to the multi handle -/
+  waiting : Std.HashMap UInt64 (Pending × Admission) := {}
+  /-- Origin of each request on the multi handle -/
+  admitted : Std.HashMap UInt64 String := {}
+  /-- Virtual time: start tag of the last started request -/
+  clock : Nat := 0
+  /-- Requests are held only by the total limit. Other workers lift it
+      without waking this one, so the worker polls while it is set. -/
+  throttled : Bool := false
+
+/-- Queue a submitted request -/
+private def Scheduler.enqueue (s : Scheduler) (id : UInt64) (p : Pending) (adm : Admission)
+    : Scheduler :=
+  let o := (s.origins.get? adm.origin).getD {}
+  let rank := priorityRank adm.priority
+  let o := { o with
+    queues := o.queues.modify rank (·.enqueue id)
+    queued := o.queued + 1
+    hostLimit := adm.hostLimit
+    totalLimit := adm.totalLimit }
+  { s with origins := s.origins.insert adm.origin o, waiting := s.waiting.insert id (p, adm) }
+
+/-- Drop a queued request that was canceled. Returns it if it was queued. -/
+private def Scheduler.withdraw (s : Scheduler) (id : UInt64) : Option Pending × Scheduler :=
+  match s.waiting.get? id with
+  | none => (none, s)
+  | some (p, adm) =>
+    let origins := match s.origins.get? adm.origin with
+      | some o => s.origins.insert adm.origin { o with queued := o.queued - 1 }
+      | none => s.origins
+    (some p, { s with origins, waiting := s.waiting.erase id })
+
+/-- Whether an origin may start its next request while `running` requests
+    are on the multi handles of all workers -/
+private def OriginQueue.eligible (o : OriginQueue) (running : Nat) : Bool :=
+  o.queued > 0 &&
+    (o.hostLimit == 0 || o.inflight < o.hostLimit) &&
+    (o.totalLimit == 0 || running < o.totalLimit)
+
+/-- Take the next live request of an origin, highest class first -/
+private def OriginQueue.next? (o : OriginQueue) (waiting : Std.HashMap UInt64 (Pending × Admission))
+    : Option (UInt64 × OriginQueue) := Id.run do
+  let mut queues := o.queues
+  for rank in [0:queues.size] do
+    let mut q := queues[rank]?.getD .empty
+    repeat
+      match q.dequeue? with
+      | none => break
+      | some (id, rest) =>
+        q := rest
+        if waiting.contains id then
+          return some (id, { o with queues := queues.set! rank q })
+    queues := queues.set! rank q
+  return none
+
+/-- Start queued requests while limits allow, fairest origin first.
+    `running` counts the requests on the multi handles of all workers. -/
+private partial def schedule
+    (multi : Wisp.FFI.Multi)
+    (pending : Std.HashMap UInt64 Pending)
+    (s : Scheduler)
+    (running : IO.Ref Nat) : IO (Std.HashMap UInt64 Pending × Scheduler) := do
+  if s.waiting.isEmpty then return (pending, { s with throttled := false })
+  -- The eligible origin with the earliest start tag goes next
+  let total ← running.get
+  let pick := s.origins.fold (init := none) fun (best : Option (String × OriginQueue)) origin o =>
+    if !o.eligible total then best
+    else match best with
+      | some (_, b) => if max s.clock o.finish < max s.clock b.finish then some (origin, o) else best
+      | none => some (origin, o)
+  -- Origins that would be eligible with nothing running wait on the total limit
+  let throttled := pick.isNone && s.origins.fold (init := false) fun acc _ o => acc || o.eligible 0
+  let some (origin, o) := pick | return (pending, { s with throttled })
+  let some (id, o) := o.next? s.waiting | return (pending, s)
+  let some (p, adm) := s.waiting.get? id | return (pending, s)
+  -- Another worker may have taken the last slot since `total` was read
+  let claimed ← running.modifyGet fun n =>
+    if o.totalLimit == 0 || n < o.totalLimit then (true, n + 1) else (false, n)
+  unless claimed do return (pending, { s with throttled := true })
+  let waitMs := (← IO.monoMsNow) - adm.submittedMs
+  let start := max s.clock o.finish
+  let o := { o with
+    queued := o.queued - 1
+    inflight := o.inflight + 1
+    finish := start + priorityCost adm.priority
+    started := o.started + 1
+    totalWaitMs := o.totalWaitMs + waitMs
+    maxWaitMs := max o.maxWaitMs waitMs }
+  let s := { s with
+    origins := s.origins.insert origin o
+    waiting := s.waiting.erase id
+    admitted := s.admitted.insert id origin
+    clock := start }
+  try
+    Wisp.FFI.multiAddHandle multi (getEasyHandle p)
+    schedule multi (pending.insert id p) s running
+  catch e =>
+    resolveFailed p (.ioError (toString e))
+    releaseEasy (getEasyHandle p)
+    schedule multi pending s running
+
+/-- Account for requests that left the multi handle since the last call, and
+    take them off `running`. `copies` pending requests are hedged duplicates,
+    never admitted. -/
+private def Scheduler.release (s : Scheduler) (pending : Std.HashMap UInt64 Pending) (copies : Nat)
+    (running : IO.Ref Nat) : IO Scheduler := do
+  if s.admitted.size + copies == pending.size then return s
+  let mut admitted := s.admitted
+  let mut origins := s.origins
+  for (id, origin) in s.admitted do
+    unless pending.contains id do
+      admitted := admitted.erase id
+      if let some o := origins.get? origin then
+        origins := origins.insert origin { o with inflight := o.inflight - 1 }
+  running.modify (· - (s.admitted.size - admitted.size))
+  -- Forget idle origins once there are many of them
+  if origins.size > maxRoutes then
+    origins := origins.filter fun _ o => o.queued > 0 || o.inflight > 0
+  return { s with admitted, origins }
+
+/-- Snapshot of the scheduler's per-origin statistics -/
+private def Scheduler.stats (s : Scheduler) : Array OriginStats :=
+  s.origins.fold (init := #[]) fun acc origin o =>
+    acc.push { origin, queued := o.queued, inflight := o.inflight, started := o.started,
+               totalWaitMs := o.totalWaitMs, maxWaitMs := o.maxWaitMs }
+
+/-- Cancel a request that reached curl, if it is still pending -/
+private def cancelPending
+    (multi : Wisp.FFI.Multi)
+    (pending : Std.HashMap UInt64 Pending)
+    (rq : Retries)
+    (id : UInt64) : IO (Std.HashMap UInt64 Pending × Retries) := do
+  match pending.get? id with
+  | none => return (pending, rq)
+  | some p =>
+      match p with
+      | .buffered bp =>
+          try
+            bp.promise.resolve (.error (.ioError "canceled"))
+          catch _ =>
+            pure ()
+          Wisp.FFI.multiRemoveHandle multi bp.easy
+          releaseEasy bp.easy
+      | .streaming sp =>
+          try
+            let _ ← Std.CloseableChannel.Sync.close sp.channel
+            sp.promise.resolve (.error (.ioError "canceled"))
+          catch _ =>
+            pure ()
+          unless (← sp.finished.get) do
+            Wisp.FFI.multiRemoveHandle multi sp.easy
+          releaseEasy sp.easy
+      return (pending.erase id, rq.forget id)
 
 private def handleCommand
     (multi : Wisp.FFI.Multi)
     (pending : Std.HashMap UInt64 Pending)
-    (cmd : Command) : IO (Std.HashMap UInt64 Pending) := do
+    (sched : Scheduler)
+    (rq : Retries)
+    (metrics : IO.Ref ClientMetrics)
+    (cmd : Command) : IO (Std.HashMap UInt64 Pending × Scheduler × Retries) := do
   match cmd with
-  | .add id p =>
-    Wisp.FFI.multiAddHandle multi (getEasyHandle p)
-    return pending.insert id p
+  | .add id p adm =>
+    metrics.modify fun m => { m with started := m.started + 1 }
+    return (pending, sched.enqueue id p adm, rq.admit id p)
+  | .addBatch items =>
+    metrics.modify fun m => { m with started := m.started + items.size }
+    return (pending,
+      items.foldl (init := sched) fun s (id, p, adm) => s.enqueue id p adm,
+      items.foldl (init := rq) fun rq (id, p, _) => rq.admit id p)
+  | .stats promise =>
+    promise.resolve sched.stats
+    return (pending, sched, rq)
+  | .metrics promise =>
+    let m ← metrics.get
+    promise.resolve { m with
+      retries := rq.retried
+      hedges := rq.hedged
+      inflight := pending.size - rq.copies
+      queued := sched.waiting.size }
+    return (pending, sched, rq)
   | .cancel id =>
-    match pending.get? id with
-    | none => return pending
-    | some p =>
-        match p with
-        | .buffered bp =>
-            try
-              bp.promise.resolve (.error (.ioError "canceled"))
-            catch _ =>
-              pure ()
-            Wisp.FFI.multiRemoveHandle multi bp.easy
-        | .streaming sp =>
-            try
-              let _ ← Std.CloseableChannel.Sync.close sp.channel
-              sp.promise.resolve (.error (.ioError "canceled"))
-            catch _ =>
-              pure ()
-            Wisp.FFI.multiRemoveHandle multi sp.easy
-        return pending.erase id
-
+    if let (some p, sched) := sched.withdraw id then
+      resolveFailed p (.ioError "canceled")
+      releaseEasy (getEasyHandle p)
+      return (pending, sched, rq)
+    if let (some promise, rq) := rq.takeRetry id then
+      try promise.resolve (.error (.ioError "canceled")) catch _ => pure ()
+      return (pending, sched, rq)
+    -- A hedged request may be running as its primary, its copy, or both
+    let (pending, rq) ← cancelPending multi pending rq id
+    let (pending, rq) ← cancelPending multi pending rq (id ||| hedgeBit)
+    return (pending, sched, rq)
+
+/-- Requests a command hands to the worker -/
+private def Command.requestCount : Command → Nat
+  | .add .. => 1
+  | .addBatch items => items.size
+  | _ => 0
+
+/-- Handle all queued commands. Also returns how many requests were added. -/
 private def drainCommands
     (multi : Wisp.FFI.Multi)
     (pending : Std.HashMap UInt64 Pending)
-    (chan : Std.CloseableChannel.Sync Command) : IO (Std.HashMap UInt64 Pending) := do
+    (sched : Scheduler)
+    (rq : Retries)
+    (metrics : IO.Ref ClientMetrics)
+    (chan : Std.CloseableChannel.Sync Command)
+    : IO (Std.HashMap UInt64 Pending × Scheduler × Retries × Nat) := do
   let mut pending := pending
+  let mut sched := sched
+  let mut rq := rq
+  let mut added := 0
   let mut cmd? ← chan.tryRecv
   while cmd?.isSome do
     match cmd? with
     | some cmd =>
-      pending ← handleCommand multi pending cmd
+      added := added + cmd.requestCount
+      (pending, sched, rq) ← handleCommand multi pending sched rq metrics cmd
     | none => pure ()
     cmd? ← chan.tryRecv
-  return pending
-
-/-- Drain streaming data from all streaming requests and send to channels -/
-private def drainStreamingData (pending : Std.HashMap UInt64 Pending) : IO Unit := do
-  for (_, p) in pending.toList do
-    match p with
-    | .streaming sp =>
-      -- Check if headers are complete and we haven't reported them yet
-      let headersComplete ← Wisp.FFI.headersComplete sp.easy
-      let reported ← sp.headersReported.get
-      if headersComplete && !reported then
-        -- Read headers and resolve promise with StreamingResponse
-        let rawHeaders ← Wisp.FFI.getResponseHeaders sp.easy
-        let status ← Wisp.FFI.getinfoLong sp.easy Wisp.FFI.CurlInfo.RESPONSE_CODE
-        let effectiveUrl ← Wisp.FFI.getinfoString sp.easy Wisp.FFI.CurlInfo.EFFECTIVE_URL
-        let headers := parseHeaders rawHeaders
-        let contentType := headers.get? "Content-Type"
-        let resp : Wisp.StreamingResponse := {
-          status := status.toUInt32
-          headers := headers
-          contentType := contentType
-          bodyChannel := sp.channel
-          effectiveUrl := effectiveUrl
-        }
-        sp.promise.resolve (.ok resp)
-        sp.headersReported.set true
-
-      -- Drain any new body data
-      let chunk ← Wisp.FFI.drainBodyChunk sp.easy
-      if chunk.size > 0 then
-        let _ ← sp.channel.send chunk
-    | .buffered _ => pure ()
-
-private partial def managerLoop (chan : Std.CloseableChannel.Sync Command) : IO Unit := do
-  let multi ← Wisp.FFI.multiInit
+  return (pending, sched, rq, added)
 
-  let rec loop (pending : Std.HashMap UInt64 Pending) : IO Unit := do
-    if pending.isEmpty then
+/-- Run timers that are due: queue retries with the scheduler, and send a
+    duplicate of each hedged request that is still running alone -/
+private def fireTimers
+    (multi : Wisp.FFI.Multi)
+    (pending : Std.HashMap UInt64 Pending)
+    (sched : Scheduler)
+    (rq : Retries) : IO (Std.HashMap UInt64 Pending × Scheduler × Retries) := do
+  if rq.timers.isEmpty then return (pending, sched, rq)
+  let now ← IO.monoMsNow
+  let (due, rq) := rq.takeDue now
+  let mut pending := pending
+  let mut sched := sched
+  let mut rq := rq
+  for action in due do
+    match action with
+    | .retry id promise rs =>
+      try
+        let easy ← rs.prepare
+        Wisp.FFI.setoptPrivate easy id
+        sched := sched.enqueue id (.buffered { easy, promise, retry := some rs })
+          { rs.admission with submittedMs := now }
+      catch e =>
+        promise.resolve (.error (.ioError (toString e)))
+    | .hedge id =>
+      let some (.buffered bp) := pending.get? id | continue
+      let some rs := bp.retry | continue
+      if rq.linked.contains id then continue
+      let some spent := rq.spend rs.policy | continue
+      let copy := id ||| hedgeBit
+      try
+        let easy ← rs.prepare
+        Wisp.FFI.setoptPrivate easy copy
+        Wisp.FFI.multiAddHandle multi easy
+        pending := pending.insert copy (.buffered { easy, promise := bp.promise, retry := some { rs with hedge := true } })
+        rq := { spent.link id copy with copies := spent.copies + 1, hedged := spent.hedged + 1 }
+      catch _ =>
+        pure ()
+  return (pending, sched, rq)
+
+/-- Hand buffered body data to a stream's channel without blocking the manager.
+    Returns false while the consumer is behind and a chunk is still waiting;
+    the native buffer then fills up and pauses the transfer. -/
+private def flushStream (sp : StreamingPending) : IO Bool := do
+  if let some chunk := (← sp.stalled.get) then
+    if !(← Std.CloseableChannel.Sync.trySend sp.channel chunk) then
+      return false
+    sp.stalled.set none
+  let chunk ← Wisp.FFI.drainBodyChunk sp.easy
+  if chunk.size > 0 then
+    if !(← Std.CloseableChannel.Sync.trySend sp.channel chunk) then
+      sp.stalled.set (some chunk)
+      return false
+  return true
+
+/-- Move the next chunk of a channel-fed request body to curl. Returns false
+    while the producer has nothing ready yet. -/
+private def feedUpload (easy : Wisp.FFI.Easy) (chunks : Std.CloseableChannel.Sync ByteArray)
+    : IO Bool := do
+  unless (← Wisp.FFI.uploadWantsData easy) do
+    return true
+  if let some chunk := (← chunks.tryRecv) then
+    Wisp.FFI.uploadPush easy chunk
+    return true
+  unless (← Std.CloseableChannel.Sync.isClosed chunks) do
+    return false
+  -- Closed: pick up anything sent right before the close, then end the body
+  match (← chunks.tryRecv) with
+  | some chunk => Wisp.FFI.uploadPush easy chunk
+  | none => Wisp.FFI.uploadFinish easy
+  return true
+
+/-- Service the given requests only: those the native callbacks marked ready,
+    streams that just finished, and those still waiting on their producer or
+    consumer. Feeds streamed request bodies and delivers streamed responses;
+    finished streams are closed and recycled once fully delivered. Returns the
+    ids that are still waiting. -/
+private def serviceTransfers
+    (pending : Std.HashMap UInt64 Pending)
+    (ids : Array UInt64) : IO (Std.HashMap UInt64 Pending × Array UInt64) := do
+  let mut pending := pending
+  let mut waiting : Array UInt64 := #[]
+  for id in ids do
+    let some p := pending.get? id | continue
+    let mut blocked := false
+    if let some chunks := getUpload p then
+      blocked := !(← feedUpload (getEasyHandle p) chunks)
+    if let .streaming sp := p then
+      -- Report headers once, after the blank line ending them has arrived
+      unless (← sp.headersReported.get) do
+        if (← Wisp.FFI.headersComplete sp.easy) then
+          reportHeaders sp
+      if !(← flushStream sp) then
+        blocked := true
+      else if (← sp.finished.get) then
+        let _ ← Std.CloseableChannel.Sync.close sp.channel
+        releaseEasy sp.easy
+        pending := pending.erase id
+    if blocked && !waiting.contains id then
+      waiting := waiting.push id
+  return (pending, waiting)
+
+/-- Run one worker: drive `multi` and handle commands from `chan` until the
+    channel is closed and no requests remain. `inflight` is decremented as
+    requests finish or are canceled; `running` counts the requests on the
+    multi handles of all workers. -/
+private partial def managerLoop
+    (multi : Wisp.FFI.Multi)
+    (chan : Std.CloseableChannel.Sync Command)
+    (inflight : IO.Ref Nat)
+    (running : IO.Ref Nat)
+    (metrics : IO.Ref ClientMetrics) : IO Unit := do
+  let rec loop (pending : Std.HashMap UInt64 Pending) (sched : Scheduler) (rq : Retries)
+      (waiting : Array UInt64) : IO Unit := do
+    if pending.isEmpty && sched.waiting.isEmpty && rq.timers.isEmpty then
       let cmd? ← chan.recv
       match cmd? with
       | none => return ()
       | some cmd =>
-        let pending ← handleCommand multi pending cmd
-        loop pending
+        let before := liveCount pending sched.waiting.size rq
+        let (pending, sched, rq) ← handleCommand multi pending sched rq metrics cmd
+        let (pending, sched) ← schedule multi pending sched running
+        let sched ← sched.release pending rq.copies running
+        -- Requests the scheduler failed to start have already been resolved
+        let departed := before + cmd.requestCount - liveCount pending sched.waiting.size rq
+        if departed > 0 then
+          inflight.modify (· - departed)
+        loop pending sched rq #[]
     else
-      let pending ← drainCommands multi pending chan
-      let _ ← Wisp.FFI.multiPerform multi
-      -- Drain streaming data before polling
-      drainStreamingData pending
-      let _ ← Wisp.FFI.multiPoll multi 100
-      let pending ← handleCompletion multi pending
-      loop pending
-
-  loop {}
+      let iterationStart ← IO.monoNanosNow
+      let before := liveCount pending sched.waiting.size rq
+      let (pending, sched, rq, added) ← drainCommands multi pending sched rq metrics chan
+      let (pending, sched, rq) ← fireTimers multi pending sched rq
+      let (pending, sched) ← schedule multi pending sched running
+      let (pending, rq, waiting, waitedNs) ←
+        if pending.isEmpty && rq.timers.isEmpty && !sched.throttled then
+          pure (pending, rq, #[], 0)
+        else do
+          -- Block until a socket is ready, curl's timer fires, a retry or
+          -- hedge is due, or a submitter wakes us up with a new command.
+          -- Channel consumers and producers don't wake us, nor do other
+          -- workers freeing total-limit slots, so poll while any transfer is
+          -- waiting on one.
+          let timeout := if waiting.isEmpty && !sched.throttled then Wisp.FFI.waitForever else streamRetryMs
+          let timeout := match rq.nextDueIn (← IO.monoMsNow) with
+            | some ms => min timeout (max ms 1).toUInt32
+            | none => timeout
+          let waitStart ← IO.monoNanosNow
+          let _ ← Wisp.FFI.multiWait multi timeout
+          let waitedNs := (← IO.monoNanosNow) - waitStart
+          let (pending, rq, finishedStreams) ← handleCompletion multi pending rq metrics sched.admitted
+          let ready ← Wisp.FFI.multiTakeReady multi
+          let (pending, waiting) ← serviceTransfers pending (waiting ++ ready ++ finishedStreams)
+          pure (pending, rq, waiting, waitedNs)
+      let sched ← sched.release pending rq.copies running
+      -- Requests that finished or were canceled no longer count towards
+      -- this worker's load
+      let departed := before + added - liveCount pending sched.waiting.size rq
+      if departed > 0 then
+        inflight.modify (· - departed)
+      let workNs := (← IO.monoNanosNow) - iterationStart - waitedNs
+      metrics.modify fun m => { m with loopTime := m.loopTime.observe (workNs.toFloat / 1000.0) }
+      loop pending sched rq waiting
+
+  loop {} {} {} #[]
+
+private structure Worker where
+  chan : Std.CloseableChannel.Sync Command
+  multi : Wisp.FFI.Multi
+  /-- Requests submitted to this worker that have not finished yet -/
+  inflight : IO.Ref Nat
+  task : Task (Except IO.Error Unit)
 
 private structure Manager where
-  chan : Std.CloseableChannel.Sync Command
+  workers : Array Worker
   nextId : Std.Mutex UInt64
-  worker : Task (Except IO.Error Unit)
+  /-- Workers serving each origin. An origin stays on them so its connections,
+      which live in each worker's multi handle, are reused. -/
+  routes : Std.Mutex (Std.HashMap String (Array Nat))
+  stealThreshold : Nat
 
-private def startManager : IO Manager := do
+initialize workerConfigRef : IO.Ref WorkerConfig ← IO.mkRef {}
+
+private def startWorker (config : WorkerConfig) (running : IO.Ref Nat) : IO Worker := do
   let chan ← Std.CloseableChannel.Sync.new
+  let multi ← Wisp.FFI.multiInit
+  -- Needs curl 7.67; older versions keep their built-in limit
+  try
+    Wisp.FFI.multiSetoptLong multi Wisp.FFI.CurlMOpt.MAX_CONCURRENT_STREAMS
+      (max config.maxConcurrentStreams 1).toInt64
+  catch _ =>
+    pure ()
+  let inflight ← IO.mkRef 0
+  let metrics ← IO.mkRef ({} : ClientMetrics)
+  let task ← (managerLoop multi chan inflight running metrics).asTask Task.Priority.dedicated
+  return { chan, multi, inflight, task }
+
+private def startManager : IO Manager := do
+  let config ← workerConfigRef.get
+  prewarmEasyPool
+  -- Requests on the workers' multi handles, shared for the total limit
+  let running ← IO.mkRef 0
+  let mut workers : Array Worker := #[]
+  for _ in [0:max config.workers 1] do
+    workers := workers.push (← startWorker config running)
   let nextId ← Std.Mutex.new 1
-  let worker ← (managerLoop chan).asTask Task.Priority.dedicated
-  return { chan, nextId, worker }
+  let routes ← Std.Mutex.new {}
+  return { workers, nextId, routes, stealThreshold := config.stealThreshold }
+
+/-- Queue a command and wake the worker so it is handled immediately. -/
+private def Worker.submit (w : Worker) (cmd : Command) : IO Unit := do
+  match cmd with
+  | .add .. => w.inflight.modify (· + 1)
+  | .addBatch items => w.inflight.modify (· + items.size)
+  | _ => pure ()
+  let _ ← Std.CloseableChannel.Sync.send w.chan cmd
+  Wisp.FFI.multiWakeup w.multi
+
+/-- Like `submit`, but returns false instead of failing once the worker has
+    been shut down (by `shutdown` or `configureWorkers`) -/
+private def Worker.trySubmit (w : Worker) (cmd : Command) : IO Bool := do
+  try
+    w.submit cmd
+    return true
+  catch _ =>
+    w.inflight.modify (· - cmd.requestCount)
+    return false
+
+/-- Scheme, host and port of a URL -/
+private def originOf (url : String) : String :=
+  match url.splitOn "://" with
+  | scheme :: rest :: _ =>
+    let authority := rest.takeWhile fun c => c != '/' && c != '?' && c != '#'
+    s!"{scheme.toLower}://{authority.toLower}"
+  | _ => url
+
+/-- Scheduling details of a request submitted by `client` -/
+private def admissionOf (client : Client) (req : Wisp.Request) : IO Admission := do
+  return {
+    origin := originOf req.url
+    priority := req.priority
+    hostLimit := client.maxHostConnections
+    totalLimit := client.maxTotalConnections
+    submittedMs := ← IO.monoMsNow
+  }
+
+/-- Retry state of a buffered request whose policy applies to it. Requests
+    whose body streams from a channel cannot be sent twice. -/
+private def retryStateOf (client : Client) (req : Wisp.Request) (adm : Admission)
+    (prepare : IO Wisp.FFI.Easy := Prod.fst <$> prepareEasy client req) : Option RetryState := do
+  let policy ← req.retry <|> client.retry
+  unless policy.allowsMethod req.method do none
+  if let .stream (.channel _) _ _ := req.body then none
+  some { policy, admission := adm, prepare }
+
+/-- Pick the worker for a request to `url`. A new origin goes to the least
+    loaded worker and stays there; once all of its workers have
+    `stealThreshold` requests in flight, it also spreads to the least loaded
+    worker it isn't using yet. `pinned` requests, whose client limits
+    connections per host, always go to the origin's first worker so a single
+    scheduler counts them. -/
+private def Manager.routeIndex (m : Manager) (url : String) (pinned : Bool := false) : IO Nat := do
+  if m.workers.size == 1 then return 0
+  let loads ← m.workers.mapM (·.inflight.get)
+  let leastLoaded (candidates : Array Nat) : Option Nat :=
+    candidates.foldl (init := none) fun best i =>
+      match best with
+      | some b => if loads[i]! < loads[b]! then some i else best
+      | none => some i
+  let all := Array.range m.workers.size
+  let origin := originOf url
+  m.routes.atomically do
+    let routes ← get
+    match routes.get? origin with
+    | none =>
+      let i := (leastLoaded all).getD 0
+      let routes := if routes.size ≥ maxRoutes then {} else routes
+      set (routes.insert origin #[i])
+      return i
+    | some assigned =>
+      if pinned then return assigned[0]?.getD 0
+      let i := (leastLoaded assigned).getD 0
+      if m.stealThreshold > 0 && loads[i]! ≥ m.stealThreshold then
+        if let some j := leastLoaded (all.filter (!assigned.contains ·)) then
+          if loads[j]! < loads[i]! then
+            set (routes.insert origin (assigned.push j))
+            return j
+      return i
+
+/-- The worker for a request to `url`, as chosen by `routeIndex` -/
+private def Manager.route (m : Manager) (url : String) (pinned : Bool := false) : IO Worker := do
+  match m.workers[← m.routeIndex url pinned]? with
+  | some w => return w
+  | none => throw (IO.userError "Wisp: no manager workers running")
 
 initialize managerRef : IO.Ref (Option Manager) ← IO.mkRef none
 initialize managerMutex : Std.Mutex Unit ← Std.Mutex.new ()
@@ -315,7 +1444,40 @@ private def getManager : IO Manager := do
       managerRef.set (some m)
       return m
 
-/-- Shutdown the async manager and stop background polling. -/
+/-- Allocate the id of a new request -/
+private def Manager.allocId (m : Manager) : IO UInt64 :=
+  m.nextId.atomically do
+    let current ← get
+    set (current + 1)
+    return current
+
+/-- Hand a new request to the worker serving its origin, under a fresh id.
+    Returns the worker and the id, for cancellation. A request racing with
+    `shutdown` or `configureWorkers` may find its worker closed; it then goes
+    to the pool that replaced it. -/
+private partial def submitRequest (client : Client) (url : String) (p : Pending) (adm : Admission)
+    : IO (Worker × UInt64) := do
+  let manager ← getManager
+  let worker ← manager.route url (pinned := client.maxHostConnections > 0)
+  let id ← manager.allocId
+  Wisp.FFI.setoptPrivate (getEasyHandle p) id
+  if (← worker.trySubmit (.add id p adm)) then
+    return (worker, id)
+  submitRequest client url p adm
+
+/-- Close a manager's workers and wait for the requests they have in flight -/
+private def Manager.stop (m : Manager) : IO Unit := do
+  try
+    for w in m.workers do
+      let _ ← Std.CloseableChannel.Sync.close w.chan
+      Wisp.FFI.multiWakeup w.multi
+    for w in m.workers do
+      let _ ← IO.wait w.task
+  catch _ =>
+    pure ()
+
+/-- Shutdown the async manager and stop background polling.
+    Waits for requests that are still in flight. -/
 def shutdown : IO Unit := do
   let manager? ← managerMutex.atomically do
     let current ← managerRef.get
@@ -324,469 +1486,426 @@ def shutdown : IO Unit := do
     | some m =>
       managerRef.set none
       return some m
-  match manager? with
-  | none => pure ()
-  | some m =>
-    try
-      let _ ← Std.CloseableChannel.Sync.close m.chan
-      let _ := m.worker.get
-      pure ()
-    catch _ =>
-      pure ()
-
-/-- Execute a request asynchronously and return a task for the response. -/
-def execute (client : Client) (req : Wisp.Request) : IO (Task (Wisp.WispResult Wisp.Response)) := do
+  if let some m := manager? then
+    m.stop
+
+/-- Queue depth, requests in flight and queueing delay for each origin,
+    combined across workers. Origins idle for long may be forgotten. -/
+def schedulerStats : IO (Array OriginStats) := do
+  let some m ← managerRef.get | return #[]
+  let mut replies : Array (Task (Option (Array OriginStats))) := #[]
+  for w in m.workers do
+    let promise ← IO.Promise.new
+    -- A closed worker drops the promise, which then reports nothing
+    let _ ← w.trySubmit (.stats promise)
+    replies := replies.push promise.result?
+  let mut byOrigin : Std.HashMap String OriginStats := {}
+  for reply in replies do
+    for st in (← IO.wait reply).getD #[] do
+      byOrigin := byOrigin.insert st.origin <| match byOrigin.get? st.origin with
+        | none => st
+        | some acc => {
+            acc with
+            queued := acc.queued + st.queued
+            inflight := acc.inflight + st.inflight
+            started := acc.started + st.started
+            totalWaitMs := acc.totalWaitMs + st.totalWaitMs
+            maxWaitMs := max acc.maxWaitMs st.maxWaitMs
+          }
+  return byOrigin.fold (init := #[]) fun acc _ st => acc.push st
+
+/-- Snapshot of the metrics kept by each background worker, in worker order.
+    Counting starts when the workers start, so it begins afresh after
+    `shutdown` or `configureWorkers`. -/
+def workerMetrics : IO (Array ClientMetrics) := do
+  let some m ← managerRef.get | return #[]
+  let mut replies : Array (Task (Option ClientMetrics)) := #[]
+  for w in m.workers do
+    let promise ← IO.Promise.new
+    let _ ← w.trySubmit (.metrics promise)
+    replies := replies.push promise.result?
+  let mut snapshots : Array ClientMetrics := #[]
+  for reply in replies do
+    snapshots := snapshots.push ((← IO.wait reply).getD {})
+  return snapshots
+
+/-- Snapshot of the metrics kept by the background workers, summed over all
+    of them (see `workerMetrics`) -/
+def metrics : IO ClientMetrics := do
+  return (← workerMetrics).foldl ClientMetrics.merge {}
+
+/-- The workers' metrics in the Prometheus text exposition format -/
+def metricsText : IO String := do
+  return (← metrics).toPrometheus
+
+/-- Write the Prometheus text to a file, e.g. for node_exporter's textfile collector.
+    The file is replaced atomically. -/
+def writeMetrics (path : System.FilePath) : IO Unit := do
+  -- Unique per write, so concurrent writers, in this process or others
+  -- sharing the collector directory, never rename each other's file
+  let tmp := path.withExtension s!"{← IO.Process.getPID}-{← IO.monoNanosNow}-{← IO.rand 0 999999}.tmp"
   try
-    -- Initialize easy handle
-    let easy ← Wisp.FFI.easyInit
-
-    -- Setup response callbacks
-    Wisp.FFI.setupWriteCallback easy
-    Wisp.FFI.setupHeaderCallback easy
-
-    -- Set URL
-    Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.URL req.url
-
-    -- Set method
-    let customMethod : Option String :=
-      match req.method with
-      | .PUT => some "PUT"
-      | .DELETE => some "DELETE"
-      | .PATCH => some "PATCH"
-      | .OPTIONS => some "OPTIONS"
-      | .TRACE => some "TRACE"
-      | .CONNECT => some "CONNECT"
-      | _ => none
-
-    match req.method with
-    | .GET => Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.HTTPGET 1
-    | .POST => Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.POST 1
-    | .HEAD => Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.NOBODY 1
-    | _ => pure ()
-
-    -- Build headers slist
-    let slist ← Wisp.FFI.slistNew
-
-    -- Add user headers
-    for (key, value) in req.headers do
-      Wisp.FFI.slistAppend slist s!"{key}: {value}"
-
-    -- Set body based on type
-    match req.body with
-    | .empty => pure ()
-    | .raw data contentType =>
-      Wisp.FFI.slistAppend slist s!"Content-Type: {contentType}"
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.POSTFIELDS (String.fromUTF8! data)
-      Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.POSTFIELDSIZE data.size.toInt64
-    | .text content =>
-      Wisp.FFI.slistAppend slist "Content-Type: text/plain; charset=utf-8"
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.POSTFIELDS content
-      Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.POSTFIELDSIZE content.utf8ByteSize.toInt64
-    | .json content =>
-      Wisp.FFI.slistAppend slist "Content-Type: application/json; charset=utf-8"
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.POSTFIELDS content
-      Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.POSTFIELDSIZE content.utf8ByteSize.toInt64
-    | .form fields =>
-      Wisp.FFI.slistAppend slist "Content-Type: application/x-www-form-urlencoded"
-      let formBody ← buildFormBody easy fields
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.POSTFIELDS formBody
-      Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.POSTFIELDSIZE formBody.utf8ByteSize.toInt64
-    | .multipart parts =>
-      let mime ← Wisp.FFI.mimeInit easy
-      for p in parts do
-        let mimepart ← Wisp.FFI.mimeAddpart mime
-        Wisp.FFI.mimepartName mimepart p.name
-        Wisp.FFI.mimepartData mimepart p.data
-        if let some filename := p.filename then
-          Wisp.FFI.mimepartFilename mimepart filename
-        if let some ct := p.contentType then
-          Wisp.FFI.mimepartType mimepart ct
-      Wisp.FFI.setoptMime easy mime
-
-    -- Set authentication
-    match req.auth with
-    | .none => pure ()
-    | .basic username password =>
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.USERPWD s!"{username}:{password}"
-      Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.HTTPAUTH Wisp.FFI.CurlOpt.AUTH_BASIC
-    | .bearer token =>
-      Wisp.FFI.slistAppend slist s!"Authorization: Bearer {token}"
-    | .digest username password =>
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.USERPWD s!"{username}:{password}"
-      Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.HTTPAUTH Wisp.FFI.CurlOpt.AUTH_DIGEST
-
-    -- Re-apply custom method after setting body/options that may override it
-    if let some method := customMethod then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.CUSTOMREQUEST method
-
-    -- Apply headers
-    Wisp.FFI.setoptSlist easy Wisp.FFI.CurlOpt.HTTPHEADER slist
-
-    -- Set timeouts
-    let timeout := if req.timeoutMs > 0 then req.timeoutMs else client.defaultTimeout
-    let connectTimeout := if req.connectTimeoutMs > 0 then req.connectTimeoutMs else client.defaultConnectTimeout
-    Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.TIMEOUT_MS timeout.toInt64
-    Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.CONNECTTIMEOUT_MS connectTimeout.toInt64
-
-    -- Set redirect behavior
-    Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.FOLLOWLOCATION (if req.followRedirects then 1 else 0)
-    Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.MAXREDIRS req.maxRedirects.toNat.toInt64
-
-    -- Set SSL options
-    Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.SSL_VERIFYPEER (if req.ssl.verifyPeer then 1 else 0)
-    Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.SSL_VERIFYHOST (if req.ssl.verifyHost then 2 else 0)
-    if let some caPath := req.ssl.caCertPath then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.CAINFO caPath
-    if let some certPath := req.ssl.clientCertPath then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.SSLCERT certPath
-    if let some keyPath := req.ssl.clientKeyPath then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.SSLKEY keyPath
-
-    -- Set user agent
-    Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.USERAGENT req.userAgent
-
-    -- Set accept encoding
-    if let some enc := req.acceptEncoding then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.ACCEPT_ENCODING enc
-
-    -- Enable verbose if requested
-    if req.verbose then
-      Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.VERBOSE 1
-
-    -- Set cookie jar options
-    if let some cookieFile := req.cookieJar.cookieFile then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.COOKIEFILE cookieFile
-    if let some jarFile := req.cookieJar.cookieJarFile then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.COOKIEJAR jarFile
-    if let some cookies := req.cookieJar.cookies then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.COOKIE cookies
-
-    -- Enqueue on async manager
-    let manager ← getManager
-    let id ← manager.nextId.atomically do
-      let current ← get
-      set (current + 1)
-      return current
-    Wisp.FFI.setoptPrivate easy id
+    IO.FS.writeFile tmp (← metricsText)
+    IO.FS.rename tmp path
+  catch e =>
+    try IO.FS.removeFile tmp catch _ => pure ()
+    throw e
+
+/-- Set how many background workers drive transfers. Takes effect for the next
+    request, which goes to a new pool of workers; the old ones finish the
+    requests they have in flight, and this waits for them. -/
+def configureWorkers (config : WorkerConfig) : IO Unit := do
+  -- Swap in the new pool before draining the old one, so requests submitted
+  -- meanwhile never wait behind long-lived transfers or hit a closed worker
+  let old? ← managerMutex.atomically do
+    workerConfigRef.set config
+    let old ← managerRef.get
+    if old.isSome then
+      managerRef.set (some (← startManager))
+    return old
+  if let some m := old? then
+    m.stop
+
+/-- Start a buffered transfer for a request, bypassing the cache. `setup`
+    runs on each attempt's handle once it is configured, told whether the
+    attempt is a retry. Also returns the worker and id the request went to,
+    for cancellation, unless it failed before reaching one. -/
+private def submitBuffered (client : Client) (req : Wisp.Request)
+    (setup : Bool → Wisp.FFI.Easy → IO Unit := fun _ _ => pure ())
+    : IO (Task (Wisp.WispResult Wisp.Response) × Option (Worker × UInt64)) := do
+  try
+    let (easy, upload) ← prepareEasy client req
+    setup false easy
 
     let promise ← IO.Promise.new
-    let pending : Pending := .buffered { easy, promise }
-    let _ ← Std.CloseableChannel.Sync.send manager.chan (.add id pending)
-
-    return promise.result!
+    let adm ← admissionOf client req
+    let prepare : IO Wisp.FFI.Easy := do
+      let (easy, _) ← prepareEasy client req
+      setup true easy
+      return easy
+    let pending : Pending := .buffered { easy, promise, upload, retry := retryStateOf client req adm prepare }
+    let submitted ← submitRequest client req.url pending adm
+
+    return (promise.result!, some submitted)
   catch e =>
     let promise ← IO.Promise.new
     promise.resolve (.error (.ioError (toString e)))
-    return promise.result!
+    return (promise.result!, none)
+
+/-- Start a transfer for a request, bypassing the cache -/
+private def executeDirect (client : Client) (req : Wisp.Request)
+    : IO (Task (Wisp.WispResult Wisp.Response)) :=
+  Prod.fst <$> submitBuffered client req
 
-/-- Execute a request asynchronously and return a task plus a cancellation handle. -/
+/-- Execute a request asynchronously and return a task for the response. -/
+def execute (client : Client) (req : Wisp.Request) : IO (Task (Wisp.WispResult Wisp.Response)) := do
+  match client.cache with
+  | some cache => cache.fetch req (executeDirect client)
+  | none => executeDirect client req
+
+/-- Whether a 416 reply means the file already holds all `size` bytes
+    (`Content-Range: bytes */size`) -/
+private def rangeSatisfied (resp : Wisp.Response) (size : Nat) : Bool :=
+  resp.status == 416 && size > 0 &&
+    (resp.header "Content-Range").any fun v => v.trim == s!"bytes */{size}"
+
+/-- `req` as sent by a download: uncompressed, so ranges count bytes of the
+    file, and under a retry policy that never hedges -/
+private def downloadRequest (client : Client) (req : Wisp.Request) : Wisp.Request :=
+  let policy := (req.retry <|> client.retry).getD {}
+  { req with
+    acceptEncoding := none
+    retry := some { policy with hedgeAfterMs := none, hedgeAtP95 := false } }
+
+/-- Submit a transfer whose body goes to a file. `setup` points the handle
+    at the file; it is told whether the attempt is a retry. -/
+private def startDownload (client : Client) (req : Wisp.Request)
+    (setup : Bool → Wisp.FFI.Easy → IO Unit) : IO (Task (Wisp.WispResult Wisp.Response)) :=
+  Prod.fst <$> submitBuffered client req setup
+
+/-- Download the body of `req` straight into the file at `path`. curl's write
+    callback writes each chunk to the file descriptor, so the body is never
+    held in memory or passed through Lean. With `resume`, bytes already in the
+    file are skipped with a Range request. Transient failures are retried
+    under the request's or client's retry policy (the default one if neither
+    sets any, never hedged), each retry resuming where the file ends. With
+    `preallocate`, disk space is reserved from the Content-Length.
+    Responses are not compressed, so a resumed download matches the resource
+    byte for byte. -/
+def download (client : Client) (req : Wisp.Request) (path : System.FilePath)
+    (resume : Bool := true) (preallocate : Bool := true)
+    : IO (Task (Wisp.WispResult Download)) := do
+  let req := downloadRequest client req
+  -- Retries pick up where the file ends
+  let task ← startDownload client req fun retry easy => do
+    let _ ← Wisp.FFI.setDownloadFile easy path.toString (resume || retry) preallocate
+  let mapped ← IO.mapTask (t := task) fun
+    | .error e => pure (.error e)
+    | .ok response => do
+      let size ← if (← path.pathExists) then pure ((← path.metadata).byteSize.toNat) else pure 0
+      return .ok { response, size, complete := response.isSuccess || rangeSatisfied response size }
+  return mapped.map fun
+    | .ok result => result
+    | .error e => .error (.ioError (toString e))
+
+/-- Split `total` bytes into consecutive ranges of `size` bytes -/
+private def segmentRanges (total size : Nat) : Array (Nat × Nat) := Id.run do
+  let size := max 1 size
+  let mut ranges : Array (Nat × Nat) := #[]
+  let mut start := 0
+  while start < total do
+    ranges := ranges.push (start, min size (total - start))
+    start := start + size
+  return ranges
+
+/-- Fetch the ranges of a `total`-byte object concurrently, each written at
+    its offset. Returns false if a range still failed after its retries or
+    the server ignored a range; the ranges in flight have finished by then. -/
+private def fetchSegments (client : Client) (req : Wisp.Request) (path : System.FilePath)
+    (config : SegmentConfig) (ranges : Array (Nat × Nat)) : IO Bool := do
+  let done : Std.CloseableChannel.Sync (Nat × Bool) ← Std.CloseableChannel.Sync.new
+  let maxConcurrency := max 1 config.maxConcurrency
+  let mut limit := min maxConcurrency (max 1 config.initialConcurrency)
+  let mut next := 0
+  let mut inflight := 0
+  let mut completed := 0
+  let mut failed := false
+  -- Throughput of the last `limit` ranges, to climb towards the best concurrency
+  let mut epochBytes := 0
+  let mut epochCount := 0
+  let mut epochStart ← IO.monoMsNow
+  let mut lastRate : Float := 0.0
+  while completed < ranges.size && !failed do
+    while inflight < limit && next < ranges.size do
+      let i := next
+      let (start, length) := ranges[i]!
+      let task ← startDownload client req fun _ easy =>
+        Wisp.FFI.setDownloadSegment easy path.toString start.toUInt64 length.toUInt64
+      let _ ← IO.mapTask (t := task) fun result => do
+        let ok := match result with
+          | .ok resp => resp.status == 206
+          | .error _ => false
+        let _ ← Std.CloseableChannel.Sync.send done (i, ok)
+      next := next + 1
+      inflight := inflight + 1
+    let some (i, ok) ← done.recv | break
+    inflight := inflight - 1
+    if !ok then
+      failed := true
+    else
+      completed := completed + 1
+      epochBytes := epochBytes + (ranges[i]!).2
+      epochCount := epochCount + 1
+      if config.adaptive && epochCount ≥ limit then
+        let now ← IO.monoMsNow
+        let rate := epochBytes.toFloat / (max 1 (now - epochStart)).toFloat
+        if rate > lastRate * 1.1 then
+          limit := min maxConcurrency (limit + 1)
+        else if rate < lastRate * 0.9 then
+          limit := max 1 (limit - 1)
+        lastRate := rate
+        epochBytes := 0
+        epochCount := 0
+        epochStart := now
+  -- Let the ranges still in flight finish before anyone rewrites the file
+  for _ in [0:inflight] do
+    let _ ← done.recv
+  return !failed
+
+/-- Download a large object in byte ranges fetched concurrently on separate
+    handles, each written at its offset in the file at `path`. A HEAD
+    request probes `Accept-Ranges` and the length first; objects without
+    range support, without a length, or smaller than
+    `config.minObjectBytes` are fetched with a single stream by `download`.
+    Each range is retried on its own under the request's or client's retry
+    policy. With `config.adaptive`, the number of ranges in flight climbs
+    while it raises the throughput and drops back when it lowers it. If a
+    range still fails, or the server ignores a range, the object is fetched
+    again with a single stream. -/
+def downloadSegmented (client : Client) (req : Wisp.Request) (path : System.FilePath)
+    (config : SegmentConfig := {}) : IO (Task (Wisp.WispResult Download)) := do
+  let req := downloadRequest client req
+  let single : IO (Wisp.WispResult Download) := do
+    IO.wait (← client.download req path (resume := false))
+  let task ← IO.asTask (prio := .dedicated) do
+    match ← IO.wait (← client.execute { req with method := .HEAD, body := .empty }) with
+    | .error _ => single
+    | .ok probe =>
+      let ranged := (probe.header "Accept-Ranges").any (·.trim.toLower == "bytes")
+      let total? := (probe.header "Content-Length").bind (·.trim.toNat?)
+      match total? with
+      | some total =>
+        if probe.isSuccess && ranged && total > 0 && total ≥ config.minObjectBytes then
+          Wisp.FFI.preallocateFile path.toString total.toUInt64
+          let ranges := segmentRanges total config.segmentBytes
+          if ← fetchSegments client { req with method := .GET, body := .empty } path config ranges then
+            return .ok { response := probe, size := total, complete := true, segments := ranges.size }
+        single
+      | none => single
+  return task.map fun
+    | .ok result => result
+    | .error e => .error (.ioError (toString e))
+
+/-- Start a cancelable transfer, bypassing the cache -/
+private def executeCancelableDirect (client : Client) (req : Wisp.Request)
+    : IO (Task (Wisp.WispResult Wisp.Response) × CancelHandle) := do
+  let (task, submitted) ← submitBuffered client req
+  let cancelHandle : CancelHandle := match submitted with
+    -- A closed worker has already finished the request
+    | some (worker, id) => { cancel := discard <| worker.trySubmit (.cancel id) }
+    | none => { cancel := pure () }
+  return (task, cancelHandle)
+
+/-- Execute a request asynchronously and return a task plus a cancellation
+    handle. The response cache is not consulted, since canceling a transfer
+    other requests had joined would fail them too; a successful unsafe
+    request still invalidates the URL in it. -/
 def executeCancelable (client : Client) (req : Wisp.Request)
     : IO (Task (Wisp.WispResult Wisp.Response) × CancelHandle) := do
-  try
-    -- Initialize easy handle
-    let easy ← Wisp.FFI.easyInit
-
-    -- Setup response callbacks
-    Wisp.FFI.setupWriteCallback easy
-    Wisp.FFI.setupHeaderCallback easy
-
-    -- Set URL
-    Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.URL req.url
-
-    -- Set method
-    let customMethod : Option String :=
-      match req.method with
-      | .PUT => some "PUT"
-      | .DELETE => some "DELETE"
-      | .PATCH => some "PATCH"
-      | .OPTIONS => some "OPTIONS"
-      | .TRACE => some "TRACE"
-      | .CONNECT => some "CONNECT"
-      | _ => none
-
-    match req.method with
-    | .GET => Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.HTTPGET 1
-    | .POST => Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.POST 1
-    | .HEAD => Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.NOBODY 1
-    | _ => pure ()
-
-    -- Build headers slist
-    let slist ← Wisp.FFI.slistNew
-
-    -- Add user headers
-    for (key, value) in req.headers do
-      Wisp.FFI.slistAppend slist s!"{key}: {value}"
-
-    -- Set body based on type
-    match req.body with
-    | .empty => pure ()
-    | .raw data contentType =>
-      Wisp.FFI.slistAppend slist s!"Content-Type: {contentType}"
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.POSTFIELDS (String.fromUTF8! data)
-      Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.POSTFIELDSIZE data.size.toInt64
-    | .text content =>
-      Wisp.FFI.slistAppend slist "Content-Type: text/plain; charset=utf-8"
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.POSTFIELDS content
-      Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.POSTFIELDSIZE content.utf8ByteSize.toInt64
-    | .json content =>
-      Wisp.FFI.slistAppend slist "Content-Type: application/json; charset=utf-8"
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.POSTFIELDS content
-      Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.POSTFIELDSIZE content.utf8ByteSize.toInt64
-    | .form fields =>
-      Wisp.FFI.slistAppend slist "Content-Type: application/x-www-form-urlencoded"
-      let formBody ← buildFormBody easy fields
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.POSTFIELDS formBody
-      Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.POSTFIELDSIZE formBody.utf8ByteSize.toInt64
-    | .multipart parts =>
-      let mime ← Wisp.FFI.mimeInit easy
-      for p in parts do
-        let mimepart ← Wisp.FFI.mimeAddpart mime
-        Wisp.FFI.mimepartName mimepart p.name
-        Wisp.FFI.mimepartData mimepart p.data
-        if let some filename := p.filename then
-          Wisp.FFI.mimepartFilename mimepart filename
-        if let some ct := p.contentType then
-          Wisp.FFI.mimepartType mimepart ct
-      Wisp.FFI.setoptMime easy mime
-
-    -- Set authentication
-    match req.auth with
-    | .none => pure ()
-    | .basic username password =>
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.USERPWD s!"{username}:{password}"
-      Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.HTTPAUTH Wisp.FFI.CurlOpt.AUTH_BASIC
-    | .bearer token =>
-      Wisp.FFI.slistAppend slist s!"Authorization: Bearer {token}"
-    | .digest username password =>
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.USERPWD s!"{username}:{password}"
-      Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.HTTPAUTH Wisp.FFI.CurlOpt.AUTH_DIGEST
-
-    -- Re-apply custom method after setting body/options that may override it
-    if let some method := customMethod then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.CUSTOMREQUEST method
-
-    -- Apply headers
-    Wisp.FFI.setoptSlist easy Wisp.FFI.CurlOpt.HTTPHEADER slist
-
-    -- Set timeouts
-    let timeout := if req.timeoutMs > 0 then req.timeoutMs else client.defaultTimeout
-    let connectTimeout := if req.connectTimeoutMs > 0 then req.connectTimeoutMs else client.defaultConnectTimeout
-    Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.TIMEOUT_MS timeout.toInt64
-    Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.CONNECTTIMEOUT_MS connectTimeout.toInt64
-
-    -- Set redirect behavior
-    Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.FOLLOWLOCATION (if req.followRedirects then 1 else 0)
-    Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.MAXREDIRS req.maxRedirects.toNat.toInt64
-
-    -- Set SSL options
-    Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.SSL_VERIFYPEER (if req.ssl.verifyPeer then 1 else 0)
-    Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.SSL_VERIFYHOST (if req.ssl.verifyHost then 2 else 0)
-    if let some caPath := req.ssl.caCertPath then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.CAINFO caPath
-    if let some certPath := req.ssl.clientCertPath then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.SSLCERT certPath
-    if let some keyPath := req.ssl.clientKeyPath then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.SSLKEY keyPath
-
-    -- Set user agent
-    Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.USERAGENT req.userAgent
-
-    -- Set accept encoding
-    if let some enc := req.acceptEncoding then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.ACCEPT_ENCODING enc
-
-    -- Enable verbose if requested
-    if req.verbose then
-      Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.VERBOSE 1
-
-    -- Set cookie jar options
-    if let some cookieFile := req.cookieJar.cookieFile then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.COOKIEFILE cookieFile
-    if let some jarFile := req.cookieJar.cookieJarFile then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.COOKIEJAR jarFile
-    if let some cookies := req.cookieJar.cookies then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.COOKIE cookies
-
-    -- Enqueue on async manager
-    let manager ← getManager
-    let id ← manager.nextId.atomically do
-      let current ← get
-      set (current + 1)
-      return current
-    Wisp.FFI.setoptPrivate easy id
-
-    let promise ← IO.Promise.new
-    let pending : Pending := .buffered { easy, promise }
-    let _ ← Std.CloseableChannel.Sync.send manager.chan (.add id pending)
-    let cancelHandle : CancelHandle := {
-      cancel := do
-        let _ ← Std.CloseableChannel.Sync.send manager.chan (.cancel id)
-        pure ()
-    }
-
-    return (promise.result!, cancelHandle)
-  catch e =>
-    let promise ← IO.Promise.new
-    promise.resolve (.error (.ioError (toString e)))
-    let cancelHandle : CancelHandle := { cancel := pure () }
-    return (promise.result!, cancelHandle)
+  let (task, handle) ← executeCancelableDirect client req
+  match client.cache with
+  | some cache => return (← cache.invalidateAfter req task (·.status), handle)
+  | none => return (task, handle)
 
 /-- Execute a request synchronously by awaiting the task. -/
 def executeSync (client : Client) (req : Wisp.Request) : IO (Wisp.WispResult Wisp.Response) := do
   let task ← client.execute req
   return task.get
 
-/-- Execute a request with streaming response.
-    Returns a StreamingResponse where body chunks arrive via channel.
-    The promise resolves when headers are received. -/
-def executeStreaming (client : Client) (req : Wisp.Request) :
+/-- Requests prepared by each thread-pool task in `executeBatch` -/
+private def batchSliceSize : Nat := 256
+
+/-- Prepare the handle for request `id` of a batch -/
+private def prepareBatchItem (client : Client) (req : Wisp.Request) (id : UInt64)
+    : IO (Wisp.FFI.Easy × Option (Std.CloseableChannel.Sync ByteArray)) := do
+  let (easy, upload) ← prepareEasy client req
+  Wisp.FFI.setoptPrivate easy id
+  return (easy, upload)
+
+/-- Prepare handles for a batch on the thread pool, one slice per task.
+    Request `i` gets id `first + i`. -/
+private def prepareBatch (client : Client) (reqs : Array Wisp.Request) (first : UInt64)
+    : IO (Array (Except IO.Error (Wisp.FFI.Easy × Option (Std.CloseableChannel.Sync ByteArray)))) := do
+  let mut slices : Array (Nat × Task (Except IO.Error
+      (Array (Except IO.Error (Wisp.FFI.Easy × Option (Std.CloseableChannel.Sync ByteArray)))))) := #[]
+  for start in [0:reqs.size:batchSliceSize] do
+    let slice := reqs.extract start (start + batchSliceSize)
+    let task ← IO.asTask do
+      let mut out : Array (Except IO.Error (Wisp.FFI.Easy × Option (Std.CloseableChannel.Sync ByteArray))) := #[]
+      for h : j in [0:slice.size] do
+        out := out.push (← (prepareBatchItem client slice[j] (first + (start + j).toUInt64)).toBaseIO)
+      return out
+    slices := slices.push (slice.size, task)
+  let mut prepared := #[]
+  for (size, task) in slices do
+    match ← IO.wait task with
+    | .ok out => prepared := prepared ++ out
+    | .error e =>
+      for _ in [0:size] do
+        prepared := prepared.push (.error e)
+  return prepared
+
+/-- Send a batch, bypassing the cache. Ids are allocated in one block,
+    handles are prepared in parallel, and each worker receives a single
+    command for its share of the batch. -/
+private def executeBatchDirect (client : Client) (reqs : Array Wisp.Request)
+    : IO (Array (Task (Wisp.WispResult Wisp.Response))) := do
+  if reqs.isEmpty then return #[]
+  let manager ← getManager
+  let first ← manager.nextId.atomically do
+    let current ← get
+    set (current + reqs.size.toUInt64)
+    return current
+  let prepared ← prepareBatch client reqs first
+
+  let mut tasks : Array (Task (Wisp.WispResult Wisp.Response)) := #[]
+  let mut groups : Std.HashMap Nat (Array (UInt64 × Pending × Admission)) := {}
+  let mut id := first
+  for (req, prep) in reqs.zip prepared do
+    let promise ← IO.Promise.new
+    tasks := tasks.push promise.result!
+    match prep with
+    | .error e => promise.resolve (.error (.ioError (toString e)))
+    | .ok (easy, upload) =>
+      let index ← manager.routeIndex req.url (pinned := client.maxHostConnections > 0)
+      let adm ← admissionOf client req
+      let item := (id, Pending.buffered { easy, promise, upload, retry := retryStateOf client req adm }, adm)
+      groups := groups.insert index (((groups.get? index).getD #[]).push item)
+    id := id + 1
+
+  for (index, items) in groups do
+    match manager.workers[index]? with
+    | some worker =>
+      unless (← worker.trySubmit (.addBatch items)) do
+        -- The pool was replaced meanwhile: send them one by one to the new one
+        for (_, p, adm) in items do
+          let _ ← submitRequest client adm.origin p adm
+    | none =>
+      for (_, p, _) in items do
+        resolveFailed p (.ioError "Wisp: no manager workers running")
+  return tasks
+
+/-- Execute many requests at once (see `executeBatchDirect`). Tasks are
+    returned in request order. With a cache, each request goes through it
+    like `execute`, and those it cannot answer are sent as one batch. -/
+def executeBatch (client : Client) (reqs : Array Wisp.Request)
+    : IO (Array (Task (Wisp.WispResult Wisp.Response))) := do
+  let some cache := client.cache | executeBatchDirect client reqs
+  let sends ← IO.mkRef (#[] : Array (Wisp.Request × IO.Promise (Wisp.WispResult Wisp.Response)))
+  let tasks ← reqs.mapM fun req => cache.fetch req fun sent => do
+    let promise ← IO.Promise.new
+    sends.modify (·.push (sent, promise))
+    return promise.result!
+  let sends ← sends.get
+  let sent ← executeBatchDirect client (sends.map (·.1))
+  for ((_, promise), task) in sends.zip sent do
+    let _ ← IO.mapTask (t := task) fun result => promise.resolve result
+  return tasks
+
+/-- Execute many requests like `executeBatch` and deliver `(index, result)`
+    pairs on a channel: as they complete, or in request order when `ordered`.
+    The channel is closed after the last result. -/
+def executeBatchStream (client : Client) (reqs : Array Wisp.Request) (ordered : Bool := false)
+    : IO (Std.CloseableChannel.Sync (Nat × Wisp.WispResult Wisp.Response)) := do
+  let results ← Std.CloseableChannel.Sync.new
+  let tasks ← client.executeBatch reqs
+  if tasks.isEmpty then
+    let _ ← Std.CloseableChannel.Sync.close results
+  else if ordered then
+    let _ ← IO.asTask do
+      for (task, i) in tasks.zipIdx do
+        let _ ← Std.CloseableChannel.Sync.send results (i, ← IO.wait task)
+      let _ ← Std.CloseableChannel.Sync.close results
+  else
+    let remaining ← IO.mkRef tasks.size
+    for (task, i) in tasks.zipIdx do
+      let _ ← IO.mapTask (t := task) fun result => do
+        let _ ← Std.CloseableChannel.Sync.send results (i, result)
+        if (← remaining.modifyGet fun n => (n - 1, n - 1)) == 0 then
+          let _ ← Std.CloseableChannel.Sync.close results
+  return results
+
+/-- Start a streaming transfer -/
+private def executeStreamingDirect (client : Client) (req : Wisp.Request) :
     IO (Task (Wisp.WispResult Wisp.StreamingResponse)) := do
   try
-    -- Initialize easy handle
-    let easy ← Wisp.FFI.easyInit
-
-    -- Setup callbacks - we still use the standard write callback which buffers,
-    -- but we'll drain it periodically for streaming
-    Wisp.FFI.setupWriteCallback easy
-    Wisp.FFI.setupHeaderCallback easy
+    let (easy, upload) ← prepareEasy client req
 
     -- Enable streaming mode in the FFI
     Wisp.FFI.setStreaming easy true
 
-    -- Set URL
-    Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.URL req.url
-
-    -- Set method (same as execute)
-    let customMethod : Option String :=
-      match req.method with
-      | .PUT => some "PUT"
-      | .DELETE => some "DELETE"
-      | .PATCH => some "PATCH"
-      | .OPTIONS => some "OPTIONS"
-      | .TRACE => some "TRACE"
-      | .CONNECT => some "CONNECT"
-      | _ => none
-
-    match req.method with
-    | .GET => Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.HTTPGET 1
-    | .POST => Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.POST 1
-    | .HEAD => Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.NOBODY 1
-    | _ => pure ()
-
-    -- Build headers slist
-    let slist ← Wisp.FFI.slistNew
-
-    -- Add user headers
-    for (key, value) in req.headers do
-      Wisp.FFI.slistAppend slist s!"{key}: {value}"
-
-    -- Set body based on type
-    match req.body with
-    | .empty => pure ()
-    | .raw data contentType =>
-      Wisp.FFI.slistAppend slist s!"Content-Type: {contentType}"
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.POSTFIELDS (String.fromUTF8! data)
-      Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.POSTFIELDSIZE data.size.toInt64
-    | .text content =>
-      Wisp.FFI.slistAppend slist "Content-Type: text/plain; charset=utf-8"
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.POSTFIELDS content
-      Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.POSTFIELDSIZE content.utf8ByteSize.toInt64
-    | .json content =>
-      Wisp.FFI.slistAppend slist "Content-Type: application/json; charset=utf-8"
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.POSTFIELDS content
-      Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.POSTFIELDSIZE content.utf8ByteSize.toInt64
-    | .form fields =>
-      Wisp.FFI.slistAppend slist "Content-Type: application/x-www-form-urlencoded"
-      let formBody ← buildFormBody easy fields
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.POSTFIELDS formBody
-      Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.POSTFIELDSIZE formBody.utf8ByteSize.toInt64
-    | .multipart parts =>
-      let mime ← Wisp.FFI.mimeInit easy
-      for p in parts do
-        let mimepart ← Wisp.FFI.mimeAddpart mime
-        Wisp.FFI.mimepartName mimepart p.name
-        Wisp.FFI.mimepartData mimepart p.data
-        if let some filename := p.filename then
-          Wisp.FFI.mimepartFilename mimepart filename
-        if let some ct := p.contentType then
-          Wisp.FFI.mimepartType mimepart ct
-      Wisp.FFI.setoptMime easy mime
-
-    -- Set authentication
-    match req.auth with
-    | .none => pure ()
-    | .basic username password =>
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.USERPWD s!"{username}:{password}"
-      Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.HTTPAUTH Wisp.FFI.CurlOpt.AUTH_BASIC
-    | .bearer token =>
-      Wisp.FFI.slistAppend slist s!"Authorization: Bearer {token}"
-    | .digest username password =>
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.USERPWD s!"{username}:{password}"
-      Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.HTTPAUTH Wisp.FFI.CurlOpt.AUTH_DIGEST
-
-    -- Re-apply custom method after setting body/options that may override it
-    if let some method := customMethod then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.CUSTOMREQUEST method
-
-    -- Apply headers
-    Wisp.FFI.setoptSlist easy Wisp.FFI.CurlOpt.HTTPHEADER slist
-
-    -- Set timeouts
-    let timeout := if req.timeoutMs > 0 then req.timeoutMs else client.defaultTimeout
-    let connectTimeout := if req.connectTimeoutMs > 0 then req.connectTimeoutMs else client.defaultConnectTimeout
-    Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.TIMEOUT_MS timeout.toInt64
-    Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.CONNECTTIMEOUT_MS connectTimeout.toInt64
-
-    -- Set redirect behavior
-    Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.FOLLOWLOCATION (if req.followRedirects then 1 else 0)
-    Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.MAXREDIRS req.maxRedirects.toNat.toInt64
-
-    -- Set SSL options
-    Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.SSL_VERIFYPEER (if req.ssl.verifyPeer then 1 else 0)
-    Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.SSL_VERIFYHOST (if req.ssl.verifyHost then 2 else 0)
-    if let some caPath := req.ssl.caCertPath then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.CAINFO caPath
-    if let some certPath := req.ssl.clientCertPath then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.SSLCERT certPath
-    if let some keyPath := req.ssl.clientKeyPath then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.SSLKEY keyPath
-
-    -- Set user agent
-    Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.USERAGENT req.userAgent
-
-    -- Set accept encoding
-    if let some enc := req.acceptEncoding then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.ACCEPT_ENCODING enc
-
-    -- Enable verbose if requested
-    if req.verbose then
-      Wisp.FFI.setoptLong easy Wisp.FFI.CurlOpt.VERBOSE 1
-
-    -- Set cookie jar options
-    if let some cookieFile := req.cookieJar.cookieFile then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.COOKIEFILE cookieFile
-    if let some jarFile := req.cookieJar.cookieJarFile then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.COOKIEJAR jarFile
-    if let some cookies := req.cookieJar.cookies then
-      Wisp.FFI.setoptString easy Wisp.FFI.CurlOpt.COOKIE cookies
-
-    -- Create channel for body chunks
-    let channel ← Std.CloseableChannel.Sync.new
+    -- Create a bounded channel for body chunks so a slow consumer applies
+    -- backpressure instead of buffering the whole body
+    let channel ← Std.CloseableChannel.Sync.new (capacity := some streamChannelCapacity)
 
     -- Create refs for tracking
     let headersReported ← IO.mkRef false
-
-    -- Enqueue on async manager
-    let manager ← getManager
-    let id ← manager.nextId.atomically do
-      let current ← get
-      set (current + 1)
-      return current
-    Wisp.FFI.setoptPrivate easy id
+    let stalled ← IO.mkRef none
+    let finished ← IO.mkRef false
 
     let promise ← IO.Promise.new
-    let pending : Pending := .streaming { easy, channel, promise, headersReported }
-    let _ ← Std.CloseableChannel.Sync.send manager.chan (.add id pending)
+    let pending : Pending := .streaming { easy, channel, promise, headersReported, stalled, finished, upload }
+    let _ ← submitRequest client req.url pending (← admissionOf client req)
 
     return promise.result!
   catch e =>
@@ -794,6 +1913,17 @@ def executeStreaming (client : Client) (req : Wisp.Request) :
     promise.resolve (.error (.ioError (toString e)))
     return promise.result!
 
+/-- Execute a request with streaming response.
+    Returns a StreamingResponse where body chunks arrive via channel.
+    The promise resolves when headers are received. Streamed responses are
+    never cached, but a successful unsafe request invalidates the URL. -/
+def executeStreaming (client : Client) (req : Wisp.Request) :
+    IO (Task (Wisp.WispResult Wisp.StreamingResponse)) := do
+  let task ← executeStreamingDirect client req
+  match client.cache with
+  | some cache => cache.invalidateAfter req task (·.status)
+  | none => return task
+
 /-- Simple GET request -/
 def get (client : Client) (url : String) : IO (Task (Wisp.WispResult Wisp.Response)) :=
   client.execute (Wisp.Request.get url)
@@ -823,6 +1953,53 @@ def delete (client : Client) (url : String) : IO (Task (Wisp.WispResult Wisp.Res
 def head (client : Client) (url : String) : IO (Task (Wisp.WispResult Wisp.Response)) :=
   client.execute (Wisp.Request.head url)
 
+/-- Compile the headers, auth and options of `base`, with the client defaults
+    and shared caches, into a native template. Requests made through the
+    result configure their handle with one call to it, then set only their
+    URL, method, body and extra headers. -/
+def prepare (client : Client) (base : Wisp.Request := Wisp.Request.get "") : IO PreparedRequest := do
+  let native ← Wisp.FFI.templateNew
+  if let some share ← acquireShare client.share then
+    Wisp.FFI.templateSetShare native share
+  applyOptions client base {
+    long := Wisp.FFI.templateSetLong native
+    string := fun option value => Wisp.FFI.templateSetString native option value
+    header := Wisp.FFI.templateAddHeader native
+  }
+  return { base, client := { client with template := some { base, native } } }
+
 end Client
 
+namespace PreparedRequest
+
+/-- The request sent for `url`: the base request with this method and body,
+    and `headers` added to (or replacing) its own -/
+def request (p : PreparedRequest) (url : String) (method : Wisp.Method := p.base.method)
+    (body : Wisp.Body := p.base.body) (headers : Wisp.Headers := #[]) : Wisp.Request :=
+  { p.base with url, method, body, headers := p.base.headers ++ headers }
+
+/-- Send a request shaped by the template -/
+def execute (p : PreparedRequest) (url : String) (method : Wisp.Method := p.base.method)
+    (body : Wisp.Body := p.base.body) (headers : Wisp.Headers := #[])
+    : IO (Task (Wisp.WispResult Wisp.Response)) :=
+  p.client.execute (p.request url method body headers)
+
+/-- Send several requests shaped by the template, see `Client.executeBatch`.
+    Only the URL, method, body and headers of each are used. -/
+def executeBatch (p : PreparedRequest) (reqs : Array Wisp.Request)
+    : IO (Array (Task (Wisp.WispResult Wisp.Response))) :=
+  p.client.executeBatch (reqs.map fun r => p.request r.url r.method r.body r.headers)
+
+/-- GET through the template -/
+def get (p : PreparedRequest) (url : String) (headers : Wisp.Headers := #[])
+    : IO (Task (Wisp.WispResult Wisp.Response)) :=
+  p.execute url .GET .empty headers
+
+/-- POST a JSON body through the template -/
+def postJson (p : PreparedRequest) (url : String) (json : String) (headers : Wisp.Headers := #[])
+    : IO (Task (Wisp.WispResult Wisp.Response)) :=
+  p.execute url .POST (.json json) headers
+
+end PreparedRequest
+
 end Wisp.HTTP
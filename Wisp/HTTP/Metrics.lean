@@ -0,0 +1,203 @@
+/-
+  Wisp Client Metrics
+  Counters, log-bucketed histograms and gauges kept by the background workers,
+  with export in the Prometheus text format
+-/
+
+import Wisp.Core.Types
+import Wisp.Core.Error
+import Wisp.Core.Retry
+import Std.Data.HashMap
+
+namespace Wisp.HTTP
+
+/-- Number of finite histogram buckets. Bucket `i` counts observations up to
+    `2^i` units, so 17 buckets reach 65536 ms (or µs). -/
+def histogramBuckets : Nat := 17
+
+/-- Histogram with power-of-two bucket bounds -/
+structure Histogram where
+  /-- Observations per bucket (not cumulative); the last one counts those
+      above every bound -/
+  counts : Array Nat := Array.replicate (histogramBuckets + 1) 0
+  /-- Number of observations -/
+  count : Nat := 0
+  /-- Sum of all observations -/
+  sum : Float := 0.0
+  deriving Repr, Inhabited
+
+namespace Histogram
+
+/-- Index of the bucket an observation falls into -/
+def bucketOf (value : Nat) : Nat :=
+  if value ≤ 1 then 0 else min histogramBuckets (Nat.log2 (value - 1) + 1)
+
+/-- Record one observation -/
+def observe (h : Histogram) (value : Float) : Histogram :=
+  let value := if value < 0.0 then 0.0 else value
+  let i := bucketOf value.ceil.toUInt64.toNat
+  { h with counts := h.counts.modify i (· + 1), count := h.count + 1, sum := h.sum + value }
+
+/-- Combine two histograms -/
+def merge (a b : Histogram) : Histogram :=
+  { counts := a.counts.zipWith (· + ·) b.counts, count := a.count + b.count, sum := a.sum + b.sum }
+
+/-- Upper bound of bucket `i` -/
+def bound (i : Nat) : Nat := 2 ^ i
+
+end Histogram
+
+/-- Labels of status classes: index 1 to 5 are 1xx to 5xx, 0 anything else -/
+private def statusClassLabels : Array String := #["other", "1xx", "2xx", "3xx", "4xx", "5xx"]
+
+/-- Label of a failure class -/
+def errorClassLabel : Wisp.RetryErrorClass → String
+  | .timeout => "timeout"
+  | .connect => "connect"
+  | .reset => "reset"
+  | .tls => "tls"
+  | .other => "other"
+
+/-- Origins tracked separately before the rest share one latency histogram -/
+private def maxMetricOrigins : Nat := 1024
+
+/-- What the background workers have done since they started -/
+structure ClientMetrics where
+  /-- Requests accepted by the workers -/
+  started : Nat := 0
+  /-- Transfers that ended with a response, by status class (see `statusClass`) -/
+  completed : Array Nat := Array.replicate 6 0
+  /-- Transfers that failed, by error class label -/
+  failed : Std.HashMap String Nat := {}
+  /-- Attempts repeated by a retry policy -/
+  retries : Nat := 0
+  /-- Duplicates sent by hedging -/
+  hedges : Nat := 0
+  /-- Transfer latency in milliseconds, per origin -/
+  latency : Std.HashMap String Histogram := {}
+  /-- Transfers that opened a new connection -/
+  connectionsOpened : Nat := 0
+  /-- Transfers that reused a pooled connection -/
+  connectionsReused : Nat := 0
+  /-- Response body bytes received -/
+  bytesIn : Nat := 0
+  /-- Request body bytes sent -/
+  bytesOut : Nat := 0
+  /-- Time each manager loop iteration spent working (not waiting), in µs -/
+  loopTime : Histogram := {}
+  /-- Requests in curl's hands when the snapshot was taken -/
+  inflight : Nat := 0
+  /-- Requests waiting for the scheduler when the snapshot was taken -/
+  queued : Nat := 0
+  deriving Inhabited
+
+namespace ClientMetrics
+
+/-- Index into `completed` for a status -/
+def statusClass (status : UInt32) : Nat :=
+  let c := (status / 100).toNat
+  if c ≥ 1 && c ≤ 5 then c else 0
+
+/-- Completed transfers with a status in the class, e.g. `completedIn 5` for 5xx -/
+def completedIn (m : ClientMetrics) (cls : Nat) : Nat :=
+  m.completed.getD cls 0
+
+/-- Failed transfers in total -/
+def totalFailed (m : ClientMetrics) : Nat :=
+  m.failed.fold (init := 0) fun acc _ n => acc + n
+
+/-- Account for a finished transfer: its status, or the class of its failure -/
+def recordTransfer (m : ClientMetrics) (origin : String) (t : Wisp.TransferMetrics)
+    (outcome : Except Wisp.RetryErrorClass UInt32) : ClientMetrics :=
+  let m := match outcome with
+    | .ok status => { m with completed := m.completed.modify (statusClass status) (· + 1) }
+    | .error cls =>
+      let label := errorClassLabel cls
+      { m with failed := m.failed.insert label ((m.failed.getD label 0) + 1) }
+  let origin := if m.latency.contains origin || m.latency.size < maxMetricOrigins then origin else "other"
+  let histogram := (m.latency.getD origin {}).observe (t.totalTime * 1000.0)
+  -- A failed transfer may never have reached a connection
+  let connected := outcome matches .ok _
+  { m with
+    latency := m.latency.insert origin histogram
+    connectionsOpened := m.connectionsOpened + (if connected && !t.connectionReused then 1 else 0)
+    connectionsReused := m.connectionsReused + (if connected && t.connectionReused then 1 else 0)
+    bytesIn := m.bytesIn + t.bytesDownloaded
+    bytesOut := m.bytesOut + t.bytesUploaded }
+
+/-- Combine the metrics of two workers -/
+def merge (a b : ClientMetrics) : ClientMetrics :=
+  { started := a.started + b.started
+    completed := a.completed.zipWith (· + ·) b.completed
+    failed := b.failed.fold (init := a.failed) fun acc k n => acc.insert k (acc.getD k 0 + n)
+    retries := a.retries + b.retries
+    hedges := a.hedges + b.hedges
+    latency := b.latency.fold (init := a.latency) fun acc k h =>
+      acc.insert k (match acc.get? k with | some g => g.merge h | none => h)
+    connectionsOpened := a.connectionsOpened + b.connectionsOpened
+    connectionsReused := a.connectionsReused + b.connectionsReused
+    bytesIn := a.bytesIn + b.bytesIn
+    bytesOut := a.bytesOut + b.bytesOut
+    loopTime := a.loopTime.merge b.loopTime
+    inflight := a.inflight + b.inflight
+    queued := a.queued + b.queued }
+
+private def escapeLabel (s : String) : String :=
+  s.replace "\\" "\\\\" |>.replace "\"" "\\\"" |>.replace "\n" "\\n"
+
+/-- Prometheus lines of a histogram, with cumulative `le` buckets. `scale`
+    converts bucket bounds and the sum to the exported unit. -/
+private def histogramLines (name : String) (labels : String) (h : Histogram) (scale : Float)
+    : Array String := Id.run do
+  let sep := if labels.isEmpty then "" else ","
+  let mut out : Array String := #[]
+  let mut cumulative := 0
+  for i in [0:histogramBuckets] do
+    cumulative := cumulative + h.counts.getD i 0
+    let le := (Histogram.bound i).toFloat * scale
+    out := out.push s!"{name}_bucket\{{labels}{sep}le=\"{le}\"} {cumulative}"
+  out := out.push s!"{name}_bucket\{{labels}{sep}le=\"+Inf\"} {h.count}"
+  let braces := if labels.isEmpty then "" else "{" ++ labels ++ "}"
+  out := out.push s!"{name}_sum{braces} {h.sum * scale}"
+  out := out.push s!"{name}_count{braces} {h.count}"
+  return out
+
+/-- Render in the Prometheus text exposition format. Latencies and loop times
+    are exported in seconds. -/
+def toPrometheus (m : ClientMetrics) : String := Id.run do
+  let mut out : Array String := #[]
+  let counter (name help : String) (value : Nat) : Array String :=
+    #[s!"# HELP {name} {help}", s!"# TYPE {name} counter", s!"{name} {value}"]
+  let gauge (name help : String) (value : Nat) : Array String :=
+    #[s!"# HELP {name} {help}", s!"# TYPE {name} gauge", s!"{name} {value}"]
+  out := out ++ counter "wisp_requests_started_total" "Requests accepted by the workers" m.started
+  out := out ++ #["# HELP wisp_requests_completed_total Transfers that ended with a response",
+    "# TYPE wisp_requests_completed_total counter"]
+  for i in [0:statusClassLabels.size] do
+    out := out.push s!"wisp_requests_completed_total\{status_class=\"{statusClassLabels[i]!}\"} {m.completedIn i}"
+  out := out ++ #["# HELP wisp_requests_failed_total Transfers that failed, by error class",
+    "# TYPE wisp_requests_failed_total counter"]
+  for cls in #[Wisp.RetryErrorClass.timeout, .connect, .reset, .tls, .other] do
+    let label := errorClassLabel cls
+    out := out.push s!"wisp_requests_failed_total\{error_class=\"{label}\"} {m.failed.getD label 0}"
+  out := out ++ counter "wisp_retries_total" "Attempts repeated by a retry policy" m.retries
+  out := out ++ counter "wisp_hedges_total" "Duplicates sent by hedging" m.hedges
+  out := out ++ counter "wisp_connections_opened_total" "Transfers that opened a new connection" m.connectionsOpened
+  out := out ++ counter "wisp_connections_reused_total" "Transfers that reused a pooled connection" m.connectionsReused
+  out := out ++ counter "wisp_bytes_received_total" "Response body bytes received" m.bytesIn
+  out := out ++ counter "wisp_bytes_sent_total" "Request body bytes sent" m.bytesOut
+  out := out ++ gauge "wisp_requests_inflight" "Requests being transferred" m.inflight
+  out := out ++ gauge "wisp_requests_queued" "Requests waiting for a connection slot" m.queued
+  out := out ++ #["# HELP wisp_request_duration_seconds Transfer latency per origin",
+    "# TYPE wisp_request_duration_seconds histogram"]
+  let origins := m.latency.fold (init := #[]) fun acc origin h => acc.push (origin, h)
+  for (origin, h) in origins.qsort (·.1 < ·.1) do
+    out := out ++ histogramLines "wisp_request_duration_seconds" s!"origin=\"{escapeLabel origin}\"" h 0.001
+  out := out ++ #["# HELP wisp_manager_loop_seconds Work done per manager loop iteration",
+    "# TYPE wisp_manager_loop_seconds histogram"]
+  out := out ++ histogramLines "wisp_manager_loop_seconds" "" m.loopTime 0.000001
+  return "\n".intercalate out.toList ++ "\n"
+
+end ClientMetrics
+
+end Wisp.HTTP
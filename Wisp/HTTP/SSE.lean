@@ -4,6 +4,7 @@
 -/
 
 import Wisp.Core.Streaming
+import Wisp.FFI.Easy
 
 namespace Wisp.HTTP.SSE
 
@@ -61,26 +62,30 @@ end ParserState
 structure Stream where
   /-- The underlying streaming response body channel -/
   bodyChannel : Std.CloseableChannel.Sync ByteArray
-  /-- Buffer for accumulating partial data between chunks -/
-  buffer : IO.Ref String
+  /-- Pieces of the current, not yet terminated line -/
+  partialLine : IO.Ref (Array ByteArray)
+  /-- The last chunk ended in CR, so an LF starting the next one ends the same line -/
+  skipLF : IO.Ref Bool
   /-- Last event ID received (for reconnection) -/
   lastEventId : IO.Ref (Option String)
   /-- Current parser state -/
   parserState : IO.Ref ParserState
   /-- Queue of parsed events ready to be consumed -/
-  eventQueue : IO.Ref (Array Event)
+  eventQueue : IO.Ref (Std.Queue Event)
 
 namespace Stream
 
 /-- Create an SSE stream from a streaming response -/
 def fromStreaming (resp : Wisp.StreamingResponse) : IO Stream := do
-  let buffer ← IO.mkRef ""
+  let partialLine ← IO.mkRef #[]
+  let skipLF ← IO.mkRef false
   let lastEventId ← IO.mkRef none
   let parserState ← IO.mkRef ParserState.reset
-  let eventQueue ← IO.mkRef #[]
+  let eventQueue ← IO.mkRef .empty
   return {
     bodyChannel := resp.bodyChannel
-    buffer := buffer
+    partialLine := partialLine
+    skipLF := skipLF
     lastEventId := lastEventId
     parserState := parserState
     eventQueue := eventQueue
@@ -129,35 +134,105 @@ private def parseLine (state : ParserState) (line : String) : ParserState × Opt
     -- Unknown field, ignore per spec
     (state, none)
 
-/-- Process buffered text into lines, keeping incomplete final line in buffer -/
-private def processBuffer (text : String) : Array String × String :=
-  -- Split on \n (SSE uses \n, \r\n, or \r as line endings)
-  -- We normalize by replacing \r\n and \r with \n first
-  let normalized := text.replace "\r\n" "\n" |>.replace "\r" "\n"
-  let parts := normalized.splitOn "\n"
-  match parts with
-  | [] => (#[], "")
-  | [single] =>
-    -- No newline found, keep everything in buffer
-    (#[], single)
-  | _ =>
-    -- Last element is either empty (if text ended with \n) or incomplete line
-    let lines := parts.dropLast.toArray
-    let remaining := parts.getLast!
-    (lines, remaining)
+/-- Decode UTF-8, keeping every valid character and replacing each maximal
+    invalid subsequence with one U+FFFD -/
+private def decodeUtf8Lossy (bytes : ByteArray) : String := Id.run do
+  let mut out := ""
+  let mut i := 0
+  while i < bytes.size do
+    let b0 := bytes[i]!.toNat
+    if b0 < 0x80 then
+      out := out.push (Char.ofNat b0)
+      i := i + 1
+      continue
+    -- Sequence length and the range allowed for the second byte, which rules
+    -- out overlong forms, surrogates and code points past U+10FFFF
+    let (len, lo, hi) :=
+      if 0xC2 ≤ b0 && b0 ≤ 0xDF then (2, 0x80, 0xBF)
+      else if b0 == 0xE0 then (3, 0xA0, 0xBF)
+      else if b0 == 0xED then (3, 0x80, 0x9F)
+      else if 0xE1 ≤ b0 && b0 ≤ 0xEF then (3, 0x80, 0xBF)
+      else if b0 == 0xF0 then (4, 0x90, 0xBF)
+      else if 0xF1 ≤ b0 && b0 ≤ 0xF3 then (4, 0x80, 0xBF)
+      else if b0 == 0xF4 then (4, 0x80, 0x8F)
+      else (0, 0, 0)
+    if len == 0 then
+      out := out.push '�'
+      i := i + 1
+      continue
+    let mut cp := b0 &&& (0xFF >>> (len + 1))
+    let mut n := 1
+    let mut valid := true
+    while valid && n < len do
+      let b := if i + n < bytes.size then bytes[i + n]!.toNat else 0
+      let (l, h) := if n == 1 then (lo, hi) else (0x80, 0xBF)
+      if l ≤ b && b ≤ h then
+        cp := (cp <<< 6) ||| (b &&& 0x3F)
+        n := n + 1
+      else
+        valid := false
+    out := out.push (if valid then Char.ofNat cp else '�')
+    i := i + n
+  return out
+
+/-- Decode a complete line. Line ends never fall inside a multibyte character,
+    so only genuinely invalid bytes are replaced. -/
+private def decodeLine (bytes : ByteArray) : String :=
+  match String.fromUTF8? bytes with
+  | some s => s
+  | none => decodeUtf8Lossy bytes
+
+/-- Concatenate the pieces of a line that spanned several chunks -/
+private def joinPieces (pieces : Array ByteArray) : ByteArray :=
+  let total := pieces.foldl (fun n piece => n + piece.size) 0
+  pieces.foldl (· ++ ·) (ByteArray.emptyWithCapacity total)
+
+/-- Parse a newly arrived chunk. Only the new bytes are scanned; a line left
+    unterminated at the end of the chunk is kept for the next one. Lines may
+    end in LF, CRLF or a lone CR, including a CRLF split across chunks. -/
+private def feed (s : Stream) (chunk : ByteArray) : IO Unit := do
+  let mut state ← s.parserState.get
+  let mut queue ← s.eventQueue.get
+  let mut pieces ← s.partialLine.get
+  let mut pos := 0
+  if (← s.skipLF.get) then
+    s.skipLF.set false
+    if chunk.size > 0 && chunk[0]! == 10 then
+      pos := 1
+  while pos < chunk.size do
+    let eol := (Wisp.FFI.findLineEnd chunk pos.toUSize).toNat
+    if eol >= chunk.size then
+      pieces := pieces.push (chunk.extract pos chunk.size)
+      pos := chunk.size
+    else
+      let piece := chunk.extract pos eol
+      let line := if pieces.isEmpty then piece else joinPieces (pieces.push piece)
+      pieces := #[]
+      let (newState, event?) := parseLine state (decodeLine line)
+      state := newState
+      if let some event := event? then
+        queue := queue.enqueue event
+      pos := eol + 1
+      if chunk[eol]! == 13 then
+        if eol + 1 == chunk.size then
+          s.skipLF.set true
+        else if chunk[eol + 1]! == 10 then
+          pos := eol + 2
+  s.parserState.set state
+  s.eventQueue.set queue
+  s.partialLine.set pieces
 
 /-- Read the next SSE event from the stream (blocks until event or EOF) -/
 partial def recv (s : Stream) : IO (Option Event) := do
   -- First check if we have queued events
-  let queue ← s.eventQueue.get
-  if h : queue.size > 0 then
-    let event := queue[0]
-    s.eventQueue.set (queue.eraseIdx 0)
+  match (← s.eventQueue.get).dequeue? with
+  | some (event, rest) =>
+    s.eventQueue.set rest
     -- Update lastEventId if present
     if let some id := event.id then
       s.lastEventId.set (some id)
     return some event
-  else
+  | none =>
     -- Need to read more data and parse
     let chunk? ← s.bodyChannel.recv
     match chunk? with
@@ -173,34 +248,8 @@ partial def recv (s : Stream) : IO (Option Event) := do
       else
         return none
     | some chunk =>
-      -- Decode chunk and append to buffer
-      let chunkStr := String.fromUTF8! chunk
-      let buf ← s.buffer.get
-      let combined := buf ++ chunkStr
-      let (lines, remaining) := processBuffer combined
-      s.buffer.set remaining
-
-      -- Parse each line
-      let mut state ← s.parserState.get
-      let mut events : Array Event := #[]
-      for line in lines do
-        let (newState, maybeEvent) := parseLine state line
-        state := newState
-        if let some event := maybeEvent then
-          events := events.push event
-      s.parserState.set state
-
-      -- If we got events, queue them and return first
-      if h : events.size > 0 then
-        let first := events[0]
-        if events.size > 1 then
-          s.eventQueue.set (events.eraseIdx 0)
-        if let some id := first.id then
-          s.lastEventId.set (some id)
-        return some first
-      else
-        -- No complete events yet, recurse to read more
-        s.recv
+      s.feed chunk
+      s.recv
 
 /-- Iterate over all events in the stream -/
 partial def forEachEvent (s : Stream) (f : Event → IO Unit) : IO Unit := do
@@ -0,0 +1,70 @@
+/-
+  Wisp Shared Caches
+  Process-wide curl share handles reused by every request and WebSocket
+-/
+
+import Wisp.FFI.Share
+import Std.Sync.Mutex
+
+namespace Wisp.HTTP
+
+/-- Caches that easy handles share with each other through a curl share handle -/
+structure ShareOptions where
+  /-- Share resolved host names -/
+  dns : Bool := true
+  /-- Share TLS session tickets so reconnects can resume instead of doing a full handshake -/
+  sslSessions : Bool := true
+  /-- Share the connection pool. Off by default: libcurl does not support
+      using one connection cache from several threads at once, and each
+      worker's multi handle already pools (and limits) its own connections,
+      with every origin routed to one worker so they are reused. -/
+  connections : Bool := false
+  /-- Share the cookie store -/
+  cookies : Bool := false
+  deriving Repr, BEq, Inhabited
+
+namespace ShareOptions
+
+/-- Share nothing: every handle gets private caches -/
+def disabled : ShareOptions :=
+  { dns := false, sslSessions := false, connections := false, cookies := false }
+
+/-- Check whether anything is shared -/
+def isEnabled (o : ShareOptions) : Bool :=
+  o.dns || o.sslSessions || o.connections || o.cookies
+
+private def lockData (o : ShareOptions) : Array UInt32 := Id.run do
+  let mut data := #[]
+  if o.dns then data := data.push Wisp.FFI.CurlLockData.DNS
+  if o.sslSessions then data := data.push Wisp.FFI.CurlLockData.SSL_SESSION
+  if o.connections then data := data.push Wisp.FFI.CurlLockData.CONNECT
+  if o.cookies then data := data.push Wisp.FFI.CurlLockData.COOKIE
+  data
+
+end ShareOptions
+
+/-- One share handle per distinct configuration, created on first use -/
+initialize shareRegistry : Std.Mutex (Array (ShareOptions × Wisp.FFI.Share)) ←
+  Std.Mutex.new #[]
+
+/-- Get the process-wide share handle for these options, if anything is shared. -/
+def acquireShare (opts : ShareOptions) : IO (Option Wisp.FFI.Share) := do
+  if !opts.isEnabled then
+    return none
+  shareRegistry.atomically do
+    let registry ← get
+    match registry.find? (·.1 == opts) with
+    | some (_, share) => return some share
+    | none =>
+      let share ← Wisp.FFI.shareInit
+      for data in opts.lockData do
+        Wisp.FFI.shareAdd share data
+      set (registry.push (opts, share))
+      return some share
+
+/-- Attach an easy handle to the shared caches selected by `opts`. -/
+def applyShare (easy : Wisp.FFI.Easy) (opts : ShareOptions) : IO Unit := do
+  if let some share ← acquireShare opts then
+    Wisp.FFI.setoptShare easy share
+
+end Wisp.HTTP
@@ -7,6 +7,7 @@ import Wisp.Core.Types
 import Wisp.Core.Error
 import Wisp.Core.WebSocket
 import Wisp.FFI.Easy
+import Wisp.HTTP.Share
 
 namespace Wisp.WebSocket
 
@@ -45,7 +46,8 @@ def isOpen (conn : Connection) : IO Bool := do
 /-- Connect to a WebSocket server.
     The URL should use ws:// or wss:// protocol.
     Returns a Connection on successful handshake. -/
-def connect (url : String) (headers : Headers := #[]) : IO (WispResult Connection) := do
+def connect (url : String) (headers : Headers := #[])
+    (share : Wisp.HTTP.ShareOptions := {}) : IO (WispResult Connection) := do
   -- Check WebSocket support
   let supported ← FFI.wsCheckSupport
   if !supported then
@@ -59,6 +61,7 @@ def connect (url : String) (headers : Headers := #[]) : IO (WispResult Connectio
   try
     -- Initialize easy handle
     let easy ← FFI.easyInit
+    Wisp.HTTP.applyShare easy share
 
     -- Setup callbacks for handshake response
     FFI.setupWriteCallback easy
@@ -123,8 +126,24 @@ def sendPing (conn : Connection) (data : ByteArray := ByteArray.empty) : IO (Wis
 def sendPong (conn : Connection) (data : ByteArray := ByteArray.empty) : IO (WispResult Unit) :=
   conn.send (WebSocketFrame.pong data)
 
-/-- Receive a WebSocket frame (non-blocking).
-    Returns none if no data available. -/
+/-- Send one piece of a fragmented message. Pass the message's type with
+    every piece and set `final` on the last one. -/
+def sendFragment (conn : Connection) (frameType : WebSocketFrameType) (data : ByteArray)
+    (final : Bool) : IO (WispResult Unit) := do
+  let state ← conn.getState
+  if state != .open then
+    return .error (.ioError "WebSocket connection is not open")
+
+  try
+    let flags := frameType.toCurlFlags ||| (if final then 0 else FFI.CurlWs.CONT)
+    FFI.wsSend conn.easy data flags
+    return .ok ()
+  catch e =>
+    return .error (.ioError s!"WebSocket send failed: {e}")
+
+/-- Receive a WebSocket message (non-blocking). Fragmented messages are
+    returned whole, once their last fragment arrives.
+    Returns none if no complete message is available. -/
 def recv (conn : Connection) : IO (WispResult (Option WebSocketFrame)) := do
   let state ← conn.getState
   if state == .closed then
@@ -148,26 +167,60 @@ def recv (conn : Connection) : IO (WispResult (Option WebSocketFrame)) := do
   catch e =>
     return .error (.ioError s!"WebSocket recv failed: {e}")
 
+/-- Receive the next piece of a message (non-blocking), without waiting for
+    the rest of it. Lets large messages be processed as they stream in.
+    Returns none if no data available. Do not interleave with `recv` while a
+    message is partially received. -/
+def recvFragment (conn : Connection) : IO (WispResult (Option WebSocketFragment)) := do
+  let state ← conn.getState
+  if state == .closed then
+    return .error (.ioError "WebSocket connection is closed")
+
+  try
+    match ← FFI.wsRecvFragment conn.easy with
+    | none => return .ok none
+    | some (payload, flags, bytesleft) =>
+      let frameType := WebSocketFrameType.fromCurlFlags flags
+      let final := bytesleft == 0 && flags &&& FFI.CurlWs.CONT == 0
+      if frameType == .close && final then
+        conn.stateRef.set .closed
+      return .ok (some { frameType, payload, final })
+  catch e =>
+    return .error (.ioError s!"WebSocket recv failed: {e}")
+
+/-- Set the largest message `recv` will assemble, in bytes (default 64 MiB).
+    Larger messages are dropped and `recv` reports an error for each. -/
+def setMaxMessageSize (conn : Connection) (maxBytes : Nat) : IO Unit :=
+  FFI.wsSetMaxMessage conn.easy maxBytes.toUInt64
+
+/-- Wait until the socket is readable or `timeout` milliseconds pass -/
+private def waitReadable (conn : Connection) (timeout : UInt32) : IO (WispResult Unit) := do
+  try
+    let _ ← FFI.wsWait conn.easy timeout
+    return .ok ()
+  catch e =>
+    return .error (.ioError s!"WebSocket wait failed: {e}")
+
 /-- Receive a WebSocket frame (blocking with timeout).
-    Polls until a frame is received or timeout expires.
-    timeout is in milliseconds. -/
+    Sleeps on the socket until a frame arrives, so it returns as soon as one
+    does. timeout is in milliseconds; returns none if it expires. -/
 partial def recvTimeout (conn : Connection) (timeout : UInt32 := 30000) : IO (WispResult (Option WebSocketFrame)) := do
   let startTime ← IO.monoMsNow
   let endTime : Nat := startTime + timeout.toNat
 
   let rec loop : IO (WispResult (Option WebSocketFrame)) := do
-    let now ← IO.monoMsNow
-    if now >= endTime then
-      return .ok none
-
     let result ← conn.recv
     match result with
     | .error e => return .error e
     | .ok (some frame) => return .ok (some frame)
     | .ok none =>
-      -- No data available, sleep briefly and retry
-      IO.sleep 10
-      loop
+      let now ← IO.monoMsNow
+      if now >= endTime then
+        return .ok none
+      -- Nothing buffered: block until the socket has data
+      match ← conn.waitReadable (endTime - now).toUInt32 with
+      | .error e => return .error e
+      | .ok () => loop
 
   loop
 
@@ -191,6 +244,9 @@ def close (conn : Connection) (code : UInt16 := WebSocketCloseCode.normal) (reas
     conn.stateRef.set .closed
     return .error (.ioError s!"WebSocket close failed: {e}")
 
+/-- Longest `onMessage` sleeps on an idle connection before rechecking its state -/
+private def idleWaitMs : UInt32 := 1000
+
 /-- Run a message handler loop until the connection closes.
     Automatically responds to ping frames with pong.
     The handler is called for each non-control frame received. -/
@@ -204,9 +260,11 @@ partial def onMessage (conn : Connection) (handler : WebSocketFrame → IO Unit)
     match result with
     | .error e => return .error e
     | .ok none =>
-      -- No data, sleep briefly
-      IO.sleep 10
-      loop
+      -- No data: block on the socket, waking now and then to notice a close
+      -- from another thread
+      match ← conn.waitReadable idleWaitMs with
+      | .error e => return .error e
+      | .ok () => loop
     | .ok (some frame) =>
       -- Auto-respond to ping with pong
       if frame.isPing then
@@ -230,7 +288,8 @@ partial def onMessage (conn : Connection) (handler : WebSocketFrame → IO Unit)
 end Connection
 
 /-- Convenience function to connect to a WebSocket server -/
-def connect (url : String) (headers : Headers := #[]) : IO (WispResult Connection) :=
-  Connection.connect url headers
+def connect (url : String) (headers : Headers := #[])
+    (share : Wisp.HTTP.ShareOptions := {}) : IO (WispResult Connection) :=
+  Connection.connect url headers share
 
 end Wisp.WebSocket
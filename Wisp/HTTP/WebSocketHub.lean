@@ -0,0 +1,362 @@
+/-
+  Wisp WebSocket Hub
+  Many WebSocket connections served by one event loop on a curl multi handle
+-/
+
+import Wisp.Core.Types
+import Wisp.Core.Error
+import Wisp.Core.WebSocket
+import Wisp.FFI.Easy
+import Wisp.FFI.Multi
+import Wisp.HTTP.Share
+import Wisp.HTTP.WebSocket
+import Std.Data.HashMap
+import Std.Sync.Channel
+import Std.Sync.Mutex
+
+namespace Wisp.WebSocket
+
+private inductive HubCommand where
+  | connect (id : UInt64) (easy : FFI.Easy) (inbox : Std.CloseableChannel.Sync WebSocketFrame)
+      (stateRef : IO.Ref ConnectionState) (opened : IO.Promise (WispResult Unit))
+  | send (id : UInt64) (frame : WebSocketFrame) (done : IO.Promise (WispResult Unit))
+  | close (id : UInt64) (code : UInt16) (reason : String)
+
+/-- A frame queued for writing, with how much of its payload is out -/
+private structure Outgoing where
+  payload : ByteArray
+  flags : UInt32
+  sent : UInt64 := 0
+  /-- Resolved once the whole frame is written; none for frames the hub sends itself -/
+  done : Option (IO.Promise (WispResult Unit)) := none
+
+/-- A connection as seen by the hub's event loop -/
+private structure HubEntry where
+  easy : FFI.Easy
+  inbox : Std.CloseableChannel.Sync WebSocketFrame
+  stateRef : IO.Ref ConnectionState
+  /-- Resolved when the handshake finishes; none once the connection is open -/
+  opened : Option (IO.Promise (WispResult Unit))
+  /-- Frames waiting for the socket, oldest first. The first may be partly
+      written, in which case nothing else may go out before its rest. -/
+  outbox : Array Outgoing := #[]
+  /-- Drop the connection once the outbox has drained (a close frame is queued) -/
+  closing : Bool := false
+
+/-- One event loop serving many WebSocket connections. Handshakes run
+    without blocking, inbound frames are delivered to each connection's
+    `inbox`, and sends queued from any thread are written in batches each
+    time the loop wakes. -/
+structure Hub where
+  private mk ::
+  private chan : Std.CloseableChannel.Sync HubCommand
+  private multi : FFI.Multi
+  private nextId : Std.Mutex UInt64
+  private task : Task (Except IO.Error Unit)
+
+/-- A WebSocket connection served by a `Hub` -/
+structure HubConnection where
+  private mk ::
+  /-- Identifier of the connection within its hub -/
+  id : UInt64
+  /-- URL connected to -/
+  url : String
+  /-- Frames received on this connection, in order. Closed when the connection closes. -/
+  inbox : Std.CloseableChannel.Sync WebSocketFrame
+  private stateRef : IO.Ref ConnectionState
+  private chan : Std.CloseableChannel.Sync HubCommand
+  private multi : FFI.Multi
+
+namespace Hub
+
+/-- Resolve a promise that nobody may be waiting on any more -/
+private def settle (promise : IO.Promise (WispResult Unit)) (result : WispResult Unit) : IO Unit := do
+  try promise.resolve result catch _ => pure ()
+
+/-- Forget a connection: stop waiting on it, fail its unsent frames and close
+    its inbox -/
+private def dropEntry (multi : FFI.Multi) (entry : HubEntry) (reason : String) : IO Unit := do
+  if let some opened := entry.opened then
+    settle opened (.error (.ioError reason))
+  for out in entry.outbox do
+    if let some done := out.done then
+      settle done (.error (.ioError reason))
+  entry.stateRef.set .closed
+  let _ ← Std.CloseableChannel.Sync.close entry.inbox
+  try FFI.multiRemoveHandle multi entry.easy catch _ => pure ()
+
+/-- Queue a frame behind those already waiting -/
+private def enqueue (entry : HubEntry) (frame : WebSocketFrame)
+    (done : Option (IO.Promise (WispResult Unit)) := none) : HubEntry :=
+  { entry with outbox := entry.outbox.push
+      { payload := frame.payload, flags := frame.frameType.toCurlFlags, done } }
+
+/-- Write queued frames until the socket would block. The rest is written
+    once the socket becomes writable again. -/
+private partial def flushOutbox (multi : FFI.Multi) (entry : HubEntry) : IO HubEntry := do
+  match entry.outbox[0]? with
+  | none =>
+    FFI.multiWebSocketWantWrite multi entry.easy false
+    return entry
+  | some out =>
+    let (sent, complete) ← FFI.wsSendSome entry.easy out.payload out.sent out.flags
+    if complete then
+      if let some done := out.done then
+        settle done (.ok ())
+      flushOutbox multi { entry with outbox := entry.outbox.extract 1 entry.outbox.size }
+    else
+      FFI.multiWebSocketWantWrite multi entry.easy true
+      return { entry with outbox := entry.outbox.set! 0 { out with sent } }
+
+/-- Flush a connection's outbox. Drops the connection if writing failed, or
+    once a close it queued has gone out. -/
+private def flushEntry (multi : FFI.Multi) (conns : Std.HashMap UInt64 HubEntry) (id : UInt64)
+    (entry : HubEntry) : IO (Std.HashMap UInt64 HubEntry) := do
+  try
+    let entry ← flushOutbox multi entry
+    if entry.closing && entry.outbox.isEmpty then
+      dropEntry multi entry "WebSocket connection closed"
+      return conns.erase id
+    return conns.insert id entry
+  catch e =>
+    dropEntry multi entry s!"WebSocket send failed: {e}"
+    return conns.erase id
+
+private def handleCommand (multi : FFI.Multi) (conns : Std.HashMap UInt64 HubEntry)
+    (cmd : HubCommand) : IO (Std.HashMap UInt64 HubEntry) := do
+  match cmd with
+  | .connect id easy inbox stateRef opened =>
+    try
+      FFI.multiAddHandle multi easy
+      return conns.insert id { easy, inbox, stateRef, opened := some opened }
+    catch e =>
+      settle opened (.error (.ioError s!"WebSocket connection failed: {e}"))
+      stateRef.set .closed
+      let _ ← Std.CloseableChannel.Sync.close inbox
+      return conns
+  | .send id frame done =>
+    match conns.get? id with
+    | some entry =>
+      if entry.opened.isNone && !entry.closing && (← entry.stateRef.get) == .open then
+        flushEntry multi conns id (enqueue entry frame done)
+      else
+        settle done (.error (.ioError "WebSocket connection is not open"))
+        return conns
+    | none =>
+      settle done (.error (.ioError "WebSocket connection is not open"))
+      return conns
+  | .close id code reason =>
+    match conns.get? id with
+    | some entry =>
+      if entry.opened.isNone then
+        -- Sent after any frames still queued; the connection is dropped once
+        -- it has gone out
+        if entry.closing then return conns
+        flushEntry multi conns id { enqueue entry (WebSocketFrame.close code reason) with closing := true }
+      else
+        dropEntry multi entry "WebSocket connection closed"
+        return conns.erase id
+    | none => return conns
+
+/-- Handle every queued command, so sends submitted together go out in one pass -/
+private def drainCommands (multi : FFI.Multi) (conns : Std.HashMap UInt64 HubEntry)
+    (chan : Std.CloseableChannel.Sync HubCommand) : IO (Std.HashMap UInt64 HubEntry) := do
+  let mut conns := conns
+  let mut cmd? ← chan.tryRecv
+  while cmd?.isSome do
+    if let some cmd := cmd? then
+      conns ← handleCommand multi conns cmd
+    cmd? ← chan.tryRecv
+  return conns
+
+/-- Open connections whose handshake finished, and drop those that failed -/
+private def finishHandshakes (multi : FFI.Multi) (conns : Std.HashMap UInt64 HubEntry)
+    : IO (Std.HashMap UInt64 HubEntry) := do
+  let mut conns := conns
+  let mut msg ← FFI.multiInfoRead multi
+  while msg.isSome do
+    if let some (id, code) := msg then
+      if let some entry := conns.get? id then
+        if let some opened := entry.opened then
+          if code == 0 then
+            try
+              -- The handle stays added: curl_ws_recv/send find the
+              -- connection through the multi handle
+              FFI.multiWatchWebSocket multi entry.easy
+              entry.stateRef.set .open
+              settle opened (.ok ())
+              conns := conns.insert id { entry with opened := none }
+            catch e =>
+              dropEntry multi entry s!"WebSocket connection failed: {e}"
+              conns := conns.erase id
+          else
+            let err := Wisp.CurlCode.fromNat code.toNat
+            dropEntry multi entry s!"WebSocket connection failed: {err}"
+            conns := conns.erase id
+    msg ← FFI.multiInfoRead multi
+  return conns
+
+/-- Deliver every frame curl has for a connection. Replies (pongs, the echo
+    of a close) are queued on the outbox. Returns none once the connection
+    has ended. -/
+private partial def receiveFrames (entry : HubEntry) : IO (Option HubEntry) := do
+  let dropped ← FFI.wsDroppedMessages entry.easy
+  try
+    match ← FFI.wsRecv entry.easy with
+    | none => return some entry
+    | some (payload, flags) =>
+      let frame : WebSocketFrame := { frameType := WebSocketFrameType.fromCurlFlags flags, payload }
+      -- Auto-respond to ping with pong, as `Connection.onMessage` does
+      let entry := if frame.isPing then enqueue entry (WebSocketFrame.pong frame.payload) else entry
+      let _ ← Std.CloseableChannel.Sync.send entry.inbox frame
+      if frame.isClose then
+        -- Echo the close frame back, unless this answers our own
+        if entry.closing then return some entry
+        let reply := WebSocketFrame.close (frame.closeCode.getD WebSocketCloseCode.normal)
+        return some { enqueue entry reply with closing := true }
+      receiveFrames entry
+  catch _ =>
+    -- A message over the size limit is skipped; any other failure ends the
+    -- connection
+    if (← FFI.wsDroppedMessages entry.easy) > dropped then
+      receiveFrames entry
+    else
+      return none
+
+/-- Run the event loop until the hub is shut down -/
+private partial def hubLoop (multi : FFI.Multi) (chan : Std.CloseableChannel.Sync HubCommand)
+    : IO Unit := do
+  let rec loop (conns : Std.HashMap UInt64 HubEntry) : IO Unit := do
+    if conns.isEmpty then
+      match ← chan.recv with
+      | none => return ()
+      | some cmd => loop (← handleCommand multi conns cmd)
+    else
+      let conns ← drainCommands multi conns chan
+      if (← Std.CloseableChannel.Sync.isClosed chan) then
+        for (_, entry) in conns do
+          dropEntry multi entry "WebSocket hub shut down"
+        return ()
+      -- Block until a handshake progresses, a socket has frames, or a
+      -- caller queues a command
+      let _ ← FFI.multiWait multi FFI.waitForever
+      let mut conns ← finishHandshakes multi conns
+      -- Ready means readable, or writable again while frames are queued
+      for id in (← FFI.multiTakeReady multi) do
+        let some entry := conns.get? id | continue
+        match ← receiveFrames entry with
+        | some entry => conns ← flushEntry multi conns id entry
+        | none =>
+          dropEntry multi entry "WebSocket connection closed"
+          conns := conns.erase id
+      loop conns
+
+  loop {}
+
+/-- Start a hub with its own event loop thread -/
+def new : IO Hub := do
+  let chan ← Std.CloseableChannel.Sync.new
+  let multi ← FFI.multiInit
+  let nextId ← Std.Mutex.new 1
+  let task ← (hubLoop multi chan).asTask Task.Priority.dedicated
+  return { chan, multi, nextId, task }
+
+/-- Queue a command and wake the event loop -/
+private def submit (chan : Std.CloseableChannel.Sync HubCommand) (multi : FFI.Multi)
+    (cmd : HubCommand) : IO Unit := do
+  let _ ← Std.CloseableChannel.Sync.send chan cmd
+  FFI.multiWakeup multi
+
+/-- Open a connection through the hub. The handshake runs on the event loop;
+    the task resolves once it has finished. Messages larger than
+    `maxMessageSize` bytes are skipped without closing the connection. -/
+def connect (hub : Hub) (url : String) (headers : Headers := #[])
+    (share : Wisp.HTTP.ShareOptions := {}) (maxMessageSize : Nat := 64 * 1024 * 1024)
+    : IO (Task (WispResult HubConnection)) := do
+  let failed (err : WispError) : IO (Task (WispResult HubConnection)) := do
+    let promise ← IO.Promise.new
+    promise.resolve (.error err)
+    return promise.result!
+
+  if !(← FFI.wsCheckSupport) then
+    return ← failed (.ioError "WebSocket support not available in libcurl. Requires curl 7.86+ with WebSocket enabled.")
+  if !(url.startsWith "ws://" || url.startsWith "wss://") then
+    return ← failed (.ioError s!"Invalid WebSocket URL: {url}. Must use ws:// or wss:// protocol.")
+
+  try
+    let id ← hub.nextId.atomically do
+      let current ← get
+      set (current + 1)
+      return current
+
+    let easy ← FFI.easyInit
+    Wisp.HTTP.applyShare easy share
+    FFI.setupWriteCallback easy
+    FFI.setupHeaderCallback easy
+    FFI.setoptString easy FFI.CurlOpt.URL url
+    -- WebSocket upgrade handshake only; frames are exchanged with curl_ws_*
+    FFI.setoptLong easy FFI.CurlOpt.CONNECT_ONLY 2
+    let slist ← FFI.slistNew
+    for (key, value) in headers do
+      FFI.slistAppend slist s!"{key}: {value}"
+    FFI.setoptSlist easy FFI.CurlOpt.HTTPHEADER slist
+    FFI.setoptPrivate easy id
+    FFI.wsSetMaxMessage easy maxMessageSize.toUInt64
+
+    let inbox ← Std.CloseableChannel.Sync.new
+    let stateRef ← IO.mkRef ConnectionState.connecting
+    let opened ← IO.Promise.new
+    submit hub.chan hub.multi (.connect id easy inbox stateRef opened)
+
+    let conn : HubConnection := { id, url, inbox, stateRef, chan := hub.chan, multi := hub.multi }
+    return opened.result!.map fun result => result.map fun () => conn
+  catch e =>
+    failed (.ioError s!"WebSocket connection failed: {e}")
+
+/-- Close every connection and stop the event loop -/
+def shutdown (hub : Hub) : IO Unit := do
+  let _ ← Std.CloseableChannel.Sync.close hub.chan
+  FFI.multiWakeup hub.multi
+  let _ ← IO.wait hub.task
+
+end Hub
+
+namespace HubConnection
+
+/-- Get the current connection state -/
+def getState (conn : HubConnection) : IO ConnectionState :=
+  conn.stateRef.get
+
+/-- Check if connection is open -/
+def isOpen (conn : HubConnection) : IO Bool := do
+  return (← conn.getState) == .open
+
+/-- Queue a frame to be sent by the hub. The task resolves once it was
+    written in full, which may wait for the socket to drain. -/
+def send (conn : HubConnection) (frame : WebSocketFrame) : IO (Task (WispResult Unit)) := do
+  let done ← IO.Promise.new
+  Hub.submit conn.chan conn.multi (.send conn.id frame done)
+  return done.result!
+
+/-- Queue a text message -/
+def sendText (conn : HubConnection) (text : String) : IO (Task (WispResult Unit)) :=
+  conn.send (WebSocketFrame.text text)
+
+/-- Queue binary data -/
+def sendBinary (conn : HubConnection) (data : ByteArray) : IO (Task (WispResult Unit)) :=
+  conn.send (WebSocketFrame.binary data)
+
+/-- Wait for the next frame. Returns none once the connection has closed and
+    every received frame has been taken. -/
+def recv (conn : HubConnection) : IO (Option WebSocketFrame) :=
+  conn.inbox.recv
+
+/-- Close the connection gracefully -/
+def close (conn : HubConnection) (code : UInt16 := WebSocketCloseCode.normal) (reason : String := "")
+    : IO Unit := do
+  conn.stateRef.set .closing
+  Hub.submit conn.chan conn.multi (.close conn.id code reason)
+
+end HubConnection
+
+end Wisp.WebSocket
@@ -0,0 +1 @@
+import WispBench.Server
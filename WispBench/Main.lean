@@ -0,0 +1,222 @@
+/-
+  Wisp Benchmarks
+  Drives the client against a loopback server and prints one JSON object per
+  benchmark on stdout, so results can be compared between releases.
+
+  Usage: lake exe wisp_bench [--quick] [benchmark ...]
+  Benchmarks: requests, bytes, sse, websocket, memory (default: all)
+-/
+
+import Wisp
+import WispBench.Server
+
+open WispBench
+
+/-- Workload sizes. `--quick` divides them for a smoke run. -/
+structure Settings where
+  requests : Nat := 20000
+  concurrency : Nat := 64
+  bodyBytes : Nat := 64 * 1024 * 1024
+  bodyRepeats : Nat := 4
+  sseEvents : Nat := 200000
+  wsMessages : Nat := 20000
+  inflight : Nat := 256
+  inflightBodyBytes : Nat := 4 * 1024 * 1024
+  deriving Repr
+
+def Settings.quick (s : Settings) : Settings :=
+  { s with
+    requests := s.requests / 10
+    bodyRepeats := 1
+    bodyBytes := s.bodyBytes / 4
+    sseEvents := s.sseEvents / 10
+    wsMessages := s.wsMessages / 10
+    inflight := s.inflight / 4 }
+
+-- ============================================================================
+-- Output
+-- ============================================================================
+
+private def jsonNum (x : Float) : String :=
+  if x.isNaN || x.isInf then "null" else toString x
+
+private def jsonStr (s : String) : String :=
+  "\"" ++ (s.replace "\\" "\\\\" |>.replace "\"" "\\\"") ++ "\""
+
+/-- Print one result line. Values must already be JSON encoded. -/
+private def emit (bench : String) (fields : List (String × String)) : IO Unit := do
+  let body := fields.map fun (k, v) => s!"{jsonStr k}: {v}"
+  IO.println ("{" ++ ", ".intercalate (s!"\"bench\": {jsonStr bench}" :: body) ++ "}")
+  (← IO.getStdout).flush
+
+/-- Events per second given a count and elapsed nanoseconds -/
+private def rate (count : Nat) (nanos : Nat) : Float :=
+  if nanos == 0 then 0 else count.toFloat * 1e9 / nanos.toFloat
+
+/-- Percentile of sorted nanosecond samples, in milliseconds -/
+private def percentileMs (sorted : Array Nat) (p : Float) : Float :=
+  if sorted.isEmpty then 0 else
+    let idx := min (sorted.size - 1) (p * sorted.size.toFloat).toUInt64.toNat
+    sorted[idx]!.toFloat / 1e6
+
+private def expectOk {α : Type} (what : String) (result : Wisp.WispResult α) : IO α :=
+  match result with
+  | .ok a => pure a
+  | .error e => throw (IO.userError s!"{what} failed: {e}")
+
+-- ============================================================================
+-- Benchmarks
+-- ============================================================================
+
+/-- Small requests from `concurrency` callers at once: throughput and latency -/
+def benchRequests (client : Wisp.HTTP.Client) (base : String) (s : Settings) : IO Unit := do
+  let callers := max s.concurrency 1
+  let perCaller := max (s.requests / callers) 1
+  let started ← IO.monoNanosNow
+  let mut tasks : Array (Task (Except IO.Error (Array Nat))) := #[]
+  for _ in [0:callers] do
+    tasks := tasks.push (← IO.asTask (prio := .dedicated) do
+      let mut samples : Array Nat := #[]
+      for _ in [0:perCaller] do
+        let t0 ← IO.monoNanosNow
+        let r ← expectOk "GET" (← IO.wait (← client.get s!"{base}/bytes/64"))
+        if r.status != 200 then
+          throw (IO.userError s!"GET returned {r.status}")
+        samples := samples.push ((← IO.monoNanosNow) - t0)
+      return samples)
+  let mut samples : Array Nat := #[]
+  for task in tasks do
+    samples := samples ++ (← IO.ofExcept (← IO.wait task))
+  let elapsed := (← IO.monoNanosNow) - started
+  let sorted := samples.qsort (· < ·)
+  emit "requests" [
+    ("requests", toString samples.size),
+    ("concurrency", toString callers),
+    ("requests_per_sec", jsonNum (rate samples.size elapsed)),
+    ("p50_ms", jsonNum (percentileMs sorted 0.5)),
+    ("p99_ms", jsonNum (percentileMs sorted 0.99)),
+    ("p999_ms", jsonNum (percentileMs sorted 0.999))]
+
+/-- Large bodies, buffered through `execute` and streamed through `executeStreaming` -/
+def benchBytes (client : Wisp.HTTP.Client) (base : String) (s : Settings) : IO Unit := do
+  let url := s!"{base}/bytes/{s.bodyBytes}"
+  let mut buffered := 0
+  let started ← IO.monoNanosNow
+  for _ in [0:s.bodyRepeats] do
+    let r ← expectOk "GET" (← IO.wait (← client.get url))
+    buffered := buffered + r.body.size
+  let bufferedNanos := (← IO.monoNanosNow) - started
+
+  let streamed ← IO.mkRef 0
+  let started ← IO.monoNanosNow
+  for _ in [0:s.bodyRepeats] do
+    let r ← expectOk "Streaming GET" (← IO.wait (← client.executeStreaming (Wisp.Request.get url)))
+    r.forEachChunk fun chunk => streamed.modify (· + chunk.size)
+  let streamedNanos := (← IO.monoNanosNow) - started
+  let streamed ← streamed.get
+
+  emit "bytes" [
+    ("body_bytes", toString s.bodyBytes),
+    ("repeats", toString s.bodyRepeats),
+    ("buffered_bytes_per_sec", jsonNum (rate buffered bufferedNanos)),
+    ("streamed_bytes_per_sec", jsonNum (rate streamed streamedNanos))]
+
+/-- Server-Sent Events parsed through `SSE.Stream` -/
+def benchSSE (client : Wisp.HTTP.Client) (base : String) (s : Settings) : IO Unit := do
+  let started ← IO.monoNanosNow
+  let resp ← expectOk "SSE GET"
+    (← IO.wait (← client.executeStreaming (Wisp.Request.get s!"{base}/sse/{s.sseEvents}")))
+  let stream ← Wisp.HTTP.SSE.Stream.fromStreaming resp
+  let count ← IO.mkRef 0
+  stream.forEachEvent fun _ => count.modify (· + 1)
+  let elapsed := (← IO.monoNanosNow) - started
+  let count ← count.get
+  if count != s.sseEvents then
+    throw (IO.userError s!"SSE: expected {s.sseEvents} events, got {count}")
+  emit "sse" [
+    ("events", toString count),
+    ("events_per_sec", jsonNum (rate count elapsed))]
+
+/-- WebSocket echo round trips through `WebSocket.Connection` -/
+def benchWebSocket (base : String) (s : Settings) : IO Unit := do
+  unless (← Wisp.WebSocket.isSupported) do
+    emit "websocket" [("skipped", jsonStr "libcurl built without WebSocket support")]
+    return
+  let url := base.replace "http://" "ws://" ++ "/ws"
+  let conn ← expectOk "WebSocket connect" (← Wisp.WebSocket.connect url)
+  let started ← IO.monoNanosNow
+  let mut received := 0
+  for _ in [0:s.wsMessages] do
+    expectOk "WebSocket send" (← conn.sendText "wisp benchmark message")
+    match ← expectOk "WebSocket recv" (← conn.recvTimeout 5000) with
+    | some frame =>
+      if frame.frameType.isData then
+        received := received + 1
+    | none => throw (IO.userError "WebSocket: echo timed out")
+  let elapsed := (← IO.monoNanosNow) - started
+  let _ ← conn.close
+  emit "websocket" [
+    ("messages", toString received),
+    ("round_trips_per_sec", jsonNum (rate received elapsed))]
+
+/-- Resident memory per streaming request held in flight by backpressure -/
+def benchMemory (client : Wisp.HTTP.Client) (base : String) (s : Settings) : IO Unit := do
+  let before ← residentBytes
+  let mut tasks : Array (Task (Wisp.WispResult Wisp.StreamingResponse)) := #[]
+  for _ in [0:s.inflight] do
+    tasks := tasks.push (← client.executeStreaming (Wisp.Request.get s!"{base}/bytes/{s.inflightBodyBytes}"))
+  let mut responses : Array Wisp.StreamingResponse := #[]
+  for task in tasks do
+    responses := responses.push (← expectOk "Streaming GET" (← IO.wait task))
+  -- Let every transfer fill its buffers and pause
+  IO.sleep 500
+  let during ← residentBytes
+  for r in responses do
+    r.forEachChunk fun _ => pure ()
+  let after ← residentBytes
+  let grown := during.toNat - before.toNat
+  emit "memory" [
+    ("inflight", toString s.inflight),
+    ("resident_before_bytes", toString before),
+    ("resident_inflight_bytes", toString during),
+    ("resident_after_bytes", toString after),
+    ("bytes_per_inflight_request", jsonNum (grown.toFloat / (max s.inflight 1).toFloat))]
+
+-- ============================================================================
+-- Entry Point
+-- ============================================================================
+
+def main (args : List String) : IO UInt32 := do
+  let quick := args.contains "--quick"
+  let selected := args.filter (· != "--quick")
+  let settings : Settings := if quick then ({} : Settings).quick else {}
+  let enabled (name : String) := selected.isEmpty || selected.contains name
+
+  Wisp.FFI.globalInit
+  let server ← serverStart
+  let base := s!"http://127.0.0.1:{← serverPort server}"
+  let client := Wisp.HTTP.Client.new |>.withTimeout 120000
+
+  emit "meta" [
+    ("curl", jsonStr (← Wisp.FFI.versionInfo)),
+    ("quick", toString quick)]
+
+  let mut failed := false
+  let benches : List (String × IO Unit) := [
+    ("requests", benchRequests client base settings),
+    ("bytes", benchBytes client base settings),
+    ("sse", benchSSE client base settings),
+    ("websocket", benchWebSocket base settings),
+    ("memory", benchMemory client base settings)]
+  for (name, run) in benches do
+    if enabled name then
+      try
+        run
+      catch e =>
+        emit name [("error", jsonStr (toString e))]
+        failed := true
+
+  Wisp.HTTP.Client.shutdown
+  serverStop server
+  Wisp.FFI.globalCleanup
+  return if failed then 1 else 0
@@ -0,0 +1,34 @@
+/-
+  Wisp Benchmark Server
+  Bindings to the loopback HTTP/1.1 and WebSocket server in wisp_bench_server.c
+-/
+
+namespace WispBench
+
+/-- Opaque handle to a running loopback server -/
+opaque ServerPointed : NonemptyType
+def Server := ServerPointed.type
+instance : Nonempty Server := ServerPointed.property
+
+/-- Start a server on 127.0.0.1. Port 0 picks a free port. -/
+@[extern "wisp_bench_server_start"]
+opaque serverStart (port : UInt16 := 0) : IO Server
+
+/-- Port the server is listening on -/
+@[extern "wisp_bench_server_port"]
+opaque serverPort (server : @& Server) : IO UInt16
+
+/-- Requests the server has read so far, WebSocket upgrades included -/
+@[extern "wisp_bench_server_requests"]
+opaque serverRequests (server : @& Server) : IO UInt64
+
+/-- Stop accepting connections. Open connections finish on their own. -/
+@[extern "wisp_bench_server_stop"]
+opaque serverStop (server : @& Server) : IO Unit
+
+/-- Resident memory of this process in bytes (peak resident memory where the
+    current value is unavailable) -/
+@[extern "wisp_bench_resident_bytes"]
+opaque residentBytes : IO UInt64
+
+end WispBench
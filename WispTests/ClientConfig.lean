@@ -25,6 +25,263 @@ test "Deflate encoding" := do
   r.status ≡ 200
   shouldSatisfy (r.bodyTextLossy.containsSubstr "deflated") "response indicates deflated"
 
+test "Shared caches across requests" := do
+  let shared := client.withShare { cookies := true }
+  let setReq := Wisp.Request.get "https://httpbin.org/cookies/set?wisp=shared"
+    |>.withCookieEngine
+    |>.withFollowRedirects false
+  let _ ← awaitTask (shared.execute setReq)
+  let getReq := Wisp.Request.get "https://httpbin.org/cookies" |>.withCookieEngine
+  let result ← awaitTask (shared.execute getReq)
+  let r ← shouldBeOk result "Shared cookies"
+  shouldSatisfy (r.bodyTextLossy.containsSubstr "shared") "cookie shared between requests"
+
+test "Reused handles start from a clean state" := do
+  -- A POST leaves its method and body on the handle; once recycled through the
+  -- pool, the following GET must not inherit either
+  let postResult ← awaitTask (client.postJson "https://httpbin.org/post" "{\"n\": 1}")
+  let _ ← shouldBeOk postResult "POST"
+  for _ in [0:3] do
+    let result ← awaitTask (client.get "https://httpbin.org/get")
+    let r ← shouldBeOk result "GET after POST"
+    r.status ≡ 200
+    shouldSatisfy (!r.bodyTextLossy.containsSubstr "\"n\": 1") "no body carried over"
+
+test "Requests spread across several workers" := do
+  Wisp.HTTP.Client.configureWorkers { workers := 2, stealThreshold := 2 }
+  try
+    -- Submitted together, so the origin's first worker reaches the steal
+    -- threshold while the rest are still being routed
+    let mut tasks : Array (Task (Wisp.WispResult Wisp.Response)) := #[]
+    for i in [0:6] do
+      tasks := tasks.push (← client.get s!"https://httpbin.org/get?n={i}")
+    for task in tasks do
+      let r ← shouldBeOk task.get "GET on a worker"
+      r.status ≡ 200
+    let perWorker ← Wisp.HTTP.Client.workerMetrics
+    perWorker.size ≡ 2
+    shouldSatisfy ((perWorker.filter (·.started > 0)).size == 2) "both workers handled requests"
+  finally
+    Wisp.HTTP.Client.configureWorkers {}
+
+test "Requests submitted while workers are reconfigured go to the new pool" := do
+  withLoopbackServer fun server => do
+    let base := s!"http://127.0.0.1:{← WispBench.serverPort server}"
+    let slow ← client.get s!"{base}/delay/500"
+    -- Drains the old pool, which holds the slow request
+    let reconfigured ← IO.asTask (Wisp.HTTP.Client.configureWorkers {})
+    IO.sleep 50
+    let started ← IO.monoMsNow
+    let r ← shouldBeOk (← client.get s!"{base}/bytes/16").get "GET during reconfiguration"
+    r.status ≡ 200
+    shouldSatisfy ((← IO.monoMsNow) - started < 300) "not held behind the draining pool"
+    let _ ← shouldBeOk slow.get "GET on the old pool"
+    let _ ← IO.wait reconfigured
+
+/-- Requests in flight to `origin`, summed over the workers -/
+private def inflightTo (origin : String) : IO Nat := do
+  return (← Wisp.HTTP.Client.schedulerStats).foldl (init := 0) fun n st =>
+    if st.origin == origin then n + st.inflight else n
+
+test "Per-host limit holds across workers and starts high priority first" := do
+  -- Without the limit, the second request would be spread to the other worker
+  Wisp.HTTP.Client.configureWorkers { workers := 2, stealThreshold := 1 }
+  try
+    withLoopbackServer fun server => do
+      let origin := s!"http://127.0.0.1:{← WispBench.serverPort server}"
+      let limited := client.withConnectionLimits (perHost := 1)
+      let submit (priority : Wisp.Priority) :=
+        limited.execute (Wisp.Request.get s!"{origin}/delay/200" |>.withPriority priority)
+      let first ← submit .low
+      -- Let the first request start, so the next two queue behind it
+      IO.sleep 50
+      let second ← submit .low
+      let urgent ← submit .high
+      let mut peak := 0
+      while !(← IO.hasFinished urgent) do
+        peak := max peak (← inflightTo origin)
+        IO.sleep 20
+      shouldSatisfy !(← IO.hasFinished second) "high priority request ran before the queued low one"
+      while !(← IO.hasFinished second) do
+        peak := max peak (← inflightTo origin)
+        IO.sleep 20
+      peak ≡ 1
+      for task in #[first, second, urgent] do
+        let r ← shouldBeOk task.get "GET behind a per-host limit"
+        r.status ≡ 200
+      let stats ← Wisp.HTTP.Client.schedulerStats
+      let some st := stats.find? (·.origin == origin)
+        | throw (IO.userError s!"no stats for {origin}")
+      st.started ≡ 3
+      st.queued ≡ 0
+      shouldSatisfy (st.maxWaitMs ≥ 100) "queued requests waited for the slot"
+  finally
+    Wisp.HTTP.Client.configureWorkers {}
+
+test "Total limit holds across workers" := do
+  Wisp.HTTP.Client.configureWorkers { workers := 2 }
+  try
+    withLoopbackServer fun server => do
+      let port ← WispBench.serverPort server
+      -- Two origins, so each goes to its own worker
+      let origins := #[s!"http://127.0.0.1:{port}", s!"http://localhost:{port}"]
+      let limited := client.withConnectionLimits (perHost := 0) (total := 1)
+      let started ← IO.monoMsNow
+      let tasks ← origins.mapM fun origin => limited.execute (Wisp.Request.get s!"{origin}/delay/200")
+      let mut peak := 0
+      while !(← tasks.allM fun t => IO.hasFinished t) do
+        let mut running := 0
+        for origin in origins do
+          running := running + (← inflightTo origin)
+        peak := max peak running
+        IO.sleep 20
+      for task in tasks do
+        let r ← shouldBeOk task.get "GET behind a total limit"
+        r.status ≡ 200
+      peak ≡ 1
+      shouldSatisfy ((← IO.monoMsNow) - started ≥ 400) "requests ran one after the other"
+  finally
+    Wisp.HTTP.Client.configureWorkers {}
+
+test "Batch requests complete in order and as a stream" := do
+  let reqs := (Array.range 4).map fun i => Wisp.Request.get s!"https://httpbin.org/get?b={i}"
+  let tasks ← client.executeBatch reqs
+  tasks.size ≡ 4
+  for (task, i) in tasks.zipIdx do
+    let r ← shouldBeOk task.get "GET in batch"
+    shouldSatisfy (r.bodyTextLossy.containsSubstr s!"\"b\": \"{i}\"") "result matches its request"
+  let results ← client.executeBatchStream reqs
+  let mut seen : Array Nat := #[]
+  repeat
+    match ← results.recv with
+    | some (i, result) =>
+      let _ ← shouldBeOk result "GET in batch stream"
+      seen := seen.push i
+    | none => break
+  (seen.qsort (· < ·)) ≡ #[0, 1, 2, 3]
+
+test "Fresh responses are served from the cache" := do
+  let cache ← Wisp.HTTP.Cache.new
+  let cached := client.withCache cache
+  -- httpbin answers /cache/{n} with Cache-Control: public, max-age={n}
+  let first ← shouldBeOk (← cached.get "https://httpbin.org/cache/60").get "first GET"
+  first.fromCache ≡ false
+  let second ← shouldBeOk (← cached.get "https://httpbin.org/cache/60").get "second GET"
+  second.fromCache ≡ true
+  second.body.size ≡ first.body.size
+  let stats ← cache.stats
+  stats.hits ≡ 1
+  stats.misses ≡ 1
+
+test "Batches use the cache and cancelable writes invalidate it" := do
+  let cache ← Wisp.HTTP.Cache.new
+  let cached := client.withCache cache
+  let url := "https://httpbin.org/response-headers?Cache-Control=max-age=60"
+  let batchGet : IO Wisp.Response := do
+    let tasks ← cached.executeBatch #[Wisp.Request.get url]
+    shouldBeOk (← IO.wait tasks[0]!) "batched GET"
+  (← batchGet).fromCache ≡ false
+  (← batchGet).fromCache ≡ true
+  -- A POST sent outside `fetch` still drops the stored response
+  let (task, _) ← cached.executeCancelable (Wisp.Request.post url)
+  let posted ← shouldBeOk (← IO.wait task) "cancelable POST"
+  posted.status ≡ 200
+  let after ← shouldBeOk (← cached.get url).get "GET after POST"
+  after.fromCache ≡ false
+
+test "Failed disk writes leave the response and the memory cache intact" := do
+  let dir ← IO.FS.createTempDir
+  let cache ← Wisp.HTTP.Cache.new { directory := some dir.toString }
+  -- Every write to the on-disk store now fails
+  IO.FS.removeDirAll dir
+  let cached := client.withCache cache
+  let first ← shouldBeOk (← cached.get "https://httpbin.org/cache/60").get "GET with a broken store"
+  first.status ≡ 200
+  let second ← shouldBeOk (← cached.get "https://httpbin.org/cache/60").get "second GET"
+  second.fromCache ≡ true
+  let stats ← cache.stats
+  stats.diskErrors ≡ 1
+
+test "Retries back off and return the last response" := do
+  let policy : Wisp.RetryPolicy := { maxAttempts := 3, baseDelayMs := 100, jitter := false }
+  let started ← IO.monoMsNow
+  let r ← shouldBeOk (← client.execute (Wisp.Request.get "https://httpbin.org/status/503" |>.withRetry policy)).get "GET with retries"
+  r.status ≡ 503
+  -- Two retries: 100 ms then 200 ms of backoff
+  shouldSatisfy ((← IO.monoMsNow) - started ≥ 300) "backed off between attempts"
+
+test "Retry-After is read as seconds or an HTTP date" := do
+  (← Wisp.HTTP.Client.parseRetryAfter "120") ≡ some 120000
+  (← Wisp.HTTP.Client.parseRetryAfter " 0 ") ≡ some 0
+  (← Wisp.HTTP.Client.parseRetryAfter "soon") ≡ none
+  -- A date already past means retry now
+  (← Wisp.HTTP.Client.parseRetryAfter "Wed, 21 Oct 2015 07:28:00 GMT") ≡ some 0
+
+test "Slow requests are hedged and the losing copy is canceled" := do
+  -- A fresh pool, so the metrics count only this test's requests
+  Wisp.HTTP.Client.configureWorkers {}
+  withLoopbackServer fun server => do
+    let base := s!"http://127.0.0.1:{← WispBench.serverPort server}"
+    let policy := Wisp.RetryPolicy.withHedging { jitter := false } 50
+    let started ← IO.monoMsNow
+    -- Only the first request to this route is slow, so the duplicate wins
+    let r ← shouldBeOk (← client.execute (Wisp.Request.get s!"{base}/slow-once/2000" |>.withRetry policy)).get "hedged GET"
+    r.status ≡ 200
+    shouldSatisfy ((← IO.monoMsNow) - started < 1000) "answered by the duplicate"
+    (← WispBench.serverRequests server) ≡ 2
+    let m ← Wisp.HTTP.Client.metrics
+    m.hedges ≡ 1
+    m.retries ≡ 0
+    -- The slow primary no longer counts as in flight
+    m.inflight ≡ 0
+
+test "Retry budget stops a retry storm once its reserve is spent" := do
+  Wisp.HTTP.Client.configureWorkers {}
+  withLoopbackServer fun server => do
+    let base := s!"http://127.0.0.1:{← WispBench.serverPort server}"
+    -- No budget is earned, so only the reserve of two retries can be spent
+    let policy : Wisp.RetryPolicy :=
+      { maxAttempts := 5, baseDelayMs := 1, jitter := false, budgetRatio := 0, budgetReserve := 2 }
+    let tasks ← (Array.range 10).mapM fun _ =>
+      client.execute (Wisp.Request.get s!"{base}/status/503" |>.withRetry policy)
+    for task in tasks do
+      let r ← shouldBeOk task.get "GET during a retry storm"
+      r.status ≡ 503
+    (← Wisp.HTTP.Client.metrics).retries ≡ 2
+    (← WispBench.serverRequests server) ≡ 12
+
+test "Prepared requests send template and per-request headers" := do
+  let prepared ← client.prepare (Wisp.Request.get "" |>.withHeader "X-Static" "template"
+    |>.withHeader "X-Mode" "template" |>.withBearerToken "prepared-token")
+  let r ← shouldBeOk (← prepared.get "https://httpbin.org/headers" (headers := #[("X-Mode", "request")])).get "prepared GET"
+  r.status ≡ 200
+  let body := r.bodyTextLossy
+  shouldSatisfy (body.containsSubstr "\"X-Static\": \"template\"") "template header sent"
+  shouldSatisfy (body.containsSubstr "Bearer prepared-token") "template auth sent"
+  shouldSatisfy (body.containsSubstr "\"X-Mode\": \"request\"") "request header replaces template header"
+  shouldSatisfy (!body.containsSubstr "\"X-Mode\": \"template\"") "template header not sent twice"
+
+test "Workers count requests and export Prometheus text" := do
+  let before ← Wisp.HTTP.Client.metrics
+  let r ← shouldBeOk (← client.get "https://httpbin.org/status/404").get "GET"
+  r.status ≡ 404
+  let after ← Wisp.HTTP.Client.metrics
+  shouldSatisfy (after.started > before.started) "request counted as started"
+  shouldSatisfy (after.completedIn 4 > before.completedIn 4) "404 counted as 4xx"
+  let text ← Wisp.HTTP.Client.metricsText
+  shouldSatisfy (text.containsSubstr "wisp_requests_completed_total{status_class=\"4xx\"}") "4xx series exported"
+  shouldSatisfy (text.containsSubstr "wisp_request_duration_seconds_bucket{origin=\"https://httpbin.org\"") "latency histogram exported"
+
+test "Concurrent metrics writers do not collide" := do
+  let dir ← IO.FS.createTempDir
+  let path := dir / "wisp.prom"
+  let writers ← (Array.range 8).mapM fun _ => IO.asTask (Wisp.HTTP.Client.writeMetrics path)
+  for writer in writers do
+    let _ ← IO.ofExcept (← IO.wait writer)
+  shouldSatisfy ((← IO.FS.readFile path).containsSubstr "wisp_requests_started_total") "metrics written"
+  -- No temporary files left behind
+  (← dir.readDir).size ≡ 1
+  IO.FS.removeDirAll dir
 
 
 end WispTests.ClientConfig
@@ -3,6 +3,7 @@
 -/
 
 import Wisp
+import WispBench.Server
 import Crucible
 import Staple
 
@@ -16,3 +17,10 @@ def defaultConnectTimeoutMs : UInt64 := 5000
 def client := Wisp.HTTP.Client.new
   |>.withTimeout defaultTimeoutMs
   |>.withConnectTimeout defaultConnectTimeoutMs
+
+/-- Run `f` against a fresh loopback server (see `WispBench.Server` for its
+    routes), stopping it afterwards -/
+def withLoopbackServer (f : WispBench.Server → IO Unit) : IO Unit := do
+  let server ← WispBench.serverStart
+  try f server
+  finally WispBench.serverStop server
@@ -26,6 +26,20 @@ test "Content-Type header" := do
   shouldSatisfy r.contentType.isSome "Content-Type header present"
   shouldSatisfy ((r.contentType.getD "").containsSubstr "json") "Content-Type contains json"
 
+test "Header lookup ignores case" := do
+  let result ← awaitTask (client.get "https://httpbin.org/response-headers?X-Mixed-Case=one&x-mixed-case=two")
+  let r ← shouldBeOk result "Response headers"
+  r.header "x-MIXED-case" ≡ some "one"
+  (r.headerMap.getAll "X-Mixed-Case").size ≡ 2
+  shouldSatisfy (r.headerMap.contains "content-type") "content-type present"
+
+test "Redirects keep only the final response's headers" := do
+  let result ← awaitTask (client.get "https://httpbin.org/redirect/2")
+  let r ← shouldBeOk result "Redirect"
+  r.status ≡ 200
+  shouldSatisfy (!r.headerMap.contains "Location") "no Location header from earlier hops"
+  (r.headerMap.getAll "Date").size ≡ 1
+
 
 
 end WispTests.Headers
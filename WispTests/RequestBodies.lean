@@ -33,6 +33,54 @@ test "Raw bytes body" := do
   let r ← shouldBeOk result "Raw POST"
   r.status ≡ 200
 
+test "Binary body is sent unmodified" := do
+  -- Not valid UTF-8; must go out byte-for-byte
+  let bytes := ByteArray.mk #[0xff, 0xfe, 0x00, 0x80, 0x41]
+  let req := Wisp.Request.post "https://httpbin.org/post" |>.withBody bytes
+  let result ← awaitTask (client.execute req)
+  let r ← shouldBeOk result "Binary POST"
+  r.status ≡ 200
+  shouldSatisfy (r.bodyTextLossy.containsSubstr "\"Content-Length\": \"5\"") "all 5 bytes sent"
+
+test "File body" := do
+  let (handle, path) ← IO.FS.createTempFile
+  handle.putStr "uploaded from a file"
+  handle.flush
+  let req := Wisp.Request.post "https://httpbin.org/post" |>.withBodyFile path.toString "text/plain"
+  let result ← awaitTask (client.execute req)
+  IO.FS.removeFile path
+  let r ← shouldBeOk result "File POST"
+  r.status ≡ 200
+  shouldSatisfy (r.bodyTextLossy.containsSubstr "uploaded from a file") "response echoes file contents"
+
+test "Channel body with chunked encoding" := do
+  let chunks ← Std.CloseableChannel.Sync.new
+  let req := Wisp.Request.put "https://httpbin.org/put" |>.withBodyStream chunks "text/plain"
+  let task ← client.execute req
+  let _ ← chunks.send "streamed ".toUTF8
+  let _ ← chunks.send "upload".toUTF8
+  let _ ← Std.CloseableChannel.Sync.close chunks
+  let r ← shouldBeOk task.get "Streamed PUT"
+  r.status ≡ 200
+  shouldSatisfy (r.bodyTextLossy.containsSubstr "streamed upload") "response echoes streamed body"
+
+test "Compressed JSON body" := do
+  let events := "[" ++ ",".intercalate (List.replicate 200 "{\"event\": \"click\"}") ++ "]"
+  let req := Wisp.Request.post "https://httpbin.org/post" |>.withJson events |>.withCompression
+  let result ← awaitTask (client.execute req)
+  let r ← shouldBeOk result "Compressed POST"
+  r.status ≡ 200
+  shouldSatisfy (r.bodyTextLossy.containsSubstr "\"Content-Encoding\": \"gzip\"") "body sent gzip-encoded"
+
+test "Body below the compression threshold is sent as is" := do
+  let req := Wisp.Request.post "https://httpbin.org/post" |>.withJson "{\"key\": \"value\"}"
+    |>.withCompression { minBytes := 1024 }
+  let result ← awaitTask (client.execute req)
+  let r ← shouldBeOk result "Small POST"
+  r.status ≡ 200
+  shouldSatisfy (!r.bodyTextLossy.containsSubstr "Content-Encoding") "no Content-Encoding sent"
+  shouldSatisfy (r.bodyTextLossy.containsSubstr "\"key\": \"value\"") "body echoed uncompressed"
+
 
 
 end WispTests.RequestBodies
@@ -16,6 +16,23 @@ test "Effective URL tracked" := do
   let r ← shouldBeOk result "GET redirect"
   shouldSatisfy (r.effectiveUrl.containsSubstr "httpbin.org") "effectiveUrl contains httpbin.org"
 
+test "Timing breakdown and transfer metrics" := do
+  let result ← awaitTask (client.get "https://httpbin.org/bytes/1024")
+  let r ← shouldBeOk result "GET bytes"
+  let m := r.metrics
+  m.bytesDownloaded ≡ 1024
+  shouldSatisfy (m.namelookupTime <= m.connectTime) "DNS before connect"
+  shouldSatisfy (m.connectTime <= m.appconnectTime) "connect before TLS"
+  shouldSatisfy (m.starttransferTime <= m.totalTime) "first byte before completion"
+  shouldSatisfy (m.totalTime == r.totalTime) "totalTime matches"
+  shouldSatisfy m.httpVersion.isSome "HTTP version reported"
+
+test "Requested HTTP version is negotiated" := do
+  let req := Wisp.Request.get "https://httpbin.org/get" |>.withHttpVersion .HTTP1_1
+  let result ← awaitTask (client.execute req)
+  let r ← shouldBeOk result "GET over HTTP/1.1"
+  shouldSatisfy (r.httpVersion == some .HTTP1_1) "HTTP/1.1 reported"
+
 
 
 end WispTests.ResponseMetadata
@@ -23,6 +23,22 @@ test "Body size tracking" := do
   let r ← shouldBeOk result "Body size"
   r.body.size ≡ 256
 
+test "Body without Content-Length" := do
+  -- Chunked response larger than the initial body array, so it must grow
+  let result ← awaitTask (client.get "https://httpbin.org/stream-bytes/65536?chunk_size=1000")
+  let r ← shouldBeOk result "Chunked body"
+  r.body.size ≡ 65536
+
+test "Bodies are not overwritten by later requests" := do
+  let first ← awaitTask (client.get "https://httpbin.org/bytes/64?seed=1")
+  let r1 ← shouldBeOk first "First body"
+  let snapshot := r1.body.toList
+  let second ← awaitTask (client.get "https://httpbin.org/bytes/32?seed=2")
+  let r2 ← shouldBeOk second "Second body"
+  r2.body.size ≡ 32
+  r1.body.size ≡ 64
+  shouldSatisfy (r1.body.toList == snapshot) "first body unchanged"
+
 
 
 end WispTests.ResponseParsing
@@ -141,6 +141,41 @@ test "SSE lastEventId tracking" := do
   let lastId ← stream.getLastEventId
   lastId ≡ some "evt-002"
 
+test "SSE line endings and characters split across chunks" := do
+  let channel ← Std.CloseableChannel.Sync.new (α := ByteArray)
+  -- CRLF split between chunks, a lone CR, and "é" (0xC3 0xA9) split in half
+  let bytes := "data: café\r\n\rdata: two\r".toUTF8
+  let splitAt := [10, 12, 13]
+  let mut start := 0
+  for stop in splitAt ++ [bytes.size] do
+    channel.send (bytes.extract start stop)
+    start := stop
+  channel.send "\ndata: three\n\n".toUTF8
+  channel.close
+  let mockResp : Wisp.StreamingResponse := {
+    status := 200
+    headers := Wisp.Headers.empty
+    bodyChannel := channel
+  }
+  let stream ← Wisp.HTTP.SSE.Stream.fromStreaming mockResp
+  let events ← stream.toArray
+  (events.map (·.data)) ≡ #["café", "two\nthree"]
+
+test "SSE invalid bytes are replaced without losing valid characters" := do
+  let channel ← Std.CloseableChannel.Sync.new (α := ByteArray)
+  -- A stray 0xFF and a truncated "é" (0xC3) among valid multibyte characters
+  let bytes := "data: é".toUTF8 ++ ByteArray.mk #[0xFF] ++ "ü".toUTF8 ++ ByteArray.mk #[0xC3] ++ "x\n\n".toUTF8
+  channel.send bytes
+  channel.close
+  let mockResp : Wisp.StreamingResponse := {
+    status := 200
+    headers := Wisp.Headers.empty
+    bodyChannel := channel
+  }
+  let stream ← Wisp.HTTP.SSE.Stream.fromStreaming mockResp
+  let events ← stream.toArray
+  (events.map (·.data)) ≡ #["é�ü�x"]
+
 
 
 end WispTests.SSEParser
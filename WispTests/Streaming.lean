@@ -58,6 +58,58 @@ test "Streaming read body as text" := do
   | some text => shouldSatisfy (text.containsSubstr "slideshow") "body contains slideshow"
   | none => throw (IO.userError "Expected text body")
 
+test "Slow consumer receives the complete body" := do
+  -- The consumer falls behind the bounded channel, so the transfer is paused
+  -- and resumed repeatedly; no bytes may be lost or duplicated
+  let req := Wisp.Request.get "https://httpbin.org/stream-bytes/102400?chunk_size=1024&seed=7"
+  let task ← client.executeStreaming req
+  let stream ← shouldBeOk task.get "slow stream"
+  let totalRef ← IO.mkRef (0 : Nat)
+  stream.forEachChunk fun chunk => do
+    IO.sleep 2
+    totalRef.modify (· + chunk.size)
+  stream.status ≡ 200
+  (← totalRef.get) ≡ 102400
+
+test "Concurrent streams each receive their own body" := do
+  let sizes := #[300, 1200, 4000, 9000]
+  let mut tasks := #[]
+  for size in sizes do
+    let req := Wisp.Request.get s!"https://httpbin.org/stream-bytes/{size}?chunk_size=100"
+    tasks := tasks.push (← client.executeStreaming req)
+  for (task, size) in tasks.zip sizes do
+    let stream ← shouldBeOk task.get s!"stream {size}"
+    let body ← stream.readAllBody
+    body.size ≡ size
+
+test "Download writes to a file and resumes from its size" := do
+  let path : System.FilePath := "/tmp/wisp-download-test.bin"
+  if ← path.pathExists then IO.FS.removeFile path
+  -- httpbin serves /range/{n} with Range support
+  let url := "https://httpbin.org/range/1024"
+  let d ← shouldBeOk (← client.download (Wisp.Request.get url) path).get "download"
+  d.size ≡ 1024
+  d.complete ≡ true
+  d.response.body.size ≡ 0
+  let full ← IO.FS.readBinFile path
+  IO.FS.writeBinFile path (full.extract 0 512)
+  let resumed ← shouldBeOk (← client.download (Wisp.Request.get url) path).get "resumed download"
+  resumed.response.status ≡ 206
+  (← IO.FS.readBinFile path).toList ≡ full.toList
+  IO.FS.removeFile path
+
+test "Segmented download fetches ranges concurrently" := do
+  let path : System.FilePath := "/tmp/wisp-segmented-test.bin"
+  let url := "https://httpbin.org/range/4096"
+  let config : Wisp.HTTP.SegmentConfig := { segmentBytes := 1024, minObjectBytes := 0, initialConcurrency := 2 }
+  let d ← shouldBeOk (← client.downloadSegmented (Wisp.Request.get url) path config).get "segmented download"
+  d.size ≡ 4096
+  d.complete ≡ true
+  d.segments ≡ 4
+  let single ← shouldBeOk (← client.get url).get "single GET"
+  (← IO.FS.readBinFile path).toList ≡ single.body.toList
+  IO.FS.removeFile path
+
 
 
 end WispTests.Streaming
@@ -6,6 +6,30 @@ namespace WispTests.WebSocket
 
 testSuite "WebSocket"
 
+/-- Run `f` with the port of a loopback server whose `/ws` route echoes
+    every data frame -/
+private def withEchoServer (f : UInt16 → IO Unit) : IO Unit :=
+  withLoopbackServer fun server => do f (← WispBench.serverPort server)
+
+private def connectEcho (port : UInt16) : IO Wisp.WebSocket.Connection := do
+  match ← Wisp.WebSocket.connect s!"ws://127.0.0.1:{port}/ws" with
+  | .ok conn => return conn
+  | .error e => throw (IO.userError s!"connect failed: {e}")
+
+/-- Wait up to five seconds for the next message -/
+private def expectFrame (conn : Wisp.WebSocket.Connection) : IO Wisp.WebSocketFrame := do
+  match ← conn.recvTimeout 5000 with
+  | .ok (some frame) => return frame
+  | .ok none => throw (IO.userError "no message within 5s")
+  | .error e => throw (IO.userError s!"recv failed: {e}")
+
+/-- `n` bytes of a repeating pattern -/
+private def patternBytes (n : Nat) : ByteArray := Id.run do
+  let mut data := ByteArray.emptyWithCapacity n
+  for i in [0:n] do
+    data := data.push (i % 251).toUInt8
+  return data
+
 test "WebSocket support check" := do
   let supported ← Wisp.FFI.wsCheckSupport
   -- With Homebrew curl 8.11+, WebSocket should be supported
@@ -48,6 +72,110 @@ test "WebSocket invalid URL rejected" := do
     shouldSatisfy true "invalid URL rejected"
   | .ok _ => throw (IO.userError "Expected error for http:// URL")
 
+test "WebSocket hub rejects invalid URL" := do
+  let hub ← Wisp.WebSocket.Hub.new
+  let result ← IO.wait (← hub.connect "http://example.com")
+  hub.shutdown
+  match result with
+  | .error _ => shouldSatisfy true "invalid URL rejected"
+  | .ok _ => throw (IO.userError "Expected error for http:// URL")
+
+
+test "WebSocket fragmented message arrives whole" := withEchoServer fun port => do
+  let conn ← connectEcho port
+  let _ ← shouldBeOk (← conn.sendFragment .text "hello ".toUTF8 false) "first fragment"
+  let _ ← shouldBeOk (← conn.sendFragment .text "fragmented ".toUTF8 false) "second fragment"
+  let _ ← shouldBeOk (← conn.sendFragment .text "world".toUTF8 true) "last fragment"
+  let frame ← expectFrame conn
+  frame.frameType ≡ .text
+  frame.payloadTextLossy ≡ "hello fragmented world"
+  let _ ← conn.close
+
+test "WebSocket message over 64 KiB round-trips" := withEchoServer fun port => do
+  let conn ← connectEcho port
+  let data := patternBytes (300 * 1024)
+  let _ ← shouldBeOk (← conn.sendBinary data) "send 300 KiB"
+  let frame ← expectFrame conn
+  frame.frameType ≡ .binary
+  frame.payload.size ≡ data.size
+  shouldSatisfy (frame.payload == data) "payload matches"
+  let _ ← conn.close
+
+test "WebSocket recvFragment streams a large message" := withEchoServer fun port => do
+  let conn ← connectEcho port
+  let data := patternBytes (300 * 1024)
+  let _ ← shouldBeOk (← conn.sendBinary data) "send 300 KiB"
+  let deadline := (← IO.monoMsNow) + 5000
+  let mut received := ByteArray.empty
+  let mut done := false
+  while !done && (← IO.monoMsNow) < deadline do
+    match ← conn.recvFragment with
+    | .ok (some piece) =>
+      received := received ++ piece.payload
+      done := piece.final
+    | .ok none => IO.sleep 5
+    | .error e => throw (IO.userError s!"recv failed: {e}")
+  shouldSatisfy done "final piece received"
+  shouldSatisfy (received == data) "pieces reassemble the message"
+  let _ ← conn.close
+
+test "WebSocket oversized message is dropped and the connection keeps working" :=
+    withEchoServer fun port => do
+  let conn ← connectEcho port
+  conn.setMaxMessageSize 1024
+  let _ ← shouldBeOk (← conn.sendBinary (patternBytes 4096)) "send oversized"
+  let _ ← shouldBeOk (← conn.sendText "after") "send after"
+  match ← conn.recvTimeout 5000 with
+  | .error e => shouldSatisfy ((toString e).containsSubstr "limit") "oversized message reported"
+  | .ok _ => throw (IO.userError "Expected an error for the oversized message")
+  let frame ← expectFrame conn
+  frame.payloadTextLossy ≡ "after"
+  let _ ← conn.close
+
+test "WebSocket recvTimeout returns a frame promptly and none at its deadline" :=
+    withEchoServer fun port => do
+  let conn ← connectEcho port
+  let _ ← shouldBeOk (← conn.sendText "ping") "send ping"
+  let start ← IO.monoMsNow
+  let frame ← expectFrame conn
+  frame.payloadTextLossy ≡ "ping"
+  -- Well before the 5s timeout: the wait wakes on the socket, not a poll tick
+  shouldSatisfy ((← IO.monoMsNow) - start < 1000) "frame arrived promptly"
+  let start ← IO.monoMsNow
+  match ← conn.recvTimeout 300 with
+  | .ok none =>
+    let elapsed := (← IO.monoMsNow) - start
+    shouldSatisfy (elapsed ≥ 300 && elapsed < 800) s!"timed out near the deadline ({elapsed}ms)"
+  | .ok (some _) => throw (IO.userError "Expected no frame")
+  | .error e => throw (IO.userError s!"recv failed: {e}")
+  let _ ← conn.close
 
+test "WebSocket hub serves several connections" := withEchoServer fun port => do
+  let hub ← Wisp.WebSocket.Hub.new
+  let mut conns : Array Wisp.WebSocket.HubConnection := #[]
+  for _ in [0:4] do
+    match ← IO.wait (← hub.connect s!"ws://127.0.0.1:{port}/ws") with
+    | .ok conn => conns := conns.push conn
+    | .error e => throw (IO.userError s!"connect failed: {e}")
+  for conn in conns, i in [0:conns.size] do
+    let _ ← shouldBeOk (← IO.wait (← conn.sendText s!"message {i}")) s!"send on connection {i}"
+  for conn in conns, i in [0:conns.size] do
+    match ← conn.recv with
+    | some frame => frame.payloadTextLossy ≡ s!"message {i}"
+    | none => throw (IO.userError s!"connection {i} closed early")
+  -- Larger than a socket buffer, so the hub has to finish it once the
+  -- socket drains
+  let data := patternBytes (4 * 1024 * 1024)
+  let _ ← shouldBeOk (← IO.wait (← conns[0]!.sendBinary data)) "send 4 MiB"
+  match ← conns[0]!.recv with
+  | some frame => shouldSatisfy (frame.payload == data) "large payload echoed"
+  | none => throw (IO.userError "connection closed early")
+  for conn in conns do
+    conn.close
+  for conn in conns do
+    -- The inbox closes once the close frame has gone out
+    while (← conn.recv).isSome do pure ()
+    (← conn.getState) ≡ .closed
+  hub.shutdown
 
 end WispTests.WebSocket
@@ -42,34 +42,67 @@ def curlIncludeArgs : Array String :=
   else
     #[]
 
+-- Request body compression: zlib always, zstd when built with `lake build -Kzstd`
+def withZstd : Bool := (get_config? zstd).isSome
+
+def compressionLinkArgs : Array String :=
+  if withZstd then #["-lz", "-lzstd"] else #["-lz"]
+
+def compressionCompileArgs : Array String :=
+  if withZstd then #["-DWISP_WITH_ZSTD"] else #[]
+
+def nativeLinkArgs : Array String := curlLinkArgs ++ compressionLinkArgs
+
+-- Loopback server used by wisp_bench and the WebSocket tests
+target wisp_bench_server_o pkg : FilePath := do
+  let oFile := pkg.buildDir / "native" / "wisp_bench_server.o"
+  let srcJob ← inputTextFile <| pkg.dir / "native" / "src" / "wisp_bench_server.c"
+  let leanIncludeDir ← getLeanIncludeDir
+  let weakArgs := #["-I", leanIncludeDir.toString,
+                    "-I", (pkg.dir / "native" / "include").toString]
+  buildO oFile srcJob weakArgs #["-fPIC", "-O2"] "cc" getLeanTrace
+
 @[default_target]
 lean_lib Wisp where
   roots := #[`Wisp]
-  moreLinkArgs := curlLinkArgs
+  moreLinkArgs := nativeLinkArgs
 
 lean_lib WispTests where
   roots := #[`WispTests]
+  moreLinkObjs := #[wisp_bench_server_o]
+
+-- The loopback server is linked only where it is used (benchmarks and
+-- tests), not package-wide, so packages depending on wisp never build it
+lean_lib WispBench where
+  roots := #[`WispBench]
+  moreLinkObjs := #[wisp_bench_server_o]
 
 @[test_driver]
 lean_exe wisp_tests where
   root := `WispTests.Main
-  moreLinkArgs := curlLinkArgs
+  moreLinkArgs := nativeLinkArgs
+  moreLinkObjs := #[wisp_bench_server_o]
+
+lean_exe wisp_bench where
+  root := `WispBench.Main
+  moreLinkArgs := nativeLinkArgs
+  moreLinkObjs := #[wisp_bench_server_o]
 
 lean_exe simple_get where
   root := `examples.SimpleGet
-  moreLinkArgs := curlLinkArgs
+  moreLinkArgs := nativeLinkArgs
 
 lean_exe post_json where
   root := `examples.PostJSON
-  moreLinkArgs := curlLinkArgs
+  moreLinkArgs := nativeLinkArgs
 
 lean_exe minimal_test where
   root := `examples.MinimalTest
-  moreLinkArgs := curlLinkArgs
+  moreLinkArgs := nativeLinkArgs
 
 lean_exe client_test where
   root := `examples.ClientTest
-  moreLinkArgs := curlLinkArgs
+  moreLinkArgs := nativeLinkArgs
 
 -- FFI: Build C code
 target wisp_ffi_o pkg : FilePath := do
@@ -78,7 +111,7 @@ target wisp_ffi_o pkg : FilePath := do
   let leanIncludeDir ← getLeanIncludeDir
   let weakArgs := #["-I", leanIncludeDir.toString,
                     "-I", (pkg.dir / "native" / "include").toString] ++ curlIncludeArgs
-  buildO oFile srcJob weakArgs #["-fPIC", "-O2"] "cc" getLeanTrace
+  buildO oFile srcJob weakArgs (#["-fPIC", "-O2"] ++ compressionCompileArgs) "cc" getLeanTrace
 
 extern_lib wisp_native pkg := do
   let name := nameToStaticLib "wisp_native"
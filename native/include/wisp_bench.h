@@ -0,0 +1,20 @@
+/*
+ * Wisp Benchmark Server Header
+ * Loopback HTTP/1.1 and WebSocket server used by wisp_bench and the tests
+ */
+
+#ifndef WISP_BENCH_H
+#define WISP_BENCH_H
+
+#include <lean/lean.h>
+
+// Server lifecycle
+LEAN_EXPORT lean_obj_res wisp_bench_server_start(uint16_t port, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_bench_server_port(b_lean_obj_arg server, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_bench_server_requests(b_lean_obj_arg server, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_bench_server_stop(b_lean_obj_arg server, lean_obj_arg world);
+
+// Process statistics
+LEAN_EXPORT lean_obj_res wisp_bench_resident_bytes(lean_obj_arg world);
+
+#endif // WISP_BENCH_H
@@ -14,6 +14,10 @@ LEAN_EXPORT lean_obj_res wisp_global_init(lean_obj_arg world);
 LEAN_EXPORT lean_obj_res wisp_global_cleanup(lean_obj_arg world);
 LEAN_EXPORT lean_obj_res wisp_version_info(lean_obj_arg world);
 
+// HTTP dates
+LEAN_EXPORT lean_obj_res wisp_parse_http_date(b_lean_obj_arg date, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_unix_time(lean_obj_arg world);
+
 // Easy handle operations
 LEAN_EXPORT lean_obj_res wisp_easy_init(lean_obj_arg world);
 LEAN_EXPORT lean_obj_res wisp_easy_cleanup(b_lean_obj_arg easy, lean_obj_arg world);
@@ -32,12 +36,27 @@ LEAN_EXPORT lean_obj_res wisp_easy_setopt_mime(b_lean_obj_arg easy, b_lean_obj_a
 LEAN_EXPORT lean_obj_res wisp_easy_getinfo_long(b_lean_obj_arg easy, uint32_t info, lean_obj_arg world);
 LEAN_EXPORT lean_obj_res wisp_easy_getinfo_double(b_lean_obj_arg easy, uint32_t info, lean_obj_arg world);
 LEAN_EXPORT lean_obj_res wisp_easy_getinfo_string(b_lean_obj_arg easy, uint32_t info, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_easy_get_transfer_info(b_lean_obj_arg easy, lean_obj_arg world);
 
 // Response buffer operations
 LEAN_EXPORT lean_obj_res wisp_easy_setup_write_callback(b_lean_obj_arg easy, lean_obj_arg world);
 LEAN_EXPORT lean_obj_res wisp_easy_setup_header_callback(b_lean_obj_arg easy, lean_obj_arg world);
 LEAN_EXPORT lean_obj_res wisp_easy_get_response_body(b_lean_obj_arg easy, lean_obj_arg world);
 LEAN_EXPORT lean_obj_res wisp_easy_get_response_headers(b_lean_obj_arg easy, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_easy_get_response_header_fields(b_lean_obj_arg easy, lean_obj_arg world);
+
+// Request body upload
+LEAN_EXPORT lean_obj_res wisp_easy_set_body_bytes(b_lean_obj_arg easy, b_lean_obj_arg data, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_easy_set_body_file(b_lean_obj_arg easy, b_lean_obj_arg path, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_easy_set_body_stream(b_lean_obj_arg easy, int64_t length, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_easy_upload_wants_data(b_lean_obj_arg easy, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_easy_upload_push(b_lean_obj_arg easy, b_lean_obj_arg chunk, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_easy_upload_finish(b_lean_obj_arg easy, lean_obj_arg world);
+
+// Download to file
+LEAN_EXPORT lean_obj_res wisp_easy_set_download_file(b_lean_obj_arg easy, b_lean_obj_arg path, uint8_t resume, uint8_t preallocate, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_easy_set_download_segment(b_lean_obj_arg easy, b_lean_obj_arg path, uint64_t start, uint64_t length, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_file_preallocate(b_lean_obj_arg path, uint64_t size, lean_obj_arg world);
 
 // Slist operations
 LEAN_EXPORT lean_obj_res wisp_slist_new(lean_obj_arg world);
@@ -54,14 +73,33 @@ LEAN_EXPORT lean_obj_res wisp_mimepart_type(b_lean_obj_arg part, b_lean_obj_arg
 LEAN_EXPORT lean_obj_res wisp_mimepart_filedata(b_lean_obj_arg part, b_lean_obj_arg filepath, lean_obj_arg world);
 LEAN_EXPORT lean_obj_res wisp_mime_free(b_lean_obj_arg mime, lean_obj_arg world);
 
+// Share handle operations
+LEAN_EXPORT lean_obj_res wisp_share_init(lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_share_add(b_lean_obj_arg share, uint32_t data, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_easy_setopt_share(b_lean_obj_arg easy, b_lean_obj_arg share, lean_obj_arg world);
+
+// Request templates
+LEAN_EXPORT lean_obj_res wisp_template_new(lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_template_set_long(b_lean_obj_arg tmpl, uint32_t option, int64_t value, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_template_set_string(b_lean_obj_arg tmpl, uint32_t option, b_lean_obj_arg value, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_template_add_header(b_lean_obj_arg tmpl, b_lean_obj_arg line, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_template_set_share(b_lean_obj_arg tmpl, b_lean_obj_arg share, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_template_apply(b_lean_obj_arg easy, b_lean_obj_arg tmpl, b_lean_obj_arg url, b_lean_obj_arg headers, lean_obj_arg world);
+
 // Multi handle operations
 LEAN_EXPORT lean_obj_res wisp_multi_init(lean_obj_arg world);
 LEAN_EXPORT lean_obj_res wisp_multi_cleanup(b_lean_obj_arg multi, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_multi_setopt_long(b_lean_obj_arg multi, uint32_t option, int64_t value, lean_obj_arg world);
 LEAN_EXPORT lean_obj_res wisp_multi_add_handle(b_lean_obj_arg multi, b_lean_obj_arg easy, lean_obj_arg world);
 LEAN_EXPORT lean_obj_res wisp_multi_remove_handle(b_lean_obj_arg multi, b_lean_obj_arg easy, lean_obj_arg world);
 LEAN_EXPORT lean_obj_res wisp_multi_perform(b_lean_obj_arg multi, lean_obj_arg world);
 LEAN_EXPORT lean_obj_res wisp_multi_poll(b_lean_obj_arg multi, uint32_t timeout_ms, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_multi_wait(b_lean_obj_arg multi, uint32_t timeout_ms, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_multi_wakeup(b_lean_obj_arg multi, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_multi_take_ready(b_lean_obj_arg multi, lean_obj_arg world);
 LEAN_EXPORT lean_obj_res wisp_multi_info_read(b_lean_obj_arg multi, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_multi_watch_ws(b_lean_obj_arg multi, b_lean_obj_arg easy, lean_obj_arg world);
+LEAN_EXPORT lean_obj_res wisp_multi_unwatch_ws(b_lean_obj_arg multi, b_lean_obj_arg easy, lean_obj_arg world);
 
 // URL encoding
 LEAN_EXPORT lean_obj_res wisp_url_encode(b_lean_obj_arg easy, b_lean_obj_arg str, lean_obj_arg world);
@@ -74,5 +112,6 @@ LEAN_EXPORT lean_obj_res wisp_easy_headers_complete(b_lean_obj_arg easy, lean_ob
 LEAN_EXPORT lean_obj_res wisp_easy_drain_body_chunk(b_lean_obj_arg easy, lean_obj_arg world);
 LEAN_EXPORT lean_obj_res wisp_easy_has_pending_data(b_lean_obj_arg easy, lean_obj_arg world);
 LEAN_EXPORT lean_obj_res wisp_easy_reset_streaming(b_lean_obj_arg easy, lean_obj_arg world);
+LEAN_EXPORT size_t wisp_sse_find_line_end(b_lean_obj_arg data, size_t start);
 
 #endif // WISP_FFI_H
@@ -0,0 +1,626 @@
+/*
+ * Wisp Benchmark Server
+ * A small loopback HTTP/1.1 server for the wisp_bench executable.
+ *
+ * Routes:
+ *   GET  /bytes/<n>  n bytes of body with Content-Length
+ *   GET  /sse/<n>    n Server-Sent Events, then the connection closes
+ *   POST /echo       the request body echoed back
+ *   GET  /ws         WebSocket upgrade; data frames are echoed back
+ *   GET  /delay/<ms>     an empty 200 after waiting ms
+ *   GET  /slow-once/<ms> like /delay for the server's first such request,
+ *                        an immediate empty 200 for the rest
+ *   GET  /status/<code>  an empty reply with that status
+ *
+ * Each connection gets its own thread and HTTP/1.1 keep-alive is honoured,
+ * so the client's connection reuse is exercised. The server is only meant
+ * for trusted local traffic. The tests use it too, for behaviour that needs
+ * a server they control.
+ */
+
+#include "wisp_bench.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <strings.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#define BENCH_MAX_HEADER 16384
+#define BENCH_MAX_BODY (64 * 1024 * 1024)
+#define BENCH_FILL_SIZE 65536
+#define BENCH_ACCEPT_POLL_MS 100
+
+// ============================================================================
+// Server Handle
+// ============================================================================
+
+// Counters shared by a server and its connection threads, which may outlive
+// the server handle; freed when the last of them lets go
+typedef struct {
+    int refs;
+    uint64_t requests;
+    int slow_taken;
+} BenchCounters;
+
+typedef struct {
+    int listen_fd;
+    uint16_t port;
+    pthread_t thread;
+    volatile int stopping;
+    int running;
+    BenchCounters* counters;
+} BenchServer;
+
+static lean_external_class* g_bench_server_class = NULL;
+static pthread_once_t g_bench_once = PTHREAD_ONCE_INIT;
+static char g_fill[BENCH_FILL_SIZE];
+
+static void bench_server_shutdown(BenchServer* server) {
+    if (!server->running) return;
+    server->stopping = 1;
+    pthread_join(server->thread, NULL);
+    close(server->listen_fd);
+    server->running = 0;
+}
+
+static void counters_release(BenchCounters* counters) {
+    if (__atomic_sub_fetch(&counters->refs, 1, __ATOMIC_ACQ_REL) == 0) free(counters);
+}
+
+static void bench_server_finalizer(void* ptr) {
+    BenchServer* server = (BenchServer*)ptr;
+    bench_server_shutdown(server);
+    counters_release(server->counters);
+    free(server);
+}
+
+static void bench_noop_foreach(void* ptr, b_lean_obj_arg arg) {
+    (void)ptr;
+    (void)arg;
+}
+
+static void bench_init(void) {
+    g_bench_server_class = lean_register_external_class(bench_server_finalizer, bench_noop_foreach);
+    memset(g_fill, 'x', sizeof(g_fill));
+    // Peers closing mid-write must not kill the benchmark process
+    signal(SIGPIPE, SIG_IGN);
+}
+
+static lean_object* bench_io_error(const char* msg) {
+    return lean_io_result_mk_error(lean_mk_io_user_error(lean_mk_string(msg)));
+}
+
+// ============================================================================
+// Socket Helpers
+// ============================================================================
+
+static int write_all(int fd, const void* data, size_t len) {
+    const char* p = (const char*)data;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int read_exact(int fd, void* data, size_t len) {
+    char* p = (char*)data;
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Connection read buffer; bytes past the current request stay for the next one
+typedef struct {
+    int fd;
+    BenchCounters* counters;
+    char data[BENCH_MAX_HEADER];
+    size_t len;
+} Conn;
+
+// Read until a complete header block is buffered. Returns its length
+// (including the blank line) or -1 on EOF or an oversized header.
+static ssize_t read_header_block(Conn* c) {
+    for (;;) {
+        if (c->len >= 4) {
+            for (size_t i = 0; i + 3 < c->len; i++) {
+                if (memcmp(c->data + i, "\r\n\r\n", 4) == 0) return (ssize_t)(i + 4);
+            }
+        }
+        if (c->len == sizeof(c->data)) return -1;
+        ssize_t n = recv(c->fd, c->data + c->len, sizeof(c->data) - c->len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        c->len += (size_t)n;
+    }
+}
+
+static void consume(Conn* c, size_t n) {
+    memmove(c->data, c->data + n, c->len - n);
+    c->len -= n;
+}
+
+// Find a header value in a header block. Copies it NUL-terminated into out.
+static int find_header(const char* block, size_t block_len, const char* name, char* out, size_t out_size) {
+    size_t name_len = strlen(name);
+    const char* end = block + block_len;
+    const char* line = memchr(block, '\n', block_len);
+    while (line && line + 1 < end) {
+        line++;
+        const char* eol = memchr(line, '\n', (size_t)(end - line));
+        if (!eol) break;
+        if ((size_t)(eol - line) > name_len && line[name_len] == ':' &&
+            strncasecmp(line, name, name_len) == 0) {
+            const char* v = line + name_len + 1;
+            while (v < eol && (*v == ' ' || *v == '\t')) v++;
+            const char* ve = eol;
+            while (ve > v && (ve[-1] == '\r' || ve[-1] == ' ')) ve--;
+            size_t n = (size_t)(ve - v);
+            if (n >= out_size) n = out_size - 1;
+            memcpy(out, v, n);
+            out[n] = '\0';
+            return 1;
+        }
+        line = eol;
+    }
+    return 0;
+}
+
+// ============================================================================
+// SHA-1 and Base64 (for the WebSocket handshake)
+// ============================================================================
+
+#define ROL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void sha1_block(uint32_t h[5], const unsigned char* p) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)p[i * 4] << 24) | ((uint32_t)p[i * 4 + 1] << 16) |
+               ((uint32_t)p[i * 4 + 2] << 8) | (uint32_t)p[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; i++) w[i] = ROL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+        else if (i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+        else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+        else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+        uint32_t t = ROL32(a, 5) + f + e + k + w[i];
+        e = d; d = c; c = ROL32(b, 30); b = a; a = t;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+}
+
+static void sha1(const unsigned char* data, size_t len, unsigned char out[20]) {
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) sha1_block(h, data + i);
+    unsigned char tail[128];
+    size_t rem = len - i;
+    memcpy(tail, data + i, rem);
+    tail[rem] = 0x80;
+    size_t tail_len = rem < 56 ? 64 : 128;
+    memset(tail + rem + 1, 0, tail_len - rem - 1);
+    uint64_t bits = (uint64_t)len * 8;
+    for (int j = 0; j < 8; j++) tail[tail_len - 1 - j] = (unsigned char)(bits >> (8 * j));
+    sha1_block(h, tail);
+    if (tail_len == 128) sha1_block(h, tail + 64);
+    for (int j = 0; j < 5; j++) {
+        out[j * 4] = (unsigned char)(h[j] >> 24);
+        out[j * 4 + 1] = (unsigned char)(h[j] >> 16);
+        out[j * 4 + 2] = (unsigned char)(h[j] >> 8);
+        out[j * 4 + 3] = (unsigned char)h[j];
+    }
+}
+
+static void base64_encode(const unsigned char* in, size_t len, char* out) {
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t o = 0;
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = (uint32_t)in[i] << 16;
+        if (i + 1 < len) v |= (uint32_t)in[i + 1] << 8;
+        if (i + 2 < len) v |= in[i + 2];
+        out[o++] = table[(v >> 18) & 63];
+        out[o++] = table[(v >> 12) & 63];
+        out[o++] = i + 1 < len ? table[(v >> 6) & 63] : '=';
+        out[o++] = i + 2 < len ? table[v & 63] : '=';
+    }
+    out[o] = '\0';
+}
+
+// ============================================================================
+// Routes
+// ============================================================================
+
+static int send_status(int fd, const char* status, int keep_alive) {
+    char head[256];
+    int n = snprintf(head, sizeof(head),
+        "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: %s\r\n\r\n",
+        status, keep_alive ? "keep-alive" : "close");
+    return write_all(fd, head, (size_t)n);
+}
+
+static int serve_delay(int fd, unsigned long long ms, int keep_alive) {
+    poll(NULL, 0, ms > 60000 ? 60000 : (int)ms);
+    return send_status(fd, "200 OK", keep_alive);
+}
+
+static int serve_code(int fd, unsigned long long code, int keep_alive) {
+    char status[32];
+    snprintf(status, sizeof(status), "%llu Status", code < 100 || code > 599 ? 500 : code);
+    return send_status(fd, status, keep_alive);
+}
+
+static int serve_bytes(int fd, unsigned long long size, int keep_alive) {
+    char head[256];
+    int n = snprintf(head, sizeof(head),
+        "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+        "Content-Length: %llu\r\nConnection: %s\r\n\r\n",
+        size, keep_alive ? "keep-alive" : "close");
+    if (write_all(fd, head, (size_t)n) != 0) return -1;
+    while (size > 0) {
+        size_t chunk = size < sizeof(g_fill) ? (size_t)size : sizeof(g_fill);
+        if (write_all(fd, g_fill, chunk) != 0) return -1;
+        size -= chunk;
+    }
+    return 0;
+}
+
+static int serve_sse(int fd, unsigned long long count) {
+    static const char head[] =
+        "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+        "Cache-Control: no-cache\r\nConnection: close\r\n\r\n";
+    if (write_all(fd, head, sizeof(head) - 1) != 0) return -1;
+    // Batch events so the stream isn't dominated by syscalls
+    char buf[BENCH_FILL_SIZE];
+    size_t used = 0;
+    for (unsigned long long i = 0; i < count; i++) {
+        if (used + 64 > sizeof(buf)) {
+            if (write_all(fd, buf, used) != 0) return -1;
+            used = 0;
+        }
+        used += (size_t)snprintf(buf + used, sizeof(buf) - used, "id: %llu\ndata: event %llu\n\n", i, i);
+    }
+    if (used > 0 && write_all(fd, buf, used) != 0) return -1;
+    return 0;
+}
+
+static int serve_echo(Conn* c, unsigned long long length, int keep_alive) {
+    if (length > BENCH_MAX_BODY) {
+        send_status(c->fd, "413 Payload Too Large", 0);
+        return -1;
+    }
+    char head[256];
+    int n = snprintf(head, sizeof(head),
+        "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+        "Content-Length: %llu\r\nConnection: %s\r\n\r\n",
+        length, keep_alive ? "keep-alive" : "close");
+    if (write_all(c->fd, head, (size_t)n) != 0) return -1;
+    // Stream the body back as it arrives, starting with what is already buffered
+    size_t buffered = c->len < length ? c->len : (size_t)length;
+    if (buffered > 0) {
+        if (write_all(c->fd, c->data, buffered) != 0) return -1;
+        consume(c, buffered);
+        length -= buffered;
+    }
+    char buf[BENCH_FILL_SIZE];
+    while (length > 0) {
+        size_t want = length < sizeof(buf) ? (size_t)length : sizeof(buf);
+        ssize_t got = recv(c->fd, buf, want, 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return -1;
+        if (write_all(c->fd, buf, (size_t)got) != 0) return -1;
+        length -= (unsigned long long)got;
+    }
+    return 0;
+}
+
+// first_byte carries the FIN bit and opcode; server frames are never masked
+static int ws_send_frame(int fd, unsigned char first_byte, const unsigned char* payload, uint64_t len) {
+    unsigned char head[10];
+    size_t head_len = 2;
+    head[0] = first_byte;
+    if (len < 126) {
+        head[1] = (unsigned char)len;
+    } else if (len <= 0xFFFF) {
+        head[1] = 126;
+        head[2] = (unsigned char)(len >> 8);
+        head[3] = (unsigned char)len;
+        head_len = 4;
+    } else {
+        head[1] = 127;
+        for (int i = 0; i < 8; i++) head[2 + i] = (unsigned char)(len >> (56 - 8 * i));
+        head_len = 10;
+    }
+    if (write_all(fd, head, head_len) != 0) return -1;
+    return len > 0 ? write_all(fd, payload, (size_t)len) : 0;
+}
+
+// Read a frame whose first bytes may already sit in the connection buffer
+static int ws_read(Conn* c, void* out, size_t len) {
+    size_t buffered = c->len < len ? c->len : len;
+    if (buffered > 0) {
+        memcpy(out, c->data, buffered);
+        consume(c, buffered);
+    }
+    return read_exact(c->fd, (char*)out + buffered, len - buffered);
+}
+
+static void serve_websocket(Conn* c, const char* key) {
+    static const char guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    char joined[256];
+    snprintf(joined, sizeof(joined), "%s%s", key, guid);
+    unsigned char digest[20];
+    sha1((const unsigned char*)joined, strlen(joined), digest);
+    char accept[32];
+    base64_encode(digest, sizeof(digest), accept);
+
+    char head[256];
+    int n = snprintf(head, sizeof(head),
+        "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+        "Connection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", accept);
+    if (write_all(c->fd, head, (size_t)n) != 0) return;
+
+    unsigned char* payload = NULL;
+    size_t payload_capacity = 0;
+    for (;;) {
+        unsigned char hdr[2];
+        if (ws_read(c, hdr, 2) != 0) break;
+        unsigned char opcode = hdr[0] & 0x0F;
+        int masked = (hdr[1] & 0x80) != 0;
+        uint64_t len = hdr[1] & 0x7F;
+        if (len == 126) {
+            unsigned char ext[2];
+            if (ws_read(c, ext, 2) != 0) break;
+            len = ((uint64_t)ext[0] << 8) | ext[1];
+        } else if (len == 127) {
+            unsigned char ext[8];
+            if (ws_read(c, ext, 8) != 0) break;
+            len = 0;
+            for (int i = 0; i < 8; i++) len = (len << 8) | ext[i];
+        }
+        if (len > BENCH_MAX_BODY) break;
+        unsigned char mask[4] = {0, 0, 0, 0};
+        if (masked && ws_read(c, mask, 4) != 0) break;
+        if (len > payload_capacity) {
+            unsigned char* grown = realloc(payload, (size_t)len);
+            if (!grown) break;
+            payload = grown;
+            payload_capacity = (size_t)len;
+        }
+        if (len > 0 && ws_read(c, payload, (size_t)len) != 0) break;
+        for (uint64_t i = 0; i < len; i++) payload[i] ^= mask[i & 3];
+
+        if (opcode == 0x8) {
+            ws_send_frame(c->fd, 0x88, payload, len < 2 ? len : 2);
+            break;
+        } else if (opcode == 0x9) {
+            if (ws_send_frame(c->fd, 0x8A, payload, len) != 0) break;
+        } else if (opcode == 0xA) {
+            continue;
+        } else {
+            // Echo data frames, keeping the FIN bit and opcode of the original
+            if (ws_send_frame(c->fd, hdr[0] & 0x8F, payload, len) != 0) break;
+        }
+    }
+    free(payload);
+}
+
+static void* connection_thread(void* arg) {
+    Conn* c = (Conn*)arg;
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    for (;;) {
+        ssize_t header_len = read_header_block(c);
+        if (header_len < 0) break;
+
+        char method[16] = {0};
+        char path[1024] = {0};
+        if (sscanf(c->data, "%15s %1023s", method, path) != 2) break;
+
+        char value[256];
+        int keep_alive = 1;
+        if (find_header(c->data, (size_t)header_len, "Connection", value, sizeof(value)) &&
+            strcasecmp(value, "close") == 0) {
+            keep_alive = 0;
+        }
+        unsigned long long content_length = 0;
+        if (find_header(c->data, (size_t)header_len, "Content-Length", value, sizeof(value))) {
+            content_length = strtoull(value, NULL, 10);
+        }
+        int chunked = find_header(c->data, (size_t)header_len, "Transfer-Encoding", value, sizeof(value)) &&
+            strcasecmp(value, "chunked") == 0;
+        char ws_key[128];
+        int is_upgrade = find_header(c->data, (size_t)header_len, "Sec-WebSocket-Key", ws_key, sizeof(ws_key));
+        consume(c, (size_t)header_len);
+        __atomic_add_fetch(&c->counters->requests, 1, __ATOMIC_RELAXED);
+
+        int rc;
+        if (chunked) {
+            // Chunked uploads aren't part of the benchmark set
+            send_status(c->fd, "501 Not Implemented", 0);
+            break;
+        } else if (strcmp(path, "/ws") == 0 && is_upgrade) {
+            serve_websocket(c, ws_key);
+            break;
+        } else if (strncmp(path, "/bytes/", 7) == 0) {
+            rc = serve_bytes(c->fd, strtoull(path + 7, NULL, 10), keep_alive);
+        } else if (strncmp(path, "/sse/", 5) == 0) {
+            serve_sse(c->fd, strtoull(path + 5, NULL, 10));
+            break;
+        } else if (strcmp(path, "/echo") == 0) {
+            rc = serve_echo(c, content_length, keep_alive);
+        } else if (strncmp(path, "/delay/", 7) == 0) {
+            rc = serve_delay(c->fd, strtoull(path + 7, NULL, 10), keep_alive);
+        } else if (strncmp(path, "/slow-once/", 11) == 0) {
+            int first = !__atomic_exchange_n(&c->counters->slow_taken, 1, __ATOMIC_ACQ_REL);
+            rc = serve_delay(c->fd, first ? strtoull(path + 11, NULL, 10) : 0, keep_alive);
+        } else if (strncmp(path, "/status/", 8) == 0) {
+            rc = serve_code(c->fd, strtoull(path + 8, NULL, 10), keep_alive);
+        } else {
+            // Discard any body so the connection stays usable
+            while (content_length > 0) {
+                if (c->len == 0) {
+                    ssize_t n = recv(c->fd, c->data, sizeof(c->data), 0);
+                    if (n <= 0) break;
+                    c->len = (size_t)n;
+                }
+                size_t take = c->len < content_length ? c->len : (size_t)content_length;
+                consume(c, take);
+                content_length -= take;
+            }
+            rc = send_status(c->fd, "404 Not Found", keep_alive);
+        }
+        if (rc != 0 || !keep_alive) break;
+    }
+
+    close(c->fd);
+    counters_release(c->counters);
+    free(c);
+    return NULL;
+}
+
+static void* accept_thread(void* arg) {
+    BenchServer* server = (BenchServer*)arg;
+    while (!server->stopping) {
+        struct pollfd pfd = { .fd = server->listen_fd, .events = POLLIN, .revents = 0 };
+        int ready = poll(&pfd, 1, BENCH_ACCEPT_POLL_MS);
+        if (ready <= 0) continue;
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) continue;
+        Conn* c = malloc(sizeof(Conn));
+        if (!c) {
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->len = 0;
+        c->counters = server->counters;
+        __atomic_add_fetch(&server->counters->refs, 1, __ATOMIC_RELAXED);
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, connection_thread, c) != 0) {
+            close(fd);
+            counters_release(c->counters);
+            free(c);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+// ============================================================================
+// Lean Interface
+// ============================================================================
+
+LEAN_EXPORT lean_obj_res wisp_bench_server_start(uint16_t port, lean_obj_arg world) {
+    pthread_once(&g_bench_once, bench_init);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return bench_io_error("Failed to create benchmark server socket");
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 1024) != 0) {
+        close(fd);
+        return bench_io_error("Failed to bind benchmark server");
+    }
+    socklen_t addr_len = sizeof(addr);
+    getsockname(fd, (struct sockaddr*)&addr, &addr_len);
+
+    BenchServer* server = calloc(1, sizeof(BenchServer));
+    if (!server) {
+        close(fd);
+        return bench_io_error("Failed to allocate benchmark server");
+    }
+    server->counters = calloc(1, sizeof(BenchCounters));
+    if (!server->counters) {
+        close(fd);
+        free(server);
+        return bench_io_error("Failed to allocate benchmark server");
+    }
+    server->counters->refs = 1;
+    server->listen_fd = fd;
+    server->port = ntohs(addr.sin_port);
+    if (pthread_create(&server->thread, NULL, accept_thread, server) != 0) {
+        close(fd);
+        free(server->counters);
+        free(server);
+        return bench_io_error("Failed to start benchmark server thread");
+    }
+    server->running = 1;
+
+    lean_object* obj = lean_alloc_external(g_bench_server_class, server);
+    return lean_io_result_mk_ok(obj);
+}
+
+LEAN_EXPORT lean_obj_res wisp_bench_server_port(b_lean_obj_arg server_obj, lean_obj_arg world) {
+    BenchServer* server = (BenchServer*)lean_get_external_data(server_obj);
+    return lean_io_result_mk_ok(lean_box((size_t)server->port));
+}
+
+// Requests the server has read so far, WebSocket upgrades included
+LEAN_EXPORT lean_obj_res wisp_bench_server_requests(b_lean_obj_arg server_obj, lean_obj_arg world) {
+    BenchServer* server = (BenchServer*)lean_get_external_data(server_obj);
+    uint64_t n = __atomic_load_n(&server->counters->requests, __ATOMIC_RELAXED);
+    return lean_io_result_mk_ok(lean_box_uint64(n));
+}
+
+LEAN_EXPORT lean_obj_res wisp_bench_server_stop(b_lean_obj_arg server_obj, lean_obj_arg world) {
+    BenchServer* server = (BenchServer*)lean_get_external_data(server_obj);
+    bench_server_shutdown(server);
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+// Resident set size of the process in bytes. Linux reports the current value
+// from /proc/self/statm; elsewhere the peak from getrusage is the best available.
+LEAN_EXPORT lean_obj_res wisp_bench_resident_bytes(lean_obj_arg world) {
+    uint64_t bytes = 0;
+#ifdef __linux__
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f) {
+        unsigned long size = 0, resident = 0;
+        if (fscanf(f, "%lu %lu", &size, &resident) == 2) {
+            bytes = (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE);
+        }
+        fclose(f);
+    }
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+        bytes = (uint64_t)usage.ru_maxrss;  // bytes on macOS
+#else
+        bytes = (uint64_t)usage.ru_maxrss * 1024;  // kilobytes elsewhere
+#endif
+    }
+#endif
+    return lean_io_result_mk_ok(lean_box_uint64(bytes));
+}
@@ -3,11 +3,34 @@
  * C bindings for libcurl with external class registration
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE  // fallocate
+#endif
+
 #include "wisp_ffi.h"
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <ctype.h>
+#include <strings.h>
+#include <zlib.h>
+#ifdef WISP_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#define WISP_USE_EPOLL 1
+#endif
 
 // ============================================================================
 // External Class Registration
@@ -18,40 +41,146 @@ static lean_external_class* g_multi_class = NULL;
 static lean_external_class* g_slist_class = NULL;
 static lean_external_class* g_mime_class = NULL;
 static lean_external_class* g_mimepart_class = NULL;
+static lean_external_class* g_share_class = NULL;
+static lean_external_class* g_template_class = NULL;
 
 static int g_initialized = 0;
+static char* g_ca_bundle = NULL;  // Resolved once by wisp_global_init
+
+// Data messages larger than this are rejected unless raised per connection
+#define WISP_WS_DEFAULT_MAX_MESSAGE ((size_t)64 * 1024 * 1024)
+// Read size while the length of the next frame is still unknown
+#define WISP_WS_READ_CHUNK ((size_t)16 * 1024)
+
+// Response buffers up to this size survive wisp_easy_reset so pooled handles
+// can be reused without reallocating; larger ones are released.
+#define WISP_RETAIN_BUFFER_MAX (1024 * 1024)
+
+// Initial body array size when the server sends no Content-Length, and the
+// most reserved up front from a Content-Length. The length is the server's
+// claim, so larger bodies grow geometrically as their bytes actually arrive.
+#define WISP_BODY_INITIAL_SIZE (16 * 1024)
+#define WISP_BODY_PRESIZE_MAX ((curl_off_t)4 * 1024 * 1024)
+
+// Capacity of the per-handle streaming ring. When Lean falls behind and the
+// ring is full, the transfer is paused until it has been drained.
+#define WISP_STREAM_RING_SIZE (256 * 1024)
 
 // ============================================================================
 // Wrapper Types
 // ============================================================================
 
+typedef struct MultiWrapper MultiWrapper;
+
+// A parsed header line: offsets into response_headers, which may move when
+// the buffer grows
+typedef struct {
+    uint32_t name_offset;
+    uint32_t name_length;
+    uint32_t value_offset;
+    uint32_t value_length;
+} HeaderField;
+
 typedef struct {
     CURL* handle;
-    char* response_body;
-    size_t response_size;
-    size_t response_capacity;
+    MultiWrapper* owner;        // Multi handle this easy is attached to, if any
+    int ready_queued;           // Already listed in owner->ready
+    int ws_watched;             // Open WebSocket whose socket owner waits on
+    int ws_socket;              // Socket registered by wisp_multi_watch_ws
+    int ws_want_write;          // Also wait for the watched socket to be writable
+    lean_object* body_array;    // ByteArray the buffered body is written into
     char* response_headers;
     size_t headers_size;
     size_t headers_capacity;
+    HeaderField* header_fields; // Parsed lines of the current response
+    size_t header_field_count;
+    size_t header_field_capacity;
     char** option_strings;
     size_t option_strings_count;
     size_t option_strings_capacity;
     struct curl_slist* owned_slist;
     curl_mime* owned_mime;
+    lean_object* share_obj;     // Share handle kept alive while attached
+    lean_object* template_obj;  // Template whose header list the handle uses
     // Streaming support
     int is_streaming;           // 0=buffered (default), 1=streaming
-    size_t stream_read_offset;  // How much body data has been read by Lean
     int headers_complete;       // 1 if all headers received
+    int follow_location;        // CURLOPT_FOLLOWLOCATION is on
+    int stream_paused;          // write_callback returned CURL_WRITEFUNC_PAUSE
+    char* stream_ring;          // Undrained body bytes (bounded ring buffer)
+    size_t stream_ring_capacity;
+    size_t stream_ring_head;    // Offset of the oldest undrained byte
+    size_t stream_ring_size;    // Number of undrained bytes
+    // Request body
+    lean_object* body_data;     // ByteArray sent via CURLOPT_POSTFIELDS without copying
+    int upload_fd;              // File streamed as the body (-1 = none)
+    int upload_from_lean;       // Body chunks are pushed from a Lean channel
+    lean_object* upload_chunk;  // Chunk currently being sent
+    size_t upload_offset;       // Bytes of upload_chunk already sent
+    int upload_eof;             // The Lean channel was closed
+    int upload_paused;          // read_callback returned CURL_READFUNC_PAUSE
+    // Request body compressed while it is sent
+    int compress_coding;        // WISP_CODING_* of body_data (0 = sent as is)
+    void* compressor;           // z_stream or ZSTD_CCtx
+    const uint8_t* compress_src;  // Bytes of body_data
+    size_t compress_size;
+    size_t compress_offset;     // Bytes of compress_src already compressed
+    int compress_done;          // The compressor has emitted its last byte
+    // Download to file
+    int download_fd;            // File a 2xx body is written to (-1 = none)
+    int download_state;         // 0 = undecided, 1 = writing to the file, 2 = buffering
+    int download_prealloc;      // Reserve disk space from the Content-Length
+    int download_segment;       // Fetching one byte range of a segmented download
+    curl_off_t download_offset; // Bytes already on disk that were requested to be skipped
+    curl_off_t download_pos;    // File offset of the next body byte
+    curl_off_t download_end;    // Offset just past the segment
+    // WebSocket message reassembly
+    lean_object* ws_message;    // ByteArray the current data message is read into
+    size_t ws_message_size;     // Bytes of ws_message received so far
+    uint32_t ws_message_flags;  // Type flags of the message's first fragment
+    int ws_assembling;          // A data message has started but not finished
+    int ws_discarding;          // Dropping the rest of an oversized message
+    uint64_t ws_frame_left;     // Payload bytes of the current frame still to read
+    int ws_in_control;          // The current frame is a control frame
+    unsigned char ws_control[125];  // Control frame payloads are at most 125 bytes
+    size_t ws_control_size;
+    uint32_t ws_control_flags;
+    size_t ws_max_message;      // Largest data message accepted
+    uint64_t ws_dropped;        // Messages dropped for exceeding ws_max_message
 } EasyWrapper;
 
-typedef struct {
+struct MultiWrapper {
     CURLM* handle;
-} MultiWrapper;
+    // Streaming handles with new headers or body data since the last take
+    EasyWrapper** ready;
+    size_t ready_count;
+    size_t ready_capacity;
+    // Event loop state for curl_multi_socket_action
+    int wakeup_read_fd;         // Becomes readable after wisp_multi_wakeup
+    int wakeup_write_fd;        // Same as wakeup_read_fd when backed by an eventfd
+    int64_t timer_deadline_ms;  // Monotonic deadline requested by curl (-1 = none)
+    int running;                // Transfers still running after the last action
+    // Open WebSocket connections waited on alongside curl's sockets
+    EasyWrapper** ws_by_fd;     // Indexed by socket
+    size_t ws_by_fd_capacity;
+#ifdef WISP_USE_EPOLL
+    int epoll_fd;
+#else
+    struct pollfd* pollfds;     // pollfds[0] is the wakeup pipe
+    size_t pollfds_count;
+    size_t pollfds_capacity;
+#endif
+};
 
 typedef struct {
     struct curl_slist* list;
 } SlistWrapper;
 
+typedef struct {
+    CURLSH* handle;
+    pthread_mutex_t locks[CURL_LOCK_DATA_LAST];
+} ShareWrapper;
+
 typedef struct {
     curl_mime* mime;
     CURL* easy;
@@ -61,6 +190,56 @@ typedef struct {
     curl_mimepart* part;
 } MimepartWrapper;
 
+typedef struct {
+    CURLoption option;
+    long value;
+} TemplateLong;
+
+typedef struct {
+    CURLoption option;
+    char* value;
+} TemplateString;
+
+// Options, headers and a share handle applied to easy handles in one call.
+// Filled from Lean before first use and only read afterwards, so workers
+// apply it concurrently without locking.
+typedef struct {
+    CURL* probe;                // Scratch handle each option is validated on
+    TemplateLong* longs;
+    size_t long_count;
+    size_t long_capacity;
+    TemplateString* strings;
+    size_t string_count;
+    size_t string_capacity;
+    struct curl_slist* headers; // Static header lines, used by every handle as is
+    lean_object* share_obj;     // Share handle attached on apply, if any
+    int follow_location;
+} TemplateWrapper;
+
+// Content codings a request body can be compressed with (Lean: ContentCoding)
+#define WISP_CODING_GZIP 1
+#define WISP_CODING_ZSTD 2
+
+static void easy_free_compressor(EasyWrapper* wrapper) {
+    if (wrapper->compressor) {
+        if (wrapper->compress_coding == WISP_CODING_GZIP) {
+            deflateEnd((z_stream*)wrapper->compressor);
+            free(wrapper->compressor);
+        }
+#ifdef WISP_WITH_ZSTD
+        else if (wrapper->compress_coding == WISP_CODING_ZSTD) {
+            ZSTD_freeCCtx((ZSTD_CCtx*)wrapper->compressor);
+        }
+#endif
+        wrapper->compressor = NULL;
+    }
+    wrapper->compress_coding = 0;
+    wrapper->compress_src = NULL;
+    wrapper->compress_size = 0;
+    wrapper->compress_offset = 0;
+    wrapper->compress_done = 0;
+}
+
 // ============================================================================
 // Finalizers
 // ============================================================================
@@ -69,8 +248,10 @@ static void easy_finalizer(void* ptr) {
     EasyWrapper* wrapper = (EasyWrapper*)ptr;
     if (wrapper) {
         if (wrapper->handle) curl_easy_cleanup(wrapper->handle);
-        if (wrapper->response_body) free(wrapper->response_body);
+        if (wrapper->body_array) lean_dec(wrapper->body_array);
         if (wrapper->response_headers) free(wrapper->response_headers);
+        if (wrapper->header_fields) free(wrapper->header_fields);
+        if (wrapper->stream_ring) free(wrapper->stream_ring);
         if (wrapper->option_strings) {
             for (size_t i = 0; i < wrapper->option_strings_count; i++) {
                 free(wrapper->option_strings[i]);
@@ -79,6 +260,16 @@ static void easy_finalizer(void* ptr) {
         }
         if (wrapper->owned_slist) curl_slist_free_all(wrapper->owned_slist);
         if (wrapper->owned_mime) curl_mime_free(wrapper->owned_mime);
+        if (wrapper->body_data) lean_dec(wrapper->body_data);
+        if (wrapper->upload_chunk) lean_dec(wrapper->upload_chunk);
+        if (wrapper->upload_fd >= 0) close(wrapper->upload_fd);
+        easy_free_compressor(wrapper);
+        if (wrapper->download_fd >= 0) close(wrapper->download_fd);
+        if (wrapper->ws_message) lean_dec(wrapper->ws_message);
+        // Release the share and template only after the easy handle has
+        // detached from them
+        if (wrapper->share_obj) lean_dec(wrapper->share_obj);
+        if (wrapper->template_obj) lean_dec(wrapper->template_obj);
         free(wrapper);
     }
 }
@@ -87,6 +278,17 @@ static void multi_finalizer(void* ptr) {
     MultiWrapper* wrapper = (MultiWrapper*)ptr;
     if (wrapper) {
         if (wrapper->handle) curl_multi_cleanup(wrapper->handle);
+        free(wrapper->ready);
+        free(wrapper->ws_by_fd);
+#ifdef WISP_USE_EPOLL
+        if (wrapper->epoll_fd >= 0) close(wrapper->epoll_fd);
+#else
+        free(wrapper->pollfds);
+#endif
+        if (wrapper->wakeup_read_fd >= 0) close(wrapper->wakeup_read_fd);
+        if (wrapper->wakeup_write_fd >= 0 && wrapper->wakeup_write_fd != wrapper->wakeup_read_fd) {
+            close(wrapper->wakeup_write_fd);
+        }
         free(wrapper);
     }
 }
@@ -112,6 +314,33 @@ static void mimepart_finalizer(void* ptr) {
     free(ptr);
 }
 
+static void share_finalizer(void* ptr) {
+    ShareWrapper* wrapper = (ShareWrapper*)ptr;
+    if (wrapper) {
+        // Easy handles hold a reference, so none can still be attached here
+        if (wrapper->handle) curl_share_cleanup(wrapper->handle);
+        for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+            pthread_mutex_destroy(&wrapper->locks[i]);
+        }
+        free(wrapper);
+    }
+}
+
+static void template_finalizer(void* ptr) {
+    TemplateWrapper* wrapper = (TemplateWrapper*)ptr;
+    if (wrapper) {
+        if (wrapper->probe) curl_easy_cleanup(wrapper->probe);
+        free(wrapper->longs);
+        for (size_t i = 0; i < wrapper->string_count; i++) {
+            free(wrapper->strings[i].value);
+        }
+        free(wrapper->strings);
+        if (wrapper->headers) curl_slist_free_all(wrapper->headers);
+        if (wrapper->share_obj) lean_dec(wrapper->share_obj);
+        free(wrapper);
+    }
+}
+
 static void noop_foreach(void* ptr, b_lean_obj_arg arg) {
     (void)ptr;
     (void)arg;
@@ -128,6 +357,8 @@ static void init_external_classes(void) {
         g_slist_class = lean_register_external_class(slist_finalizer, noop_foreach);
         g_mime_class = lean_register_external_class(mime_finalizer, noop_foreach);
         g_mimepart_class = lean_register_external_class(mimepart_finalizer, noop_foreach);
+        g_share_class = lean_register_external_class(share_finalizer, noop_foreach);
+        g_template_class = lean_register_external_class(template_finalizer, noop_foreach);
     }
 }
 
@@ -181,6 +412,109 @@ static void easy_clear_owned_handles(EasyWrapper* wrapper) {
     }
 }
 
+static void easy_clear_upload(EasyWrapper* wrapper) {
+    if (wrapper->body_data) {
+        lean_dec(wrapper->body_data);
+        wrapper->body_data = NULL;
+    }
+    if (wrapper->upload_chunk) {
+        lean_dec(wrapper->upload_chunk);
+        wrapper->upload_chunk = NULL;
+    }
+    if (wrapper->upload_fd >= 0) {
+        close(wrapper->upload_fd);
+        wrapper->upload_fd = -1;
+    }
+    easy_free_compressor(wrapper);
+    wrapper->upload_from_lean = 0;
+    wrapper->upload_offset = 0;
+    wrapper->upload_eof = 0;
+    wrapper->upload_paused = 0;
+}
+
+static void easy_clear_download(EasyWrapper* wrapper) {
+    if (wrapper->download_fd >= 0) {
+        close(wrapper->download_fd);
+        wrapper->download_fd = -1;
+    }
+    wrapper->download_state = 0;
+    wrapper->download_prealloc = 0;
+    wrapper->download_segment = 0;
+    wrapper->download_offset = 0;
+    wrapper->download_pos = 0;
+    wrapper->download_end = 0;
+}
+
+// Forget any partially received WebSocket message
+static void easy_clear_ws(EasyWrapper* wrapper) {
+    if (wrapper->ws_message) {
+        lean_dec(wrapper->ws_message);
+        wrapper->ws_message = NULL;
+    }
+    wrapper->ws_message_size = 0;
+    wrapper->ws_message_flags = 0;
+    wrapper->ws_assembling = 0;
+    wrapper->ws_discarding = 0;
+    wrapper->ws_frame_left = 0;
+    wrapper->ws_in_control = 0;
+    wrapper->ws_control_size = 0;
+    wrapper->ws_control_flags = 0;
+}
+
+static void easy_release_share(EasyWrapper* wrapper) {
+    if (wrapper->share_obj) {
+        lean_dec(wrapper->share_obj);
+        wrapper->share_obj = NULL;
+    }
+}
+
+static void easy_release_template(EasyWrapper* wrapper) {
+    if (wrapper->template_obj) {
+        lean_dec(wrapper->template_obj);
+        wrapper->template_obj = NULL;
+    }
+}
+
+// Prepare the body array for a new transfer. An array Lean still references
+// (handed out by wisp_easy_get_response_body) is never written again.
+static void easy_reset_body(EasyWrapper* wrapper) {
+    lean_object* body = wrapper->body_array;
+    if (!body) return;
+    if (lean_is_exclusive(body) && lean_sarray_capacity(body) <= WISP_RETAIN_BUFFER_MAX) {
+        lean_to_sarray(body)->m_size = 0;
+    } else {
+        lean_dec(body);
+        wrapper->body_array = NULL;
+    }
+}
+
+// Make room for `extra` more body bytes. The first write of a transfer sizes
+// the array from Content-Length when known, up to WISP_BODY_PRESIZE_MAX;
+// beyond that it grows geometrically.
+static void body_reserve(EasyWrapper* wrapper, size_t extra) {
+    lean_object* body = wrapper->body_array;
+    size_t size = body ? lean_sarray_size(body) : 0;
+    size_t capacity = body ? lean_sarray_capacity(body) : 0;
+    size_t needed = size + extra;
+    if (needed <= capacity) return;
+
+    size_t new_capacity = capacity == 0 ? WISP_BODY_INITIAL_SIZE : capacity * 2;
+    if (size == 0) {
+        curl_off_t length = -1;
+        if (curl_easy_getinfo(wrapper->handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length) == CURLE_OK &&
+            length > 0) {
+            if (length > WISP_BODY_PRESIZE_MAX) length = WISP_BODY_PRESIZE_MAX;
+            if ((size_t)length > new_capacity) new_capacity = (size_t)length;
+        }
+    }
+    while (new_capacity < needed) new_capacity *= 2;
+
+    lean_object* grown = lean_alloc_sarray(1, size, new_capacity);
+    if (size > 0) memcpy(lean_sarray_cptr(grown), lean_sarray_cptr(body), size);
+    if (body) lean_dec(body);
+    wrapper->body_array = grown;
+}
+
 // Find CA bundle (same logic as afferent)
 static const char* find_ca_bundle(void) {
     const char* envs[] = {
@@ -216,36 +550,197 @@ static const char* find_ca_bundle(void) {
 // Write Callbacks
 // ============================================================================
 
+// Record that a streaming handle has something for the manager to deliver.
+// Each handle is listed at most once until wisp_multi_take_ready collects it.
+static void easy_mark_ready(EasyWrapper* wrapper) {
+    MultiWrapper* owner = wrapper->owner;
+    if (!owner || wrapper->ready_queued) return;
+    if (!wrapper->is_streaming && !wrapper->upload_from_lean && !wrapper->ws_watched) return;
+    if (owner->ready_count == owner->ready_capacity) {
+        size_t new_capacity = owner->ready_capacity == 0 ? 16 : owner->ready_capacity * 2;
+        EasyWrapper** list = realloc(owner->ready, new_capacity * sizeof(EasyWrapper*));
+        if (!list) return;
+        owner->ready = list;
+        owner->ready_capacity = new_capacity;
+    }
+    owner->ready[owner->ready_count++] = wrapper;
+    wrapper->ready_queued = 1;
+}
+
+// Append body data to the streaming ring, or pause the transfer when the
+// undrained data leaves no room. curl delivers the same data again once the
+// handle is unpaused by wisp_easy_drain_body_chunk.
+static size_t stream_write(EasyWrapper* wrapper, const char* data, size_t len) {
+    size_t free_space = wrapper->stream_ring_capacity - wrapper->stream_ring_size;
+    if (len > free_space) {
+        if (wrapper->stream_ring_size > 0) {
+            wrapper->stream_paused = 1;
+            easy_mark_ready(wrapper);
+            return CURL_WRITEFUNC_PAUSE;
+        }
+
+        // Empty ring that is still too small (first write, or a single chunk
+        // larger than the ring): size it to fit
+        size_t new_capacity = len > WISP_STREAM_RING_SIZE ? len : WISP_STREAM_RING_SIZE;
+        char* ring = realloc(wrapper->stream_ring, new_capacity);
+        if (!ring) return 0;
+        wrapper->stream_ring = ring;
+        wrapper->stream_ring_capacity = new_capacity;
+        wrapper->stream_ring_head = 0;
+    }
+
+    size_t tail = (wrapper->stream_ring_head + wrapper->stream_ring_size) % wrapper->stream_ring_capacity;
+    size_t first = wrapper->stream_ring_capacity - tail;
+    if (first > len) first = len;
+    memcpy(wrapper->stream_ring + tail, data, first);
+    memcpy(wrapper->stream_ring, data + first, len - first);
+    wrapper->stream_ring_size += len;
+    easy_mark_ready(wrapper);
+
+    return len;
+}
+
+// Decide where the final response's body goes, once its headers are in. A
+// 2xx body goes to the download file: a 206 continues at the offset asked
+// for, any other success replaces the file's contents. Anything else (an
+// error page) is buffered as usual and the file is left alone.
+static int download_begin(EasyWrapper* wrapper) {
+    long code = 0;
+    curl_easy_getinfo(wrapper->handle, CURLINFO_RESPONSE_CODE, &code);
+    if (code < 200 || code >= 300) {
+        wrapper->download_state = 2;
+        return 1;
+    }
+    if (wrapper->download_segment) {
+        // The whole object instead of the range asked for: stop rather than
+        // write it over the other segments
+        if (code != 206) return 0;
+        wrapper->download_pos = wrapper->download_offset;
+        wrapper->download_state = 1;
+        return 1;
+    }
+    if (code == 206 && wrapper->download_offset > 0) {
+        wrapper->download_pos = wrapper->download_offset;
+    } else {
+        if (ftruncate(wrapper->download_fd, 0) != 0) return 0;
+        wrapper->download_pos = 0;
+    }
+    wrapper->download_state = 1;
+#ifdef __linux__
+    // Reserve the blocks up front so a long download is laid out contiguously
+    // and a full disk fails now; the file size still only grows as data arrives
+    curl_off_t length = -1;
+    if (wrapper->download_prealloc &&
+        curl_easy_getinfo(wrapper->handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length) == CURLE_OK &&
+        length > 0) {
+        if (fallocate(wrapper->download_fd, FALLOC_FL_KEEP_SIZE, (off_t)wrapper->download_pos, (off_t)length) != 0 &&
+            errno == ENOSPC) {
+            return 0;
+        }
+    }
+#endif
+    return 1;
+}
+
+// Write body data to the download file. Returning short makes curl fail the
+// transfer with CURLE_WRITE_ERROR.
+static size_t download_write(EasyWrapper* wrapper, const char* data, size_t len) {
+    if (wrapper->download_segment && wrapper->download_pos + (curl_off_t)len > wrapper->download_end) {
+        return 0;
+    }
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pwrite(wrapper->download_fd, data + done, len - done, (off_t)wrapper->download_pos);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        done += (size_t)n;
+        wrapper->download_pos += n;
+    }
+    return len;
+}
+
 static size_t write_callback(void* contents, size_t size, size_t nmemb, void* userp) {
     size_t realsize = size * nmemb;
     EasyWrapper* wrapper = (EasyWrapper*)userp;
 
-    // Grow buffer if needed
-    size_t needed = wrapper->response_size + realsize + 1;
-    if (needed > wrapper->response_capacity) {
-        size_t new_capacity = wrapper->response_capacity == 0 ? 4096 : wrapper->response_capacity * 2;
-        while (new_capacity < needed) new_capacity *= 2;
-
-        char* ptr = realloc(wrapper->response_body, new_capacity);
-        if (!ptr) return 0;
+    if (wrapper->download_fd >= 0) {
+        if (wrapper->download_state == 0 && !download_begin(wrapper)) return 0;
+        if (wrapper->download_state == 1) {
+            return download_write(wrapper, (const char*)contents, realsize);
+        }
+    }
 
-        wrapper->response_body = ptr;
-        wrapper->response_capacity = new_capacity;
+    if (wrapper->is_streaming) {
+        return stream_write(wrapper, (const char*)contents, realsize);
     }
 
-    memcpy(wrapper->response_body + wrapper->response_size, contents, realsize);
-    wrapper->response_size += realsize;
-    wrapper->response_body[wrapper->response_size] = 0;
+    // Write straight into the Lean ByteArray that becomes Response.body
+    body_reserve(wrapper, realsize);
+    lean_object* body = wrapper->body_array;
+    size_t body_size = lean_sarray_size(body);
+    memcpy(lean_sarray_cptr(body) + body_size, contents, realsize);
+    lean_to_sarray(body)->m_size = body_size + realsize;
 
     return realsize;
 }
 
+static int is_header_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Record the name and value spans of a "Name: value" line stored at
+// response_headers + offset. Lines without a colon and obsolete folded
+// continuation lines are kept in the raw block but not parsed.
+static int header_record_field(EasyWrapper* wrapper, size_t offset, size_t length) {
+    const char* line = wrapper->response_headers + offset;
+    if (length == 0 || line[0] == ' ' || line[0] == '\t') return 1;
+    const char* colon = memchr(line, ':', length);
+    if (!colon || colon == line) return 1;
+
+    size_t name_end = (size_t)(colon - line);
+    while (name_end > 0 && is_header_space(line[name_end - 1])) name_end--;
+    if (name_end == 0) return 1;
+    size_t value_start = (size_t)(colon - line) + 1;
+    size_t value_end = length;
+    while (value_start < value_end && is_header_space(line[value_start])) value_start++;
+    while (value_end > value_start && is_header_space(line[value_end - 1])) value_end--;
+
+    if (wrapper->header_field_count == wrapper->header_field_capacity) {
+        size_t new_capacity = wrapper->header_field_capacity == 0 ? 32 : wrapper->header_field_capacity * 2;
+        HeaderField* fields = realloc(wrapper->header_fields, new_capacity * sizeof(HeaderField));
+        if (!fields) return 0;
+        wrapper->header_fields = fields;
+        wrapper->header_field_capacity = new_capacity;
+    }
+    HeaderField* field = &wrapper->header_fields[wrapper->header_field_count++];
+    field->name_offset = (uint32_t)offset;
+    field->name_length = (uint32_t)name_end;
+    field->value_offset = (uint32_t)(offset + value_start);
+    field->value_length = (uint32_t)(value_end - value_start);
+    return 1;
+}
+
 static size_t header_callback(void* contents, size_t size, size_t nmemb, void* userp) {
     size_t realsize = size * nmemb;
     EasyWrapper* wrapper = (EasyWrapper*)userp;
+    const char* line = (const char*)contents;
+
+    // A status line starts a new response (after a redirect, 100 Continue or
+    // proxy CONNECT); only the final response's headers are kept
+    int is_status_line = realsize >= 5 && memcmp(line, "HTTP/", 5) == 0;
+    if (is_status_line) {
+        wrapper->headers_size = 0;
+        wrapper->header_field_count = 0;
+        wrapper->headers_complete = 0;
+        // A buffered 401 may be followed by the authenticated response
+        if (wrapper->download_state == 2) wrapper->download_state = 0;
+    }
 
     // Grow buffer if needed
     size_t needed = wrapper->headers_size + realsize + 1;
+    if (needed > UINT32_MAX) return 0;
     if (needed > wrapper->headers_capacity) {
         size_t new_capacity = wrapper->headers_capacity == 0 ? 2048 : wrapper->headers_capacity * 2;
         while (new_capacity < needed) new_capacity *= 2;
@@ -257,14 +752,32 @@ static size_t header_callback(void* contents, size_t size, size_t nmemb, void* u
         wrapper->headers_capacity = new_capacity;
     }
 
-    memcpy(wrapper->response_headers + wrapper->headers_size, contents, realsize);
+    size_t offset = wrapper->headers_size;
+    memcpy(wrapper->response_headers + offset, contents, realsize);
     wrapper->headers_size += realsize;
     wrapper->response_headers[wrapper->headers_size] = 0;
 
     // Check if headers are complete (blank line = just "\r\n")
-    // This signals the end of headers and start of body
-    if (realsize == 2 && ((char*)contents)[0] == '\r' && ((char*)contents)[1] == '\n') {
-        wrapper->headers_complete = 1;
+    // This signals the end of headers and start of body. Interim 1xx
+    // responses and redirects curl is about to follow are followed by
+    // another response, so they don't count.
+    if (realsize == 2 && line[0] == '\r' && line[1] == '\n') {
+        long code = 0;
+        char* redirect = NULL;
+        curl_easy_getinfo(wrapper->handle, CURLINFO_RESPONSE_CODE, &code);
+        if (wrapper->follow_location && code >= 300 && code < 400) {
+            curl_easy_getinfo(wrapper->handle, CURLINFO_REDIRECT_URL, &redirect);
+        }
+        if ((code < 100 || code >= 200) && !redirect) {
+            wrapper->headers_complete = 1;
+            easy_mark_ready(wrapper);
+            // Decided here too, so an empty body still replaces the file
+            if (wrapper->download_fd >= 0 && wrapper->download_state == 0 && !download_begin(wrapper)) {
+                return 0;
+            }
+        }
+    } else if (!is_status_line) {
+        if (!header_record_field(wrapper, offset, realsize)) return 0;
     }
 
     return realsize;
@@ -281,6 +794,8 @@ LEAN_EXPORT lean_obj_res wisp_global_init(lean_obj_arg world) {
             return mk_io_error("Failed to initialize libcurl");
         }
         init_external_classes();
+        const char* ca_bundle = find_ca_bundle();
+        g_ca_bundle = ca_bundle ? strdup(ca_bundle) : NULL;
         g_initialized = 1;
     }
     return lean_io_result_mk_ok(lean_box(0));
@@ -289,6 +804,8 @@ LEAN_EXPORT lean_obj_res wisp_global_init(lean_obj_arg world) {
 LEAN_EXPORT lean_obj_res wisp_global_cleanup(lean_obj_arg world) {
     if (g_initialized) {
         curl_global_cleanup();
+        free(g_ca_bundle);
+        g_ca_bundle = NULL;
         g_initialized = 0;
     }
     return lean_io_result_mk_ok(lean_box(0));
@@ -312,6 +829,21 @@ LEAN_EXPORT lean_obj_res wisp_version_info(lean_obj_arg world) {
     return lean_io_result_mk_ok(lean_mk_string(buf));
 }
 
+// ============================================================================
+// HTTP Dates
+// ============================================================================
+
+// Seconds since the epoch for an HTTP date in any of the three formats
+// RFC 9110 allows, or -1 if it cannot be parsed.
+LEAN_EXPORT lean_obj_res wisp_parse_http_date(b_lean_obj_arg date, lean_obj_arg world) {
+    time_t t = curl_getdate(lean_string_cstr(date), NULL);
+    return lean_io_result_mk_ok(lean_box_uint64((uint64_t)(int64_t)t));
+}
+
+LEAN_EXPORT lean_obj_res wisp_unix_time(lean_obj_arg world) {
+    return lean_io_result_mk_ok(lean_box_uint64((uint64_t)(int64_t)time(NULL)));
+}
+
 // ============================================================================
 // Easy Handle Operations
 // ============================================================================
@@ -328,9 +860,8 @@ LEAN_EXPORT lean_obj_res wisp_easy_init(lean_obj_arg world) {
     }
 
     // Set default CA bundle
-    const char* ca_bundle = find_ca_bundle();
-    if (ca_bundle) {
-        curl_easy_setopt(handle, CURLOPT_CAINFO, ca_bundle);
+    if (g_ca_bundle) {
+        curl_easy_setopt(handle, CURLOPT_CAINFO, g_ca_bundle);
     }
 
     EasyWrapper* wrapper = calloc(1, sizeof(EasyWrapper));
@@ -339,6 +870,10 @@ LEAN_EXPORT lean_obj_res wisp_easy_init(lean_obj_arg world) {
         return mk_io_error("Failed to allocate EasyWrapper");
     }
     wrapper->handle = handle;
+    wrapper->upload_fd = -1;
+    wrapper->download_fd = -1;
+    wrapper->ws_socket = -1;
+    wrapper->ws_max_message = WISP_WS_DEFAULT_MAX_MESSAGE;
 
     lean_object* obj = lean_alloc_external(g_easy_class, wrapper);
     return lean_io_result_mk_ok(obj);
@@ -354,25 +889,40 @@ LEAN_EXPORT lean_obj_res wisp_easy_reset(b_lean_obj_arg easy, lean_obj_arg world
     curl_easy_reset(wrapper->handle);
     easy_clear_strings(wrapper);
     easy_clear_owned_handles(wrapper);
-
-    // Reset response buffers
-    if (wrapper->response_body) {
-        free(wrapper->response_body);
-        wrapper->response_body = NULL;
-        wrapper->response_size = 0;
-        wrapper->response_capacity = 0;
-    }
-    if (wrapper->response_headers) {
+    easy_clear_upload(wrapper);
+    easy_clear_download(wrapper);
+    easy_clear_ws(wrapper);
+    wrapper->ws_max_message = WISP_WS_DEFAULT_MAX_MESSAGE;
+    wrapper->ws_dropped = 0;
+    easy_release_share(wrapper);  // curl_easy_reset dropped CURLOPT_SHARE
+    easy_release_template(wrapper);  // ...and CURLOPT_HTTPHEADER
+    wrapper->follow_location = 0;
+
+    // Reset response buffers, keeping moderately sized ones for the next transfer
+    easy_reset_body(wrapper);
+    wrapper->headers_size = 0;
+    wrapper->header_field_count = 0;
+    if (wrapper->headers_capacity > WISP_RETAIN_BUFFER_MAX) {
         free(wrapper->response_headers);
         wrapper->response_headers = NULL;
-        wrapper->headers_size = 0;
         wrapper->headers_capacity = 0;
     }
 
+    // Reset streaming state
+    wrapper->is_streaming = 0;
+    wrapper->headers_complete = 0;
+    wrapper->stream_paused = 0;
+    wrapper->stream_ring_head = 0;
+    wrapper->stream_ring_size = 0;
+    if (wrapper->stream_ring_capacity > WISP_RETAIN_BUFFER_MAX) {
+        free(wrapper->stream_ring);
+        wrapper->stream_ring = NULL;
+        wrapper->stream_ring_capacity = 0;
+    }
+
     // Re-set CA bundle
-    const char* ca_bundle = find_ca_bundle();
-    if (ca_bundle) {
-        curl_easy_setopt(wrapper->handle, CURLOPT_CAINFO, ca_bundle);
+    if (g_ca_bundle) {
+        curl_easy_setopt(wrapper->handle, CURLOPT_CAINFO, g_ca_bundle);
     }
 
     return lean_io_result_mk_ok(lean_box(0));
@@ -382,8 +932,9 @@ LEAN_EXPORT lean_obj_res wisp_easy_perform(b_lean_obj_arg easy, lean_obj_arg wor
     EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy);
 
     // Reset response buffers before performing
-    wrapper->response_size = 0;
+    easy_reset_body(wrapper);
     wrapper->headers_size = 0;
+    wrapper->header_field_count = 0;
 
     CURLcode res = curl_easy_perform(wrapper->handle);
     if (res != CURLE_OK) {
@@ -448,6 +999,9 @@ LEAN_EXPORT lean_obj_res wisp_easy_setopt_long(
     if (res != CURLE_OK) {
         return mk_curl_error(res);
     }
+    if (option == CURLOPT_FOLLOWLOCATION) {
+        wrapper->follow_location = value != 0;
+    }
 
     return lean_io_result_mk_ok(lean_box(0));
 }
@@ -576,6 +1130,77 @@ LEAN_EXPORT lean_obj_res wisp_easy_getinfo_string(
     return lean_io_result_mk_ok(lean_mk_string(value ? value : ""));
 }
 
+// Slots of the FloatArray returned by wisp_easy_get_transfer_info; must match
+// TransferMetrics.fromInfo on the Lean side.
+enum {
+    WISP_INFO_NAMELOOKUP,
+    WISP_INFO_CONNECT,
+    WISP_INFO_APPCONNECT,
+    WISP_INFO_PRETRANSFER,
+    WISP_INFO_STARTTRANSFER,
+    WISP_INFO_REDIRECT,
+    WISP_INFO_TOTAL,
+    WISP_INFO_SIZE_UPLOAD,
+    WISP_INFO_SIZE_DOWNLOAD,
+    WISP_INFO_SPEED_DOWNLOAD,
+    WISP_INFO_NUM_CONNECTS,
+    WISP_INFO_HTTP_VERSION,
+    WISP_INFO_COUNT
+};
+
+// Gather timing and transfer statistics in one call rather than a getinfo
+// round trip per field. Times are in seconds; fields libcurl can't report
+// are left at 0.
+LEAN_EXPORT lean_obj_res wisp_easy_get_transfer_info(b_lean_obj_arg easy, lean_obj_arg world) {
+    EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy);
+    CURL* handle = wrapper->handle;
+
+    lean_object* arr = lean_alloc_sarray(sizeof(double), WISP_INFO_COUNT, WISP_INFO_COUNT);
+    double* out = lean_float_array_cptr(arr);
+    memset(out, 0, sizeof(double) * WISP_INFO_COUNT);
+
+    // The *_T variants report microseconds without floating point rounding
+    static const CURLINFO times[] = {
+        CURLINFO_NAMELOOKUP_TIME_T,
+        CURLINFO_CONNECT_TIME_T,
+        CURLINFO_APPCONNECT_TIME_T,
+        CURLINFO_PRETRANSFER_TIME_T,
+        CURLINFO_STARTTRANSFER_TIME_T,
+        CURLINFO_REDIRECT_TIME_T,
+        CURLINFO_TOTAL_TIME_T,
+    };
+    for (size_t i = 0; i < sizeof(times) / sizeof(times[0]); i++) {
+        curl_off_t us = 0;
+        if (curl_easy_getinfo(handle, times[i], &us) == CURLE_OK) {
+            out[WISP_INFO_NAMELOOKUP + i] = (double)us / 1e6;
+        }
+    }
+
+    curl_off_t value = 0;
+    if (curl_easy_getinfo(handle, CURLINFO_SIZE_UPLOAD_T, &value) == CURLE_OK) {
+        out[WISP_INFO_SIZE_UPLOAD] = (double)value;
+    }
+    value = 0;
+    if (curl_easy_getinfo(handle, CURLINFO_SIZE_DOWNLOAD_T, &value) == CURLE_OK) {
+        out[WISP_INFO_SIZE_DOWNLOAD] = (double)value;
+    }
+    value = 0;
+    if (curl_easy_getinfo(handle, CURLINFO_SPEED_DOWNLOAD_T, &value) == CURLE_OK) {
+        out[WISP_INFO_SPEED_DOWNLOAD] = (double)value;
+    }
+
+    long connects = 0;
+    if (curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects) == CURLE_OK) {
+        out[WISP_INFO_NUM_CONNECTS] = (double)connects;
+    }
+    long version = 0;
+    if (curl_easy_getinfo(handle, CURLINFO_HTTP_VERSION, &version) == CURLE_OK) {
+        out[WISP_INFO_HTTP_VERSION] = (double)version;
+    }
+
+    return lean_io_result_mk_ok(arr);
+}
+
 // ============================================================================
 // Response Buffer Operations
 // ============================================================================
@@ -601,15 +1226,15 @@ LEAN_EXPORT lean_obj_res wisp_easy_setup_header_callback(b_lean_obj_arg easy, le
 LEAN_EXPORT lean_obj_res wisp_easy_get_response_body(b_lean_obj_arg easy, lean_obj_arg world) {
     EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy);
 
-    if (!wrapper->response_body || wrapper->response_size == 0) {
+    if (!wrapper->body_array) {
         lean_object* empty = lean_alloc_sarray(1, 0, 0);
         return lean_io_result_mk_ok(empty);
     }
 
-    lean_object* arr = lean_alloc_sarray(1, wrapper->response_size, wrapper->response_size);
-    memcpy(lean_sarray_cptr(arr), wrapper->response_body, wrapper->response_size);
-
-    return lean_io_result_mk_ok(arr);
+    // Share the array instead of copying it; the next transfer allocates a
+    // fresh one because this one is no longer exclusive
+    lean_inc(wrapper->body_array);
+    return lean_io_result_mk_ok(wrapper->body_array);
 }
 
 LEAN_EXPORT lean_obj_res wisp_easy_get_response_headers(b_lean_obj_arg easy, lean_obj_arg world) {
@@ -622,98 +1247,256 @@ LEAN_EXPORT lean_obj_res wisp_easy_get_response_headers(b_lean_obj_arg easy, lea
     return lean_io_result_mk_ok(lean_mk_string(wrapper->response_headers));
 }
 
-// ============================================================================
-// Slist Operations
-// ============================================================================
+// Common response header names. Matching names are returned as shared
+// persistent strings instead of being allocated for every response.
+static const char* const g_common_header_names[] = {
+    "Accept-Ranges", "Access-Control-Allow-Credentials", "Access-Control-Allow-Headers",
+    "Access-Control-Allow-Methods", "Access-Control-Allow-Origin", "Access-Control-Expose-Headers",
+    "Age", "Alt-Svc", "Cache-Control", "Connection", "Content-Disposition",
+    "Content-Encoding", "Content-Language", "Content-Length", "Content-Location",
+    "Content-Range", "Content-Security-Policy", "Content-Type", "Date", "ETag",
+    "Expires", "Keep-Alive", "Last-Modified", "Link", "Location", "Pragma",
+    "Referrer-Policy", "Retry-After", "Server", "Set-Cookie", "Strict-Transport-Security",
+    "Transfer-Encoding", "Vary", "Via", "WWW-Authenticate", "X-Cache",
+    "X-Content-Type-Options", "X-Frame-Options", "X-Powered-By", "X-Request-Id",
+    "X-XSS-Protection",
+};
+#define WISP_COMMON_HEADER_COUNT (sizeof(g_common_header_names) / sizeof(g_common_header_names[0]))
 
-LEAN_EXPORT lean_obj_res wisp_slist_new(lean_obj_arg world) {
-    if (!g_initialized) {
-        lean_object* init_result = wisp_global_init(lean_box(0));
-        lean_dec(init_result);
-    }
+typedef struct {
+    size_t length;
+    lean_object* canonical;  // As listed above
+    lean_object* lower;      // Lowercased, as HTTP/2 and HTTP/3 send them
+} InternedHeaderName;
 
-    SlistWrapper* wrapper = calloc(1, sizeof(SlistWrapper));
-    if (!wrapper) {
-        return mk_io_error("Failed to allocate SlistWrapper");
-    }
+static InternedHeaderName g_interned_headers[WISP_COMMON_HEADER_COUNT];
+static pthread_once_t g_interned_headers_once = PTHREAD_ONCE_INIT;
 
-    lean_object* obj = lean_alloc_external(g_slist_class, wrapper);
-    return lean_io_result_mk_ok(obj);
+static lean_object* mk_persistent_string(const char* str, size_t length) {
+    lean_object* obj = lean_mk_string_from_bytes(str, length);
+    lean_mark_persistent(obj);
+    return obj;
 }
 
-LEAN_EXPORT lean_obj_res wisp_slist_append(
-    b_lean_obj_arg slist,
-    b_lean_obj_arg str,
-    lean_obj_arg world
-) {
-    SlistWrapper* wrapper = (SlistWrapper*)lean_get_external_data(slist);
-    const char* s = lean_string_cstr(str);
-
-    struct curl_slist* new_list = curl_slist_append(wrapper->list, s);
-    if (!new_list && s[0] != '\0') {
-        return mk_io_error("Failed to append to slist");
+static void init_interned_headers(void) {
+    char lower[64];
+    for (size_t i = 0; i < WISP_COMMON_HEADER_COUNT; i++) {
+        const char* name = g_common_header_names[i];
+        size_t length = strlen(name);
+        for (size_t j = 0; j < length; j++) lower[j] = (char)tolower((unsigned char)name[j]);
+        g_interned_headers[i].length = length;
+        g_interned_headers[i].canonical = mk_persistent_string(name, length);
+        g_interned_headers[i].lower = mk_persistent_string(lower, length);
     }
+}
 
-    wrapper->list = new_list;
-    return lean_io_result_mk_ok(lean_box(0));
+static const InternedHeaderName* find_interned_header(const char* name, size_t length) {
+    for (size_t i = 0; i < WISP_COMMON_HEADER_COUNT; i++) {
+        if (g_interned_headers[i].length == length &&
+            strncasecmp(g_common_header_names[i], name, length) == 0) {
+            return &g_interned_headers[i];
+        }
+    }
+    return NULL;
 }
 
-LEAN_EXPORT lean_obj_res wisp_slist_free(b_lean_obj_arg slist, lean_obj_arg world) {
-    // Cleanup is handled by finalizer
-    return lean_io_result_mk_ok(lean_box(0));
+// Parsed headers of the final response as (#[(name, value)], #[lowercased name]).
+// The second array keys the case-insensitive index built on the Lean side.
+LEAN_EXPORT lean_obj_res wisp_easy_get_response_header_fields(b_lean_obj_arg easy, lean_obj_arg world) {
+    EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy);
+    pthread_once(&g_interned_headers_once, init_interned_headers);
+
+    size_t count = wrapper->header_field_count;
+    lean_object* pairs = lean_alloc_array(count, count);
+    lean_object* keys = lean_alloc_array(count, count);
+    char lower_buf[256];
+
+    for (size_t i = 0; i < count; i++) {
+        const HeaderField* field = &wrapper->header_fields[i];
+        const char* name = wrapper->response_headers + field->name_offset;
+        size_t length = field->name_length;
+
+        lean_object* name_obj;
+        lean_object* key_obj;
+        const InternedHeaderName* interned = find_interned_header(name, length);
+        if (interned && memcmp(lean_string_cstr(interned->canonical), name, length) == 0) {
+            name_obj = interned->canonical;
+            key_obj = interned->lower;
+        } else if (interned && memcmp(lean_string_cstr(interned->lower), name, length) == 0) {
+            name_obj = interned->lower;
+            key_obj = interned->lower;
+        } else {
+            name_obj = lean_mk_string_from_bytes(name, length);
+            if (interned) {
+                key_obj = interned->lower;
+            } else {
+                char* lower = length <= sizeof(lower_buf) ? lower_buf : malloc(length);
+                if (!lower) {
+                    lean_dec(pairs);
+                    lean_dec(keys);
+                    lean_dec(name_obj);
+                    return mk_io_error("Out of memory parsing headers");
+                }
+                for (size_t j = 0; j < length; j++) lower[j] = (char)tolower((unsigned char)name[j]);
+                key_obj = lean_mk_string_from_bytes(lower, length);
+                if (lower != lower_buf) free(lower);
+            }
+        }
+
+        lean_object* value_obj = lean_mk_string_from_bytes(
+            wrapper->response_headers + field->value_offset, field->value_length);
+        lean_object* pair = lean_alloc_ctor(0, 2, 0);
+        lean_ctor_set(pair, 0, name_obj);
+        lean_ctor_set(pair, 1, value_obj);
+        lean_array_cptr(pairs)[i] = pair;
+        lean_array_cptr(keys)[i] = key_obj;
+    }
+
+    lean_object* result = lean_alloc_ctor(0, 2, 0);
+    lean_ctor_set(result, 0, pairs);
+    lean_ctor_set(result, 1, keys);
+    return lean_io_result_mk_ok(result);
 }
 
 // ============================================================================
-// Mime Operations
+// Request Body Upload
 // ============================================================================
 
-LEAN_EXPORT lean_obj_res wisp_mime_init(b_lean_obj_arg easy, lean_obj_arg world) {
-    EasyWrapper* e_wrapper = (EasyWrapper*)lean_get_external_data(easy);
-
-    curl_mime* mime = curl_mime_init(e_wrapper->handle);
-    if (!mime) {
-        return mk_io_error("Failed to create CURL mime handle");
+// Compress the next part of body_data straight into curl's upload buffer.
+// Returns the bytes produced, 0 once the stream has ended, or
+// CURL_READFUNC_ABORT. Never returns 0 early: curl takes that as the end of
+// the body, so the compressor is run until it has output or is finished.
+static size_t compress_read(EasyWrapper* wrapper, char* buffer, size_t room) {
+    while (!wrapper->compress_done) {
+        size_t produced;
+        if (wrapper->compress_coding == WISP_CODING_GZIP) {
+            z_stream* z = (z_stream*)wrapper->compressor;
+            size_t remaining = wrapper->compress_size - wrapper->compress_offset;
+            uInt in = remaining > UINT_MAX ? UINT_MAX : (uInt)remaining;
+            uInt out = room > UINT_MAX ? UINT_MAX : (uInt)room;
+            z->next_in = (Bytef*)(wrapper->compress_src + wrapper->compress_offset);
+            z->avail_in = in;
+            z->next_out = (Bytef*)buffer;
+            z->avail_out = out;
+            int rc = deflate(z, in == remaining ? Z_FINISH : Z_NO_FLUSH);
+            if (rc == Z_STREAM_ERROR) return CURL_READFUNC_ABORT;
+            wrapper->compress_offset += in - z->avail_in;
+            produced = out - z->avail_out;
+            if (rc == Z_STREAM_END) wrapper->compress_done = 1;
+        }
+#ifdef WISP_WITH_ZSTD
+        else if (wrapper->compress_coding == WISP_CODING_ZSTD) {
+            ZSTD_inBuffer in = { wrapper->compress_src, wrapper->compress_size, wrapper->compress_offset };
+            ZSTD_outBuffer out = { buffer, room, 0 };
+            size_t rc = ZSTD_compressStream2((ZSTD_CCtx*)wrapper->compressor, &out, &in, ZSTD_e_end);
+            if (ZSTD_isError(rc)) return CURL_READFUNC_ABORT;
+            wrapper->compress_offset = in.pos;
+            produced = out.pos;
+            if (rc == 0) wrapper->compress_done = 1;
+        }
+#endif
+        else {
+            return CURL_READFUNC_ABORT;
+        }
+        if (produced > 0) return produced;
     }
+    return 0;
+}
 
-    MimeWrapper* wrapper = calloc(1, sizeof(MimeWrapper));
-    if (!wrapper) {
-        curl_mime_free(mime);
-        return mk_io_error("Failed to allocate MimeWrapper");
+// Supply request body data from the compressor, the file, or the chunk pushed
+// by Lean. When a channel-fed body has no chunk yet the transfer pauses, and
+// the handle is marked ready so the manager pushes the next one.
+static size_t read_callback(char* buffer, size_t size, size_t nitems, void* userp) {
+    EasyWrapper* wrapper = (EasyWrapper*)userp;
+    size_t room = size * nitems;
+
+    if (wrapper->compress_coding) {
+        return compress_read(wrapper, buffer, room);
+    }
+
+    if (wrapper->upload_fd >= 0) {
+        ssize_t n;
+        do {
+            n = read(wrapper->upload_fd, buffer, room);
+        } while (n < 0 && errno == EINTR);
+        return n < 0 ? CURL_READFUNC_ABORT : (size_t)n;
+    }
+
+    while (wrapper->upload_chunk) {
+        size_t available = lean_sarray_size(wrapper->upload_chunk) - wrapper->upload_offset;
+        size_t n = available < room ? available : room;
+        memcpy(buffer, lean_sarray_cptr(wrapper->upload_chunk) + wrapper->upload_offset, n);
+        wrapper->upload_offset += n;
+        if (wrapper->upload_offset == lean_sarray_size(wrapper->upload_chunk)) {
+            // Chunk used up: release it and ask for the next one early
+            lean_dec(wrapper->upload_chunk);
+            wrapper->upload_chunk = NULL;
+            wrapper->upload_offset = 0;
+            easy_mark_ready(wrapper);
+        }
+        if (n > 0) return n;
     }
-    wrapper->mime = mime;
-    wrapper->easy = e_wrapper->handle;
 
-    lean_object* obj = lean_alloc_external(g_mime_class, wrapper);
-    return lean_io_result_mk_ok(obj);
-}
+    if (wrapper->upload_eof) return 0;
 
-LEAN_EXPORT lean_obj_res wisp_mime_addpart(b_lean_obj_arg mime, lean_obj_arg world) {
-    MimeWrapper* m_wrapper = (MimeWrapper*)lean_get_external_data(mime);
+    wrapper->upload_paused = 1;
+    easy_mark_ready(wrapper);
+    return CURL_READFUNC_PAUSE;
+}
 
-    curl_mimepart* part = curl_mime_addpart(m_wrapper->mime);
-    if (!part) {
-        return mk_io_error("Failed to add mime part");
+// Start compressing body_data again from its first byte
+static int compress_restart(EasyWrapper* wrapper) {
+    wrapper->compress_offset = 0;
+    wrapper->compress_done = 0;
+    if (wrapper->compress_coding == WISP_CODING_GZIP) {
+        return deflateReset((z_stream*)wrapper->compressor) == Z_OK;
     }
+#ifdef WISP_WITH_ZSTD
+    if (wrapper->compress_coding == WISP_CODING_ZSTD) {
+        return !ZSTD_isError(ZSTD_CCtx_reset((ZSTD_CCtx*)wrapper->compressor, ZSTD_reset_session_only));
+    }
+#endif
+    return 0;
+}
 
-    MimepartWrapper* wrapper = calloc(1, sizeof(MimepartWrapper));
-    if (!wrapper) {
-        return mk_io_error("Failed to allocate MimepartWrapper");
+// Rewind for redirects and auth retries. File bodies can be replayed, and
+// compressed bodies restarted from the beginning.
+static int seek_callback(void* userp, curl_off_t offset, int origin) {
+    EasyWrapper* wrapper = (EasyWrapper*)userp;
+    if (wrapper->compress_coding) {
+        if (offset != 0 || origin != SEEK_SET) return CURL_SEEKFUNC_CANTSEEK;
+        return compress_restart(wrapper) ? CURL_SEEKFUNC_OK : CURL_SEEKFUNC_FAIL;
     }
-    wrapper->part = part;
+    if (wrapper->upload_fd < 0) return CURL_SEEKFUNC_CANTSEEK;
+    if (lseek(wrapper->upload_fd, (off_t)offset, origin) < 0) return CURL_SEEKFUNC_FAIL;
+    return CURL_SEEKFUNC_OK;
+}
 
-    lean_object* obj = lean_alloc_external(g_mimepart_class, wrapper);
-    return lean_io_result_mk_ok(obj);
+// Send the body with CURLOPT_READFUNCTION. A negative length means unknown,
+// in which case HTTP/1.1 uses chunked transfer encoding.
+static void easy_setup_read(EasyWrapper* wrapper, curl_off_t length) {
+    curl_easy_setopt(wrapper->handle, CURLOPT_POST, 1L);
+    curl_easy_setopt(wrapper->handle, CURLOPT_READFUNCTION, read_callback);
+    curl_easy_setopt(wrapper->handle, CURLOPT_READDATA, wrapper);
+    curl_easy_setopt(wrapper->handle, CURLOPT_SEEKFUNCTION, seek_callback);
+    curl_easy_setopt(wrapper->handle, CURLOPT_SEEKDATA, wrapper);
+    curl_easy_setopt(wrapper->handle, CURLOPT_POSTFIELDSIZE_LARGE, length);
 }
 
-LEAN_EXPORT lean_obj_res wisp_mimepart_name(
-    b_lean_obj_arg part,
-    b_lean_obj_arg name,
+// Send a ByteArray as the body without converting or copying it. The array is
+// kept alive until the handle is reset.
+LEAN_EXPORT lean_obj_res wisp_easy_set_body_bytes(
+    b_lean_obj_arg easy,
+    b_lean_obj_arg data,
     lean_obj_arg world
 ) {
-    MimepartWrapper* wrapper = (MimepartWrapper*)lean_get_external_data(part);
-    const char* n = lean_string_cstr(name);
+    EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy);
+    easy_clear_upload(wrapper);
 
-    CURLcode res = curl_mime_name(wrapper->part, n);
+    lean_inc(data);
+    wrapper->body_data = data;
+    curl_easy_setopt(wrapper->handle, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)lean_sarray_size(data));
+    CURLcode res = curl_easy_setopt(wrapper->handle, CURLOPT_POSTFIELDS, (char*)lean_sarray_cptr(data));
     if (res != CURLE_OK) {
         return mk_curl_error(res);
     }
@@ -721,37 +1504,435 @@ LEAN_EXPORT lean_obj_res wisp_mimepart_name(
     return lean_io_result_mk_ok(lean_box(0));
 }
 
-LEAN_EXPORT lean_obj_res wisp_mimepart_data(
-    b_lean_obj_arg part,
+// Send a String or ByteArray as the body, compressed with `coding` as curl
+// reads it, so no compressed copy of the whole body is made. The compressed
+// length is not known up front, so the body is sent chunked. `level` 0 means
+// the codec's default. Returns the coding used: zstd falls back to gzip when
+// Wisp was built without it.
+static lean_obj_res easy_set_body_compressed(
+    EasyWrapper* wrapper,
     b_lean_obj_arg data,
-    lean_obj_arg world
+    const uint8_t* bytes,
+    size_t size,
+    uint8_t coding,
+    uint32_t level
 ) {
-    MimepartWrapper* wrapper = (MimepartWrapper*)lean_get_external_data(part);
-    size_t size = lean_sarray_size(data);
-    uint8_t* ptr = lean_sarray_cptr(data);
+    easy_clear_upload(wrapper);
 
-    CURLcode res = curl_mime_data(wrapper->part, (const char*)ptr, size);
-    if (res != CURLE_OK) {
-        return mk_curl_error(res);
+#ifndef WISP_WITH_ZSTD
+    if (coding == WISP_CODING_ZSTD) coding = WISP_CODING_GZIP;
+#endif
+
+    if (coding == WISP_CODING_GZIP) {
+        z_stream* z = calloc(1, sizeof(z_stream));
+        if (!z) return mk_io_error("Failed to allocate gzip compressor");
+        int zlevel = level == 0 ? Z_DEFAULT_COMPRESSION : (int)(level > 9 ? 9 : level);
+        // windowBits + 16 writes a gzip header and trailer instead of zlib's
+        if (deflateInit2(z, zlevel, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            free(z);
+            return mk_io_error("Failed to initialize gzip compressor");
+        }
+        wrapper->compressor = z;
+    }
+#ifdef WISP_WITH_ZSTD
+    else if (coding == WISP_CODING_ZSTD) {
+        ZSTD_CCtx* cctx = ZSTD_createCCtx();
+        if (!cctx) return mk_io_error("Failed to allocate zstd compressor");
+        if (level != 0) {
+            int zlevel = (int)level > ZSTD_maxCLevel() ? ZSTD_maxCLevel() : (int)level;
+            ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, zlevel);
+        }
+        ZSTD_CCtx_setPledgedSrcSize(cctx, (unsigned long long)size);
+        wrapper->compressor = cctx;
+    }
+#endif
+    else {
+        return mk_io_error("Unknown content coding");
     }
 
-    return lean_io_result_mk_ok(lean_box(0));
+    lean_inc(data);
+    wrapper->body_data = data;
+    wrapper->compress_coding = coding;
+    wrapper->compress_src = bytes;
+    wrapper->compress_size = size;
+    easy_setup_read(wrapper, (curl_off_t)-1);
+
+    return lean_io_result_mk_ok(lean_box((size_t)coding));
 }
 
-LEAN_EXPORT lean_obj_res wisp_mimepart_filename(
-    b_lean_obj_arg part,
-    b_lean_obj_arg filename,
+LEAN_EXPORT lean_obj_res wisp_easy_set_body_compressed(
+    b_lean_obj_arg easy,
+    b_lean_obj_arg data,
+    uint8_t coding,
+    uint32_t level,
     lean_obj_arg world
 ) {
-    MimepartWrapper* wrapper = (MimepartWrapper*)lean_get_external_data(part);
-    const char* f = lean_string_cstr(filename);
-
-    CURLcode res = curl_mime_filename(wrapper->part, f);
-    if (res != CURLE_OK) {
-        return mk_curl_error(res);
-    }
-
-    return lean_io_result_mk_ok(lean_box(0));
+    EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy);
+    return easy_set_body_compressed(wrapper, data, lean_sarray_cptr(data),
+                                    lean_sarray_size(data), coding, level);
+}
+
+LEAN_EXPORT lean_obj_res wisp_easy_set_body_compressed_string(
+    b_lean_obj_arg easy,
+    b_lean_obj_arg data,
+    uint8_t coding,
+    uint32_t level,
+    lean_obj_arg world
+) {
+    EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy);
+    return easy_set_body_compressed(wrapper, data, (const uint8_t*)lean_string_cstr(data),
+                                    lean_string_size(data) - 1, coding, level);
+}
+
+// Stream a file as the body. Returns the file size, which is sent as the
+// Content-Length.
+LEAN_EXPORT lean_obj_res wisp_easy_set_body_file(
+    b_lean_obj_arg easy,
+    b_lean_obj_arg path,
+    lean_obj_arg world
+) {
+    EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy);
+    easy_clear_upload(wrapper);
+
+    const char* path_str = lean_string_cstr(path);
+    int fd = open(path_str, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        char msg[512];
+        snprintf(msg, sizeof(msg), "Cannot open upload file %s: %s", path_str, strerror(errno));
+        return mk_io_error(msg);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return mk_io_error("Cannot stat upload file");
+    }
+
+    wrapper->upload_fd = fd;
+    easy_setup_read(wrapper, (curl_off_t)st.st_size);
+
+    return lean_io_result_mk_ok(lean_box_uint64((uint64_t)st.st_size));
+}
+
+// Stream the body from chunks pushed with wisp_easy_upload_push.
+// A negative length means unknown (chunked transfer encoding).
+LEAN_EXPORT lean_obj_res wisp_easy_set_body_stream(
+    b_lean_obj_arg easy,
+    int64_t length,
+    lean_obj_arg world
+) {
+    EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy);
+    easy_clear_upload(wrapper);
+
+    wrapper->upload_from_lean = 1;
+    easy_setup_read(wrapper, length < 0 ? (curl_off_t)-1 : (curl_off_t)length);
+
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+// Whether a channel-fed body has used up its chunk and needs another
+LEAN_EXPORT lean_obj_res wisp_easy_upload_wants_data(b_lean_obj_arg easy, lean_obj_arg world) {
+    EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy);
+    int wants = wrapper->upload_from_lean && !wrapper->upload_chunk && !wrapper->upload_eof;
+    return lean_io_result_mk_ok(lean_box(wants ? 1 : 0));
+}
+
+static void easy_resume_upload(EasyWrapper* wrapper) {
+    if (wrapper->upload_paused) {
+        wrapper->upload_paused = 0;
+        curl_easy_pause(wrapper->handle, CURLPAUSE_CONT);
+    }
+}
+
+// Hand the next body chunk to curl, resuming a transfer waiting for data
+LEAN_EXPORT lean_obj_res wisp_easy_upload_push(
+    b_lean_obj_arg easy,
+    b_lean_obj_arg chunk,
+    lean_obj_arg world
+) {
+    EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy);
+    if (wrapper->upload_chunk) {
+        return mk_io_error("Upload chunk already pending");
+    }
+
+    lean_inc(chunk);
+    wrapper->upload_chunk = chunk;
+    wrapper->upload_offset = 0;
+    easy_resume_upload(wrapper);
+
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+// Mark the end of a channel-fed body
+LEAN_EXPORT lean_obj_res wisp_easy_upload_finish(b_lean_obj_arg easy, lean_obj_arg world) {
+    EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy);
+    wrapper->upload_eof = 1;
+    easy_resume_upload(wrapper);
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+// ============================================================================
+// Download to File
+// ============================================================================
+
+// Write the body of a successful response to the file at `path` instead of
+// the body array. With `resume`, the bytes already in the file are skipped
+// with a Range request. Returns the offset asked for.
+LEAN_EXPORT lean_obj_res wisp_easy_set_download_file(
+    b_lean_obj_arg easy,
+    b_lean_obj_arg path,
+    uint8_t resume,
+    uint8_t preallocate,
+    lean_obj_arg world
+) {
+    EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy);
+    easy_clear_download(wrapper);
+
+    const char* path_str = lean_string_cstr(path);
+    int fd = open(path_str, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        char msg[512];
+        snprintf(msg, sizeof(msg), "Cannot open download file %s: %s", path_str, strerror(errno));
+        return mk_io_error(msg);
+    }
+
+    curl_off_t offset = 0;
+    if (resume) {
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            return mk_io_error("Cannot stat download file");
+        }
+        offset = (curl_off_t)st.st_size;
+    }
+    if (offset > 0) {
+        // CURLOPT_RANGE rather than CURLOPT_RESUME_FROM_LARGE: a server that
+        // ignores the range then sends the whole body (written from the start)
+        // instead of curl failing the transfer
+        char* range = malloc(32);
+        if (!range) {
+            close(fd);
+            return mk_io_error("Failed to allocate string");
+        }
+        snprintf(range, 32, "%" CURL_FORMAT_CURL_OFF_T "-", offset);
+        CURLcode res = curl_easy_setopt(wrapper->handle, CURLOPT_RANGE, range);
+        if (res != CURLE_OK) {
+            free(range);
+            close(fd);
+            return mk_curl_error(res);
+        }
+        easy_store_string(wrapper, range);
+    }
+
+    wrapper->download_fd = fd;
+    wrapper->download_prealloc = preallocate ? 1 : 0;
+    wrapper->download_offset = offset;
+
+    return lean_io_result_mk_ok(lean_box_uint64((uint64_t)offset));
+}
+
+// Write one byte range of a segmented download at its offset in the file.
+// A reply that is not a 206 for exactly this range fails the transfer.
+LEAN_EXPORT lean_obj_res wisp_easy_set_download_segment(
+    b_lean_obj_arg easy,
+    b_lean_obj_arg path,
+    uint64_t start,
+    uint64_t length,
+    lean_obj_arg world
+) {
+    EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy);
+    easy_clear_download(wrapper);
+    if (length == 0) {
+        return mk_io_error("Empty download segment");
+    }
+
+    const char* path_str = lean_string_cstr(path);
+    int fd = open(path_str, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        char msg[512];
+        snprintf(msg, sizeof(msg), "Cannot open download file %s: %s", path_str, strerror(errno));
+        return mk_io_error(msg);
+    }
+
+    char* range = malloc(64);
+    if (!range) {
+        close(fd);
+        return mk_io_error("Failed to allocate string");
+    }
+    snprintf(range, 64, "%" CURL_FORMAT_CURL_OFF_T "-%" CURL_FORMAT_CURL_OFF_T,
+             (curl_off_t)start, (curl_off_t)(start + length - 1));
+    CURLcode res = curl_easy_setopt(wrapper->handle, CURLOPT_RANGE, range);
+    if (res != CURLE_OK) {
+        free(range);
+        close(fd);
+        return mk_curl_error(res);
+    }
+    easy_store_string(wrapper, range);
+
+    wrapper->download_fd = fd;
+    wrapper->download_segment = 1;
+    wrapper->download_offset = (curl_off_t)start;
+    wrapper->download_end = (curl_off_t)(start + length);
+
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+// Create (or empty) the file at `path` and size it to `size` bytes, so the
+// segments of a download can be written at their offsets in any order
+LEAN_EXPORT lean_obj_res wisp_file_preallocate(b_lean_obj_arg path, uint64_t size, lean_obj_arg world) {
+    const char* path_str = lean_string_cstr(path);
+    int fd = open(path_str, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        char msg[512];
+        snprintf(msg, sizeof(msg), "Cannot open download file %s: %s", path_str, strerror(errno));
+        return mk_io_error(msg);
+    }
+#ifdef __linux__
+    int rc = fallocate(fd, 0, 0, (off_t)size);
+    // File systems without fallocate get a sparse file instead
+    if (rc != 0 && errno != ENOSPC) rc = ftruncate(fd, (off_t)size);
+#else
+    int rc = ftruncate(fd, (off_t)size);
+#endif
+    int err = errno;
+    close(fd);
+    if (rc != 0) {
+        char msg[512];
+        snprintf(msg, sizeof(msg), "Cannot size download file %s: %s", path_str, strerror(err));
+        return mk_io_error(msg);
+    }
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+// ============================================================================
+// Slist Operations
+// ============================================================================
+
+LEAN_EXPORT lean_obj_res wisp_slist_new(lean_obj_arg world) {
+    if (!g_initialized) {
+        lean_object* init_result = wisp_global_init(lean_box(0));
+        lean_dec(init_result);
+    }
+
+    SlistWrapper* wrapper = calloc(1, sizeof(SlistWrapper));
+    if (!wrapper) {
+        return mk_io_error("Failed to allocate SlistWrapper");
+    }
+
+    lean_object* obj = lean_alloc_external(g_slist_class, wrapper);
+    return lean_io_result_mk_ok(obj);
+}
+
+LEAN_EXPORT lean_obj_res wisp_slist_append(
+    b_lean_obj_arg slist,
+    b_lean_obj_arg str,
+    lean_obj_arg world
+) {
+    SlistWrapper* wrapper = (SlistWrapper*)lean_get_external_data(slist);
+    const char* s = lean_string_cstr(str);
+
+    struct curl_slist* new_list = curl_slist_append(wrapper->list, s);
+    if (!new_list && s[0] != '\0') {
+        return mk_io_error("Failed to append to slist");
+    }
+
+    wrapper->list = new_list;
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+LEAN_EXPORT lean_obj_res wisp_slist_free(b_lean_obj_arg slist, lean_obj_arg world) {
+    // Cleanup is handled by finalizer
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+// ============================================================================
+// Mime Operations
+// ============================================================================
+
+LEAN_EXPORT lean_obj_res wisp_mime_init(b_lean_obj_arg easy, lean_obj_arg world) {
+    EasyWrapper* e_wrapper = (EasyWrapper*)lean_get_external_data(easy);
+
+    curl_mime* mime = curl_mime_init(e_wrapper->handle);
+    if (!mime) {
+        return mk_io_error("Failed to create CURL mime handle");
+    }
+
+    MimeWrapper* wrapper = calloc(1, sizeof(MimeWrapper));
+    if (!wrapper) {
+        curl_mime_free(mime);
+        return mk_io_error("Failed to allocate MimeWrapper");
+    }
+    wrapper->mime = mime;
+    wrapper->easy = e_wrapper->handle;
+
+    lean_object* obj = lean_alloc_external(g_mime_class, wrapper);
+    return lean_io_result_mk_ok(obj);
+}
+
+LEAN_EXPORT lean_obj_res wisp_mime_addpart(b_lean_obj_arg mime, lean_obj_arg world) {
+    MimeWrapper* m_wrapper = (MimeWrapper*)lean_get_external_data(mime);
+
+    curl_mimepart* part = curl_mime_addpart(m_wrapper->mime);
+    if (!part) {
+        return mk_io_error("Failed to add mime part");
+    }
+
+    MimepartWrapper* wrapper = calloc(1, sizeof(MimepartWrapper));
+    if (!wrapper) {
+        return mk_io_error("Failed to allocate MimepartWrapper");
+    }
+    wrapper->part = part;
+
+    lean_object* obj = lean_alloc_external(g_mimepart_class, wrapper);
+    return lean_io_result_mk_ok(obj);
+}
+
+LEAN_EXPORT lean_obj_res wisp_mimepart_name(
+    b_lean_obj_arg part,
+    b_lean_obj_arg name,
+    lean_obj_arg world
+) {
+    MimepartWrapper* wrapper = (MimepartWrapper*)lean_get_external_data(part);
+    const char* n = lean_string_cstr(name);
+
+    CURLcode res = curl_mime_name(wrapper->part, n);
+    if (res != CURLE_OK) {
+        return mk_curl_error(res);
+    }
+
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+LEAN_EXPORT lean_obj_res wisp_mimepart_data(
+    b_lean_obj_arg part,
+    b_lean_obj_arg data,
+    lean_obj_arg world
+) {
+    MimepartWrapper* wrapper = (MimepartWrapper*)lean_get_external_data(part);
+    size_t size = lean_sarray_size(data);
+    uint8_t* ptr = lean_sarray_cptr(data);
+
+    CURLcode res = curl_mime_data(wrapper->part, (const char*)ptr, size);
+    if (res != CURLE_OK) {
+        return mk_curl_error(res);
+    }
+
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+LEAN_EXPORT lean_obj_res wisp_mimepart_filename(
+    b_lean_obj_arg part,
+    b_lean_obj_arg filename,
+    lean_obj_arg world
+) {
+    MimepartWrapper* wrapper = (MimepartWrapper*)lean_get_external_data(part);
+    const char* f = lean_string_cstr(filename);
+
+    CURLcode res = curl_mime_filename(wrapper->part, f);
+    if (res != CURLE_OK) {
+        return mk_curl_error(res);
+    }
+
+    return lean_io_result_mk_ok(lean_box(0));
 }
 
 LEAN_EXPORT lean_obj_res wisp_mimepart_type(
@@ -770,25 +1951,530 @@ LEAN_EXPORT lean_obj_res wisp_mimepart_type(
     return lean_io_result_mk_ok(lean_box(0));
 }
 
-LEAN_EXPORT lean_obj_res wisp_mimepart_filedata(
-    b_lean_obj_arg part,
-    b_lean_obj_arg filepath,
-    lean_obj_arg world
-) {
-    MimepartWrapper* wrapper = (MimepartWrapper*)lean_get_external_data(part);
-    const char* f = lean_string_cstr(filepath);
+LEAN_EXPORT lean_obj_res wisp_mimepart_filedata(
+    b_lean_obj_arg part,
+    b_lean_obj_arg filepath,
+    lean_obj_arg world
+) {
+    MimepartWrapper* wrapper = (MimepartWrapper*)lean_get_external_data(part);
+    const char* f = lean_string_cstr(filepath);
+
+    CURLcode res = curl_mime_filedata(wrapper->part, f);
+    if (res != CURLE_OK) {
+        return mk_curl_error(res);
+    }
+
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+LEAN_EXPORT lean_obj_res wisp_mime_free(b_lean_obj_arg mime, lean_obj_arg world) {
+    // Cleanup is handled by finalizer
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+// ============================================================================
+// Share Handle Operations
+// ============================================================================
+
+static void share_lock_callback(CURL* handle, curl_lock_data data, curl_lock_access access, void* userp) {
+    (void)handle;
+    (void)access;
+    ShareWrapper* wrapper = (ShareWrapper*)userp;
+    if (data >= 0 && data < CURL_LOCK_DATA_LAST) {
+        pthread_mutex_lock(&wrapper->locks[data]);
+    }
+}
+
+static void share_unlock_callback(CURL* handle, curl_lock_data data, void* userp) {
+    (void)handle;
+    ShareWrapper* wrapper = (ShareWrapper*)userp;
+    if (data >= 0 && data < CURL_LOCK_DATA_LAST) {
+        pthread_mutex_unlock(&wrapper->locks[data]);
+    }
+}
+
+LEAN_EXPORT lean_obj_res wisp_share_init(lean_obj_arg world) {
+    if (!g_initialized) {
+        lean_object* init_result = wisp_global_init(lean_box(0));
+        lean_dec(init_result);
+    }
+
+    CURLSH* handle = curl_share_init();
+    if (!handle) {
+        return mk_io_error("Failed to create CURL share handle");
+    }
+
+    ShareWrapper* wrapper = calloc(1, sizeof(ShareWrapper));
+    if (!wrapper) {
+        curl_share_cleanup(handle);
+        return mk_io_error("Failed to allocate ShareWrapper");
+    }
+    wrapper->handle = handle;
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&wrapper->locks[i], NULL);
+    }
+
+    // Handles on different threads (manager, WebSocket, callers) use the share
+    curl_share_setopt(handle, CURLSHOPT_LOCKFUNC, share_lock_callback);
+    curl_share_setopt(handle, CURLSHOPT_UNLOCKFUNC, share_unlock_callback);
+    curl_share_setopt(handle, CURLSHOPT_USERDATA, wrapper);
+
+    lean_object* obj = lean_alloc_external(g_share_class, wrapper);
+    return lean_io_result_mk_ok(obj);
+}
+
+LEAN_EXPORT lean_obj_res wisp_share_add(
+    b_lean_obj_arg share,
+    uint32_t data,
+    lean_obj_arg world
+) {
+    ShareWrapper* wrapper = (ShareWrapper*)lean_get_external_data(share);
+
+    CURLSHcode res = curl_share_setopt(wrapper->handle, CURLSHOPT_SHARE, (curl_lock_data)data);
+    if (res != CURLSHE_OK) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "CURLSH error %d: %s", res, curl_share_strerror(res));
+        return mk_io_error(msg);
+    }
+
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+LEAN_EXPORT lean_obj_res wisp_easy_setopt_share(
+    b_lean_obj_arg easy,
+    b_lean_obj_arg share,
+    lean_obj_arg world
+) {
+    EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy);
+    ShareWrapper* s_wrapper = (ShareWrapper*)lean_get_external_data(share);
+
+    CURLcode res = curl_easy_setopt(wrapper->handle, CURLOPT_SHARE, s_wrapper->handle);
+    if (res != CURLE_OK) {
+        return mk_curl_error(res);
+    }
+
+    // Keep the share alive for as long as this handle points at it
+    lean_inc(share);
+    easy_release_share(wrapper);
+    wrapper->share_obj = share;
+
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+// ============================================================================
+// Request Templates
+// ============================================================================
+
+LEAN_EXPORT lean_obj_res wisp_template_new(lean_obj_arg world) {
+    if (!g_initialized) {
+        lean_object* init_result = wisp_global_init(lean_box(0));
+        lean_dec(init_result);
+    }
+
+    TemplateWrapper* wrapper = calloc(1, sizeof(TemplateWrapper));
+    if (!wrapper) {
+        return mk_io_error("Failed to allocate TemplateWrapper");
+    }
+    wrapper->probe = curl_easy_init();
+    if (!wrapper->probe) {
+        free(wrapper);
+        return mk_io_error("Failed to create CURL easy handle");
+    }
+
+    lean_object* obj = lean_alloc_external(g_template_class, wrapper);
+    return lean_io_result_mk_ok(obj);
+}
+
+LEAN_EXPORT lean_obj_res wisp_template_set_long(
+    b_lean_obj_arg tmpl,
+    uint32_t option,
+    int64_t value,
+    lean_obj_arg world
+) {
+    TemplateWrapper* wrapper = (TemplateWrapper*)lean_get_external_data(tmpl);
+
+    // Fail now rather than on every apply
+    CURLcode res = curl_easy_setopt(wrapper->probe, (CURLoption)option, (long)value);
+    if (res != CURLE_OK) {
+        return mk_curl_error(res);
+    }
+    if (option == CURLOPT_FOLLOWLOCATION) {
+        wrapper->follow_location = value != 0;
+    }
+
+    for (size_t i = 0; i < wrapper->long_count; i++) {
+        if (wrapper->longs[i].option == (CURLoption)option) {
+            wrapper->longs[i].value = (long)value;
+            return lean_io_result_mk_ok(lean_box(0));
+        }
+    }
+    if (wrapper->long_count == wrapper->long_capacity) {
+        size_t new_capacity = wrapper->long_capacity == 0 ? 16 : wrapper->long_capacity * 2;
+        TemplateLong* new_longs = realloc(wrapper->longs, new_capacity * sizeof(TemplateLong));
+        if (!new_longs) {
+            return mk_io_error("Failed to grow template");
+        }
+        wrapper->longs = new_longs;
+        wrapper->long_capacity = new_capacity;
+    }
+    wrapper->longs[wrapper->long_count].option = (CURLoption)option;
+    wrapper->longs[wrapper->long_count].value = (long)value;
+    wrapper->long_count++;
+
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+LEAN_EXPORT lean_obj_res wisp_template_set_string(
+    b_lean_obj_arg tmpl,
+    uint32_t option,
+    b_lean_obj_arg value,
+    lean_obj_arg world
+) {
+    TemplateWrapper* wrapper = (TemplateWrapper*)lean_get_external_data(tmpl);
+    const char* str = lean_string_cstr(value);
+
+    // Validate, then clear again so the probe never acts on the option
+    // (a COOKIEJAR would otherwise be written when it is cleaned up)
+    CURLcode res = curl_easy_setopt(wrapper->probe, (CURLoption)option, str);
+    curl_easy_setopt(wrapper->probe, (CURLoption)option, (char*)NULL);
+    if (res != CURLE_OK) {
+        return mk_curl_error(res);
+    }
+
+    char* str_copy = strdup(str);
+    if (!str_copy) {
+        return mk_io_error("Failed to allocate string");
+    }
+    for (size_t i = 0; i < wrapper->string_count; i++) {
+        if (wrapper->strings[i].option == (CURLoption)option) {
+            free(wrapper->strings[i].value);
+            wrapper->strings[i].value = str_copy;
+            return lean_io_result_mk_ok(lean_box(0));
+        }
+    }
+    if (wrapper->string_count == wrapper->string_capacity) {
+        size_t new_capacity = wrapper->string_capacity == 0 ? 8 : wrapper->string_capacity * 2;
+        TemplateString* new_strings = realloc(wrapper->strings, new_capacity * sizeof(TemplateString));
+        if (!new_strings) {
+            free(str_copy);
+            return mk_io_error("Failed to grow template");
+        }
+        wrapper->strings = new_strings;
+        wrapper->string_capacity = new_capacity;
+    }
+    wrapper->strings[wrapper->string_count].option = (CURLoption)option;
+    wrapper->strings[wrapper->string_count].value = str_copy;
+    wrapper->string_count++;
+
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+LEAN_EXPORT lean_obj_res wisp_template_add_header(
+    b_lean_obj_arg tmpl,
+    b_lean_obj_arg line,
+    lean_obj_arg world
+) {
+    TemplateWrapper* wrapper = (TemplateWrapper*)lean_get_external_data(tmpl);
+    const char* s = lean_string_cstr(line);
+
+    struct curl_slist* new_list = curl_slist_append(wrapper->headers, s);
+    if (!new_list) {
+        return mk_io_error("Failed to append to slist");
+    }
+
+    wrapper->headers = new_list;
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+LEAN_EXPORT lean_obj_res wisp_template_set_share(
+    b_lean_obj_arg tmpl,
+    b_lean_obj_arg share,
+    lean_obj_arg world
+) {
+    TemplateWrapper* wrapper = (TemplateWrapper*)lean_get_external_data(tmpl);
+
+    lean_inc(share);
+    if (wrapper->share_obj) lean_dec(wrapper->share_obj);
+    wrapper->share_obj = share;
+
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+// Length of a header line's name: up to the ':' (or the ';' curl uses for
+// headers with an empty value)
+static size_t header_name_length(const char* line) {
+    size_t n = 0;
+    while (line[n] && line[n] != ':' && line[n] != ';') n++;
+    return n;
+}
+
+// The template's header lines not overridden by one in `extra`, followed by
+// `extra` itself. Copies the template's lines and takes over `extra`'s nodes;
+// returns NULL (leaving `extra` untouched) when out of memory.
+static struct curl_slist* template_merge_headers(struct curl_slist* fixed, struct curl_slist* extra) {
+    struct curl_slist* merged = NULL;
+    struct curl_slist* tail = NULL;
+    for (struct curl_slist* s = fixed; s; s = s->next) {
+        size_t length = header_name_length(s->data);
+        int overridden = 0;
+        for (struct curl_slist* e = extra; e && !overridden; e = e->next) {
+            overridden = header_name_length(e->data) == length && strncasecmp(s->data, e->data, length) == 0;
+        }
+        if (overridden) continue;
+        struct curl_slist* node = curl_slist_append(NULL, s->data);
+        if (!node) {
+            curl_slist_free_all(merged);
+            return NULL;
+        }
+        if (tail) tail->next = node; else merged = node;
+        tail = node;
+    }
+    if (!tail) return extra;
+    tail->next = extra;
+    return merged;
+}
+
+LEAN_EXPORT lean_obj_res wisp_template_apply(
+    b_lean_obj_arg easy,
+    b_lean_obj_arg tmpl,
+    b_lean_obj_arg url,
+    b_lean_obj_arg headers,
+    lean_obj_arg world
+) {
+    EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy);
+    TemplateWrapper* t = (TemplateWrapper*)lean_get_external_data(tmpl);
+    SlistWrapper* extra = (SlistWrapper*)lean_get_external_data(headers);
+    CURL* handle = wrapper->handle;
+
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, wrapper);
+    curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, header_callback);
+    curl_easy_setopt(handle, CURLOPT_HEADERDATA, wrapper);
+
+    CURLcode res = curl_easy_setopt(handle, CURLOPT_URL, lean_string_cstr(url));
+    if (res != CURLE_OK) {
+        return mk_curl_error(res);
+    }
+
+    // Every option was accepted by the probe, so these cannot fail for
+    // reasons other than memory
+    for (size_t i = 0; i < t->long_count; i++) {
+        res = curl_easy_setopt(handle, t->longs[i].option, t->longs[i].value);
+        if (res != CURLE_OK) {
+            return mk_curl_error(res);
+        }
+    }
+    for (size_t i = 0; i < t->string_count; i++) {
+        res = curl_easy_setopt(handle, t->strings[i].option, t->strings[i].value);
+        if (res != CURLE_OK) {
+            return mk_curl_error(res);
+        }
+    }
+    wrapper->follow_location = t->follow_location;
+
+    // Without per-request headers the template's list is used as is
+    struct curl_slist* list = t->headers;
+    if (extra->list) {
+        list = template_merge_headers(t->headers, extra->list);
+        if (!list) {
+            return mk_io_error("Failed to build header list");
+        }
+        extra->list = NULL;
+        if (wrapper->owned_slist) {
+            curl_slist_free_all(wrapper->owned_slist);
+        }
+        wrapper->owned_slist = list;
+    }
+    if (list) {
+        res = curl_easy_setopt(handle, CURLOPT_HTTPHEADER, list);
+        if (res != CURLE_OK) {
+            return mk_curl_error(res);
+        }
+    }
+
+    if (t->share_obj) {
+        ShareWrapper* s_wrapper = (ShareWrapper*)lean_get_external_data(t->share_obj);
+        res = curl_easy_setopt(handle, CURLOPT_SHARE, s_wrapper->handle);
+        if (res != CURLE_OK) {
+            return mk_curl_error(res);
+        }
+        lean_inc(t->share_obj);
+        easy_release_share(wrapper);
+        wrapper->share_obj = t->share_obj;
+    }
+
+    // Keep the template, and so its header list, alive while the handle uses it
+    lean_inc(tmpl);
+    easy_release_template(wrapper);
+    wrapper->template_obj = tmpl;
+
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+// ============================================================================
+// Multi Event Loop (curl_multi_socket_action)
+// ============================================================================
 
-    CURLcode res = curl_mime_filedata(wrapper->part, f);
-    if (res != CURLE_OK) {
-        return mk_curl_error(res);
+// epoll/poll tag for the wakeup descriptor; curl sockets are tagged by fd
+// and watched WebSocket sockets by fd with WISP_TAG_WS set
+#define WISP_TAG_WAKEUP UINT64_MAX
+#define WISP_TAG_WS ((uint64_t)1 << 62)
+#define WISP_MAX_EVENTS 64
+#define WISP_WAIT_FOREVER UINT32_MAX
+
+static int64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+#ifndef WISP_USE_EPOLL
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return -1;
+    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) return -1;
+    return fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+#endif
+
+static int multi_open_wakeup(MultiWrapper* wrapper) {
+#ifdef WISP_USE_EPOLL
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) return -1;
+    wrapper->wakeup_read_fd = fd;
+    wrapper->wakeup_write_fd = fd;
+#else
+    int fds[2];
+    if (pipe(fds) != 0) return -1;
+    if (set_nonblocking(fds[0]) != 0 || set_nonblocking(fds[1]) != 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    wrapper->wakeup_read_fd = fds[0];
+    wrapper->wakeup_write_fd = fds[1];
+#endif
+    return 0;
+}
+
+static void multi_drain_wakeup(MultiWrapper* wrapper) {
+    uint64_t buf[8];
+    while (read(wrapper->wakeup_read_fd, buf, sizeof(buf)) > 0) {
+        // eventfd resets on a single read; a pipe may need several
     }
+}
 
-    return lean_io_result_mk_ok(lean_box(0));
+#ifndef WISP_USE_EPOLL
+static struct pollfd* multi_find_pollfd(MultiWrapper* wrapper, int fd) {
+    for (size_t i = 1; i < wrapper->pollfds_count; i++) {
+        if (wrapper->pollfds[i].fd == fd) return &wrapper->pollfds[i];
+    }
+    return NULL;
+}
+#endif
+
+// The open WebSocket connection watched on socket `fd`, if any
+static EasyWrapper* multi_ws_lookup(MultiWrapper* wrapper, int fd) {
+    if (fd < 0 || (size_t)fd >= wrapper->ws_by_fd_capacity) return NULL;
+    return wrapper->ws_by_fd[fd];
+}
+
+// CURLMOPT_SOCKETFUNCTION: keep the readiness set in sync with curl's sockets
+static int multi_socket_callback(CURL* easy, curl_socket_t s, int what, void* userp, void* socketp) {
+    (void)easy;
+    MultiWrapper* wrapper = (MultiWrapper*)userp;
+    // curl is done with a socket we still wait on for a WebSocket: keep it
+    int keep_ws = what == CURL_POLL_REMOVE && multi_ws_lookup(wrapper, (int)s) != NULL;
+
+#ifdef WISP_USE_EPOLL
+    if (keep_ws) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = multi_ws_lookup(wrapper, (int)s)->ws_want_write ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        ev.data.u64 = WISP_TAG_WS | (uint64_t)s;
+        epoll_ctl(wrapper->epoll_fd, EPOLL_CTL_MOD, s, &ev);
+        return 0;
+    }
+    if (what == CURL_POLL_REMOVE) {
+        epoll_ctl(wrapper->epoll_fd, EPOLL_CTL_DEL, s, NULL);
+        return 0;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    if (what & CURL_POLL_IN) ev.events |= EPOLLIN;
+    if (what & CURL_POLL_OUT) ev.events |= EPOLLOUT;
+    ev.data.u64 = (uint64_t)s;
+
+    if (socketp) {
+        if (epoll_ctl(wrapper->epoll_fd, EPOLL_CTL_MOD, s, &ev) != 0 && errno == ENOENT) {
+            epoll_ctl(wrapper->epoll_fd, EPOLL_CTL_ADD, s, &ev);
+        }
+    } else {
+        if (epoll_ctl(wrapper->epoll_fd, EPOLL_CTL_ADD, s, &ev) != 0 && errno == EEXIST) {
+            epoll_ctl(wrapper->epoll_fd, EPOLL_CTL_MOD, s, &ev);
+        }
+        curl_multi_assign(wrapper->handle, s, wrapper);
+    }
+#else
+    (void)socketp;
+    struct pollfd* entry = multi_find_pollfd(wrapper, (int)s);
+
+    if (keep_ws) {
+        if (entry) entry->events = multi_ws_lookup(wrapper, (int)s)->ws_want_write ? POLLIN | POLLOUT : POLLIN;
+        return 0;
+    }
+    if (what == CURL_POLL_REMOVE) {
+        if (entry) {
+            *entry = wrapper->pollfds[--wrapper->pollfds_count];
+        }
+        return 0;
+    }
+
+    if (!entry) {
+        if (wrapper->pollfds_count == wrapper->pollfds_capacity) {
+            size_t new_capacity = wrapper->pollfds_capacity * 2;
+            struct pollfd* new_fds = realloc(wrapper->pollfds, new_capacity * sizeof(struct pollfd));
+            if (!new_fds) return -1;
+            wrapper->pollfds = new_fds;
+            wrapper->pollfds_capacity = new_capacity;
+        }
+        entry = &wrapper->pollfds[wrapper->pollfds_count++];
+        entry->fd = (int)s;
+    }
+    entry->events = 0;
+    entry->revents = 0;
+    if (what & CURL_POLL_IN) entry->events |= POLLIN;
+    if (what & CURL_POLL_OUT) entry->events |= POLLOUT;
+#endif
+
+    return 0;
 }
 
-LEAN_EXPORT lean_obj_res wisp_mime_free(b_lean_obj_arg mime, lean_obj_arg world) {
-    // Cleanup is handled by finalizer
-    return lean_io_result_mk_ok(lean_box(0));
+// CURLMOPT_TIMERFUNCTION: remember when curl next wants to be driven
+static int multi_timer_callback(CURLM* multi, long timeout_ms, void* userp) {
+    (void)multi;
+    MultiWrapper* wrapper = (MultiWrapper*)userp;
+    wrapper->timer_deadline_ms = timeout_ms < 0 ? -1 : monotonic_ms() + timeout_ms;
+    return 0;
+}
+
+static CURLMcode multi_socket_ready(MultiWrapper* wrapper, curl_socket_t s, int flags) {
+    return curl_multi_socket_action(wrapper->handle, s, flags, &wrapper->running);
+}
+
+// Compute how long to block: the caller's limit capped by curl's timer
+static int multi_wait_timeout(MultiWrapper* wrapper, uint32_t timeout_ms) {
+    // Handles made ready outside the wait (e.g. by unpausing) need no I/O
+    if (wrapper->ready_count > 0) return 0;
+    int64_t wait_ms = timeout_ms == WISP_WAIT_FOREVER ? -1 : (int64_t)timeout_ms;
+    if (wrapper->timer_deadline_ms >= 0) {
+        int64_t remaining = wrapper->timer_deadline_ms - monotonic_ms();
+        if (remaining < 0) remaining = 0;
+        if (wait_ms < 0 || remaining < wait_ms) wait_ms = remaining;
+    }
+    if (wait_ms > INT_MAX) wait_ms = INT_MAX;
+    return (int)wait_ms;
 }
 
 // ============================================================================
@@ -819,6 +2505,44 @@ LEAN_EXPORT lean_obj_res wisp_multi_init(lean_obj_arg world) {
         return mk_io_error("Failed to allocate MultiWrapper");
     }
     wrapper->handle = handle;
+    wrapper->timer_deadline_ms = -1;
+    wrapper->wakeup_read_fd = -1;
+    wrapper->wakeup_write_fd = -1;
+#ifdef WISP_USE_EPOLL
+    wrapper->epoll_fd = -1;
+#endif
+
+    // Event-driven transfers: curl reports sockets and timeouts, we wait on them
+    if (multi_open_wakeup(wrapper) != 0) {
+        multi_finalizer(wrapper);
+        return mk_io_error("Failed to create multi wakeup descriptor");
+    }
+#ifdef WISP_USE_EPOLL
+    wrapper->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (wrapper->epoll_fd < 0) {
+        multi_finalizer(wrapper);
+        return mk_io_error("Failed to create epoll instance");
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = WISP_TAG_WAKEUP;
+    epoll_ctl(wrapper->epoll_fd, EPOLL_CTL_ADD, wrapper->wakeup_read_fd, &ev);
+#else
+    wrapper->pollfds_capacity = 16;
+    wrapper->pollfds = calloc(wrapper->pollfds_capacity, sizeof(struct pollfd));
+    if (!wrapper->pollfds) {
+        multi_finalizer(wrapper);
+        return mk_io_error("Failed to allocate poll set");
+    }
+    wrapper->pollfds[0].fd = wrapper->wakeup_read_fd;
+    wrapper->pollfds[0].events = POLLIN;
+    wrapper->pollfds_count = 1;
+#endif
+    curl_multi_setopt(handle, CURLMOPT_SOCKETFUNCTION, multi_socket_callback);
+    curl_multi_setopt(handle, CURLMOPT_SOCKETDATA, wrapper);
+    curl_multi_setopt(handle, CURLMOPT_TIMERFUNCTION, multi_timer_callback);
+    curl_multi_setopt(handle, CURLMOPT_TIMERDATA, wrapper);
 
     lean_object* obj = lean_alloc_external(g_multi_class, wrapper);
     return lean_io_result_mk_ok(obj);
@@ -829,6 +2553,40 @@ LEAN_EXPORT lean_obj_res wisp_multi_cleanup(b_lean_obj_arg multi, lean_obj_arg w
     return lean_io_result_mk_ok(lean_box(0));
 }
 
+LEAN_EXPORT lean_obj_res wisp_multi_setopt_long(
+    b_lean_obj_arg multi,
+    uint32_t option,
+    int64_t value,
+    lean_obj_arg world
+) {
+    MultiWrapper* wrapper = (MultiWrapper*)lean_get_external_data(multi);
+
+    CURLMcode res = curl_multi_setopt(wrapper->handle, (CURLMoption)option, (long)value);
+    if (res != CURLM_OK) {
+        return mk_curlm_error(res);
+    }
+
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+// Stop waiting on a WebSocket connection's socket
+static void multi_ws_unwatch(MultiWrapper* wrapper, EasyWrapper* e_wrapper) {
+    if (!e_wrapper->ws_watched) return;
+    int fd = e_wrapper->ws_socket;
+    if (multi_ws_lookup(wrapper, fd) == e_wrapper) {
+        wrapper->ws_by_fd[fd] = NULL;
+#ifdef WISP_USE_EPOLL
+        epoll_ctl(wrapper->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+#else
+        struct pollfd* entry = multi_find_pollfd(wrapper, fd);
+        if (entry) *entry = wrapper->pollfds[--wrapper->pollfds_count];
+#endif
+    }
+    e_wrapper->ws_watched = 0;
+    e_wrapper->ws_socket = -1;
+    e_wrapper->ws_want_write = 0;
+}
+
 LEAN_EXPORT lean_obj_res wisp_multi_add_handle(
     b_lean_obj_arg multi,
     b_lean_obj_arg easy,
@@ -837,10 +2595,13 @@ LEAN_EXPORT lean_obj_res wisp_multi_add_handle(
     MultiWrapper* m_wrapper = (MultiWrapper*)lean_get_external_data(multi);
     EasyWrapper* e_wrapper = (EasyWrapper*)lean_get_external_data(easy);
 
+    easy_reset_body(e_wrapper);
     CURLMcode res = curl_multi_add_handle(m_wrapper->handle, e_wrapper->handle);
     if (res != CURLM_OK) {
         return mk_curlm_error(res);
     }
+    e_wrapper->owner = m_wrapper;
+    e_wrapper->ready_queued = 0;
 
     return lean_io_result_mk_ok(lean_box(0));
 }
@@ -853,11 +2614,138 @@ LEAN_EXPORT lean_obj_res wisp_multi_remove_handle(
     MultiWrapper* m_wrapper = (MultiWrapper*)lean_get_external_data(multi);
     EasyWrapper* e_wrapper = (EasyWrapper*)lean_get_external_data(easy);
 
+    multi_ws_unwatch(m_wrapper, e_wrapper);
     CURLMcode res = curl_multi_remove_handle(m_wrapper->handle, e_wrapper->handle);
     if (res != CURLM_OK) {
         return mk_curlm_error(res);
     }
 
+    // Drop a pending ready entry so the list never points at a detached handle
+    if (e_wrapper->ready_queued) {
+        for (size_t i = 0; i < m_wrapper->ready_count; i++) {
+            if (m_wrapper->ready[i] == e_wrapper) {
+                m_wrapper->ready[i] = m_wrapper->ready[--m_wrapper->ready_count];
+                break;
+            }
+        }
+        e_wrapper->ready_queued = 0;
+    }
+    e_wrapper->owner = NULL;
+
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+// Wait on the socket of a WebSocket connection whose CONNECT_ONLY handshake
+// finished on this multi handle. wisp_multi_wait then lists the connection
+// in wisp_multi_take_ready whenever its socket is readable, so one event loop
+// serves any number of connections. The handle must stay added until it is
+// unwatched or removed.
+LEAN_EXPORT lean_obj_res wisp_multi_watch_ws(
+    b_lean_obj_arg multi,
+    b_lean_obj_arg easy,
+    lean_obj_arg world
+) {
+    MultiWrapper* m_wrapper = (MultiWrapper*)lean_get_external_data(multi);
+    EasyWrapper* e_wrapper = (EasyWrapper*)lean_get_external_data(easy);
+    if (e_wrapper->owner != m_wrapper) {
+        return mk_io_error("WebSocket handle is not attached to this multi handle");
+    }
+
+    curl_socket_t sock = CURL_SOCKET_BAD;
+    CURLcode code = curl_easy_getinfo(e_wrapper->handle, CURLINFO_ACTIVESOCKET, &sock);
+    if (code != CURLE_OK) return mk_curl_error(code);
+    if (sock == CURL_SOCKET_BAD) return mk_io_error("WebSocket connection has no socket");
+    int fd = (int)sock;
+
+    if ((size_t)fd >= m_wrapper->ws_by_fd_capacity) {
+        size_t new_capacity = m_wrapper->ws_by_fd_capacity == 0 ? 64 : m_wrapper->ws_by_fd_capacity;
+        while (new_capacity <= (size_t)fd) new_capacity *= 2;
+        EasyWrapper** table = realloc(m_wrapper->ws_by_fd, new_capacity * sizeof(EasyWrapper*));
+        if (!table) return mk_io_error("Failed to grow WebSocket socket table");
+        memset(table + m_wrapper->ws_by_fd_capacity, 0,
+               (new_capacity - m_wrapper->ws_by_fd_capacity) * sizeof(EasyWrapper*));
+        m_wrapper->ws_by_fd = table;
+        m_wrapper->ws_by_fd_capacity = new_capacity;
+    }
+
+#ifdef WISP_USE_EPOLL
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = WISP_TAG_WS | (uint64_t)fd;
+    if (epoll_ctl(m_wrapper->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        if (errno != EEXIST || epoll_ctl(m_wrapper->epoll_fd, EPOLL_CTL_MOD, fd, &ev) != 0) {
+            return mk_io_error("Failed to watch WebSocket socket");
+        }
+    }
+#else
+    struct pollfd* entry = multi_find_pollfd(m_wrapper, fd);
+    if (!entry) {
+        if (m_wrapper->pollfds_count == m_wrapper->pollfds_capacity) {
+            size_t new_capacity = m_wrapper->pollfds_capacity * 2;
+            struct pollfd* new_fds = realloc(m_wrapper->pollfds, new_capacity * sizeof(struct pollfd));
+            if (!new_fds) return mk_io_error("Failed to watch WebSocket socket");
+            m_wrapper->pollfds = new_fds;
+            m_wrapper->pollfds_capacity = new_capacity;
+        }
+        entry = &m_wrapper->pollfds[m_wrapper->pollfds_count++];
+        entry->fd = fd;
+    }
+    entry->events = POLLIN;
+    entry->revents = 0;
+#endif
+
+    m_wrapper->ws_by_fd[fd] = e_wrapper;
+    e_wrapper->ws_watched = 1;
+    e_wrapper->ws_socket = fd;
+    // Frames may have arrived together with the handshake response
+    easy_mark_ready(e_wrapper);
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+// Also wait for a watched WebSocket's socket to be writable, so a frame that
+// did not fit in the send buffer is continued as soon as there is room. The
+// connection is listed in wisp_multi_take_ready for either event.
+LEAN_EXPORT lean_obj_res wisp_multi_ws_want_write(
+    b_lean_obj_arg multi,
+    b_lean_obj_arg easy,
+    uint8_t want,
+    lean_obj_arg world
+) {
+    MultiWrapper* m_wrapper = (MultiWrapper*)lean_get_external_data(multi);
+    EasyWrapper* e_wrapper = (EasyWrapper*)lean_get_external_data(easy);
+    if (!e_wrapper->ws_watched || e_wrapper->owner != m_wrapper) {
+        return mk_io_error("WebSocket is not watched by this multi handle");
+    }
+    if (e_wrapper->ws_want_write == (want != 0)) {
+        return lean_io_result_mk_ok(lean_box(0));
+    }
+    e_wrapper->ws_want_write = want != 0;
+    int fd = e_wrapper->ws_socket;
+
+#ifdef WISP_USE_EPOLL
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = want ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    ev.data.u64 = WISP_TAG_WS | (uint64_t)fd;
+    if (epoll_ctl(m_wrapper->epoll_fd, EPOLL_CTL_MOD, fd, &ev) != 0) {
+        return mk_io_error("Failed to update WebSocket socket events");
+    }
+#else
+    struct pollfd* entry = multi_find_pollfd(m_wrapper, fd);
+    if (entry) entry->events = want ? POLLIN | POLLOUT : POLLIN;
+#endif
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+LEAN_EXPORT lean_obj_res wisp_multi_unwatch_ws(
+    b_lean_obj_arg multi,
+    b_lean_obj_arg easy,
+    lean_obj_arg world
+) {
+    MultiWrapper* m_wrapper = (MultiWrapper*)lean_get_external_data(multi);
+    EasyWrapper* e_wrapper = (EasyWrapper*)lean_get_external_data(easy);
+    multi_ws_unwatch(m_wrapper, e_wrapper);
     return lean_io_result_mk_ok(lean_box(0));
 }
 
@@ -889,6 +2777,119 @@ LEAN_EXPORT lean_obj_res wisp_multi_poll(
     return lean_io_result_mk_ok(lean_box_uint32((uint32_t)numfds));
 }
 
+// Block until a socket is ready, curl's timer expires, or a wakeup arrives,
+// then drive the affected transfers. Returns the number still running.
+LEAN_EXPORT lean_obj_res wisp_multi_wait(
+    b_lean_obj_arg multi,
+    uint32_t timeout_ms,
+    lean_obj_arg world
+) {
+    MultiWrapper* wrapper = (MultiWrapper*)lean_get_external_data(multi);
+    int wait_ms = multi_wait_timeout(wrapper, timeout_ms);
+
+#ifdef WISP_USE_EPOLL
+    struct epoll_event events[WISP_MAX_EVENTS];
+    int n = epoll_wait(wrapper->epoll_fd, events, WISP_MAX_EVENTS, wait_ms);
+    if (n < 0) {
+        if (errno != EINTR) return mk_io_error("epoll_wait failed");
+        n = 0;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (events[i].data.u64 == WISP_TAG_WAKEUP) {
+            multi_drain_wakeup(wrapper);
+            continue;
+        }
+        if (events[i].data.u64 & WISP_TAG_WS) {
+            EasyWrapper* ws = multi_ws_lookup(wrapper, (int)(events[i].data.u64 & ~WISP_TAG_WS));
+            if (ws) easy_mark_ready(ws);
+            continue;
+        }
+        int flags = 0;
+        if (events[i].events & EPOLLIN) flags |= CURL_CSELECT_IN;
+        if (events[i].events & EPOLLOUT) flags |= CURL_CSELECT_OUT;
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) flags |= CURL_CSELECT_ERR;
+        CURLMcode res = multi_socket_ready(wrapper, (curl_socket_t)events[i].data.u64, flags);
+        if (res != CURLM_OK) return mk_curlm_error(res);
+    }
+#else
+    int n = poll(wrapper->pollfds, (nfds_t)wrapper->pollfds_count, wait_ms);
+    if (n < 0) {
+        if (errno != EINTR) return mk_io_error("poll failed");
+        n = 0;
+    }
+
+    if (n > 0) {
+        if (wrapper->pollfds[0].revents) {
+            multi_drain_wakeup(wrapper);
+        }
+
+        // socket_action may add/remove entries, so act on a snapshot
+        struct pollfd ready[WISP_MAX_EVENTS];
+        size_t ready_count = 0;
+        for (size_t i = 1; i < wrapper->pollfds_count && ready_count < WISP_MAX_EVENTS; i++) {
+            if (wrapper->pollfds[i].revents) ready[ready_count++] = wrapper->pollfds[i];
+        }
+        for (size_t i = 0; i < ready_count; i++) {
+            EasyWrapper* ws = multi_ws_lookup(wrapper, ready[i].fd);
+            if (ws) {
+                easy_mark_ready(ws);
+                continue;
+            }
+            int flags = 0;
+            if (ready[i].revents & POLLIN) flags |= CURL_CSELECT_IN;
+            if (ready[i].revents & POLLOUT) flags |= CURL_CSELECT_OUT;
+            if (ready[i].revents & (POLLERR | POLLHUP | POLLNVAL)) flags |= CURL_CSELECT_ERR;
+            CURLMcode res = multi_socket_ready(wrapper, ready[i].fd, flags);
+            if (res != CURLM_OK) return mk_curlm_error(res);
+        }
+    }
+#endif
+
+    // Fire curl's timer if it has expired
+    if (wrapper->timer_deadline_ms >= 0 && monotonic_ms() >= wrapper->timer_deadline_ms) {
+        wrapper->timer_deadline_ms = -1;
+        CURLMcode res = multi_socket_ready(wrapper, CURL_SOCKET_TIMEOUT, 0);
+        if (res != CURLM_OK) return mk_curlm_error(res);
+    }
+
+    return lean_io_result_mk_ok(lean_box_uint32((uint32_t)wrapper->running));
+}
+
+// Interrupt a blocked wisp_multi_wait. Safe to call from any thread.
+LEAN_EXPORT lean_obj_res wisp_multi_wakeup(b_lean_obj_arg multi, lean_obj_arg world) {
+    MultiWrapper* wrapper = (MultiWrapper*)lean_get_external_data(multi);
+#ifdef WISP_USE_EPOLL
+    uint64_t one = 1;
+    ssize_t written = write(wrapper->wakeup_write_fd, &one, sizeof(one));
+#else
+    char one = 1;
+    ssize_t written = write(wrapper->wakeup_write_fd, &one, sizeof(one));
+#endif
+    // EAGAIN means a wakeup is already pending, which is just as good
+    (void)written;
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+// Collect the IDs (CURLOPT_PRIVATE) of streaming handles that received
+// headers or body data since the last call, and clear the list.
+LEAN_EXPORT lean_obj_res wisp_multi_take_ready(b_lean_obj_arg multi, lean_obj_arg world) {
+    MultiWrapper* wrapper = (MultiWrapper*)lean_get_external_data(multi);
+    size_t count = wrapper->ready_count;
+
+    lean_object* arr = lean_alloc_array(count, count);
+    for (size_t i = 0; i < count; i++) {
+        EasyWrapper* e_wrapper = wrapper->ready[i];
+        void* private_ptr = NULL;
+        curl_easy_getinfo(e_wrapper->handle, CURLINFO_PRIVATE, &private_ptr);
+        lean_array_cptr(arr)[i] = lean_box_uint64((uint64_t)(uintptr_t)private_ptr);
+        e_wrapper->ready_queued = 0;
+    }
+    wrapper->ready_count = 0;
+
+    return lean_io_result_mk_ok(arr);
+}
+
 LEAN_EXPORT lean_obj_res wisp_multi_info_read(b_lean_obj_arg multi, lean_obj_arg world) {
     MultiWrapper* wrapper = (MultiWrapper*)lean_get_external_data(multi);
     int msgs_in_queue = 0;
@@ -972,8 +2973,9 @@ LEAN_EXPORT lean_obj_res wisp_easy_set_streaming(
 ) {
     EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy);
     wrapper->is_streaming = streaming ? 1 : 0;
-    wrapper->stream_read_offset = 0;
     wrapper->headers_complete = 0;
+    wrapper->stream_ring_head = 0;
+    wrapper->stream_ring_size = 0;
     return lean_io_result_mk_ok(lean_box(0));
 }
 
@@ -993,29 +2995,31 @@ LEAN_EXPORT lean_obj_res wisp_easy_headers_complete(
     return lean_io_result_mk_ok(lean_box(wrapper->headers_complete ? 1 : 0));
 }
 
-// Get new body data since last drain (for streaming)
-// Returns ByteArray of new bytes, updates read offset
+// Take all body data buffered since the last drain (for streaming)
+// Returns a ByteArray of the undrained bytes and frees their ring space.
+// A transfer paused on a full ring is resumed; curl may deliver the held-back
+// data before this returns.
 LEAN_EXPORT lean_obj_res wisp_easy_drain_body_chunk(
     b_lean_obj_arg easy,
     lean_obj_arg world
 ) {
     EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy);
 
-    size_t available = wrapper->response_size - wrapper->stream_read_offset;
-    if (available == 0) {
-        // No new data - return empty ByteArray
-        lean_object* empty = lean_alloc_sarray(1, 0, 0);
-        return lean_io_result_mk_ok(empty);
-    }
-
-    // Create ByteArray with new data
+    size_t available = wrapper->stream_ring_size;
     lean_object* arr = lean_alloc_sarray(1, available, available);
-    memcpy(lean_sarray_cptr(arr),
-           wrapper->response_body + wrapper->stream_read_offset,
-           available);
+    if (available > 0) {
+        size_t first = wrapper->stream_ring_capacity - wrapper->stream_ring_head;
+        if (first > available) first = available;
+        memcpy(lean_sarray_cptr(arr), wrapper->stream_ring + wrapper->stream_ring_head, first);
+        memcpy(lean_sarray_cptr(arr) + first, wrapper->stream_ring, available - first);
+    }
+    wrapper->stream_ring_head = 0;
+    wrapper->stream_ring_size = 0;
 
-    // Update read offset
-    wrapper->stream_read_offset = wrapper->response_size;
+    if (wrapper->stream_paused) {
+        wrapper->stream_paused = 0;
+        curl_easy_pause(wrapper->handle, CURLPAUSE_CONT);
+    }
 
     return lean_io_result_mk_ok(arr);
 }
@@ -1026,8 +3030,7 @@ LEAN_EXPORT lean_obj_res wisp_easy_has_pending_data(
     lean_obj_arg world
 ) {
     EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy);
-    size_t available = wrapper->response_size - wrapper->stream_read_offset;
-    return lean_io_result_mk_ok(lean_box(available > 0 ? 1 : 0));
+    return lean_io_result_mk_ok(lean_box(wrapper->stream_ring_size > 0 ? 1 : 0));
 }
 
 // Reset streaming state (for reuse)
@@ -1036,11 +3039,28 @@ LEAN_EXPORT lean_obj_res wisp_easy_reset_streaming(
     lean_obj_arg world
 ) {
     EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy);
-    wrapper->stream_read_offset = 0;
+    wrapper->stream_ring_head = 0;
+    wrapper->stream_ring_size = 0;
     wrapper->headers_complete = 0;
     return lean_io_result_mk_ok(lean_box(0));
 }
 
+// Index of the first CR or LF at or after start, or the array size if there
+// is none. memchr is vectorized by libc, so long SSE data lines are scanned
+// in bulk rather than byte by byte in Lean.
+LEAN_EXPORT size_t wisp_sse_find_line_end(b_lean_obj_arg data, size_t start) {
+    size_t size = lean_sarray_size(data);
+    if (start >= size) return size;
+    const uint8_t* base = lean_sarray_cptr(data);
+    const uint8_t* p = base + start;
+    size_t remaining = size - start;
+    const uint8_t* lf = memchr(p, '\n', remaining);
+    size_t span = lf ? (size_t)(lf - p) : remaining;
+    const uint8_t* cr = memchr(p, '\r', span);
+    if (cr) return (size_t)(cr - base);
+    return lf ? (size_t)(lf - base) : size;
+}
+
 // ============================================================================
 // WebSocket Support (curl 7.86+)
 // ============================================================================
@@ -1088,38 +3108,307 @@ LEAN_EXPORT lean_obj_res wisp_ws_send(
 #endif
 }
 
-// Receive a WebSocket frame (returns Option (ByteArray × UInt32))
+// Send as much of a frame's payload, from `offset` on, as the socket takes
+// without blocking. Returns (offset reached, frame complete). An incomplete
+// frame must be continued from the returned offset with the same data and
+// type before anything else is sent on the connection, since curl has
+// already written its header.
+LEAN_EXPORT lean_obj_res wisp_ws_send_some(
+    b_lean_obj_arg easy_obj,
+    b_lean_obj_arg data,
+    uint64_t offset,
+    uint32_t frame_type,
+    lean_obj_arg world
+) {
+#if LIBCURL_VERSION_NUM >= 0x075600  // 7.86.0
+    EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy_obj);
+    size_t len = lean_sarray_size(data);
+    if (offset > len) offset = len;
+    const char* buf = (const char*)lean_sarray_cptr(data) + offset;
+
+    size_t sent = 0;
+    CURLcode res = curl_ws_send(wrapper->handle, buf, len - (size_t)offset, &sent, 0, frame_type);
+    if (res != CURLE_OK && res != CURLE_AGAIN) {
+        return mk_curl_error(res);
+    }
+    offset += sent;
+    int complete = res == CURLE_OK && offset == len;
+
+    lean_object* pair = lean_alloc_ctor(0, 2, 0);
+    lean_ctor_set(pair, 0, lean_box_uint64(offset));
+    lean_ctor_set(pair, 1, lean_box(complete ? 1 : 0));
+    return lean_io_result_mk_ok(pair);
+#else
+    return mk_io_error("WebSocket support not available in libcurl");
+#endif
+}
+
+#if LIBCURL_VERSION_NUM >= 0x075600  // 7.86.0
+#define WISP_WS_CONTROL_FLAGS (CURLWS_CLOSE | CURLWS_PING | CURLWS_PONG)
+
+// Make room for `needed` bytes in the message buffer, keeping what was
+// received so far. Sized from the frame length where it is known, so a
+// large single-frame message is allocated once at its final size.
+static int ws_reserve(EasyWrapper* wrapper, size_t needed) {
+    lean_object* current = wrapper->ws_message;
+    size_t capacity = current ? lean_sarray_capacity(current) : 0;
+    if (needed <= capacity) return 1;
+    size_t new_capacity = needed;
+    if (current && new_capacity < capacity * 2) new_capacity = capacity * 2;
+    lean_object* grown = lean_alloc_sarray(1, 0, new_capacity);
+    if (!grown) return 0;
+    if (current) {
+        memcpy(lean_sarray_cptr(grown), lean_sarray_cptr(current), wrapper->ws_message_size);
+        lean_dec(current);
+    }
+    wrapper->ws_message = grown;
+    return 1;
+}
+
+// curl_ws_recv's last parameter is `const struct curl_ws_frame**` in current
+// curl and lacks the const in older releases; passing it through void*
+// matches either prototype without a warning.
+static CURLcode ws_recv(CURL* handle, void* buffer, size_t buflen, size_t* received,
+                        const struct curl_ws_frame** meta) {
+    return curl_ws_recv(handle, buffer, buflen, received, (void*)meta);
+}
+
+static lean_object* ws_mk_some_frame(lean_object* payload, uint32_t flags) {
+    lean_object* pair = lean_alloc_ctor(0, 2, 0);
+    lean_ctor_set(pair, 0, payload);
+    lean_ctor_set(pair, 1, lean_box_uint32(flags));
+    lean_object* some = lean_alloc_ctor(1, 1, 0);
+    lean_ctor_set(some, 0, pair);
+    return some;
+}
+#endif
+
+// Receive the next complete WebSocket message or control frame.
+// Fragments (CURLWS_CONT) and frames larger than one read are reassembled
+// into a single ByteArray that curl writes into directly; control frames
+// that arrive between fragments are returned on their own. Returns None
+// when no complete message is available yet; the partial message is kept
+// for the next call.
 LEAN_EXPORT lean_obj_res wisp_ws_recv(b_lean_obj_arg easy_obj, lean_obj_arg world) {
 #if LIBCURL_VERSION_NUM >= 0x075600  // 7.86.0
     EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy_obj);
-    char buffer[65536];
+
+    for (;;) {
+        int in_control = wrapper->ws_frame_left > 0 && wrapper->ws_in_control;
+        unsigned char* dst;
+        size_t room;
+        if (in_control) {
+            dst = wrapper->ws_control + wrapper->ws_control_size;
+            room = sizeof(wrapper->ws_control) - wrapper->ws_control_size;
+        } else {
+            // While discarding, reuse the start of the buffer
+            if (wrapper->ws_discarding) wrapper->ws_message_size = 0;
+            size_t want = wrapper->ws_frame_left > 0 ? (size_t)wrapper->ws_frame_left : WISP_WS_READ_CHUNK;
+            if (want > WISP_WS_READ_CHUNK && wrapper->ws_discarding) want = WISP_WS_READ_CHUNK;
+            if (!ws_reserve(wrapper, wrapper->ws_message_size + want)) {
+                easy_clear_ws(wrapper);
+                return mk_io_error("Out of memory receiving WebSocket message");
+            }
+            dst = lean_sarray_cptr(wrapper->ws_message) + wrapper->ws_message_size;
+            room = lean_sarray_capacity(wrapper->ws_message) - wrapper->ws_message_size;
+        }
+
+        size_t received = 0;
+        const struct curl_ws_frame* meta = NULL;
+        CURLcode res = ws_recv(wrapper->handle, dst, room, &received, &meta);
+        if (res == CURLE_AGAIN) {
+            return lean_io_result_mk_ok(lean_box(0));  // Option.none
+        }
+        if (res != CURLE_OK) {
+            easy_clear_ws(wrapper);
+            return mk_curl_error(res);
+        }
+        uint32_t flags = meta ? (uint32_t)meta->flags : 0;
+        uint64_t bytesleft = meta ? (uint64_t)meta->bytesleft : 0;
+
+        if (in_control) {
+            wrapper->ws_control_size += received;
+        } else if (wrapper->ws_frame_left == 0 && (flags & WISP_WS_CONTROL_FLAGS)) {
+            // A new control frame landed after the message received so far
+            size_t n = received < sizeof(wrapper->ws_control) ? received : sizeof(wrapper->ws_control);
+            memcpy(wrapper->ws_control, dst, n);
+            wrapper->ws_control_size = n;
+            wrapper->ws_control_flags = flags;
+            wrapper->ws_in_control = 1;
+        } else {
+            if (!wrapper->ws_assembling) {
+                wrapper->ws_assembling = 1;
+                wrapper->ws_message_flags = flags & ~(uint32_t)CURLWS_CONT;
+            }
+            wrapper->ws_message_size += received;
+            if (!wrapper->ws_discarding && wrapper->ws_message_size + bytesleft > wrapper->ws_max_message) {
+                // Drop the rest of this message and report it once
+                wrapper->ws_discarding = 1;
+                wrapper->ws_dropped++;
+                wrapper->ws_frame_left = bytesleft;
+                if (bytesleft == 0 && !(flags & CURLWS_CONT)) {
+                    easy_clear_ws(wrapper);
+                }
+                char msg[128];
+                snprintf(msg, sizeof(msg), "WebSocket message exceeds the %zu byte limit",
+                         wrapper->ws_max_message);
+                return mk_io_error(msg);
+            }
+        }
+        wrapper->ws_frame_left = bytesleft;
+        if (bytesleft > 0) continue;
+
+        // The current frame is complete
+        if (wrapper->ws_in_control) {
+            size_t n = wrapper->ws_control_size;
+            lean_object* payload = lean_alloc_sarray(1, n, n);
+            memcpy(lean_sarray_cptr(payload), wrapper->ws_control, n);
+            uint32_t control_flags = wrapper->ws_control_flags;
+            wrapper->ws_in_control = 0;
+            wrapper->ws_control_size = 0;
+            return lean_io_result_mk_ok(ws_mk_some_frame(payload, control_flags));
+        }
+        if (flags & CURLWS_CONT) continue;  // More fragments of this message follow
+
+        if (wrapper->ws_discarding) {
+            easy_clear_ws(wrapper);
+            continue;
+        }
+        lean_object* buffer = wrapper->ws_message;
+        size_t size = wrapper->ws_message_size;
+        uint32_t message_flags = wrapper->ws_message_flags;
+        wrapper->ws_message = NULL;
+        easy_clear_ws(wrapper);
+        size_t capacity = lean_sarray_capacity(buffer);
+        if (capacity > size && (size <= WISP_WS_READ_CHUNK || capacity - size > size / 4)) {
+            // Read before its length was known, or grown for further
+            // fragments: hand out an exact-size copy
+            lean_object* payload = lean_alloc_sarray(1, size, size);
+            memcpy(lean_sarray_cptr(payload), lean_sarray_cptr(buffer), size);
+            if (capacity <= WISP_RETAIN_BUFFER_MAX) {
+                wrapper->ws_message = buffer;  // Reused for the next message
+            } else {
+                lean_dec(buffer);
+            }
+            return lean_io_result_mk_ok(ws_mk_some_frame(payload, message_flags));
+        }
+        lean_to_sarray(buffer)->m_size = size;
+        return lean_io_result_mk_ok(ws_mk_some_frame(buffer, message_flags));
+    }
+#else
+    return mk_io_error("WebSocket support not available in libcurl");
+#endif
+}
+
+// Receive the next piece of a message without reassembling it: whatever
+// curl has for the current frame, read straight into a ByteArray sized for
+// it. Returns (payload, flags, bytesleft); a piece ends its message when
+// bytesleft is 0 and flags lack CURLWS_CONT. Must not be mixed with
+// wisp_ws_recv in the middle of a message.
+LEAN_EXPORT lean_obj_res wisp_ws_recv_fragment(b_lean_obj_arg easy_obj, lean_obj_arg world) {
+#if LIBCURL_VERSION_NUM >= 0x075600  // 7.86.0
+    EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy_obj);
+    if (wrapper->ws_assembling || wrapper->ws_in_control) {
+        return mk_io_error("A WebSocket message is partially received as a whole message");
+    }
+
+    // With the frame length known, read straight into an array of that size;
+    // otherwise read into the idle message buffer and copy out what arrived
+    lean_object* payload = NULL;
+    unsigned char* dst;
+    size_t capacity;
+    if (wrapper->ws_frame_left > 0) {
+        capacity = (size_t)wrapper->ws_frame_left;
+        if (capacity > WISP_RETAIN_BUFFER_MAX) capacity = WISP_RETAIN_BUFFER_MAX;
+        payload = lean_alloc_sarray(1, 0, capacity);
+        dst = lean_sarray_cptr(payload);
+    } else {
+        if (!ws_reserve(wrapper, WISP_WS_READ_CHUNK)) {
+            return mk_io_error("Out of memory receiving WebSocket message");
+        }
+        capacity = WISP_WS_READ_CHUNK;
+        dst = lean_sarray_cptr(wrapper->ws_message);
+    }
+
     size_t received = 0;
     const struct curl_ws_frame* meta = NULL;
-
-    CURLcode res = curl_ws_recv(wrapper->handle, buffer, sizeof(buffer), &received, &meta);
+    CURLcode res = ws_recv(wrapper->handle, dst, capacity, &received, &meta);
     if (res == CURLE_AGAIN) {
-        // No data available - return None (constructor 0, no args)
+        if (payload) lean_dec(payload);
         return lean_io_result_mk_ok(lean_box(0));  // Option.none
     }
     if (res != CURLE_OK) {
+        if (payload) lean_dec(payload);
+        wrapper->ws_frame_left = 0;
         return mk_curl_error(res);
     }
+    if (payload) {
+        lean_to_sarray(payload)->m_size = received;
+    } else {
+        payload = lean_alloc_sarray(1, received, received);
+        memcpy(lean_sarray_cptr(payload), dst, received);
+    }
+    uint32_t flags = meta ? (uint32_t)meta->flags : 0;
+    uint64_t bytesleft = meta ? (uint64_t)meta->bytesleft : 0;
+    wrapper->ws_frame_left = bytesleft;
+
+    // (ByteArray × UInt32 × UInt64) is Prod ByteArray (Prod UInt32 UInt64)
+    lean_object* inner = lean_alloc_ctor(0, 2, 0);
+    lean_ctor_set(inner, 0, lean_box_uint32(flags));
+    lean_ctor_set(inner, 1, lean_box_uint64(bytesleft));
+    lean_object* outer = lean_alloc_ctor(0, 2, 0);
+    lean_ctor_set(outer, 0, payload);
+    lean_ctor_set(outer, 1, inner);
+    lean_object* some = lean_alloc_ctor(1, 1, 0);
+    lean_ctor_set(some, 0, outer);
+    return lean_io_result_mk_ok(some);
+#else
+    return mk_io_error("WebSocket support not available in libcurl");
+#endif
+}
 
-    // Build (ByteArray × UInt32) tuple
-    lean_object* bytes = lean_alloc_sarray(1, received, received);
-    memcpy(lean_sarray_cptr(bytes), buffer, received);
+// Set the largest data message wisp_ws_recv will assemble
+LEAN_EXPORT lean_obj_res wisp_ws_set_max_message(b_lean_obj_arg easy_obj, uint64_t max_bytes, lean_obj_arg world) {
+    EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy_obj);
+    wrapper->ws_max_message = max_bytes > SIZE_MAX ? SIZE_MAX : (size_t)max_bytes;
+    return lean_io_result_mk_ok(lean_box(0));
+}
 
-    // Get frame flags from metadata
-    uint32_t flags = meta ? meta->flags : 0;
+// Number of messages wisp_ws_recv has dropped for exceeding the size limit
+LEAN_EXPORT lean_obj_res wisp_ws_dropped_messages(b_lean_obj_arg easy_obj, lean_obj_arg world) {
+    EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy_obj);
+    return lean_io_result_mk_ok(lean_box_uint64(wrapper->ws_dropped));
+}
 
-    lean_object* pair = lean_alloc_ctor(0, 2, 0);
-    lean_ctor_set(pair, 0, bytes);
-    lean_ctor_set(pair, 1, lean_box_uint32(flags));
+// Block until the WebSocket's socket is readable or timeout_ms elapses.
+// Returns true when readable (or on hangup/error, which the next recv
+// reports). Only call this after wisp_ws_recv returned no data: bytes curl
+// has already buffered don't make the socket readable.
+LEAN_EXPORT lean_obj_res wisp_ws_wait(b_lean_obj_arg easy_obj, uint32_t timeout_ms, lean_obj_arg world) {
+#if LIBCURL_VERSION_NUM >= 0x075600  // 7.86.0
+    EasyWrapper* wrapper = (EasyWrapper*)lean_get_external_data(easy_obj);
+    curl_socket_t sock = CURL_SOCKET_BAD;
+    CURLcode res = curl_easy_getinfo(wrapper->handle, CURLINFO_ACTIVESOCKET, &sock);
+    if (res != CURLE_OK) {
+        return mk_curl_error(res);
+    }
+    if (sock == CURL_SOCKET_BAD) {
+        return mk_io_error("WebSocket is not connected");
+    }
 
-    // Return Some(pair) - constructor 1 with 1 argument
-    lean_object* some = lean_alloc_ctor(1, 1, 0);
-    lean_ctor_set(some, 0, pair);
-    return lean_io_result_mk_ok(some);
+    struct pollfd pfd = { .fd = sock, .events = POLLIN, .revents = 0 };
+    int64_t deadline = monotonic_ms() + timeout_ms;
+    int rc;
+    for (;;) {
+        int64_t remaining = deadline - monotonic_ms();
+        if (remaining < 0) remaining = 0;
+        rc = poll(&pfd, 1, (int)(remaining > INT_MAX ? INT_MAX : remaining));
+        if (rc >= 0 || errno != EINTR) break;
+    }
+    if (rc < 0) {
+        return mk_io_error("poll failed while waiting for WebSocket data");
+    }
+    return lean_io_result_mk_ok(lean_box(rc > 0 ? 1 : 0));
 #else
     return mk_io_error("WebSocket support not available in libcurl");
 #endif